@@ -0,0 +1,33 @@
+#!/bin/bash
+# ------------------------------------------------------------------
+# Summary
+# Benchmark the software forwarder on virtual devices (no FPGA needed)
+# net_null ports generate/sink packets at full speed, so the numbers
+# only reflect the cost of the forwarding pipeline itself
+# E.g. ./run_bench.sh -m both -t 5
+#      LCORES=0-4 ./run_bench.sh -m rtc -q 4 -s
+#      LCORES=0-4 VDEVS="--vdev=net_ring0" ./run_bench.sh -m rtc -q 4 -s -P 512
+#      ./run_bench.sh -M tx -t 3          (tx hot loop microbenchmark)
+#      ./run_bench.sh -M cmac             (CMAC collector against mock registers)
+#      ./run_bench.sh -M regs             (Onic control path on the simulated shell)
+#      ./run_bench.sh -M bringup          (serial vs parallel CMAC bring-up of simulated cards)
+#      LCORES=0-4 ./run_bench.sh -M metrics (shared counters page, written by workers, read through its own mapping)
+#      ./run_bench.sh -M idle             (wake-up latency and sleep share of each idle policy)
+#      ./run_bench.sh -M flows -t 6         (flow table cycles per packet, 64 to 64k flows through a net_ring)
+#      ./run_bench.sh -M aging            (flow timeouts and eviction on simulated time, bounded work per poll)
+#      ./run_bench.sh -M parse -t 3       (burst header parser cycles per packet, scalar vs SSE4.1 vs AVX2)
+#      LCORES=0-3 ./run_bench.sh -M replay (pcap replay through the pipeline, every packet accounted for)
+#      ./run_bench.sh -M capture          (capture filter, ring drops and rotating pcapng files read back)
+#      ./run_bench.sh -M latency          (hop histograms and raw records encoded as they are on the main lcore)
+#      LCORES=0-2 ./run_bench.sh -m rtc -B -t 2 (rx Mpps per burst size at 64/512/1500 B, add -F 0 to compare without prefetch)
+# ------------------------------------------------------------------
+LCORES=${LCORES:-0-2}
+VDEVS=${VDEVS:-"--vdev=net_null0,size=64 --vdev=net_null1,size=64"}
+
+sudo LD_LIBRARY_PATH=$P2P_DIR/server/tools/dpdk-stable/lib/x86_64-linux-gnu \
+$P2P_DIR/server/src_bench/build/onic_bench \
+    --file-prefix bench \
+    -l $LCORES \
+    --no-pci \
+    $VDEVS \
+    -- $@
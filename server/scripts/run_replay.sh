@@ -0,0 +1,21 @@
+#!/bin/bash
+# ------------------------------------------------------------------
+# Summary
+# Run onic_app on a pcap instead of the FPGA: the contexts of the
+# topology forward a trace replayed at full speed from a net_ring port
+# and print their Mpps and inspection cycles per packet per stage
+# E.g. ./run_replay.sh trace.pcap
+#      LCORES=0-9 ./run_replay.sh trace.pcap $P2P_DIR/server/config/onic_app.toml
+# Set loops in [replay] for a run that ends on its own
+# ------------------------------------------------------------------
+PCAP=${1:?usage: $0 trace.pcap [topology.toml]}
+TOPOLOGY=${2:-$P2P_DIR/server/config/onic_app.toml}
+LCORES=${LCORES:-168,169,170,171,172,173,174,176,177,178}
+
+sudo LD_LIBRARY_PATH=$P2P_DIR/server/tools/dpdk-stable/lib/x86_64-linux-gnu \
+$P2P_DIR/server/src/build/onic_app \
+    --file-prefix replay \
+    -l $LCORES \
+    -n 2 \
+    --no-pci \
+    -- -c $TOPOLOGY -r $PCAP
@@ -0,0 +1,310 @@
+#include "burst_parse.h"
+#include "prefetch.h"
+
+#include <cstring>
+#include <rte_byteorder.h>
+#include <rte_cpuflags.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_vect.h>
+
+// Every header field the parser reads is in bytes [12, 28) of the packet, behind a VLAN tag or not:
+// the vector paths load them with one 16 byte load per packet
+#define PARSE_LOAD_OFF (12)
+
+// A lane's bytes [12, 28) as 4 little endian words. Ethertypes compare raw, as they are on the wire
+#define RAW_VLAN (0x0081)       // RTE_ETHER_TYPE_VLAN
+#define RAW_IPV4 (0x0008)
+#define RAW_IPV6 (0xdd86)
+#define RAW_FRAG_OFFSET (0xff1f)    // fragment offset bits of the IPv4 flags/offset field
+
+const char *to_string(ParseImpl impl) {
+    switch (impl) {
+        case ParseImpl::SCALAR: return "scalar";
+        case ParseImpl::SSE: return "sse4.1";
+        default: return "avx2";
+    }
+}
+
+static inline void parse_one(const struct rte_mbuf *mbuf, BurstMeta *meta, uint16_t i){
+    uint32_t len = rte_pktmbuf_data_len(mbuf);
+    meta->ether_type[i] = 0;
+    meta->vlan_tci[i] = 0;
+    meta->l4_off[i] = 0;
+    meta->l3_off[i] = 0;
+    meta->ip_proto[i] = 0;
+    meta->flags[i] = 0;
+    if (unlikely(len < PKT_PARSE_MIN_LEN))
+        return;
+
+    const uint8_t *pkt = rte_pktmbuf_mtod(mbuf, const uint8_t *);
+    uint8_t flags = 0;
+    uint32_t l3 = sizeof(struct rte_ether_hdr);
+    uint16_t ether_type = rte_be_to_cpu_16(((const struct rte_ether_hdr *)pkt)->ether_type);
+    if (ether_type == RTE_ETHER_TYPE_VLAN) {
+        const auto *vlan = (const struct rte_vlan_hdr *)(pkt + l3);
+        meta->vlan_tci[i] = rte_be_to_cpu_16(vlan->vlan_tci);
+        ether_type = rte_be_to_cpu_16(vlan->eth_proto);
+        l3 += sizeof(struct rte_vlan_hdr);
+        flags |= PKT_VLAN;
+    }
+    meta->ether_type[i] = ether_type;
+    meta->l3_off[i] = l3;
+
+    uint32_t l4 = 0;
+    if (ether_type == RTE_ETHER_TYPE_IPV4 && len >= l3 + sizeof(struct rte_ipv4_hdr)) {
+        const auto *ip = (const struct rte_ipv4_hdr *)(pkt + l3);
+        uint32_t ihl = ip->version_ihl & RTE_IPV4_HDR_IHL_MASK;
+        flags |= PKT_IPV4;
+        meta->ip_proto[i] = ip->next_proto_id;
+        // Later fragments have no L4 header
+        if (ip->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_OFFSET_MASK))
+            flags |= PKT_FRAG;
+        else if (ihl >= 5)
+            l4 = l3 + ihl * RTE_IPV4_IHL_MULTIPLIER;
+    } else if (ether_type == RTE_ETHER_TYPE_IPV6 && len >= l3 + sizeof(struct rte_ipv6_hdr)) {
+        flags |= PKT_IPV6;
+        meta->ip_proto[i] = ((const struct rte_ipv6_hdr *)(pkt + l3))->proto;
+        l4 = l3 + sizeof(struct rte_ipv6_hdr);
+    }
+    if (l4 != 0 && len >= l4 + sizeof(uint32_t)) {
+        meta->l4_off[i] = l4;
+        flags |= PKT_L4;
+    }
+    meta->flags[i] = flags;
+}
+
+static void parse_scalar(struct rte_mbuf *const *mbufs, uint16_t nb, BurstMeta *meta, uint16_t ahead){
+    prefetch_data_prime(mbufs, nb, ahead);
+    for (uint16_t i = 0; i < nb; i++) {
+        prefetch_data_ahead(mbufs, i, nb, ahead);
+        parse_one(mbufs[i], meta, i);
+    }
+    meta->nb = nb;
+}
+
+#if defined(RTE_ARCH_X86)
+
+static const uint8_t zero_headers[PKT_PARSE_MIN_LEN] = {};
+
+// Bytes [12, 28) of the packet, zeros for one too short to have them. A select rather than a
+// branch: runts come at random in a burst, a mispredict costs more than the whole packet's parsing
+static inline const void *parse_load_addr(const struct rte_mbuf *mbuf){
+    const uint8_t *pkt = rte_pktmbuf_mtod_offset(mbuf, const uint8_t *, PARSE_LOAD_OFF);
+    return (rte_pktmbuf_data_len(mbuf) < PKT_PARSE_MIN_LEN) ? zero_headers : pkt;
+}
+
+// 4 packets per step. After the transpose w[k] holds word k of bytes [12, 28) of every lane:
+//   w0 = outer ethertype | TCI << 16
+//   w1 = inner ethertype | untagged IP version/IHL << 16
+//   w2 = untagged IPv4 flags/offset, IPv6 next header | untagged IPv4 protocol << 24
+//   w3 = the same as w2, behind a VLAN tag
+// Everything else is compares and selects between the untagged and the tagged layout
+__attribute__((target("sse4.1")))
+static void parse_sse(struct rte_mbuf *const *mbufs, uint16_t nb, BurstMeta *meta, uint16_t ahead){
+    const __m128i lo16 = _mm_set1_epi32(0xffff);
+    const __m128i lo8 = _mm_set1_epi32(0xff);
+    uint16_t i = 0;
+
+    prefetch_data_prime(mbufs, nb, ahead);
+    for (; i + 4 <= nb; i += 4) {
+        for (uint16_t k = 0; k < 4; k++)
+            prefetch_data_ahead(mbufs, i + k, nb, ahead);
+
+        __m128i r0 = _mm_loadu_si128((const __m128i *)parse_load_addr(mbufs[i]));
+        __m128i r1 = _mm_loadu_si128((const __m128i *)parse_load_addr(mbufs[i + 1]));
+        __m128i r2 = _mm_loadu_si128((const __m128i *)parse_load_addr(mbufs[i + 2]));
+        __m128i r3 = _mm_loadu_si128((const __m128i *)parse_load_addr(mbufs[i + 3]));
+        __m128i len = _mm_setr_epi32(rte_pktmbuf_data_len(mbufs[i]), rte_pktmbuf_data_len(mbufs[i + 1]),
+                                     rte_pktmbuf_data_len(mbufs[i + 2]), rte_pktmbuf_data_len(mbufs[i + 3]));
+
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+        __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+        __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+        __m128i w0 = _mm_unpacklo_epi64(t0, t1);
+        __m128i w1 = _mm_unpackhi_epi64(t0, t1);
+        __m128i w2 = _mm_unpacklo_epi64(t2, t3);
+        __m128i w3 = _mm_unpackhi_epi64(t2, t3);
+
+        __m128i outer = _mm_and_si128(w0, lo16);
+        __m128i vlan = _mm_cmpeq_epi32(outer, _mm_set1_epi32(RAW_VLAN));
+        __m128i tci = _mm_and_si128(_mm_srli_epi32(w0, 16), vlan);
+        __m128i raw_type = _mm_blendv_epi8(outer, _mm_and_si128(w1, lo16), vlan);
+        __m128i ver_ihl = _mm_and_si128(_mm_srli_epi32(_mm_blendv_epi8(w0, w1, vlan), 16), lo8);
+        __m128i w = _mm_blendv_epi8(w2, w3, vlan);
+        __m128i l3 = _mm_add_epi32(_mm_set1_epi32(sizeof(struct rte_ether_hdr)), _mm_and_si128(vlan, _mm_set1_epi32(4)));
+
+        __m128i ipv4 = _mm_and_si128(_mm_cmpeq_epi32(raw_type, _mm_set1_epi32(RAW_IPV4)),
+                                     _mm_cmpgt_epi32(len, _mm_add_epi32(l3, _mm_set1_epi32(19))));
+        __m128i ipv6 = _mm_and_si128(_mm_cmpeq_epi32(raw_type, _mm_set1_epi32(RAW_IPV6)),
+                                     _mm_cmpgt_epi32(len, _mm_add_epi32(l3, _mm_set1_epi32(39))));
+        __m128i proto = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(w, 24), ipv4), _mm_and_si128(_mm_and_si128(w, lo8), ipv6));
+        __m128i frag = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(w, _mm_set1_epi32(RAW_FRAG_OFFSET)), _mm_setzero_si128()), ipv4);
+        __m128i ihl = _mm_and_si128(ver_ihl, _mm_set1_epi32(RTE_IPV4_HDR_IHL_MASK));
+        __m128i l4 = _mm_blendv_epi8(_mm_add_epi32(l3, _mm_set1_epi32(40)), _mm_add_epi32(l3, _mm_slli_epi32(ihl, 2)), ipv4);
+        __m128i has_l4 = _mm_or_si128(_mm_andnot_si128(frag, _mm_and_si128(ipv4, _mm_cmpgt_epi32(ihl, _mm_set1_epi32(4)))), ipv6);
+        has_l4 = _mm_and_si128(has_l4, _mm_cmpgt_epi32(len, _mm_add_epi32(l4, _mm_set1_epi32(3))));
+        // Too short to be read at all: the zeros it was given leave only l3 to clear
+        l3 = _mm_and_si128(l3, _mm_cmpgt_epi32(len, _mm_set1_epi32(PKT_PARSE_MIN_LEN - 1)));
+
+        __m128i flags = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(vlan, _mm_set1_epi32(PKT_VLAN)), _mm_and_si128(ipv4, _mm_set1_epi32(PKT_IPV4))),
+            _mm_or_si128(_mm_and_si128(ipv6, _mm_set1_epi32(PKT_IPV6)),
+                         _mm_or_si128(_mm_and_si128(frag, _mm_set1_epi32(PKT_FRAG)), _mm_and_si128(has_l4, _mm_set1_epi32(PKT_L4)))));
+        // Byte swapped to host order: the low byte on the wire is the high one
+        __m128i ether_type = _mm_or_si128(_mm_srli_epi32(raw_type, 8), _mm_and_si128(_mm_slli_epi32(raw_type, 8), lo16));
+        tci = _mm_or_si128(_mm_srli_epi32(tci, 8), _mm_and_si128(_mm_slli_epi32(tci, 8), lo16));
+
+        _mm_storel_epi64((__m128i *)&meta->ether_type[i], _mm_packus_epi32(ether_type, ether_type));
+        _mm_storel_epi64((__m128i *)&meta->vlan_tci[i], _mm_packus_epi32(tci, tci));
+        _mm_storel_epi64((__m128i *)&meta->l4_off[i], _mm_packus_epi32(_mm_and_si128(l4, has_l4), _mm_and_si128(l4, has_l4)));
+        __m128i bytes = _mm_packus_epi16(_mm_packus_epi32(l3, proto), _mm_packus_epi32(flags, flags));
+        uint32_t out[4];
+        _mm_storeu_si128((__m128i *)out, bytes);
+        memcpy(&meta->l3_off[i], &out[0], 4);
+        memcpy(&meta->ip_proto[i], &out[1], 4);
+        memcpy(&meta->flags[i], &out[2], 4);
+    }
+    for (; i < nb; i++)
+        parse_one(mbufs[i], meta, i);
+    meta->nb = nb;
+}
+
+// Two 16 byte loads per 256 bit register: packets i to i + 3 in the low half, i + 4 to i + 7 in the
+// high one. The transpose and every step after it stay within the halves, as in parse_sse()
+__attribute__((target("avx2")))
+static inline __m256i load_pair(const struct rte_mbuf *lo, const struct rte_mbuf *hi){
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)parse_load_addr(lo))),
+                                   _mm_loadu_si128((const __m128i *)parse_load_addr(hi)), 1);
+}
+
+__attribute__((target("avx2")))
+static void parse_avx2(struct rte_mbuf *const *mbufs, uint16_t nb, BurstMeta *meta, uint16_t ahead){
+    const __m256i lo16 = _mm256_set1_epi32(0xffff);
+    const __m256i lo8 = _mm256_set1_epi32(0xff);
+    uint16_t i = 0;
+
+    prefetch_data_prime(mbufs, nb, ahead);
+    for (; i + 8 <= nb; i += 8) {
+        for (uint16_t k = 0; k < 8; k++)
+            prefetch_data_ahead(mbufs, i + k, nb, ahead);
+
+        __m256i r0 = load_pair(mbufs[i], mbufs[i + 4]);
+        __m256i r1 = load_pair(mbufs[i + 1], mbufs[i + 5]);
+        __m256i r2 = load_pair(mbufs[i + 2], mbufs[i + 6]);
+        __m256i r3 = load_pair(mbufs[i + 3], mbufs[i + 7]);
+        __m256i len = _mm256_setr_epi32(rte_pktmbuf_data_len(mbufs[i]), rte_pktmbuf_data_len(mbufs[i + 1]),
+                                        rte_pktmbuf_data_len(mbufs[i + 2]), rte_pktmbuf_data_len(mbufs[i + 3]),
+                                        rte_pktmbuf_data_len(mbufs[i + 4]), rte_pktmbuf_data_len(mbufs[i + 5]),
+                                        rte_pktmbuf_data_len(mbufs[i + 6]), rte_pktmbuf_data_len(mbufs[i + 7]));
+
+        __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+        __m256i t1 = _mm256_unpacklo_epi32(r2, r3);
+        __m256i t2 = _mm256_unpackhi_epi32(r0, r1);
+        __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+        __m256i w0 = _mm256_unpacklo_epi64(t0, t1);
+        __m256i w1 = _mm256_unpackhi_epi64(t0, t1);
+        __m256i w2 = _mm256_unpacklo_epi64(t2, t3);
+        __m256i w3 = _mm256_unpackhi_epi64(t2, t3);
+
+        __m256i outer = _mm256_and_si256(w0, lo16);
+        __m256i vlan = _mm256_cmpeq_epi32(outer, _mm256_set1_epi32(RAW_VLAN));
+        __m256i tci = _mm256_and_si256(_mm256_srli_epi32(w0, 16), vlan);
+        __m256i raw_type = _mm256_blendv_epi8(outer, _mm256_and_si256(w1, lo16), vlan);
+        __m256i ver_ihl = _mm256_and_si256(_mm256_srli_epi32(_mm256_blendv_epi8(w0, w1, vlan), 16), lo8);
+        __m256i w = _mm256_blendv_epi8(w2, w3, vlan);
+        __m256i l3 = _mm256_add_epi32(_mm256_set1_epi32(sizeof(struct rte_ether_hdr)), _mm256_and_si256(vlan, _mm256_set1_epi32(4)));
+
+        __m256i ipv4 = _mm256_and_si256(_mm256_cmpeq_epi32(raw_type, _mm256_set1_epi32(RAW_IPV4)),
+                                        _mm256_cmpgt_epi32(len, _mm256_add_epi32(l3, _mm256_set1_epi32(19))));
+        __m256i ipv6 = _mm256_and_si256(_mm256_cmpeq_epi32(raw_type, _mm256_set1_epi32(RAW_IPV6)),
+                                        _mm256_cmpgt_epi32(len, _mm256_add_epi32(l3, _mm256_set1_epi32(39))));
+        __m256i proto = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(w, 24), ipv4),
+                                        _mm256_and_si256(_mm256_and_si256(w, lo8), ipv6));
+        __m256i frag = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_and_si256(w, _mm256_set1_epi32(RAW_FRAG_OFFSET)),
+                                                              _mm256_setzero_si256()), ipv4);
+        __m256i ihl = _mm256_and_si256(ver_ihl, _mm256_set1_epi32(RTE_IPV4_HDR_IHL_MASK));
+        __m256i l4 = _mm256_blendv_epi8(_mm256_add_epi32(l3, _mm256_set1_epi32(40)),
+                                        _mm256_add_epi32(l3, _mm256_slli_epi32(ihl, 2)), ipv4);
+        __m256i has_l4 = _mm256_or_si256(_mm256_andnot_si256(frag, _mm256_and_si256(ipv4, _mm256_cmpgt_epi32(ihl, _mm256_set1_epi32(4)))), ipv6);
+        has_l4 = _mm256_and_si256(has_l4, _mm256_cmpgt_epi32(len, _mm256_add_epi32(l4, _mm256_set1_epi32(3))));
+        l3 = _mm256_and_si256(l3, _mm256_cmpgt_epi32(len, _mm256_set1_epi32(PKT_PARSE_MIN_LEN - 1)));
+
+        __m256i flags = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(vlan, _mm256_set1_epi32(PKT_VLAN)), _mm256_and_si256(ipv4, _mm256_set1_epi32(PKT_IPV4))),
+            _mm256_or_si256(_mm256_and_si256(ipv6, _mm256_set1_epi32(PKT_IPV6)),
+                            _mm256_or_si256(_mm256_and_si256(frag, _mm256_set1_epi32(PKT_FRAG)),
+                                            _mm256_and_si256(has_l4, _mm256_set1_epi32(PKT_L4)))));
+        __m256i ether_type = _mm256_or_si256(_mm256_srli_epi32(raw_type, 8), _mm256_and_si256(_mm256_slli_epi32(raw_type, 8), lo16));
+        tci = _mm256_or_si256(_mm256_srli_epi32(tci, 8), _mm256_and_si256(_mm256_slli_epi32(tci, 8), lo16));
+        l4 = _mm256_and_si256(l4, has_l4);
+
+        // packus works per half: lanes come out 0-3 | 4-7 for 16 bits, 0-3 | 4-7 of each input for 8
+        __m256i words = _mm256_packus_epi32(ether_type, tci);
+        __m256i words_l4 = _mm256_packus_epi32(l4, l4);
+        __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(l3, proto), _mm256_packus_epi32(flags, flags));
+        uint64_t out_w[4], out_l4[4];
+        uint32_t out_b[8];
+        _mm256_storeu_si256((__m256i *)out_w, words);
+        _mm256_storeu_si256((__m256i *)out_l4, words_l4);
+        _mm256_storeu_si256((__m256i *)out_b, bytes);
+        memcpy(&meta->ether_type[i], &out_w[0], 8);
+        memcpy(&meta->ether_type[i + 4], &out_w[2], 8);
+        memcpy(&meta->vlan_tci[i], &out_w[1], 8);
+        memcpy(&meta->vlan_tci[i + 4], &out_w[3], 8);
+        memcpy(&meta->l4_off[i], &out_l4[0], 8);
+        memcpy(&meta->l4_off[i + 4], &out_l4[2], 8);
+        memcpy(&meta->l3_off[i], &out_b[0], 4);
+        memcpy(&meta->l3_off[i + 4], &out_b[4], 4);
+        memcpy(&meta->ip_proto[i], &out_b[1], 4);
+        memcpy(&meta->ip_proto[i + 4], &out_b[5], 4);
+        memcpy(&meta->flags[i], &out_b[2], 4);
+        memcpy(&meta->flags[i + 4], &out_b[6], 4);
+    }
+    for (; i < nb; i++)
+        parse_one(mbufs[i], meta, i);
+    meta->nb = nb;
+}
+
+#endif
+
+typedef void (*parse_fn_t)(struct rte_mbuf *const *, uint16_t, BurstMeta *, uint16_t);
+
+// Written once by burst_parse_select() before the lcores are launched, only read after
+static parse_fn_t parse_fn = parse_scalar;
+
+// impl if the CPU and EAL allow it, else the next narrower one
+static ParseImpl supported(ParseImpl impl){
+#if defined(RTE_ARCH_X86)
+    uint16_t max_bits = rte_vect_get_max_simd_bitwidth();
+    if (impl == ParseImpl::AVX2 && (max_bits < RTE_VECT_SIMD_256 || rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) <= 0))
+        impl = ParseImpl::SSE;
+    if (impl == ParseImpl::SSE && (max_bits < RTE_VECT_SIMD_128 || rte_cpu_get_flag_enabled(RTE_CPUFLAG_SSE4_1) <= 0))
+        impl = ParseImpl::SCALAR;
+    return impl;
+#else
+    RTE_SET_USED(impl);
+    return ParseImpl::SCALAR;
+#endif
+}
+
+ParseImpl burst_parse_force(ParseImpl impl){
+    impl = supported(impl);
+    switch (impl) {
+#if defined(RTE_ARCH_X86)
+        case ParseImpl::AVX2: parse_fn = parse_avx2; break;
+        case ParseImpl::SSE: parse_fn = parse_sse; break;
+#endif
+        default: parse_fn = parse_scalar; break;
+    }
+    return impl;
+}
+
+ParseImpl burst_parse_select(){
+    return burst_parse_force(ParseImpl::AVX2);
+}
+
+void burst_parse(struct rte_mbuf *const *mbufs, uint16_t nb, BurstMeta *meta, uint16_t prefetch_ahead){
+    parse_fn(mbufs, nb, meta, prefetch_ahead);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <rte_common.h>
+#include <rte_mbuf.h>
+
+#include "forward_context.h"
+
+#define PKT_PARSE_MIN_LEN (32)  // shorter frames are not read at all and come out as unknown
+
+// BurstMeta::flags
+#define PKT_VLAN (1 << 0)       // 802.1Q tagged, vlan_tci is set
+#define PKT_IPV4 (1 << 1)
+#define PKT_IPV6 (1 << 2)
+#define PKT_FRAG (1 << 3)       // IPv4 fragment past the first one: no L4 header
+#define PKT_L4 (1 << 4)         // l4_off points at 4 or more bytes of L4 header (ports for TCP/UDP/SCTP)
+
+// Headers of every packet of a burst, one array per field: a later stage loads only the fields it
+// needs, a few packets per cache line, instead of going back to the packet data
+struct alignas(RTE_CACHE_LINE_SIZE) BurstMeta {
+    uint16_t ether_type[MAX_BURST_SIZE];    // host order, the one behind the VLAN tag when tagged
+    uint16_t vlan_tci[MAX_BURST_SIZE];      // host order, 0 when untagged
+    uint16_t l4_off[MAX_BURST_SIZE];        // from the start of the packet, 0 without PKT_L4
+    uint8_t l3_off[MAX_BURST_SIZE];         // 14, or 18 behind a VLAN tag
+    uint8_t ip_proto[MAX_BURST_SIZE];       // IPv4 protocol or IPv6 next header, 0 for anything else
+    uint8_t flags[MAX_BURST_SIZE];
+    uint16_t nb;
+};
+
+// Implementations, widest last. The vector ones classify 4 (SSE4.1) or 8 (AVX2) packets per step
+// with the same rules as the scalar one, and leave a burst's tail to it
+enum class ParseImpl {
+    SCALAR,
+    SSE,
+    AVX2,
+};
+
+const char *to_string(ParseImpl impl);
+
+// Picks the widest implementation this CPU runs and EAL allows (--force-max-simd-bitwidth), once
+// rte_eal_init() is done and before any lcore parses. Until then bursts go through SCALAR.
+// Returns what was picked
+ParseImpl burst_parse_select();
+// Forces impl, falling back towards SCALAR while the CPU lacks it. For benchmarks and tests
+ParseImpl burst_parse_force(ParseImpl impl);
+
+// Fills meta for mbufs[0, nb). Reads the first 32 bytes of each packet (past the IPv4 options for
+// the L4 offset), prefetched prefetch_ahead packets ahead, 0 disables it. IPv6 extension headers
+// are not walked: ip_proto is the first next header
+void burst_parse(struct rte_mbuf *const *mbufs, uint16_t nb, BurstMeta *meta, uint16_t prefetch_ahead);
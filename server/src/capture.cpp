@@ -0,0 +1,441 @@
+#include "capture.h"
+#include "burst_parse.h"
+#include "forward_context.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <time.h>
+#include <unistd.h>
+#include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_log.h>
+
+// pcapng block types and options, as in the pcapng draft (draft-ietf-opsawg-pcapng)
+#define PCAPNG_SHB (0x0A0D0D0A)
+#define PCAPNG_IDB (0x00000001)
+#define PCAPNG_EPB (0x00000006)
+#define PCAPNG_BYTE_ORDER_MAGIC (0x1A2B3C4D)
+#define PCAPNG_OPT_END (0)
+#define PCAPNG_OPT_IF_NAME (2)
+#define PCAPNG_OPT_IF_TSRESOL (9)
+#define PCAPNG_LINKTYPE_ETHERNET (1)
+#define PCAPNG_TSRESOL_NS (9)
+
+static_assert(sizeof(CaptureRecord) % 4 == 0, "ring elements are a multiple of 4 bytes");
+
+/**************************************************************************************************
+                                        Filter
+**************************************************************************************************/
+
+void CaptureFilter::set_ip_version(uint8_t version){
+    mask.ip_version = 0xff;
+    value.ip_version = version;
+    ip = true;
+}
+
+bool CaptureFilter::set_prefix(const std::string &cidr, bool src){
+    std::string addr = cidr;
+    int bits = -1;
+    size_t slash = cidr.find('/');
+    if (slash != std::string::npos) {
+        addr = cidr.substr(0, slash);
+        char *end;
+        bits = strtol(cidr.c_str() + slash + 1, &end, 10);
+        if (*end != '\0' || end == cidr.c_str() + slash + 1 || bits < 0)
+            return false;
+    }
+
+    uint8_t bytes[16] = {};
+    uint8_t version;
+    if (inet_pton(AF_INET, addr.c_str(), bytes) == 1)
+        version = 4;
+    else if (inet_pton(AF_INET6, addr.c_str(), bytes) == 1)
+        version = 6;
+    else
+        return false;
+    int max_bits = (version == 4) ? 32 : 128;
+    if (bits < 0)
+        bits = max_bits;
+    // One filter, one address family: src 10.0.0.1 dst 2001:db8::1 never matches anything
+    if (bits > max_bits || (mask.ip_version != 0 && value.ip_version != version))
+        return false;
+
+    uint8_t *m = src ? mask.src : mask.dst;
+    uint8_t *v = src ? value.src : value.dst;
+    for (int b = 0; b < 16; b++) {
+        int left = bits - 8 * b;
+        m[b] = (left >= 8) ? 0xff : (left <= 0) ? 0 : (uint8_t)(0xff << (8 - left));
+        v[b] = bytes[b] & m[b];
+    }
+    set_ip_version(version);
+    text += std::string(src ? " src " : " dst ") + cidr;
+    update_reverse();
+    return true;
+}
+
+bool CaptureFilter::set_proto(const std::string &proto){
+    static const struct { const char *name; uint8_t proto; } names[] = {
+        {"tcp", IPPROTO_TCP}, {"udp", IPPROTO_UDP}, {"sctp", IPPROTO_SCTP},
+        {"icmp", IPPROTO_ICMP}, {"icmp6", IPPROTO_ICMPV6},
+    };
+    int number = -1;
+    for (const auto &n : names) {
+        if (proto == n.name)
+            number = n.proto;
+    }
+    if (number < 0) {
+        char *end;
+        number = strtol(proto.c_str(), &end, 10);
+        if (proto.empty() || *end != '\0' || number < 0 || number > UINT8_MAX)
+            return false;
+    }
+    mask.proto = 0xff;
+    value.proto = number;
+    ip = true;
+    text += " " + proto;
+    update_reverse();
+    return true;
+}
+
+void CaptureFilter::set_src_port(uint16_t port){
+    mask.src_port = 0xffff;
+    value.src_port = rte_cpu_to_be_16(port);
+    ip = true;
+    text += " src_port " + std::to_string(port);
+    update_reverse();
+}
+
+void CaptureFilter::set_dst_port(uint16_t port){
+    mask.dst_port = 0xffff;
+    value.dst_port = rte_cpu_to_be_16(port);
+    ip = true;
+    text += " dst_port " + std::to_string(port);
+    update_reverse();
+}
+
+bool CaptureFilter::set_vlan(int vlan_id){
+    if (vlan_id < 0 || vlan_id > 4095)
+        return false;
+    vlan = vlan_id;
+    text += " vlan " + std::to_string(vlan_id);
+    return true;
+}
+
+static FlowKey swap_key(const FlowKey &key){
+    FlowKey out = key;
+    memcpy(out.src, key.dst, sizeof(out.src));
+    memcpy(out.dst, key.src, sizeof(out.dst));
+    out.src_port = key.dst_port;
+    out.dst_port = key.src_port;
+    return out;
+}
+
+void CaptureFilter::update_reverse(){
+    reverse_mask = both_ways ? swap_key(mask) : mask;
+    reverse_value = both_ways ? swap_key(value) : value;
+}
+
+static inline bool key_match(const FlowKey &key, const FlowKey &mask, const FlowKey &value){
+    return (((key.words[0] & mask.words[0]) ^ value.words[0]) | ((key.words[1] & mask.words[1]) ^ value.words[1]) |
+            ((key.words[2] & mask.words[2]) ^ value.words[2]) | ((key.words[3] & mask.words[3]) ^ value.words[3]) |
+            ((key.words[4] & mask.words[4]) ^ value.words[4])) == 0;
+}
+
+bool CaptureFilter::match(const struct rte_mbuf *mbuf, const BurstMeta &meta, uint16_t i) const {
+    if (vlan >= 0 && (!(meta.flags[i] & PKT_VLAN) || (meta.vlan_tci[i] & 0xfff) != vlan))
+        return false;
+    if (!ip)
+        return true;
+    if (!(meta.flags[i] & (PKT_IPV4 | PKT_IPV6)))
+        return false;
+    FlowKey key;
+    flow_key(mbuf, meta, i, &key);
+    return key_match(key, mask, value) || key_match(key, reverse_mask, reverse_value);
+}
+
+std::string CaptureFilter::to_string() const {
+    if (text.empty())
+        return "all packets";
+    return text.substr(1) + ((both_ways && ip) ? ", both ways" : "");
+}
+
+uint16_t capture_burst(const CaptureFilter &filter, struct rte_ring *ring, uint32_t interface, LcoreStats *stats,
+                       struct rte_mbuf *const *mbufs, const BurstMeta &meta, uint64_t tsc){
+    CaptureRecord records[MAX_BURST_SIZE];
+    uint16_t nb = 0;
+    for (uint16_t i = 0; i < meta.nb; i++) {
+        if (!filter.match(mbufs[i], meta, i))
+            continue;
+        // rte_pktmbuf_free() drops a reference on every segment, so each one gets the writer's
+        for (struct rte_mbuf *seg = mbufs[i]; seg != nullptr; seg = seg->next)
+            rte_mbuf_refcnt_update(seg, 1);
+        records[nb++] = {mbufs[i], tsc, interface, 0};
+    }
+    if (nb == 0)
+        return 0;
+
+    unsigned int nb_enq = rte_ring_enqueue_burst_elem(ring, records, sizeof(CaptureRecord), nb, NULL);
+    lcore_stats_add(&stats->capture_pkts, nb_enq);
+    if (unlikely(nb_enq < nb)) {
+        for (unsigned int i = nb_enq; i < nb; i++) {
+            for (struct rte_mbuf *seg = records[i].mbuf; seg != nullptr; seg = seg->next)
+                rte_mbuf_refcnt_update(seg, -1);
+        }
+        lcore_stats_add(&stats->capture_drops, nb - nb_enq);
+    }
+    return nb_enq;
+}
+
+/**************************************************************************************************
+                                        Writer
+**************************************************************************************************/
+
+// Padding of the packet data up to 32 bits
+static const uint8_t zeros[4] = {};
+
+static inline uint32_t pad4(uint32_t len) { return (len + 3) & ~3u; }
+
+static void put32(std::vector<uint8_t> &buf, uint32_t v){
+    buf.insert(buf.end(), (const uint8_t *)&v, (const uint8_t *)&v + sizeof(v));
+}
+
+static void put16(std::vector<uint8_t> &buf, uint16_t v){
+    buf.insert(buf.end(), (const uint8_t *)&v, (const uint8_t *)&v + sizeof(v));
+}
+
+static void put_option(std::vector<uint8_t> &buf, uint16_t code, const void *data, uint16_t len){
+    put16(buf, code);
+    put16(buf, len);
+    buf.insert(buf.end(), (const uint8_t *)data, (const uint8_t *)data + len);
+    buf.insert(buf.end(), zeros, zeros + (pad4(len) - len));
+}
+
+// Block total length is known once its body is in: written at both ends
+static void end_block(std::vector<uint8_t> &buf, size_t start){
+    uint32_t total = buf.size() - start + sizeof(uint32_t);
+    memcpy(&buf[start + sizeof(uint32_t)], &total, sizeof(total));
+    put32(buf, total);
+}
+
+CaptureWriter::CaptureWriter(const CaptureConfig &cfg, struct rte_ring *ring, const std::vector<std::string> &interfaces)
+    : cfg(cfg), ring(ring), interfaces(interfaces) {
+    if (access(cfg.dir.c_str(), W_OK) != 0)
+        rte_exit(EXIT_FAILURE, "Capture directory %s: %s\n", cfg.dir.c_str(), strerror(errno));
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    base_tsc = rte_get_tsc_cycles();
+    base_ns = (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+// Split so the multiplication cannot overflow. A packet can be older than the base: it is placed before base_ns
+uint64_t CaptureWriter::tsc_to_ns(uint64_t tsc) const {
+    uint64_t hz = rte_get_tsc_hz();
+    uint64_t delta = (tsc >= base_tsc) ? tsc - base_tsc : base_tsc - tsc;
+    uint64_t delta_ns = delta / hz * NS_PER_S + delta % hz * NS_PER_S / hz;
+    return (tsc >= base_tsc) ? base_ns + delta_ns : base_ns - delta_ns;
+}
+
+CaptureWriter::~CaptureWriter(){
+    close_file();
+}
+
+bool CaptureWriter::write_all(struct iovec *vec, int cnt){
+    while (cnt > 0) {
+        ssize_t ret = pwritev(fd, vec, RTE_MIN(cnt, IOV_MAX), file_off);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        file_off += ret;
+        // Short write: skip what went out and go on from there
+        while (cnt > 0 && (size_t)ret >= vec->iov_len) {
+            ret -= vec->iov_len;
+            vec++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            vec->iov_base = (uint8_t *)vec->iov_base + ret;
+            vec->iov_len -= ret;
+        }
+    }
+    return true;
+}
+
+void CaptureWriter::close_file(){
+    if (fd < 0)
+        return;
+    close(fd);
+    fd = -1;
+}
+
+void CaptureWriter::open_next(){
+    close_file();
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s_%05u.pcapng", cfg.dir.c_str(), cfg.prefix.c_str(), file_seq++);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        if (!failing)
+            RTE_LOG(ERR, USER1, "Cannot open capture file %s: %s\n", path, strerror(errno));
+        return;
+    }
+    file_off = 0;
+
+    // Section header, then one interface per context: the EPBs refer to them by index
+    std::vector<uint8_t> head;
+    put32(head, PCAPNG_SHB);
+    put32(head, 0);
+    put32(head, PCAPNG_BYTE_ORDER_MAGIC);
+    put16(head, 1);
+    put16(head, 0);
+    put32(head, UINT32_MAX);    // section length unknown: -1 as 64 bits
+    put32(head, UINT32_MAX);
+    end_block(head, 0);
+    for (const std::string &name : interfaces) {
+        size_t start = head.size();
+        put32(head, PCAPNG_IDB);
+        put32(head, 0);
+        put16(head, PCAPNG_LINKTYPE_ETHERNET);
+        put16(head, 0);
+        put32(head, cfg.snaplen);
+        put_option(head, PCAPNG_OPT_IF_NAME, name.data(), name.size());
+        uint8_t tsresol = PCAPNG_TSRESOL_NS;
+        put_option(head, PCAPNG_OPT_IF_TSRESOL, &tsresol, sizeof(tsresol));
+        put_option(head, PCAPNG_OPT_END, nullptr, 0);
+        end_block(head, start);
+    }
+    struct iovec vec = {head.data(), head.size()};
+    if (!write_all(&vec, 1)) {
+        RTE_LOG(ERR, USER1, "Cannot write capture file %s: %s\n", path, strerror(errno));
+        close_file();
+        return;
+    }
+
+    bump(&stats.files);
+    paths.push_back(path);
+    while (cfg.files > 0 && paths.size() > cfg.files) {
+        unlink(paths.front().c_str());
+        paths.pop_front();
+    }
+}
+
+unsigned int CaptureWriter::run_once(){
+    CaptureRecord records[CAPTURE_BATCH];
+    struct rte_mbuf *mbufs[CAPTURE_BATCH];
+    unsigned int nb = rte_ring_sc_dequeue_burst_elem(ring, records, sizeof(CaptureRecord), CAPTURE_BATCH, NULL);
+    if (nb == 0)
+        return 0;
+
+    // Rotation is looked at once per batch: a file ends at most one batch past file_mb
+    if (fd < 0 || (uint64_t)file_off >= (uint64_t)cfg.file_mb << 20)
+        open_next();
+
+    // Packets whose iovecs are not written yet, and what they add to the counters once they are
+    unsigned int nb_pending = 0;
+    uint64_t pending_bytes = 0;
+    uint64_t pending_truncated = 0;
+    int cnt = 0;
+    auto flush = [&]() {
+        if (fd >= 0 && write_all(iov, cnt)) {
+            bump(&stats.pkts, nb_pending);
+            bump(&stats.bytes, pending_bytes);
+            bump(&stats.truncated, pending_truncated);
+            failing = false;
+        } else {
+            // A failed write leaves a partial block behind: that file is done, the next batch starts another
+            if (!failing)
+                RTE_LOG(ERR, USER1, "Capture write failed: %s\n", (fd >= 0) ? strerror(errno) : "no file open");
+            failing = true;
+            close_file();
+            bump(&stats.write_errors, nb_pending);
+        }
+        nb_pending = 0;
+        pending_bytes = 0;
+        pending_truncated = 0;
+        cnt = 0;
+    };
+
+    for (unsigned int i = 0; i < nb; i++) {
+        struct rte_mbuf *m = records[i].mbuf;
+        mbufs[i] = m;
+        if (cnt + m->nb_segs + 3 > CAPTURE_IOV_MAX)
+            flush();
+
+        uint32_t len = rte_pktmbuf_pkt_len(m);
+        uint32_t caplen = (cfg.snaplen > 0) ? RTE_MIN(len, cfg.snaplen) : len;
+        uint64_t ts = tsc_to_ns(records[i].tsc);
+
+        EpbHeader &h = headers[i];
+        h.type = PCAPNG_EPB;
+        h.total_len = sizeof(EpbHeader) + pad4(caplen) + sizeof(uint32_t);
+        h.interface = records[i].interface;
+        h.ts_high = ts >> 32;
+        h.ts_low = (uint32_t)ts;
+        h.caplen = caplen;
+        h.len = len;
+        trailers[i] = h.total_len;
+
+        iov[cnt++] = {&h, sizeof(h)};
+        uint32_t left = caplen;
+        for (struct rte_mbuf *seg = m; seg != nullptr && left > 0; seg = seg->next) {
+            uint32_t take = RTE_MIN(left, (uint32_t)seg->data_len);
+            iov[cnt++] = {rte_pktmbuf_mtod(seg, void *), take};
+            left -= take;
+        }
+        if (pad4(caplen) != caplen)
+            iov[cnt++] = {(void *)zeros, pad4(caplen) - caplen};
+        iov[cnt++] = {&trailers[i], sizeof(uint32_t)};
+        nb_pending++;
+        pending_bytes += caplen;
+        pending_truncated += (caplen < len);
+    }
+    flush();
+
+    // Only now are the packets' data no longer needed: drop the writer's reference
+    rte_pktmbuf_free_bulk(mbufs, nb);
+    return nb;
+}
+
+int CaptureWriter::run(void *arg){
+    auto *writer = static_cast<CaptureWriter *>(arg);
+    printf("Capture writer started on lcore %u\n", rte_lcore_id());
+
+    while (!writer->stop_flag) {
+        // Not a datapath lcore: sleep when idle rather than spin
+        if (writer->run_once() == 0)
+            usleep(1000);
+    }
+    printf("Capture writer stopped on lcore %u\n", rte_lcore_id());
+    return 0;
+}
+
+void CaptureWriter::drain(){
+    while (run_once() > 0)
+        ;
+}
+
+CaptureStats CaptureWriter::get_stats() const {
+    CaptureStats out;
+    out.pkts = __atomic_load_n(&stats.pkts, __ATOMIC_RELAXED);
+    out.bytes = __atomic_load_n(&stats.bytes, __ATOMIC_RELAXED);
+    out.truncated = __atomic_load_n(&stats.truncated, __ATOMIC_RELAXED);
+    out.files = __atomic_load_n(&stats.files, __ATOMIC_RELAXED);
+    out.write_errors = __atomic_load_n(&stats.write_errors, __ATOMIC_RELAXED);
+    return out;
+}
+
+void CaptureWriter::report(){
+    CaptureStats s = get_stats();
+    if (s.pkts == last.pkts && s.write_errors == last.write_errors)
+        return;
+    printf("Capture: +%" PRIu64 " pkts +%" PRIu64 " bytes (%" PRIu64 " truncated), %" PRIu64 " files (+%" PRIu64 "), write errors %" PRIu64 " (+%" PRIu64 ")\n",
+           s.pkts - last.pkts, s.bytes - last.bytes, s.truncated - last.truncated, s.files, s.files - last.files,
+           s.write_errors, s.write_errors - last.write_errors);
+    last = s;
+}
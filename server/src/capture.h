@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include <rte_ring.h>
+#include <rte_ring_elem.h>
+#include <rte_mbuf.h>
+
+#include "lcore_stats.h"
+#include "flow.h"
+
+#define DEFAULT_CAPTURE_RING_SIZE (8192)     // captured packets waiting for the writer, more are dropped
+#define DEFAULT_CAPTURE_DIR "/var/tmp"
+#define DEFAULT_CAPTURE_PREFIX "onic_capture"
+#define DEFAULT_CAPTURE_FILE_MB (128)
+#define DEFAULT_CAPTURE_FILES (8)
+#define CAPTURE_BATCH (256)                  // packets dequeued and written per pwritev()
+#define CAPTURE_IOV_MAX (1024)
+
+// What a context captures, as masks over the packet's FlowKey. An empty filter takes every packet,
+// one with an address, port or protocol only IPv4/IPv6 packets. Matched on both directions of a
+// conversation by default: src 10.0.0.1 dst_port 53 also takes the replies from port 53 to 10.0.0.1
+class CaptureFilter {
+    private:
+        bool ip = false;            // some FlowKey field is matched: non-IP packets never match
+        int vlan = -1;              // 802.1Q VLAN id, -1 for any (untagged too)
+        bool both_ways = true;
+        FlowKey mask = {};
+        FlowKey value = {};
+        FlowKey reverse_mask = {};  // the same filter with src and dst swapped
+        FlowKey reverse_value = {};
+        std::string text;           // the setters' terms, for to_string()
+
+        void set_ip_version(uint8_t version);
+        bool set_prefix(const std::string &cidr, bool src);
+        void update_reverse();
+
+    public:
+        // Setup only. Return false on a value they cannot parse
+        bool set_proto(const std::string &proto);   // "tcp", "udp", "sctp", "icmp", "icmp6" or a number
+        bool set_src(const std::string &cidr) { return set_prefix(cidr, true); }    // "10.0.0.0/8", "2001:db8::1"
+        bool set_dst(const std::string &cidr) { return set_prefix(cidr, false); }
+        void set_src_port(uint16_t port);
+        void set_dst_port(uint16_t port);
+        bool set_vlan(int vlan_id);
+        void set_both_ways(bool on) { both_ways = on; update_reverse(); }
+
+        bool match(const struct rte_mbuf *mbuf, const BurstMeta &meta, uint16_t i) const;
+        std::string to_string() const;
+};
+
+// One captured packet on its way to the writer. The mbuf holds an extra reference the writer drops
+struct CaptureRecord {
+    struct rte_mbuf *mbuf;
+    uint64_t tsc;
+    uint32_t interface;         // pcapng interface of the context that captured it
+    uint32_t reserved;
+};
+
+static inline struct rte_ring *create_capture_ring(const char *name, unsigned int size, int socket_id){
+    return rte_ring_create_elem(name, sizeof(CaptureRecord), size, socket_id, RING_F_SC_DEQ);
+}
+
+// Hands the packets of a parsed burst that match filter to the writer: one more reference each, no copy.
+// Never waits on the writer, what the ring cannot take is counted in capture_drops. Returns how many were taken
+uint16_t capture_burst(const CaptureFilter &filter, struct rte_ring *ring, uint32_t interface, LcoreStats *stats,
+                       struct rte_mbuf *const *mbufs, const BurstMeta &meta, uint64_t tsc);
+
+struct CaptureConfig {
+    std::string dir = DEFAULT_CAPTURE_DIR;
+    std::string prefix = DEFAULT_CAPTURE_PREFIX;    // files are <dir>/<prefix>_<sequence>.pcapng
+    unsigned int file_mb = DEFAULT_CAPTURE_FILE_MB; // a file is closed and the next one started past this size
+    unsigned int files = DEFAULT_CAPTURE_FILES;     // the oldest file is deleted beyond this many, 0 keeps all
+    unsigned int snaplen = 0;                       // bytes kept of each packet, 0 keeps whole packets
+    unsigned int ring_size = DEFAULT_CAPTURE_RING_SIZE;
+};
+
+struct CaptureStats {
+    uint64_t pkts = 0;          // written to a file
+    uint64_t bytes = 0;         // of packet data written, after snaplen
+    uint64_t truncated = 0;     // packets cut to snaplen
+    uint64_t files = 0;         // files started
+    uint64_t write_errors = 0;  // packets lost to a failed open or write
+};
+
+// Writes the capture ring to rotating pcapng files, one interface per context. Batches of
+// CAPTURE_BATCH packets go out in one pwritev() straight from the mbufs, which are freed once written.
+// Runs on its own lcore; when it falls behind the ring fills up and the forwarders drop, not wait
+class CaptureWriter {
+    private:
+        CaptureConfig cfg;
+        struct rte_ring *ring;
+        std::vector<std::string> interfaces;
+        CaptureStats stats;
+        volatile bool stop_flag = false;
+
+        int fd = -1;
+        off_t file_off = 0;
+        uint32_t file_seq = 0;
+        std::deque<std::string> paths;  // files written, oldest first
+        bool failing = false;           // the last open or write failed: logged once until one works again
+
+        // Realtime at base_tsc, taken when the writer is built: packet timestamps are TSC based
+        uint64_t base_ns;
+        uint64_t base_tsc;
+        uint64_t tsc_to_ns(uint64_t tsc) const;
+
+        // Enhanced packet block headers and trailers of a batch, the data iovecs point into the mbufs
+        struct EpbHeader {
+            uint32_t type;
+            uint32_t total_len;
+            uint32_t interface;
+            uint32_t ts_high;
+            uint32_t ts_low;
+            uint32_t caplen;
+            uint32_t len;
+        };
+        EpbHeader headers[CAPTURE_BATCH];
+        uint32_t trailers[CAPTURE_BATCH];
+        struct iovec iov[CAPTURE_IOV_MAX];
+
+        static inline void bump(uint64_t *counter, uint64_t n = 1) {
+            __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+        }
+        bool write_all(struct iovec *vec, int cnt);
+        void open_next();
+        void close_file();
+
+    public:
+        // interfaces: one name per pcapng interface, CaptureRecord::interface indexes it.
+        // Built before the forwarders start, the time base then precedes every packet
+        CaptureWriter(const CaptureConfig &cfg, struct rte_ring *ring, const std::vector<std::string> &interfaces);
+        ~CaptureWriter();
+
+        // One batch from the ring into the current file, returns how many packets it took
+        unsigned int run_once();
+        // Writer loop for rte_eal_remote_launch, runs until stop()
+        static int run(void *writer);
+        void stop() { stop_flag = true; }
+        // Writes what is left in the ring, e.g. once the forwarders stopped
+        void drain();
+
+        CaptureStats get_stats() const;
+        // Prints what was written since the last call, if anything
+        void report();
+
+    private:
+        CaptureStats last;
+};
@@ -0,0 +1,200 @@
+#include "cmac_bringup.h"
+
+#include <cerrno>
+
+#define SHELL_STATUS_READY (0x10)
+#define SHELL_RESET_CMAC(i) (0x10 << (4 * (i)))
+
+const char *to_string(CmacStage stage) {
+    switch (stage) {
+        case CmacStage::SHELL: return "shell";
+        case CmacStage::RESET: return "reset";
+        case CmacStage::ALIGN: return "align";
+        case CmacStage::UP: return "up";
+        case CmacStage::LINK_DOWN: return "link down";
+        case CmacStage::ABSENT: return "absent";
+        case CmacStage::SKIPPED: return "skipped";
+        default: return "failed";
+    }
+}
+
+CmacBringup::CmacBringup(const std::vector<Onic *> &onics, uint32_t cmac_mask) {
+    for (size_t i = 0; i < onics.size(); i++) {
+        this->onics.push_back({onics[i]});
+        for (int cmac_id = 0; cmac_id < NB_CMAC; cmac_id++) {
+            if (cmac_mask & (1u << cmac_id)) {
+                CmacState state;
+                state.onic = i;
+                state.cmac_id = cmac_id;
+                cmacs.push_back(state);
+            }
+        }
+    }
+}
+
+// Once the shell is up, all the onic's CMACs are reset by one write
+bool CmacBringup::step_onic(OnicState &state) {
+    if (state.shell_ready || state.failed)
+        return true;
+
+    if ((state.onic->read_reg(SYSCFG_OFFSET_SHELL_STATUS) & SHELL_STATUS_READY) != SHELL_STATUS_READY) {
+        if (now_ms < SHELL_RESET_TIMEOUT_MS)
+            return false;
+        state.failed = true;
+        for (CmacState &cmac : cmacs) {
+            if (&onics[cmac.onic] == &state)
+                finish(cmac, CmacStage::FAILED);
+        }
+        return true;
+    }
+
+    state.shell_ready = true;
+    state.shell_ms = now_ms;
+    uint32_t reset = 0;
+    for (CmacState &cmac : cmacs) {
+        if (&onics[cmac.onic] == &state) {
+            reset |= SHELL_RESET_CMAC(cmac.cmac_id);
+            cmac.stage = CmacStage::RESET;
+            cmac.stage_start_ms = now_ms;
+        }
+    }
+    state.onic->write_reg(SYSCFG_OFFSET_SHELL_RESET, reset);
+    return true;
+}
+
+// Where the CMACs below this one on its onic stand: ABSENT once one of them is absent or failed,
+// RESET while one of them is not checked yet, ALIGN when they are all there
+CmacStage CmacBringup::lower_cmacs(const CmacState &state) const {
+    bool pending = false;
+    for (const CmacState &other : cmacs) {
+        if (other.onic != state.onic || other.cmac_id >= state.cmac_id)
+            continue;
+        if (other.stage == CmacStage::ABSENT || other.stage == CmacStage::FAILED || other.stage == CmacStage::SKIPPED)
+            return CmacStage::ABSENT;
+        if (other.stage == CmacStage::SHELL || other.stage == CmacStage::RESET)
+            pending = true;
+    }
+    return pending ? CmacStage::RESET : CmacStage::ALIGN;
+}
+
+bool CmacBringup::step_cmac(CmacState &state) {
+    Onic *onic = onics[state.onic].onic;
+    int cmac_id = state.cmac_id;
+    unsigned int in_stage = now_ms - state.stage_start_ms;
+
+    switch (state.stage) {
+        case CmacStage::SHELL:
+            return false;
+
+        case CmacStage::RESET: {
+            uint32_t bit = SHELL_RESET_CMAC(cmac_id);
+            if ((onic->read_reg(SYSCFG_OFFSET_SHELL_STATUS) & bit) != bit) {
+                if (in_stage >= SHELL_RESET_TIMEOUT_MS)
+                    finish(state, CmacStage::FAILED);
+                return state.stage == CmacStage::FAILED;
+            }
+            state.reset_ms = in_stage;
+            CmacStage lower = lower_cmacs(state);
+            if (lower == CmacStage::RESET)
+                return false;
+            if (lower == CmacStage::ABSENT) {
+                finish(state, CmacStage::SKIPPED);
+                return true;
+            }
+            if (onic->read_reg(CMAC_OFFSET_CORE_VERSION(cmac_id)) != ONIC_CMAC_CORE_VERSION) {
+                finish(state, CmacStage::ABSENT);
+                return true;
+            }
+            onic->configure_cmac(cmac_id);
+            state.stage = CmacStage::ALIGN;
+            state.stage_start_ms = now_ms;
+            return false;
+        }
+
+        case CmacStage::ALIGN:
+            if (onic->read_reg(CMAC_OFFSET_STAT_RX_STATUS(cmac_id)) & CMAC_RX_STATUS_ALIGNED) {
+                state.align_ms = in_stage;
+                finish(state, CmacStage::UP);
+            } else if (in_stage >= RX_ALIGN_TIMEOUT_MS) {
+                state.align_ms = in_stage;
+                finish(state, CmacStage::LINK_DOWN);
+            } else {
+                return false;
+            }
+            return true;
+
+        default:
+            return true;
+    }
+}
+
+void CmacBringup::finish(CmacState &state, CmacStage stage) {
+    if (stage == CmacStage::UP || stage == CmacStage::LINK_DOWN)
+        onics[state.onic].onic->start_cmac_tx(state.cmac_id);
+    if (stage == CmacStage::FAILED)
+        state.failed_stage = state.stage;
+    state.stage = stage;
+    state.done_ms = now_ms;
+}
+
+int CmacBringup::run(WaitFn wait) {
+    uint64_t start = rte_get_tsc_cycles();
+    for (;;) {
+        bool done = true;
+        for (OnicState &state : onics)
+            done &= step_onic(state);
+        for (CmacState &state : cmacs)
+            done &= step_cmac(state);
+        if (done)
+            break;
+        wait(CMAC_RESET_WAIT_MS);
+        now_ms += CMAC_RESET_WAIT_MS;
+    }
+    wall_us = (rte_get_tsc_cycles() - start) * US_PER_S / rte_get_tsc_hz();
+    apply();
+
+    for (const OnicState &state : onics) {
+        if (state.failed)
+            return -ETIMEDOUT;
+    }
+    return 0;
+}
+
+// Same rule as the serial bring-up: CMACs count from 0 up to the first one that is not usable
+void CmacBringup::apply() {
+    for (size_t i = 0; i < onics.size(); i++) {
+        int nb_cmacs = 0;
+        while (nb_cmacs < NB_CMAC) {
+            CmacStage s = stage(i, nb_cmacs);
+            if (s != CmacStage::UP && s != CmacStage::LINK_DOWN)
+                break;
+            nb_cmacs++;
+        }
+        onics[i].onic->nb_cmacs = nb_cmacs;
+        onics[i].onic->init_status = onics[i].failed ? -ETIMEDOUT : 0;
+    }
+}
+
+CmacStage CmacBringup::stage(size_t onic, int cmac_id) const {
+    for (const CmacState &state : cmacs) {
+        if (state.onic == onic && state.cmac_id == cmac_id)
+            return state.stage;
+    }
+    return CmacStage::ABSENT;
+}
+
+void CmacBringup::report(const std::vector<std::string> &names) const {
+    for (const CmacState &state : cmacs) {
+        std::string name = (state.onic < names.size()) ? names[state.onic] : "onic" + std::to_string(state.onic);
+        const OnicState &onic = onics[state.onic];
+        if (state.stage == CmacStage::FAILED)
+            printf("%s CMAC %d: failed in %s after %u ms\n", name.c_str(), state.cmac_id,
+                   to_string(state.failed_stage), state.done_ms);
+        else
+            printf("%s CMAC %d: %-9s shell %4u ms, reset %4u ms, align %4u ms, done at %4u ms\n",
+                   name.c_str(), state.cmac_id, to_string(state.stage), onic.shell_ms,
+                   state.reset_ms, state.align_ms, state.done_ms);
+    }
+    printf("CMAC bring-up: %zu onics, %zu CMACs in %u ms (%.1f ms wall clock)\n",
+           onics.size(), cmacs.size(), now_ms, wall_us / 1e3);
+}
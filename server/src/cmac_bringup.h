@@ -0,0 +1,78 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "onic.h"
+
+#define CMAC_RX_STATUS_ALIGNED (0x2) // stat_rx_aligned in CMAC_OFFSET_STAT_RX_STATUS
+
+enum class CmacStage {
+    SHELL,      // waiting for the shell to be out of reset
+    RESET,      // shell reset of the CMAC subsystem requested, waiting for its status bit
+    ALIGN,      // rx enabled and tx sending RFI, waiting for rx alignment
+    UP,         // aligned, tx enabled
+    LINK_DOWN,  // no alignment by RX_ALIGN_TIMEOUT_MS, tx enabled anyway so the link can come up later
+    ABSENT,     // no CMAC core behind this subsystem
+    FAILED,     // a reset never completed
+    SKIPPED,    // left alone: a lower CMAC of the onic is absent or failed
+};
+
+const char *to_string(CmacStage stage);
+
+// Brings up every CMAC of several onics at once: one state machine per CMAC, all stepped from a
+// single loop that sleeps CMAC_RESET_WAIT_MS between rounds, so the cold start of a host costs the
+// slowest CMAC rather than the sum of all of them. Every wait has a deadline, and the time each
+// CMAC spent in each stage is kept for report().
+// As in the serial bring-up, the CMACs of an onic are used from 0 up to the first absent or failed one:
+// a CMAC is only configured once every lower one is known to be there, and is skipped otherwise.
+// Time is counted in rounds rather than read from a clock, so a model backend, whose wait() only
+// advances its own clock, times out after the same number of rounds as hardware
+class CmacBringup {
+    public:
+        using WaitFn = std::function<void(unsigned int ms)>;
+
+    private:
+        struct OnicState {
+            Onic *onic;
+            bool shell_ready = false;
+            bool failed = false;
+            unsigned int shell_ms = 0;
+        };
+        struct CmacState {
+            size_t onic;
+            int cmac_id;
+            CmacStage stage = CmacStage::SHELL;
+            CmacStage failed_stage = CmacStage::SHELL;
+            unsigned int stage_start_ms = 0;
+            unsigned int reset_ms = 0; // reset requested -> status bit set
+            unsigned int align_ms = 0; // rx enabled -> aligned or timed out
+            unsigned int done_ms = 0;  // since the start of the bring-up
+        };
+
+        std::vector<OnicState> onics;
+        std::vector<CmacState> cmacs;
+        unsigned int now_ms = 0;
+        uint64_t wall_us = 0;
+
+        bool step_onic(OnicState &state);
+        CmacStage lower_cmacs(const CmacState &state) const;
+        bool step_cmac(CmacState &state);
+        void finish(CmacState &state, CmacStage stage);
+        void apply();
+
+    public:
+        // cmac_mask selects the CMACs to bring up on every onic, bit i for CMAC i
+        CmacBringup(const std::vector<Onic *> &onics, uint32_t cmac_mask = (1u << NB_CMAC) - 1);
+
+        // Steps until every CMAC is done, then sets each onic's CMAC count and init status.
+        // Returns -ETIMEDOUT if any shell never came out of reset
+        int run(WaitFn wait = [](unsigned int ms) { rte_delay_ms(ms); });
+
+        CmacStage stage(size_t onic, int cmac_id) const;
+        unsigned int elapsed_ms() const { return now_ms; }
+        uint64_t wall_time_us() const { return wall_us; }
+        // Per CMAC stage timings, names default to the onic index
+        void report(const std::vector<std::string> &names = {}) const;
+};
@@ -0,0 +1,177 @@
+#include "cmac_collector.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+static const char *COUNTER_NAMES[NB_CMAC_COUNTERS] = {
+    "tx_total_pkts", "tx_total_good_pkts", "tx_total_bytes", "tx_total_good_bytes", "tx_bad_fcs",
+    "rx_total_pkts", "rx_total_good_pkts", "rx_total_bytes", "rx_total_good_bytes", "rx_pkt_bad_fcs",
+    "rx_undersize", "rx_oversize", "rx_frag", "rx_jabber",
+};
+
+const char *cmac_counter_name(int counter) {
+    return COUNTER_NAMES[counter];
+}
+
+uint32_t cmac_counter_offset(int cmac_id, int counter) {
+    switch (counter) {
+        case CMAC_TX_TOTAL_PKTS: return CMAC_OFFSET_STAT_TX_TOTAL_PKTS(cmac_id);
+        case CMAC_TX_GOOD_PKTS: return CMAC_OFFSET_STAT_TX_TOTAL_GOOD_PKTS(cmac_id);
+        case CMAC_TX_TOTAL_BYTES: return CMAC_OFFSET_STAT_TX_TOTAL_BYTES(cmac_id);
+        case CMAC_TX_GOOD_BYTES: return CMAC_OFFSET_STAT_TX_TOTAL_GOOD_BYTES(cmac_id);
+        case CMAC_TX_BAD_FCS: return CMAC_OFFSET_STAT_TX_BAD_FCS(cmac_id);
+        case CMAC_RX_TOTAL_PKTS: return CMAC_OFFSET_STAT_RX_TOTAL_PKTS(cmac_id);
+        case CMAC_RX_GOOD_PKTS: return CMAC_OFFSET_STAT_RX_TOTAL_GOOD_PKTS(cmac_id);
+        case CMAC_RX_TOTAL_BYTES: return CMAC_OFFSET_STAT_RX_TOTAL_BYTES(cmac_id);
+        case CMAC_RX_GOOD_BYTES: return CMAC_OFFSET_STAT_RX_TOTAL_GOOD_BYTES(cmac_id);
+        case CMAC_RX_PKT_BAD_FCS: return CMAC_OFFSET_STAT_RX_PKT_BAD_FCS(cmac_id);
+        case CMAC_RX_UNDERSIZE: return CMAC_OFFSET_STAT_RX_UNDERSIZE(cmac_id);
+        case CMAC_RX_OVERSIZE: return CMAC_OFFSET_STAT_RX_OVERSIZE(cmac_id);
+        case CMAC_RX_FRAGMENT: return CMAC_OFFSET_STAT_RX_FRAGMENT(cmac_id);
+        default: return CMAC_OFFSET_STAT_RX_JABBER(cmac_id);
+    }
+}
+
+CmacCollector::CmacCollector(RegRead read_reg, RegWrite write_reg, int nb_cmacs,
+                             unsigned int interval_ms, CmacCounterMode mode, unsigned int width)
+    : read_reg(read_reg), write_reg(write_reg), nb_cmacs(nb_cmacs), mode(mode),
+      width(width), interval_us((uint64_t)interval_ms * 1000) {
+    if (this->nb_cmacs > NB_CMAC)
+        this->nb_cmacs = NB_CMAC;
+    if (this->width == 0 || this->width > 64)
+        this->width = CMAC_COUNTER_WIDTH;
+    mask = (this->width == 64) ? UINT64_MAX : ((1ULL << this->width) - 1);
+
+    if (mode == CmacCounterMode::FREE_RUNNING && interval_us > max_interval_us(this->width))
+        printf("CMAC collector: a %u-bit counter can wrap more than once in %u ms at line rate, "
+               "use an interval under %" PRIu64 " ms\n", this->width, interval_ms, max_interval_us(this->width) / 1000);
+}
+
+CmacCollector CmacCollector::for_onic(const Onic &onic, unsigned int interval_ms,
+                                      CmacCounterMode mode, unsigned int width) {
+    const Onic *p = &onic;
+    return CmacCollector([p](uint32_t offset) { return p->read_reg(offset); },
+                         [p](uint32_t offset, uint32_t val) { p->write_reg(offset, val); },
+                         onic.get_nb_cmacs(), interval_ms, mode, width);
+}
+
+uint64_t CmacCollector::max_interval_us(unsigned int width, uint64_t line_rate_bps) {
+    if (width >= 64)
+        return UINT64_MAX;
+    // 2^width bytes at line_rate_bps / 8 bytes per second
+    return (uint64_t)((double)(1ULL << width) * 8 * US_PER_S / line_rate_bps);
+}
+
+uint64_t CmacCollector::read_counter(int cmac_id, int counter) const {
+    uint32_t offset = cmac_counter_offset(cmac_id, counter);
+    uint64_t value = read_reg(offset);
+    if (width > 32)
+        value |= (uint64_t)read_reg(offset + 4) << 32;
+    return value & mask;
+}
+
+void CmacCollector::tick(int cmac_id, uint64_t now_us) {
+    CmacState &state = cmacs[cmac_id];
+    bool first = (state.totals.ticks == 0);
+
+    write_reg(CMAC_OFFSET_TICK(cmac_id), 0x1); // latch the counters into the stat registers
+    for (int c = 0; c < NB_CMAC_COUNTERS; c++) {
+        uint64_t raw = read_counter(cmac_id, c);
+        uint64_t delta;
+        if (mode == CmacCounterMode::LATCHED)
+            delta = raw;
+        else // modulo 2^width: right across a wrap as long as it went round at most once
+            delta = first ? 0 : ((raw - state.raw[c]) & mask);
+
+        state.raw[c] = raw;
+        state.delta[c] = delta;
+        state.totals.counters[c] += delta;
+    }
+    state.totals.ticks++;
+
+    // The first tick has no start time: it primes the counters, rates start with the second
+    if (!first)
+        update_rates(state, now_us - state.last_tick_us);
+    state.last_tick_us = now_us;
+}
+
+static inline uint64_t per_second(uint64_t count, uint64_t elapsed_us) {
+    return (uint64_t)((double)count * US_PER_S / elapsed_us);
+}
+
+static inline uint64_t ppm(uint64_t part, uint64_t total) {
+    return (total == 0) ? 0 : (uint64_t)((double)part * 1000000 / total);
+}
+
+void CmacCollector::update_rates(CmacState &state, uint64_t elapsed_us) {
+    if (elapsed_us == 0)
+        return;
+    const uint64_t *d = state.delta;
+    CmacRates &r = state.rates;
+    r.valid = true;
+    r.interval_us = elapsed_us;
+    r.tx_pps = per_second(d[CMAC_TX_TOTAL_PKTS], elapsed_us);
+    r.tx_bps = per_second(d[CMAC_TX_TOTAL_BYTES] * 8, elapsed_us);
+    r.rx_pps = per_second(d[CMAC_RX_TOTAL_PKTS], elapsed_us);
+    r.rx_bps = per_second(d[CMAC_RX_TOTAL_BYTES] * 8, elapsed_us);
+    // good can run ahead of total by a packet in flight when the tick lands mid-frame
+    r.tx_err_ppm = (d[CMAC_TX_TOTAL_PKTS] > d[CMAC_TX_GOOD_PKTS]) ?
+                   ppm(d[CMAC_TX_TOTAL_PKTS] - d[CMAC_TX_GOOD_PKTS], d[CMAC_TX_TOTAL_PKTS]) : 0;
+    r.rx_err_ppm = (d[CMAC_RX_TOTAL_PKTS] > d[CMAC_RX_GOOD_PKTS]) ?
+                   ppm(d[CMAC_RX_TOTAL_PKTS] - d[CMAC_RX_GOOD_PKTS], d[CMAC_RX_TOTAL_PKTS]) : 0;
+    r.rx_fcs_ppm = ppm(d[CMAC_RX_PKT_BAD_FCS], d[CMAC_RX_TOTAL_PKTS]);
+}
+
+bool CmacCollector::poll(uint64_t now_us) {
+    if (next_tick_us != 0 && now_us < next_tick_us)
+        return false;
+
+    for (int i = 0; i < nb_cmacs; i++)
+        tick(i, now_us);
+
+    if (next_tick_us == 0) {
+        next_tick_us = now_us + interval_us;
+    } else {
+        next_tick_us += interval_us;
+        // A whole interval late (main lcore stalled): restart the schedule rather than tick back to back
+        if (next_tick_us <= now_us) {
+            next_tick_us = now_us + interval_us;
+            for (int i = 0; i < nb_cmacs; i++)
+                cmacs[i].totals.late_ticks++;
+        }
+    }
+    return true;
+}
+
+uint64_t CmacCollector::us_until_due(uint64_t now_us) const {
+    return (next_tick_us > now_us) ? next_tick_us - now_us : 0;
+}
+
+void CmacCollector::print(const char *name, int cmac_id) const {
+    const CmacTotals &t = cmacs[cmac_id].totals;
+    const CmacRates &r = cmacs[cmac_id].rates;
+    printf("%s CMAC %d: rx %10.3f Mpps %8.3f Gbps err %6" PRIu64 " ppm fcs %6" PRIu64 " ppm | "
+           "tx %10.3f Mpps %8.3f Gbps err %6" PRIu64 " ppm | rx_total_pkts=%" PRIu64 " tx_total_pkts=%" PRIu64 "\n",
+           name, cmac_id,
+           r.rx_pps / 1e6, r.rx_bps / 1e9, r.rx_err_ppm, r.rx_fcs_ppm,
+           r.tx_pps / 1e6, r.tx_bps / 1e9, r.tx_err_ppm,
+           t[CMAC_RX_TOTAL_PKTS], t[CMAC_TX_TOTAL_PKTS]);
+}
+
+void CmacCollector::encode(LineEncoder &enc, const char *name, int cmac_id) const {
+    const CmacTotals &t = cmacs[cmac_id].totals;
+    const CmacRates &r = cmacs[cmac_id].rates;
+
+    enc.begin(CMAC_TABLE_NAME).tag("onic", name).tag("cmac", cmac_id);
+    for (int c = 0; c < NB_CMAC_COUNTERS; c++)
+        enc.field(cmac_counter_name(c), t[c]);
+    enc.field("rx_pps", r.rx_pps)
+       .field("rx_bps", r.rx_bps)
+       .field("tx_pps", r.tx_pps)
+       .field("tx_bps", r.tx_bps)
+       .field("rx_err_ppm", r.rx_err_ppm)
+       .field("rx_fcs_ppm", r.rx_fcs_ppm)
+       .field("tx_err_ppm", r.tx_err_ppm)
+       .field("interval_us", r.interval_us);
+    enc.end();
+}
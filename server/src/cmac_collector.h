@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include <rte_cycles.h>
+
+#include "onic.h"
+#include "line_protocol.h"
+
+#define CMAC_TABLE_NAME ("Cmac_stats")
+#define CMAC_DEFAULT_INTERVAL_MS (1000)
+#define CMAC_COUNTER_WIDTH (48) // stat registers are LSB at the offset, MSB[15:0] at offset + 4
+#define CMAC_LINE_RATE_BPS (100000000000ULL)
+
+// Counters the collector follows, see cmac_counter_offset() for their registers
+enum CmacCounter {
+    CMAC_TX_TOTAL_PKTS,
+    CMAC_TX_GOOD_PKTS,
+    CMAC_TX_TOTAL_BYTES,
+    CMAC_TX_GOOD_BYTES,
+    CMAC_TX_BAD_FCS,
+    CMAC_RX_TOTAL_PKTS,
+    CMAC_RX_GOOD_PKTS,
+    CMAC_RX_TOTAL_BYTES,
+    CMAC_RX_GOOD_BYTES,
+    CMAC_RX_PKT_BAD_FCS,
+    CMAC_RX_UNDERSIZE,
+    CMAC_RX_OVERSIZE,
+    CMAC_RX_FRAGMENT,
+    CMAC_RX_JABBER,
+    NB_CMAC_COUNTERS
+};
+
+const char *cmac_counter_name(int counter);
+uint32_t cmac_counter_offset(int cmac_id, int counter);
+
+// What the stat registers hold after a tick
+enum class CmacCounterMode {
+    LATCHED,      // the counts since the previous tick, the CMAC clears its counters on every tick
+    FREE_RUNNING, // a running count that wraps at 2^width
+};
+
+// Rates over the last tick interval
+struct CmacRates {
+    bool valid = false;     // false until two ticks were seen
+    uint64_t interval_us = 0;
+    uint64_t tx_pps = 0;
+    uint64_t tx_bps = 0;
+    uint64_t rx_pps = 0;
+    uint64_t rx_bps = 0;
+    uint64_t tx_err_ppm = 0;  // (total - good) / total packets, in parts per million
+    uint64_t rx_err_ppm = 0;
+    uint64_t rx_fcs_ppm = 0;  // bad FCS / total rx packets
+};
+
+struct CmacTotals {
+    uint64_t counters[NB_CMAC_COUNTERS] = {0};
+    uint64_t ticks = 0;
+    uint64_t late_ticks = 0;  // ticks that came more than one interval late, so the schedule was reset
+
+    uint64_t operator[](int counter) const { return counters[counter]; }
+};
+
+// Ticks the CMAC stat registers on a fixed schedule and keeps every counter as a 64-bit total,
+// so a 32-bit register wrapping at 100G (rx bytes wrap in ~0.34s) never shows up as a drop.
+// Registers are reached through read/write callables so the collector can run against a mock.
+// Must be the only thing ticking a CMAC: Onic::get_cmac_stats() ticks too and would steal
+// the latched counts
+class CmacCollector {
+    public:
+        using RegRead = std::function<uint32_t(uint32_t offset)>;
+        using RegWrite = std::function<void(uint32_t offset, uint32_t val)>;
+
+    private:
+        struct CmacState {
+            uint64_t raw[NB_CMAC_COUNTERS] = {0};  // register values at the last tick
+            uint64_t delta[NB_CMAC_COUNTERS] = {0}; // increments over the last interval
+            uint64_t last_tick_us = 0;
+            CmacTotals totals;
+            CmacRates rates;
+        };
+
+        RegRead read_reg;
+        RegWrite write_reg;
+        int nb_cmacs;
+        CmacCounterMode mode;
+        unsigned int width;
+        uint64_t mask;
+        uint64_t interval_us;
+        uint64_t next_tick_us = 0;
+        CmacState cmacs[NB_CMAC];
+
+        uint64_t read_counter(int cmac_id, int counter) const;
+        void tick(int cmac_id, uint64_t now_us);
+        void update_rates(CmacState &state, uint64_t elapsed_us);
+
+    public:
+        CmacCollector(RegRead read_reg, RegWrite write_reg, int nb_cmacs,
+                      unsigned int interval_ms = CMAC_DEFAULT_INTERVAL_MS,
+                      CmacCounterMode mode = CmacCounterMode::LATCHED,
+                      unsigned int width = CMAC_COUNTER_WIDTH);
+
+        // Collector on the CMACs the onic enabled, through its register backend. The onic must outlive it
+        static CmacCollector for_onic(const Onic &onic, unsigned int interval_ms = CMAC_DEFAULT_INTERVAL_MS,
+                                      CmacCounterMode mode = CmacCounterMode::LATCHED,
+                                      unsigned int width = CMAC_COUNTER_WIDTH);
+
+        // Ticks every CMAC when an interval is due, true if it did. Ticks keep to multiples of
+        // the interval from the first one, unless a call came a whole interval late
+        bool poll(uint64_t now_us);
+        uint64_t us_until_due(uint64_t now_us) const;
+
+        const CmacTotals &totals(int cmac_id) const { return cmacs[cmac_id].totals; }
+        const CmacRates &rates(int cmac_id) const { return cmacs[cmac_id].rates; }
+        uint64_t delta(int cmac_id, int counter) const { return cmacs[cmac_id].delta[counter]; }
+
+        // Longest interval before a free running byte counter of this width can go all the way round
+        // at line rate, past which a whole wrap would go unseen
+        static uint64_t max_interval_us(unsigned int width, uint64_t line_rate_bps = CMAC_LINE_RATE_BPS);
+
+        void print(const char *name, int cmac_id) const;
+        // One Cmac_stats line per CMAC with the totals and the rates of the last interval
+        void encode(LineEncoder &enc, const char *name, int cmac_id) const;
+};
+
+// Time base of the collector in main
+static inline uint64_t cmac_now_us() {
+    return rte_get_tsc_cycles() / (rte_get_tsc_hz() / US_PER_S);
+}
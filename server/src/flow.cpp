@@ -0,0 +1,408 @@
+#include "flow.h"
+#include "burst_parse.h"
+#include "forward_context.h"
+#include "line_protocol.h"
+
+#include <arpa/inet.h>
+#include <cinttypes>
+#include <cstring>
+#include <netinet/in.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_hash_crc.h>
+#include <rte_malloc.h>
+#include <rte_prefetch.h>
+#include <rte_vect.h>
+
+// Keys are written a word at a time: the hash reads them back as words right away, and a load
+// spanning several narrower stores cannot be forwarded from the store buffer. The parser already
+// found the headers, only the addresses and ports are read from the packet
+static inline void build_key(const struct rte_mbuf *mbuf, const BurstMeta &meta, uint16_t i, FlowKey *key){
+    const uint8_t *pkt = rte_pktmbuf_mtod(mbuf, const uint8_t *);
+    const uint8_t *l3 = pkt + meta.l3_off[i];
+    uint64_t *words = key->words;
+    uint64_t proto = meta.ip_proto[i];
+    uint64_t ip_version;
+    if (meta.flags[i] & PKT_IPV4) {
+        const auto *ip = (const struct rte_ipv4_hdr *)l3;
+        words[0] = ip->src_addr;
+        words[1] = 0;
+        words[2] = ip->dst_addr;
+        words[3] = 0;
+        ip_version = 4;
+    } else {
+        const auto *ip = (const struct rte_ipv6_hdr *)l3;
+        memcpy(&words[0], &ip->src_addr, 2 * sizeof(uint64_t));
+        memcpy(&words[2], &ip->dst_addr, 2 * sizeof(uint64_t));
+        ip_version = 6;
+    }
+
+    // TCP, UDP and SCTP all start with the source and destination ports, as in FlowKey. Later
+    // fragments have no L4 header, they are keyed with ports 0
+    uint32_t ports = 0;
+    if ((meta.flags[i] & PKT_L4) && (proto == IPPROTO_TCP || proto == IPPROTO_UDP || proto == IPPROTO_SCTP))
+        memcpy(&ports, pkt + meta.l4_off[i], sizeof(ports));
+    words[4] = ports | (proto << 32) | (ip_version << 40);
+}
+
+void flow_key(const struct rte_mbuf *mbuf, const BurstMeta &meta, uint16_t i, FlowKey *key){
+    build_key(mbuf, meta, i, key);
+}
+
+const char *to_string(FlowEnd reason) {
+    switch (reason) {
+        case FlowEnd::IDLE: return "idle";
+        case FlowEnd::ACTIVE: return "active";
+        case FlowEnd::EVICTED: return "evicted";
+        default: return "stop";
+    }
+}
+
+// Largest power of 2 TSC cycles that is at most 1 ms: ticks are a shift away from the TSC
+static uint32_t tsc_tick_shift(){
+    return 63 - __builtin_clzll(RTE_MAX(rte_get_tsc_hz() / MS_PER_S, (uint64_t)1));
+}
+
+FlowTable::FlowTable(const FlowConfig &cfg, int socket_id, LcoreStats *stats, struct rte_ring *export_ring)
+    : capacity(cfg.capacity), stats(stats),
+      idle_cycles(rte_get_tsc_hz() * cfg.idle_timeout_ms / MS_PER_S),
+      active_cycles(rte_get_tsc_hz() * cfg.active_timeout_ms / MS_PER_S),
+      tick_shift(tsc_tick_shift()),
+      wheel(cfg.capacity, rte_rdtsc() >> tick_shift, socket_id),
+      export_ring(export_ring)
+{
+    // Twice as many slots as entries: buckets stay half full and a new key nearly always fits
+    uint32_t nb_buckets = rte_align32pow2(RTE_MAX(capacity * 2 / FLOW_BUCKET_ENTRIES, 1u));
+    bucket_mask = nb_buckets - 1;
+
+    entries = (FlowEntry *)rte_zmalloc_socket("flow_entries", sizeof(FlowEntry) * capacity, RTE_CACHE_LINE_SIZE, socket_id);
+    free_idx = (uint32_t *)rte_malloc_socket("flow_free", sizeof(uint32_t) * capacity, 0, socket_id);
+    buckets = (FlowBucket *)rte_malloc_socket("flow_buckets", sizeof(FlowBucket) * nb_buckets, RTE_CACHE_LINE_SIZE, socket_id);
+    if (entries == NULL || free_idx == NULL || buckets == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate a flow table of %u flows on socket %d\n", capacity, socket_id);
+
+    for (uint32_t b = 0; b < nb_buckets; b++) {
+        for (int s = 0; s < FLOW_BUCKET_ENTRIES; s++) {
+            buckets[b].sig[s] = 0;
+            buckets[b].idx[s] = FLOW_NONE;
+        }
+    }
+    // Popped from the top: entries are handed out from 0 up
+    for (uint32_t i = 0; i < capacity; i++)
+        free_idx[i] = capacity - 1 - i;
+    nb_free = capacity;
+}
+
+FlowTable::~FlowTable(){
+    rte_free(entries);
+    rte_free(free_idx);
+    rte_free(buckets);
+}
+
+// Bit s set when slot s holds sig, the 8 signatures are compared at once where SSE2 is there
+inline uint32_t FlowTable::sig_match(const FlowBucket &bucket, uint16_t sig){
+#if defined(RTE_ARCH_X86)
+    __m128i eq = _mm_cmpeq_epi16(_mm_load_si128((const __m128i *)bucket.sig), _mm_set1_epi16(sig));
+    return _mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128()));
+#else
+    uint32_t match = 0;
+    for (int s = 0; s < FLOW_BUCKET_ENTRIES; s++)
+        match |= (uint32_t)(bucket.sig[s] == sig) << s;
+    return match;
+#endif
+}
+
+uint32_t FlowTable::find(const FlowKey &key, uint32_t hash) const {
+    uint16_t sig = sig_of(hash);
+    for (uint32_t b : {bucket_of(hash), alt_bucket_of(hash)}) {
+        const FlowBucket &bucket = buckets[b];
+        for (uint32_t match = sig_match(bucket, sig); match != 0; match &= match - 1) {
+            uint32_t idx = bucket.idx[__builtin_ctz(match)];
+            if (flow_key_equal(entries[idx].key, key))
+                return idx;
+        }
+    }
+    return FLOW_NONE;
+}
+
+const FlowEntry *FlowTable::lookup(const FlowKey &key) const {
+    uint32_t idx = find(key, rte_hash_crc(&key, sizeof(FlowKey), 0));
+    return (idx == FLOW_NONE) ? nullptr : &entries[idx];
+}
+
+static inline int free_slots(const FlowBucket &bucket){
+    int nb = 0;
+    for (int s = 0; s < FLOW_BUCKET_ENTRIES; s++)
+        nb += (bucket.idx[s] == FLOW_NONE);
+    return nb;
+}
+
+uint32_t FlowTable::insert(const FlowKey &key, uint32_t hash, uint64_t tsc){
+    FlowBucket *bucket = &buckets[bucket_of(hash)];
+    FlowBucket *alt = &buckets[alt_bucket_of(hash)];
+    // A full arena or two full buckets: the least recently seen flow around the key makes room
+    if (unlikely(nb_free == 0 || (free_slots(*bucket) == 0 && free_slots(*alt) == 0))) {
+        if (!evict(hash))
+            return FLOW_NONE;
+    }
+    // The alternative bucket only takes keys the primary one has no room for: update_burst() then
+    // only has to fetch one bucket per packet
+    if (free_slots(*bucket) == 0)
+        bucket = alt;
+
+    for (int s = 0; s < FLOW_BUCKET_ENTRIES; s++) {
+        if (bucket->idx[s] != FLOW_NONE)
+            continue;
+        uint32_t idx = free_idx[--nb_free];
+        FlowEntry &entry = entries[idx];
+        entry.key = key;
+        entry.pkts = 0;
+        entry.bytes = 0;
+        entry.last_tsc = tsc;
+        entry.first_tsc = tsc;
+        entry.hash = hash;
+        bucket->sig[s] = sig_of(hash);
+        bucket->idx[s] = idx;
+        arm(idx, tsc + RTE_MIN(idle_cycles, active_cycles));
+        lcore_stats_add(&stats->flows_new, 1);
+        lcore_stats_set(&stats->flows_active, size());
+        return idx;
+    }
+    return FLOW_NONE;
+}
+
+// Sampled LRU: the victim is the flow seen longest ago among the slots of the key's two buckets,
+// so the table never keeps a recency list that every packet would have to reorder. Their entries
+// are only read here, under pressure. When both buckets are empty but the arena is full, the next
+// FLOW_EVICT_SCAN buckets are searched as well
+bool FlowTable::evict(uint32_t hash){
+    uint32_t victim = FLOW_NONE;
+    uint64_t oldest = UINT64_MAX;
+    uint32_t first = bucket_of(hash);
+    for (uint32_t b : {first, alt_bucket_of(hash)}) {
+        for (int s = 0; s < FLOW_BUCKET_ENTRIES; s++) {
+            uint32_t idx = buckets[b].idx[s];
+            if (idx != FLOW_NONE && entries[idx].last_tsc < oldest) {
+                oldest = entries[idx].last_tsc;
+                victim = idx;
+            }
+        }
+    }
+    for (uint32_t n = 1; victim == FLOW_NONE && n <= FLOW_EVICT_SCAN; n++) {
+        const FlowBucket &bucket = buckets[(first + n) & bucket_mask];
+        for (int s = 0; s < FLOW_BUCKET_ENTRIES; s++) {
+            uint32_t idx = bucket.idx[s];
+            if (idx != FLOW_NONE && entries[idx].last_tsc < oldest) {
+                oldest = entries[idx].last_tsc;
+                victim = idx;
+            }
+        }
+    }
+    if (victim == FLOW_NONE)
+        return false;
+    export_flow(entries[victim], FlowEnd::EVICTED);
+    remove(victim);
+    lcore_stats_add(&stats->flows_evicted, 1);
+    return true;
+}
+
+void FlowTable::remove(uint32_t idx){
+    uint32_t hash = entries[idx].hash;
+    for (uint32_t b : {bucket_of(hash), alt_bucket_of(hash)}) {
+        FlowBucket &bucket = buckets[b];
+        for (uint32_t match = sig_match(bucket, sig_of(hash)); match != 0; match &= match - 1) {
+            int s = __builtin_ctz(match);
+            if (bucket.idx[s] == idx) {
+                bucket.sig[s] = 0;
+                bucket.idx[s] = FLOW_NONE;
+                goto unlinked;
+            }
+        }
+    }
+unlinked:
+    wheel.cancel(idx);
+    free_idx[nb_free++] = idx;
+    lcore_stats_set(&stats->flows_active, size());
+}
+
+// A flow without a packet since its last export has nothing to say
+void FlowTable::export_flow(const FlowEntry &entry, FlowEnd reason){
+    if (export_ring == nullptr || entry.pkts == 0)
+        return;
+    FlowRecord &record = pending[nb_pending++];
+    record.key = entry.key;
+    record.pkts = entry.pkts;
+    record.bytes = entry.bytes;
+    record.first_tsc = entry.first_tsc;
+    record.last_tsc = entry.last_tsc;
+    record.ctx_id = stats->ctx_id;
+    record.reason = reason;
+    if (nb_pending == FLOW_EXPORT_BATCH)
+        flush_records();
+}
+
+// Never waits for the consumer: what the ring cannot take is counted and lost
+void FlowTable::flush_records(){
+    if (nb_pending == 0)
+        return;
+    unsigned int nb_enq = rte_ring_enqueue_burst_elem(export_ring, pending, sizeof(FlowRecord), nb_pending, NULL);
+    lcore_stats_add(&stats->flow_records, nb_enq);
+    if (unlikely(nb_enq < nb_pending))
+        lcore_stats_add(&stats->flow_record_drops, nb_pending - nb_enq);
+    nb_pending = 0;
+}
+
+// Timers only fire on the earlier of the two deadlines as they were when armed: the flow has
+// likely been seen since, then it is armed again for its new ones
+uint32_t FlowTable::expire(const uint32_t *fired, uint32_t nb, uint64_t tsc){
+    for (uint32_t i = 0; i < nb; i++)
+        rte_prefetch0(&entries[fired[i]]);
+
+    for (uint32_t i = 0; i < nb; i++) {
+        uint32_t idx = fired[i];
+        FlowEntry &entry = entries[idx];
+        uint64_t idle_end = entry.last_tsc + idle_cycles;
+        uint64_t active_end = entry.first_tsc + active_cycles;
+        if (tsc >= idle_end) {
+            export_flow(entry, FlowEnd::IDLE);
+            remove(idx);
+            lcore_stats_add(&stats->flows_expired, 1);
+            continue;
+        }
+        if (tsc >= active_end) {
+            export_flow(entry, FlowEnd::ACTIVE);
+            entry.pkts = 0;
+            entry.bytes = 0;
+            entry.first_tsc = tsc;
+            active_end = tsc + active_cycles;
+        }
+        arm(idx, RTE_MIN(idle_end, active_end));
+    }
+    flush_records();
+    return nb;
+}
+
+void FlowTable::flush(){
+    for_each([this](const FlowEntry &entry) { export_flow(entry, FlowEnd::STOP); });
+    flush_records();
+}
+
+uint16_t FlowTable::update_burst(struct rte_mbuf *const *mbufs, const BurstMeta &meta, uint64_t tsc){
+    uint16_t nb = meta.nb;
+    FlowKey keys[MAX_BURST_SIZE];
+    uint32_t hashes[MAX_BURST_SIZE];
+    uint32_t lens[MAX_BURST_SIZE];
+    uint32_t found[MAX_BURST_SIZE];
+    uint16_t nb_keys = 0;
+
+    // Keys, then hashes in a loop of their own: by then the keys' stores have left the store buffer.
+    // The parser just read the headers, they are still in cache
+    for (uint16_t i = 0; i < nb; i++) {
+        if (!(meta.flags[i] & (PKT_IPV4 | PKT_IPV6)))
+            continue;
+        lens[nb_keys] = rte_pktmbuf_pkt_len(mbufs[i]);
+        build_key(mbufs[i], meta, i, &keys[nb_keys++]);
+    }
+    for (uint16_t k = 0; k < nb_keys; k++) {
+        hashes[k] = rte_hash_crc(&keys[k], sizeof(FlowKey), 0);
+        rte_prefetch0(&buckets[bucket_of(hashes[k])]);
+    }
+
+    // First signature match of each key, its entry is fetched while the other buckets are searched.
+    // Keys are only in their alternative bucket when the primary one was full, that one is read cold
+    for (uint16_t k = 0; k < nb_keys; k++) {
+        uint16_t sig = sig_of(hashes[k]);
+        const FlowBucket *bucket = &buckets[bucket_of(hashes[k])];
+        uint32_t match = sig_match(*bucket, sig);
+        if (match == 0) {
+            bucket = &buckets[alt_bucket_of(hashes[k])];
+            match = sig_match(*bucket, sig);
+        }
+        found[k] = (match != 0) ? bucket->idx[__builtin_ctz(match)] : FLOW_NONE;
+        if (found[k] != FLOW_NONE)
+            rte_prefetch0(&entries[found[k]]);
+    }
+
+    // A signature collision, or a flow already created earlier in this burst, takes the slow path
+    uint16_t nb_tracked = 0;
+    for (uint16_t k = 0; k < nb_keys; k++) {
+        uint32_t idx = found[k];
+        if (unlikely(idx == FLOW_NONE || !flow_key_equal(entries[idx].key, keys[k]))) {
+            idx = find(keys[k], hashes[k]);
+            if (idx == FLOW_NONE)
+                idx = insert(keys[k], hashes[k], tsc);
+            if (unlikely(idx == FLOW_NONE))
+                continue;
+        }
+        FlowEntry &entry = entries[idx];
+        // Counts restart after an active timeout export: the next record starts at its first packet
+        if (unlikely(entry.pkts == 0))
+            entry.first_tsc = tsc;
+        entry.pkts++;
+        entry.bytes += lens[k];
+        entry.last_tsc = tsc;
+        nb_tracked++;
+    }
+
+    if (unlikely(nb_pending > 0))
+        flush_records();
+    if (unlikely(nb_tracked < nb))
+        lcore_stats_add(&stats->flow_untracked, nb - nb_tracked);
+    return nb_tracked;
+}
+
+// Lines are at most this long: addresses, ports and counts of one record
+#define FLOW_LINE_MAX (384)
+
+static void encode_record(LineEncoder &enc, const FlowRecord &record){
+    char src[INET6_ADDRSTRLEN];
+    char dst[INET6_ADDRSTRLEN];
+    int af = (record.key.ip_version == 4) ? AF_INET : AF_INET6;
+    inet_ntop(af, record.key.src, src, sizeof(src));
+    inet_ntop(af, record.key.dst, dst, sizeof(dst));
+    enc.begin(FLOW_TABLE_NAME).tag("ctx", record.ctx_id).tag("reason", to_string(record.reason))
+        .tag("proto", record.key.proto).tag("src", src).tag("dst", dst)
+        .field_int("src_port", rte_be_to_cpu_16(record.key.src_port))
+        .field_int("dst_port", rte_be_to_cpu_16(record.key.dst_port))
+        .field_int("pkts", record.pkts)
+        .field_int("bytes", record.bytes)
+        .field_int("duration_us", (record.last_tsc - record.first_tsc) * US_PER_S / rte_get_tsc_hz());
+    enc.end();
+}
+
+unsigned int FlowRecordConsumer::drain(LineEncoder *enc){
+    FlowRecord records[FLOW_EXPORT_BATCH];
+    unsigned int total = 0;
+    for (;;) {
+        unsigned int max = FLOW_EXPORT_BATCH;
+        if (enc != nullptr)
+            max = RTE_MIN(max, (unsigned int)(enc->room() / FLOW_LINE_MAX));
+        if (max == 0)
+            break;
+        unsigned int nb = rte_ring_dequeue_burst_elem(ring, records, sizeof(FlowRecord), max, NULL);
+        for (unsigned int i = 0; i < nb; i++) {
+            totals[(int)records[i].reason]++;
+            if (enc != nullptr)
+                encode_record(*enc, records[i]);
+        }
+        total += nb;
+        if (nb < max)
+            break;
+    }
+    return total;
+}
+
+void FlowRecordConsumer::report(){
+    uint64_t nb = 0;
+    for (int r = 0; r < FLOW_END_REASONS; r++)
+        nb += totals[r] - last_totals[r];
+    if (nb == 0)
+        return;
+    printf("Flow records +%" PRIu64 ":", nb);
+    for (int r = 0; r < FLOW_END_REASONS; r++) {
+        printf(" %s +%" PRIu64, to_string((FlowEnd)r), totals[r] - last_totals[r]);
+        last_totals[r] = totals[r];
+    }
+    printf("\n");
+}
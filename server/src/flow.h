@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstdint>
+#include <rte_common.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_ring_elem.h>
+
+#include "lcore_stats.h"
+#include "timer_wheel.h"
+
+#define FLOW_BUCKET_ENTRIES (8)     // slots per bucket, their signatures share one cache line
+#define FLOW_NONE (UINT32_MAX)      // free bucket slot
+#define DEFAULT_FLOW_CAPACITY (0)   // flows tracked per rx lcore, 0 disables flow tracking
+#define MAX_FLOW_CAPACITY (1u << 24)
+#define DEFAULT_FLOW_IDLE_TIMEOUT_MS (15000)     // a flow without packets for this long is exported and dropped
+#define DEFAULT_FLOW_ACTIVE_TIMEOUT_MS (120000)  // a long lived flow is exported this often, its counts restart
+#define FLOW_AGE_BUDGET (32)        // flows one age() call looks at, at most
+#define FLOW_EVICT_SCAN (4)         // buckets past the key's two searched for a flow to evict
+#define FLOW_EXPORT_BATCH (32)      // FlowRecords enqueued in one go
+#define DEFAULT_FLOW_RING_SIZE (16384)
+#define FLOW_TABLE_NAME ("Flow_stats")
+
+struct FlowConfig {
+    uint32_t capacity = DEFAULT_FLOW_CAPACITY;
+    uint32_t idle_timeout_ms = DEFAULT_FLOW_IDLE_TIMEOUT_MS;
+    uint32_t active_timeout_ms = DEFAULT_FLOW_ACTIVE_TIMEOUT_MS;
+};
+
+// Why a FlowRecord was exported
+enum class FlowEnd : uint8_t {
+    IDLE,       // no packet for idle_timeout_ms, the flow is gone from the table
+    ACTIVE,     // still sending after active_timeout_ms, the flow stays with its counts restarted
+    EVICTED,    // the table was full and this was the least recently seen flow around the new one
+    STOP,       // still in the table when the lcore stopped
+};
+#define FLOW_END_REASONS (4)
+
+const char *to_string(FlowEnd reason);
+
+// IPv4/IPv6 5-tuple as it is on the wire. IPv4 addresses take the first 4 bytes of src/dst,
+// every byte not set by the packet is 0 so keys compare and hash as 5 plain words
+struct alignas(8) FlowKey {
+    union {
+        struct {
+            uint8_t src[16];
+            uint8_t dst[16];
+            uint16_t src_port;      // 0 for protocols without ports
+            uint16_t dst_port;
+            uint8_t proto;
+            uint8_t ip_version;     // 4 or 6
+            uint16_t reserved;
+        };
+        uint64_t words[5];
+    };
+};
+
+static_assert(sizeof(FlowKey) == 40, "FlowKey is hashed and compared as 5 words");
+
+static inline bool flow_key_equal(const FlowKey &a, const FlowKey &b) {
+    return ((a.words[0] ^ b.words[0]) | (a.words[1] ^ b.words[1]) | (a.words[2] ^ b.words[2]) |
+            (a.words[3] ^ b.words[3]) | (a.words[4] ^ b.words[4])) == 0;
+}
+
+// First cache line is everything a packet of a known flow touches
+struct alignas(RTE_CACHE_LINE_SIZE) FlowEntry {
+    FlowKey key;
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t last_tsc;
+    // Only written when the flow is created or its counts restart
+    alignas(RTE_CACHE_LINE_SIZE) uint64_t first_tsc;
+    uint32_t hash;
+};
+
+// What the rx lcores hand the stats consumer for each flow that ends or reaches its active timeout
+struct FlowRecord {
+    FlowKey key;
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t first_tsc;
+    uint64_t last_tsc;
+    int32_t ctx_id;
+    FlowEnd reason;
+};
+
+static_assert(sizeof(FlowRecord) % 4 == 0, "ring elements are a multiple of 4 bytes");
+
+// Records of every rx lcore towards one consumer: multi producer, single consumer
+static inline struct rte_ring *create_flow_ring(const char *name, unsigned int size, int socket_id){
+    return rte_ring_create_elem(name, sizeof(FlowRecord), size, socket_id, RING_F_SC_DEQ);
+}
+
+struct BurstMeta;
+
+// Key of packet i of a parsed burst, which must be IPv4 or IPv6: what the flow table hashes
+void flow_key(const struct rte_mbuf *mbuf, const BurstMeta &meta, uint16_t i, FlowKey *key);
+
+struct alignas(RTE_CACHE_LINE_SIZE) FlowBucket {
+    uint16_t sig[FLOW_BUCKET_ENTRIES];  // upper hash bits with the low bit set, 0 in a free slot
+    uint32_t idx[FLOW_BUCKET_ENTRIES];  // entry index, FLOW_NONE in a free slot
+};
+
+// Flow table of one rx lcore: no locks, no atomics, only its lcore ever touches it.
+// Open addressing over cache line buckets, each key has two candidate buckets and goes into the
+// second only when the first is full, entries live in an arena allocated once: memory is bounded by the capacity.
+// Each flow has a timer on a TimerWheel for the earlier of its idle and active timeouts. Packets
+// never touch it: when it fires the flow's times are looked at and it is armed again if the flow
+// was seen since. Ended flows go to the export ring as FlowRecords
+class FlowTable {
+    private:
+        FlowEntry *entries = nullptr;
+        uint32_t *free_idx = nullptr;   // stack of unused entries
+        uint32_t nb_free = 0;
+        uint32_t capacity;
+        FlowBucket *buckets = nullptr;
+        uint32_t bucket_mask;
+        LcoreStats *stats;
+
+        // Timeouts in TSC cycles, wheel ticks are 2^tick_shift cycles: the power of 2 under 1 ms
+        uint64_t idle_cycles;
+        uint64_t active_cycles;
+        uint32_t tick_shift;
+        TimerWheel wheel;
+
+        struct rte_ring *export_ring;
+        FlowRecord pending[FLOW_EXPORT_BATCH];
+        uint32_t nb_pending = 0;
+
+        inline uint32_t bucket_of(uint32_t hash) const { return hash & bucket_mask; }
+        inline uint32_t alt_bucket_of(uint32_t hash) const { return (hash ^ ((hash >> 16) * 0x5bd1e995)) & bucket_mask; }
+        static inline uint16_t sig_of(uint32_t hash) { return (hash >> 16) | 1; }
+        static inline uint32_t sig_match(const FlowBucket &bucket, uint16_t sig);
+
+        // Fires on the first tick after tsc
+        inline void arm(uint32_t idx, uint64_t tsc) { wheel.arm(idx, (tsc >> tick_shift) + 1); }
+
+        uint32_t find(const FlowKey &key, uint32_t hash) const;
+        uint32_t insert(const FlowKey &key, uint32_t hash, uint64_t tsc);
+        bool evict(uint32_t hash);
+        void remove(uint32_t idx);
+        void export_flow(const FlowEntry &entry, FlowEnd reason);
+        void flush_records();
+        uint32_t expire(const uint32_t *fired, uint32_t nb, uint64_t tsc);
+
+    public:
+        // cfg.capacity entries on socket_id, exits when they cannot be allocated. Records of ended
+        // flows go to export_ring, or are only counted without one
+        FlowTable(const FlowConfig &cfg, int socket_id, LcoreStats *stats, struct rte_ring *export_ring = nullptr);
+        ~FlowTable();
+        FlowTable(const FlowTable &) = delete;
+        FlowTable &operator=(const FlowTable &) = delete;
+
+        // Accounts the IPv4/IPv6 packets of a burst burst_parse() filled meta for to their flows,
+        // creating the new ones. The burst goes through in stages, key, hash, bucket search, update,
+        // each prefetching what the next one reads so the cache misses of the whole burst overlap.
+        // IPv6 extension headers are not walked: such packets are keyed with ports 0 and the first
+        // next header. Returns how many packets were accounted to a flow
+        uint16_t update_burst(struct rte_mbuf *const *mbufs, const BurstMeta &meta, uint64_t tsc);
+
+        // Runs the timeouts up to tsc, once per poll loop iteration. Looks at FLOW_AGE_BUDGET flows at
+        // most whatever came due, the rest waits for the next iterations. Returns how many it looked at
+        inline uint32_t age(uint64_t tsc) {
+            uint32_t fired[FLOW_AGE_BUDGET];
+            uint32_t nb = wheel.advance(tsc >> tick_shift, fired, FLOW_AGE_BUDGET);
+            if (likely(nb == 0))
+                return 0;
+            return expire(fired, nb, tsc);
+        }
+
+        // Exports every flow still in the table, when the lcore stops
+        void flush();
+
+        const FlowEntry *lookup(const FlowKey &key) const;
+        uint32_t size() const { return capacity - nb_free; }
+
+        // Calls fn(const FlowEntry &) for every flow, off the datapath
+        template <typename Fn>
+        void for_each(Fn fn) const {
+            for (uint32_t b = 0; b <= bucket_mask; b++) {
+                for (int s = 0; s < FLOW_BUCKET_ENTRIES; s++) {
+                    if (buckets[b].idx[s] != FLOW_NONE)
+                        fn((const FlowEntry &)entries[buckets[b].idx[s]]);
+                }
+            }
+        }
+};
+
+class LineEncoder;
+
+// The single consumer of the flow ring, off the datapath: counts records by reason and encodes one
+// FLOW_TABLE_NAME line per record
+class FlowRecordConsumer {
+    private:
+        struct rte_ring *ring;
+        uint64_t totals[FLOW_END_REASONS] = {};
+        uint64_t last_totals[FLOW_END_REASONS] = {};
+
+    public:
+        explicit FlowRecordConsumer(struct rte_ring *ring) : ring(ring) {}
+
+        // Dequeues what is in the ring, only as much as enc still has room for when it is set.
+        // Returns how many records were taken
+        unsigned int drain(LineEncoder *enc = nullptr);
+        // Prints the records seen since the last call, if any
+        void report();
+};
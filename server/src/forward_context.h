@@ -1,13 +1,64 @@
 #pragma once
 
 #define MAX_Q_PER_FORWARDER (3)
+#define RING_SIZE (8192) // default rx->tx handoff ring size
+#define DEFAULT_TX_RETRY_US (10)
+#define DEFAULT_TX_FLUSH_US (100)
+#define RING_RETRY_MAX (16) // enqueue attempts of the ring retry policy before dropping the tail
+#define DEFAULT_BURST_SIZE (32)
+#define MAX_BURST_SIZE (256) // sizes the lcores' burst arrays, burst_size can be anything up to it
 
 #include <rte_atomic.h>
+#include <rte_ring.h>
+#include <rte_errno.h>
 
 // Custom headers
 #include "onic_helper.h"
 #include "onic_port.h"
 #include "onic.h"
+#include "idle.h"
+#include "prefetch.h"
+#include "flow.h"
+#include "capture.h"
+
+enum class ForwardMode {
+    PIPELINED,          // rx lcore -> mbuf ring -> tx lcore
+    RUN_TO_COMPLETION,  // rx -> inspect -> tx on a single lcore
+};
+
+static inline const char *to_string(ForwardMode mode) {
+    return (mode == ForwardMode::PIPELINED) ? "pipelined" : "run-to-completion";
+}
+
+// What a worker does with the mbufs rte_eth_tx_burst did not take
+enum class TxPolicy {
+    DROP,   // free them at once, lowest latency
+    RETRY,  // resend for up to tx_retry_us, then free the rest
+    BUFFER, // keep them in an rte_eth_dev_tx_buffer, flushed when full or every tx_flush_us
+};
+
+static inline const char *to_string(TxPolicy policy) {
+    switch (policy) {
+        case TxPolicy::RETRY: return "retry";
+        case TxPolicy::BUFFER: return "buffer";
+        default: return "drop";
+    }
+}
+
+// What the rx lcore does with the part of a burst that did not fit in the handoff ring
+enum class RingPolicy {
+    DROP,   // free only the tail that did not fit
+    RETRY,  // re-enqueue the tail up to RING_RETRY_MAX times, then free it
+    HOLD,   // keep the tail and stop polling until the tx lcore made room: the NIC Qs absorb the burst
+};
+
+static inline const char *to_string(RingPolicy policy) {
+    switch (policy) {
+        case RingPolicy::RETRY: return "retry";
+        case RingPolicy::HOLD: return "hold";
+        default: return "drop";
+    }
+}
 
 struct ForwardingContext {
     int ctx_id;
@@ -16,23 +67,95 @@ struct ForwardingContext {
 	int rx_port;
 	int tx_port;
 
+    // Qs polled by this context: one lcore can poll several Qs, or a port's Qs can be split over
+    // several contexts for one lcore per Q. tx Qs must never be shared between contexts
     std::array<int, MAX_Q_PER_FORWARDER> rx_Qs = {-1};
     std::array<int, MAX_Q_PER_FORWARDER> tx_Qs = {-1};
     int nb_rx_Qs;
     int nb_tx_Qs;
 
-    struct rte_ring *stats_ring;
-    struct rte_eth_stats stats;
+    struct rte_ring *stats_ring = nullptr; // LatencyRecord elements, see create_latency_ring()
+    struct rte_ring *flow_ring = nullptr;  // FlowRecord elements, see create_flow_ring()
+    struct rte_ring *capture_ring = nullptr; // CaptureRecord elements, see create_capture_ring(). Null: no capture
 
     rte_atomic32_t stop_flag;
 
+    ForwardMode mode = ForwardMode::PIPELINED;
+    unsigned int ring_size = RING_SIZE;
+    RingPolicy ring_policy = RingPolicy::DROP;
+    // Pinned lcores: [rx, tx] when pipelined, [worker] when run-to-completion, -1 picks the next free lcore
+    std::array<int, 2> lcores = {-1, -1};
+
+    // Parse timestamp packets on the rx lcore into the mbuf's LatencyField
+    bool parse_latency = false;
+
+    TxPolicy tx_policy = TxPolicy::DROP;
+    unsigned int tx_retry_us = DEFAULT_TX_RETRY_US;
+    unsigned int tx_flush_us = DEFAULT_TX_FLUSH_US;
+
+    // What the lcores do when their polls come back empty
+    IdleConfig idle;
+
+    // Packets asked for per rx burst and ring dequeue, and how far ahead of the inspection loops the
+    // packet data is prefetched (0 disables it)
+    uint16_t burst_size = DEFAULT_BURST_SIZE;
+    uint16_t prefetch_ahead = DEFAULT_PREFETCH_AHEAD;
+
+    // Flows tracked by the rx lcore's flow table (capacity 0 disables flow tracking) and their timeouts
+    FlowConfig flows;
+
+    // Time each inspection stage of the rx lcores (parse, capture, flows, latency) into their LcoreStats
+    bool stage_cycles = false;
+
+    // Packets the rx lcore hands to the capture writer, as pcapng interface capture_if
+    CaptureFilter capture;
+    uint32_t capture_if = 0;
+
+    // DPDK port ids, filled by resolve_ports() when onics are given
+    uint16_t rx_port_id = 0;
+    uint16_t tx_port_id = 0;
+    // rx->tx handoff ring owned by this context only, so it can stay single producer/single consumer
+    struct rte_ring *mbuf_ring = nullptr;
+
+    void resolve_ports() {
+        if (rx_onic != nullptr)
+            rx_port_id = rx_onic->get_ports()[rx_port].get_port_id();
+        if (tx_onic != nullptr)
+            tx_port_id = tx_onic->get_ports()[tx_port].get_port_id();
+    }
+
+    // Ring lives on the rx port's NUMA node as the rx lcore does most of the touching
+    int create_ring() {
+        char ring_name[RTE_RING_NAMESIZE];
+        snprintf(ring_name, sizeof(ring_name), "ctx_ring_%d", ctx_id);
+
+        mbuf_ring = rte_ring_create(ring_name, ring_size,
+                                    rte_eth_dev_socket_id(rx_port_id),
+                                    RING_F_SP_ENQ | RING_F_SC_DEQ | RING_F_EXACT_SZ);
+        return (mbuf_ring == nullptr) ? -rte_errno : 0;
+    }
+
+    void free_ring() {
+        rte_ring_free(mbuf_ring);
+        mbuf_ring = nullptr;
+    }
+
     void print_schema() {
-        std::cout   << "CTX(" << ctx_id << "): " 
-                    << std::endl
-                    << "\t Forwarding " << to_string(rx_onic->get_ports()[rx_port].get_bdf())
-                    << " --------> " << to_string(tx_onic->get_ports()[tx_port].get_bdf())
-                    << std::endl
-                    << "\t rx_port " << rx_port << "\t --------> " << "tx_port " << tx_port 
+        std::cout   << "CTX(" << ctx_id << "): " << to_string(mode)
+                    << ", ring policy " << to_string(ring_policy)
+                    << ", tx policy " << to_string(tx_policy)
+                    << ", idle policy " << to_string(idle.policy)
+                    << ", burst " << burst_size << ", prefetch " << prefetch_ahead
+                    << ", flows " << flows.capacity
+                    << (stage_cycles ? ", stage cycles" : "")
+                    << std::endl;
+        if (capture_ring != nullptr)
+            std::cout   << "\t Capturing " << capture.to_string() << std::endl;
+        if (rx_onic != nullptr && tx_onic != nullptr)
+            std::cout   << "\t Forwarding " << to_string(rx_onic->get_ports()[rx_port].get_bdf())
+                        << " --------> " << to_string(tx_onic->get_ports()[tx_port].get_bdf())
+                        << std::endl;
+        std::cout   << "\t rx_port " << rx_port_id << "\t --------> " << "tx_port " << tx_port_id
                     << std::endl;
     }
-};
\ No newline at end of file
+};
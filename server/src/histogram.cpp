@@ -0,0 +1,49 @@
+#include "histogram.h"
+
+#include <cstring>
+
+void LatencyHistogram::reset(){
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other){
+    uint64_t merged = 0;
+    for (unsigned int i = 0; i < HIST_NB_BUCKETS; i++) {
+        uint64_t n = __atomic_load_n(&other.counts[i], __ATOMIC_RELAXED);
+        counts[i] += n;
+        merged += n;
+    }
+    // Summed from the buckets read, so count() always matches them even while other is written
+    total += merged;
+}
+
+void LatencyHistogram::subtract(const LatencyHistogram &older){
+    for (unsigned int i = 0; i < HIST_NB_BUCKETS; i++)
+        counts[i] -= older.counts[i];
+    total -= older.total;
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * total);
+    if (rank >= total)
+        rank = total - 1;
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_NB_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > rank)
+            return bucket_upper(i);
+    }
+    return max();
+}
+
+uint64_t LatencyHistogram::max() const {
+    for (int i = HIST_NB_BUCKETS - 1; i >= 0; i--) {
+        if (counts[i] != 0)
+            return bucket_upper(i);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <rte_common.h>
+#include <rte_branch_prediction.h>
+
+// Log-bucketed (HDR style) histogram: exact below HIST_SUB_BUCKETS, then HIST_SUB_BUCKETS buckets per
+// power of two, i.e. ~3% relative precision. Values from 2^HIST_MAX_EXPONENT up land in the last bucket
+#define HIST_SUB_BUCKET_BITS (5)
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BUCKET_BITS)
+#define HIST_MAX_EXPONENT (40) // 2^40 ns ~ 18 minutes
+#define HIST_NB_BUCKETS ((HIST_MAX_EXPONENT - HIST_SUB_BUCKET_BITS + 1) * HIST_SUB_BUCKETS)
+
+class LatencyHistogram {
+    private:
+        uint64_t counts[HIST_NB_BUCKETS];
+        uint64_t total;
+
+        static inline void bump(uint64_t *counter, uint64_t n) {
+            __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+        }
+
+    public:
+        LatencyHistogram() { reset(); }
+
+        static inline unsigned int bucket(uint64_t value) {
+            if (value < HIST_SUB_BUCKETS)
+                return value;
+            unsigned int exponent = 63 - __builtin_clzll(value);
+            if (unlikely(exponent >= HIST_MAX_EXPONENT))
+                return HIST_NB_BUCKETS - 1;
+            unsigned int shift = exponent - HIST_SUB_BUCKET_BITS;
+            return (shift + 1) * HIST_SUB_BUCKETS + ((value >> shift) & (HIST_SUB_BUCKETS - 1));
+        }
+
+        // Highest value that falls into the bucket, what percentiles report
+        static inline uint64_t bucket_upper(unsigned int idx) {
+            if (idx < 2 * HIST_SUB_BUCKETS)
+                return idx;
+            unsigned int shift = idx / HIST_SUB_BUCKETS - 1;
+            uint64_t lower = (uint64_t)(HIST_SUB_BUCKETS + idx % HIST_SUB_BUCKETS) << shift;
+            return lower + (1ULL << shift) - 1;
+        }
+
+        // Single writer: the owning lcore only. Readers use merge()/subtract() at any time
+        inline void record(uint64_t value) {
+            bump(&counts[bucket(value)], 1);
+            bump(&total, 1);
+        }
+
+        void reset();
+        // Adds other into this one, other may be written concurrently by its lcore
+        void merge(const LatencyHistogram &other);
+        // Removes an older snapshot of the same histogram: what was recorded in between
+        void subtract(const LatencyHistogram &older);
+
+        uint64_t count() const { return total; }
+        // Value at quantile q in [0, 1], 0 when empty
+        uint64_t percentile(double q) const;
+        uint64_t max() const;
+};
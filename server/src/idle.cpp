@@ -0,0 +1,158 @@
+#include "idle.h"
+
+#include <cerrno>
+#include <rte_cycles.h>
+#include <rte_cpuflags.h>
+#include <rte_ethdev.h>
+#include <rte_interrupts.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+
+const char *to_string(IdlePolicy policy) {
+    switch (policy) {
+        case IdlePolicy::SPIN: return "spin";
+        case IdlePolicy::MONITOR: return "monitor";
+        case IdlePolicy::SLEEP: return "sleep";
+        case IdlePolicy::INTERRUPT: return "interrupt";
+        default: return "pause";
+    }
+}
+
+// Monitor condition for the ring: opaque[0] is the producer tail seen before sleeping, any other
+// value means mbufs were enqueued meanwhile and the wait is called off
+static int ring_tail_moved(const uint64_t val, const uint64_t opaque[RTE_POWER_MONITOR_OPAQUE_SZ]) {
+    return (val == opaque[0]) ? 0 : -1;
+}
+
+IdleGovernor::IdleGovernor(const IdleConfig &cfg, LcoreStats *stats)
+    : cfg(cfg), stats(stats), wait_policy(cfg.policy),
+      max_sleep_cycles(rte_get_tsc_hz() / US_PER_S * RTE_MAX(cfg.max_sleep_us, 1u))
+{
+}
+
+IdleGovernor::~IdleGovernor() {
+    del_interrupts();
+}
+
+void IdleGovernor::del_interrupts() {
+    for (int i = 0; intr_added && i < nb_Qs; i++)
+        rte_eth_dev_rx_intr_ctl_q(port_id, Qs[i], RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_DEL, NULL);
+    intr_added = false;
+}
+
+static bool can_monitor(int nb_addrs) {
+    struct rte_cpu_intrinsics caps;
+    rte_cpu_get_intrinsics_support(&caps);
+    return (nb_addrs == 1) ? caps.power_monitor : caps.power_monitor_multi;
+}
+
+// Falls back one step at a time and says so: the deployment should know it is not getting what it asked for
+void IdleGovernor::watch_rx(uint16_t port_id, const int *Qs, int nb_Qs) {
+    if (wait_policy != IdlePolicy::MONITOR && wait_policy != IdlePolicy::INTERRUPT)
+        return;
+    if (nb_Qs > IDLE_MAX_WATCH) {
+        RTE_LOG(INFO, USER1, "lcore %u: idle waits watch at most %d Qs, using sleep\n", rte_lcore_id(), IDLE_MAX_WATCH);
+        wait_policy = IdlePolicy::SLEEP;
+        return;
+    }
+    this->port_id = port_id;
+    this->nb_Qs = nb_Qs;
+    for (int i = 0; i < nb_Qs; i++)
+        this->Qs[i] = Qs[i];
+
+    if (wait_policy == IdlePolicy::INTERRUPT && cfg.max_sleep_us < IDLE_INTR_GRANULARITY_US) {
+        RTE_LOG(INFO, USER1, "lcore %u: interrupt waits are in whole ms, max_sleep_us %u is less, using monitor\n",
+                rte_lcore_id(), cfg.max_sleep_us);
+        wait_policy = IdlePolicy::MONITOR;
+    }
+    if (wait_policy == IdlePolicy::INTERRUPT) {
+        for (int i = 0; i < nb_Qs; i++) {
+            int ret = rte_eth_dev_rx_intr_ctl_q(port_id, Qs[i], RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, NULL);
+            if (ret < 0) {
+                RTE_LOG(INFO, USER1, "lcore %u: no rx interrupt on port %u Q %d (%d), using monitor\n",
+                        rte_lcore_id(), port_id, Qs[i], ret);
+                for (int j = 0; j < i; j++)
+                    rte_eth_dev_rx_intr_ctl_q(port_id, Qs[j], RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_DEL, NULL);
+                wait_policy = IdlePolicy::MONITOR;
+                break;
+            }
+        }
+        intr_added = (wait_policy == IdlePolicy::INTERRUPT);
+    }
+
+    if (wait_policy == IdlePolicy::MONITOR) {
+        bool ok = can_monitor(nb_Qs);
+        for (int i = 0; ok && i < nb_Qs; i++)
+            ok = (rte_eth_get_monitor_addr(port_id, Qs[i], &pmc[i]) == 0);
+        if (!ok) {
+            RTE_LOG(INFO, USER1, "lcore %u: no power monitor for port %u on this PMD/CPU, using sleep\n",
+                    rte_lcore_id(), port_id);
+            wait_policy = IdlePolicy::SLEEP;
+        }
+    }
+}
+
+void IdleGovernor::watch_ring(struct rte_ring *ring) {
+    // Rings have no interrupt: the enqueue is the only event there is to watch
+    if (wait_policy == IdlePolicy::INTERRUPT)
+        wait_policy = IdlePolicy::MONITOR;
+    if (wait_policy != IdlePolicy::MONITOR)
+        return;
+    if (!can_monitor(1)) {
+        RTE_LOG(INFO, USER1, "lcore %u: no power monitor on this CPU, using sleep\n", rte_lcore_id());
+        wait_policy = IdlePolicy::SLEEP;
+        return;
+    }
+    this->ring = ring;
+    pmc[0] = {};
+    pmc[0].addr = &ring->prod.tail;
+    pmc[0].fn = ring_tail_moved;
+    pmc[0].size = sizeof(ring->prod.tail);
+}
+
+// The rx descriptor to watch moves with every burst, the PMD is asked again before each wait
+void IdleGovernor::monitor_wait() {
+    int nb_pmc = 1;
+    if (ring != nullptr) {
+        pmc[0].opaque[0] = __atomic_load_n(&ring->prod.tail, __ATOMIC_ACQUIRE);
+    } else {
+        for (int i = 0; i < nb_Qs; i++)
+            rte_eth_get_monitor_addr(port_id, Qs[i], &pmc[i]);
+        nb_pmc = nb_Qs;
+    }
+    uint64_t deadline = rte_rdtsc() + max_sleep_cycles;
+    int ret = (nb_pmc == 1) ? rte_power_monitor(&pmc[0], deadline) : rte_power_monitor_multi(pmc, nb_pmc, deadline);
+    if (unlikely(ret == -ENOTSUP)) {
+        RTE_LOG(INFO, USER1, "lcore %u: power monitor refused, using sleep\n", rte_lcore_id());
+        wait_policy = IdlePolicy::SLEEP;
+    }
+}
+
+// The Qs' interrupts are only armed while waiting, polling never pays for them.
+// watch_rx() only keeps INTERRUPT for a max_sleep_us of 1 ms or more: the timeout never exceeds it
+void IdleGovernor::interrupt_wait() {
+    struct rte_epoll_event events[IDLE_MAX_WATCH];
+    int timeout_ms = cfg.max_sleep_us / IDLE_INTR_GRANULARITY_US;
+
+    for (int i = 0; i < nb_Qs; i++)
+        rte_eth_dev_rx_intr_enable(port_id, Qs[i]);
+    rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, nb_Qs, timeout_ms);
+    for (int i = 0; i < nb_Qs; i++)
+        rte_eth_dev_rx_intr_disable(port_id, Qs[i]);
+}
+
+void IdleGovernor::sleep_wait() {
+    rte_delay_us_sleep(cfg.max_sleep_us);
+}
+
+void IdleGovernor::wait() {
+    uint64_t start = rte_rdtsc();
+    if (wait_policy == IdlePolicy::MONITOR && (ring != nullptr || nb_Qs > 0))
+        monitor_wait();
+    else if (wait_policy == IdlePolicy::INTERRUPT && intr_added)
+        interrupt_wait();
+    else
+        sleep_wait();
+    lcore_stats_add(&stats->idle_waits, 1);
+    lcore_stats_add(&stats->wait_cycles, rte_rdtsc() - start);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <rte_ring.h>
+#include <rte_pause.h>
+#include <rte_power_intrinsics.h>
+#include <rte_branch_prediction.h>
+
+#include "lcore_stats.h"
+
+#define IDLE_MAX_WATCH (4)                  // rx Qs (or one ring) a governor waits on
+#define DEFAULT_IDLE_PAUSE_AFTER (0)        // empty polls before rte_pause(), 0 pauses on the first one
+#define DEFAULT_IDLE_SLEEP_AFTER (1024)     // empty polls before the policy's wait
+#define DEFAULT_IDLE_MAX_SLEEP_US (50)      // longest single wait: bounds stop, flush and wake-up latency
+#define IDLE_INTR_GRANULARITY_US (1000)     // epoll times out in whole ms
+
+// What a forwarding lcore does once its polls keep coming back empty. Every policy spins while
+// there is traffic and steps down only after a run of empty polls, the first packet steps back up
+enum class IdlePolicy {
+    SPIN,       // never yields: lowest latency, always 100% of a core
+    PAUSE,      // rte_pause() between empty polls (default, what the loops always did)
+    MONITOR,    // then rte_power_monitor() (umwait) on the rx descriptor or ring tail, sleep without support
+    SLEEP,      // then a timed sleep of up to max_sleep_us
+    INTERRUPT,  // then epoll on the rx Qs' interrupts, monitor for rings, without rx interrupts or under 1 ms waits
+};
+
+const char *to_string(IdlePolicy policy);
+
+struct IdleConfig {
+    IdlePolicy policy = IdlePolicy::PAUSE;
+    unsigned int pause_after = DEFAULT_IDLE_PAUSE_AFTER;
+    unsigned int sleep_after = DEFAULT_IDLE_SLEEP_AFTER;
+    // Never exceeded by a wait. INTERRUPT waits in whole ms (IDLE_INTR_GRANULARITY_US), rounded down:
+    // below 1 ms it steps down to MONITOR, which keeps to the us
+    unsigned int max_sleep_us = DEFAULT_IDLE_MAX_SLEEP_US;
+};
+
+// Per lcore idle state machine, called once per poll loop iteration with what the iteration moved.
+// The wait it escalates to watches whatever the loop polls: rx Qs or the handoff ring
+class IdleGovernor {
+    private:
+        IdleConfig cfg;
+        LcoreStats *stats;
+        IdlePolicy wait_policy;             // cfg.policy once what the lcore watches is known
+        uint32_t nb_empty = 0;
+        uint64_t max_sleep_cycles;
+
+        // Watched rx Qs, or ring
+        uint16_t port_id = 0;
+        uint16_t Qs[IDLE_MAX_WATCH];
+        int nb_Qs = 0;
+        bool intr_added = false;
+        struct rte_ring *ring = nullptr;
+        struct rte_power_monitor_cond pmc[IDLE_MAX_WATCH];
+
+        void del_interrupts();
+
+        void monitor_wait();
+        void interrupt_wait();
+        void sleep_wait();
+        void wait();
+
+    public:
+        IdleGovernor(const IdleConfig &cfg, LcoreStats *stats);
+        ~IdleGovernor();
+
+        // What the wait watches, call one of them before the loop. MONITOR and INTERRUPT step down to
+        // what the PMD and CPU support, logged once
+        void watch_rx(uint16_t port_id, const int *Qs, int nb_Qs);
+        void watch_ring(struct rte_ring *ring);
+
+        IdlePolicy effective_policy() const { return wait_policy; }
+
+        inline void idle(unsigned int nb_moved) {
+            if (likely(nb_moved > 0)) {
+                nb_empty = 0;
+                return;
+            }
+            if (cfg.policy == IdlePolicy::SPIN)
+                return;
+            if (nb_empty <= cfg.sleep_after) // saturates: a long idle spell keeps waiting
+                nb_empty++;
+            if (nb_empty <= cfg.pause_after)
+                return;
+            if (nb_empty <= cfg.sleep_after || wait_policy == IdlePolicy::PAUSE) {
+                rte_pause();
+                return;
+            }
+            wait();
+        }
+};
@@ -0,0 +1,67 @@
+#include "kafka_service.h"
+
+#include <librdkafka/rdkafka.h>
+#include <unistd.h>
+#include <rte_debug.h>
+
+static void kafka_conf_set(rd_kafka_conf_t *conf, const char *name, const std::string &value){
+    char errstr[512];
+    if (rd_kafka_conf_set(conf, name, value.c_str(), errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+        rte_exit(EXIT_FAILURE, "Kafka config error (%s=%s): %s\n", name, value.c_str(), errstr);
+}
+
+RdKafkaTransport::RdKafkaTransport(const KafkaConfig &cfg){
+    char hostname[128];
+    char errstr[512];
+    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+
+    if (gethostname(hostname, sizeof(hostname)) == 0)
+        kafka_conf_set(conf, "client.id", hostname);
+    kafka_conf_set(conf, "bootstrap.servers", cfg.brokers);
+    kafka_conf_set(conf, "acks", cfg.acks);
+    kafka_conf_set(conf, "compression.codec", cfg.compression);
+    kafka_conf_set(conf, "linger.ms", std::to_string(cfg.linger_ms));
+    kafka_conf_set(conf, "batch.size", std::to_string(cfg.batch_size));
+
+    rd_kafka_conf_set_dr_msg_cb(conf, dr_msg_cb);
+    rd_kafka_conf_set_opaque(conf, this);
+
+    rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr)); // takes conf
+    if (rk == NULL)
+        rte_exit(EXIT_FAILURE, "Failed to create Kafka producer: %s\n", errstr);
+}
+
+RdKafkaTransport::~RdKafkaTransport(){
+    for (rd_kafka_topic_t *rkt : topics)
+        rd_kafka_topic_destroy(rkt);
+    rd_kafka_destroy(rk);
+}
+
+int RdKafkaTransport::add_topic(const char *name){
+    rd_kafka_topic_t *rkt = rd_kafka_topic_new(rk, name, NULL);
+    if (rkt == NULL)
+        rte_exit(EXIT_FAILURE, "Failed to create topic %s: %s\n", name, rd_kafka_err2str(rd_kafka_last_error()));
+    topics.push_back(rkt);
+    return topics.size() - 1;
+}
+
+bool RdKafkaTransport::produce(int topic, char *payload, size_t len){
+    // The topic id rides along as the message opaque, for the delivery report
+    return rd_kafka_produce(topics[topic], RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_FREE,
+                            payload, len, NULL, 0, (void *)(intptr_t)topic) == 0;
+}
+
+void RdKafkaTransport::dr_msg_cb(rd_kafka_t *, const rd_kafka_message_t *msg, void *opaque){
+    auto *transport = static_cast<RdKafkaTransport *>(opaque);
+    if (transport->on_delivery)
+        transport->on_delivery(msg->err == RD_KAFKA_RESP_ERR_NO_ERROR, (int)(intptr_t)msg->_private,
+                               (const char *)msg->payload, msg->len);
+}
+
+void RdKafkaTransport::poll(int timeout_ms){
+    rd_kafka_poll(rk, timeout_ms);
+}
+
+void RdKafkaTransport::flush(int timeout_ms){
+    rd_kafka_flush(rk, timeout_ms);
+}
@@ -0,0 +1,286 @@
+#include "kafka_service.h"
+
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <rte_cycles.h>
+#include <rte_debug.h>
+#include <rte_errno.h>
+#include <rte_lcore.h>
+
+/******************************************************************************************************************
+                                                    Spool
+******************************************************************************************************************/
+// Record: u32 topic, u32 len, payload
+struct SpoolRecordHdr {
+    uint32_t topic;
+    uint32_t len;
+};
+
+KafkaSpool::KafkaSpool(const std::string &path, uint64_t max_bytes) : path(path), max_bytes(max_bytes) {
+    if (!enabled())
+        return;
+    // Leftovers of a previous run are kept and replayed first
+    file = fopen(path.c_str(), "a+b");
+    if (file == NULL) {
+        printf("Kafka spool: cannot open %s (%s), spooling disabled\n", path.c_str(), strerror(errno));
+        this->max_bytes = 0;
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    bytes = ftell(file);
+}
+
+KafkaSpool::~KafkaSpool(){
+    if (file != NULL)
+        fclose(file);
+}
+
+bool KafkaSpool::append(int topic, const char *payload, size_t len){
+    uint64_t record_len = sizeof(SpoolRecordHdr) + len;
+    if (!enabled() || bytes + record_len > max_bytes)
+        return false;
+
+    SpoolRecordHdr hdr = {(uint32_t)topic, (uint32_t)len};
+    if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 || fwrite(payload, 1, len, file) != len || fflush(file) != 0) {
+        // A partial record would hide every later one from replay(): cut back to the last whole one
+        truncate(bytes);
+        return false;
+    }
+    bytes += record_len;
+    return true;
+}
+
+void KafkaSpool::truncate(uint64_t len){
+    fflush(file);
+    clearerr(file);
+    if (ftruncate(fileno(file), len) != 0)
+        printf("Kafka spool: cannot truncate %s to %" PRIu64 " bytes (%s)\n", path.c_str(), len, strerror(errno));
+    fseek(file, 0, SEEK_END);
+    bytes = ftell(file);
+}
+
+uint64_t KafkaSpool::replay(const std::function<bool(int topic, char *payload, size_t len)> &produce){
+    if (empty())
+        return 0;
+
+    rewind(file);
+    uint64_t nb_taken = 0;
+    uint64_t offset = 0;
+    bool unreadable = false;
+    SpoolRecordHdr hdr;
+    while (offset < bytes) {
+        // A record cut short by a crash or a full disk, or a garbled length
+        if (bytes - offset < sizeof(hdr) || fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+            hdr.len > bytes - offset - sizeof(hdr)) {
+            unreadable = true;
+            break;
+        }
+        char *payload = (char *)malloc(hdr.len);
+        if (payload == NULL)
+            break;
+        if (fread(payload, 1, hdr.len, file) != hdr.len) {
+            free(payload);
+            unreadable = true;
+            break;
+        }
+        if (!produce(hdr.topic, payload, hdr.len)) {
+            free(payload);
+            break;
+        }
+        nb_taken++;
+        offset += sizeof(hdr) + hdr.len;
+    }
+
+    // Nothing past an unreadable record can be replayed: kept, it would never let the spool empty
+    uint64_t keep = bytes;
+    if (unreadable) {
+        printf("Kafka spool: unreadable record at byte %" PRIu64 " of %s, dropping the last %" PRIu64 " bytes\n",
+               offset, path.c_str(), bytes - offset);
+        dropped_bytes += bytes - offset;
+        keep = offset;
+    }
+
+    // Keep what was not taken: copied to a new file that replaces the spool
+    std::string tmp_path = path + ".tmp";
+    FILE *tmp = fopen(tmp_path.c_str(), "w+b");
+    if (tmp == NULL) {
+        truncate(keep);
+        return nb_taken; // taken ones will be replayed again: duplicates rather than losses
+    }
+    char chunk[4096];
+    fseek(file, offset, SEEK_SET);
+    size_t n;
+    uint64_t left = keep - offset;
+    while (left > 0 && (n = fread(chunk, 1, RTE_MIN(left, (uint64_t)sizeof(chunk)), file)) > 0) {
+        fwrite(chunk, 1, n, tmp);
+        left -= n;
+    }
+    // The old file stays the spool unless the new one is complete and in its place
+    if (fflush(tmp) != 0 || ferror(tmp) || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        printf("Kafka spool: cannot replace %s with %s (%s), keeping it\n", path.c_str(), tmp_path.c_str(),
+               strerror(errno));
+        fclose(tmp);
+        remove(tmp_path.c_str());
+        truncate(keep);
+        return nb_taken;
+    }
+    fclose(file);
+    file = tmp;
+    fseek(file, 0, SEEK_END);
+    bytes = ftell(file);
+    return nb_taken;
+}
+
+/******************************************************************************************************************
+                                                    Service
+******************************************************************************************************************/
+KafkaService::KafkaService(KafkaTransport *transport, const KafkaConfig &cfg)
+    : transport(transport), cfg(cfg), spool(cfg.spool_path, (uint64_t)cfg.spool_max_mb << 20)
+{
+    // Multi producer: any lcore sends. Single consumer: the service lcore
+    queue = rte_ring_create("kafka_queue", KAFKA_QUEUE_SIZE, rte_socket_id(), RING_F_SC_DEQ);
+    if (queue == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot create Kafka queue: %s\n", rte_strerror(rte_errno));
+
+    transport->set_delivery_cb([this](bool ok, int topic, const char *payload, size_t len) {
+        on_delivery(ok, topic, payload, len);
+    });
+}
+
+KafkaService::~KafkaService(){
+    Message *msg;
+    while (rte_ring_sc_dequeue(queue, (void **)&msg) == 0) {
+        free(msg->payload);
+        free(msg);
+    }
+    rte_ring_free(queue);
+}
+
+int KafkaService::add_topic(const char *name){
+    topic_names.push_back(name);
+    return transport->add_topic(name);
+}
+
+bool KafkaService::send(int topic, char *payload, size_t len){
+    Message *msg = (Message *)malloc(sizeof(Message));
+    if (msg != NULL) {
+        *msg = {topic, len, payload};
+        if (rte_ring_mp_enqueue(queue, msg) == 0) {
+            bump(&stats.queued);
+            return true;
+        }
+        free(msg);
+    }
+    free(payload);
+    bump(&stats.queue_full);
+    return false;
+}
+
+bool KafkaService::send(int topic, const std::string &payload){
+    char *copy = (char *)malloc(payload.size());
+    if (copy == NULL)
+        return false;
+    memcpy(copy, payload.data(), payload.size());
+    return send(topic, copy, payload.size());
+}
+
+void KafkaService::on_delivery(bool ok, int topic, const char *payload, size_t len){
+    if (ok) {
+        bump(&stats.delivered);
+        return;
+    }
+    bump(&stats.failed);
+    if (spool.append(topic, payload, len))
+        bump(&stats.spooled);
+    else
+        bump(&stats.spool_dropped);
+}
+
+void KafkaService::handle(Message *msg){
+    // Nothing overtakes the spool: while it holds messages, new ones queue behind them on disk
+    if (spool.empty() && transport->produce(msg->topic, msg->payload, msg->len)) {
+        bump(&stats.produced);
+    } else {
+        if (spool.append(msg->topic, msg->payload, msg->len))
+            bump(&stats.spooled);
+        else
+            bump(&stats.spool_dropped);
+        free(msg->payload);
+    }
+    free(msg);
+}
+
+unsigned int KafkaService::run_once(){
+    Message *msgs[KAFKA_BURST];
+    unsigned int nb = rte_ring_sc_dequeue_burst(queue, (void **)msgs, KAFKA_BURST, NULL);
+    for (unsigned int i = 0; i < nb; i++)
+        handle(msgs[i]);
+
+    uint64_t now = rte_get_tsc_cycles();
+    if (now >= next_poll) {
+        transport->poll(0);
+        next_poll = now + rte_get_tsc_hz() / 1000 * cfg.poll_ms;
+    }
+    if (!spool.empty() && now >= next_replay) {
+        uint64_t nb_replayed = spool.replay([this](int topic, char *payload, size_t len) {
+            return transport->produce(topic, payload, len);
+        });
+        bump(&stats.replayed, nb_replayed);
+        __atomic_store_n(&stats.spool_unreadable, spool.dropped(), __ATOMIC_RELAXED);
+        bump(&stats.produced, nb_replayed);
+        next_replay = now + rte_get_tsc_hz() / 1000 * cfg.spool_retry_ms;
+    }
+    return nb;
+}
+
+uint64_t KafkaService::us_until_due() const {
+    uint64_t due = next_poll;
+    if (!spool.empty())
+        due = RTE_MIN(due, next_replay);
+    uint64_t now = rte_get_tsc_cycles();
+    return (due > now) ? (due - now) / (rte_get_tsc_hz() / US_PER_S) : 0;
+}
+
+int KafkaService::run(void *arg){
+    auto *service = static_cast<KafkaService *>(arg);
+    printf("Kafka service started on lcore %u\n", rte_lcore_id());
+
+    while (!service->stop_flag) {
+        // Not a datapath lcore: sleep when idle rather than spin
+        if (service->run_once() == 0)
+            usleep(1000);
+    }
+    service->drain(5000);
+    printf("Kafka service stopped on lcore %u\n", rte_lcore_id());
+    return 0;
+}
+
+void KafkaService::drain(int timeout_ms){
+    while (run_once() > 0)
+        ;
+    transport->flush(timeout_ms);
+}
+
+KafkaServiceStats KafkaService::get_stats() const {
+    KafkaServiceStats out;
+    out.queued = __atomic_load_n(&stats.queued, __ATOMIC_RELAXED);
+    out.queue_full = __atomic_load_n(&stats.queue_full, __ATOMIC_RELAXED);
+    out.produced = __atomic_load_n(&stats.produced, __ATOMIC_RELAXED);
+    out.delivered = __atomic_load_n(&stats.delivered, __ATOMIC_RELAXED);
+    out.failed = __atomic_load_n(&stats.failed, __ATOMIC_RELAXED);
+    out.spooled = __atomic_load_n(&stats.spooled, __ATOMIC_RELAXED);
+    out.spool_dropped = __atomic_load_n(&stats.spool_dropped, __ATOMIC_RELAXED);
+    out.spool_unreadable = __atomic_load_n(&stats.spool_unreadable, __ATOMIC_RELAXED);
+    out.replayed = __atomic_load_n(&stats.replayed, __ATOMIC_RELAXED);
+    return out;
+}
+
+void KafkaService::print_stats() const {
+    KafkaServiceStats s = get_stats();
+    printf("Kafka: queued %" PRIu64 " (queue full %" PRIu64 ") produced %" PRIu64 " delivered %" PRIu64
+           " failed %" PRIu64 " spooled %" PRIu64 " (dropped %" PRIu64 ", unreadable %" PRIu64 " B) replayed %" PRIu64 "\n",
+           s.queued, s.queue_full, s.produced, s.delivered, s.failed, s.spooled, s.spool_dropped, s.spool_unreadable,
+           s.replayed);
+}
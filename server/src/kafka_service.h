@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include <rte_ring.h>
+
+#define KAFKA_QUEUE_SIZE (4096) // messages waiting for the service lcore
+#define KAFKA_BURST (32)
+
+struct KafkaConfig {
+    std::string brokers = "localhost:9092";
+    std::string acks = "1";
+    std::string compression = "lz4";
+    unsigned int linger_ms = 100;
+    unsigned int batch_size = 1 << 20;
+    unsigned int poll_ms = 100;              // how often delivery reports are served
+    std::string spool_path = "/var/tmp/onic_app.spool";
+    unsigned int spool_max_mb = 64;          // 0 disables the spool: failed messages are dropped
+    unsigned int spool_retry_ms = 5000;      // how often a non-empty spool is replayed
+};
+
+// Where messages end up: librdkafka in the app, a mock in onic_bench
+class KafkaTransport {
+    public:
+        // Delivery reports: ok or not, with the payload (still owned by the transport)
+        using DeliveryCb = std::function<void(bool ok, int topic, const char *payload, size_t len)>;
+
+        virtual ~KafkaTransport() = default;
+        virtual int add_topic(const char *name) = 0;
+        // Takes ownership of the malloc'd payload when it returns true
+        virtual bool produce(int topic, char *payload, size_t len) = 0;
+        // Serves delivery reports through the callback
+        virtual void poll(int timeout_ms) = 0;
+        // Waits up to timeout_ms for everything in flight to be reported
+        virtual void flush(int timeout_ms) = 0;
+        void set_delivery_cb(DeliveryCb cb) { on_delivery = std::move(cb); }
+
+    protected:
+        DeliveryCb on_delivery;
+};
+
+class RdKafkaTransport : public KafkaTransport {
+    private:
+        struct rd_kafka_s *rk = nullptr;
+        std::vector<struct rd_kafka_topic_s *> topics;
+
+        static void dr_msg_cb(struct rd_kafka_s *rk, const struct rd_kafka_message_s *msg, void *opaque);
+
+    public:
+        explicit RdKafkaTransport(const KafkaConfig &cfg);
+        ~RdKafkaTransport();
+        int add_topic(const char *name) override;
+        bool produce(int topic, char *payload, size_t len) override;
+        void poll(int timeout_ms) override;
+        void flush(int timeout_ms) override;
+};
+
+// Bounded append-only file of messages that could not be delivered, replayed in order
+class KafkaSpool {
+    private:
+        std::string path;
+        uint64_t max_bytes;
+        uint64_t bytes = 0;
+        uint64_t dropped_bytes = 0;
+        FILE *file = nullptr;
+
+        // Cuts the file back to len bytes, e.g. to the last whole record
+        void truncate(uint64_t len);
+
+    public:
+        KafkaSpool(const std::string &path, uint64_t max_bytes);
+        ~KafkaSpool();
+
+        bool enabled() const { return max_bytes > 0; }
+        bool empty() const { return bytes == 0; }
+        uint64_t size() const { return bytes; }
+        // Of unreadable records replay() dropped
+        uint64_t dropped() const { return dropped_bytes; }
+        // False when the spool is full or disabled: the message is lost
+        bool append(int topic, const char *payload, size_t len);
+        // Hands the messages in order to produce (malloc'd payloads, ownership passed on true).
+        // Stops at the first one refused and keeps it and the rest. A record cut short or with a length
+        // past the end is dropped with all that follows. Returns how many were taken
+        uint64_t replay(const std::function<bool(int topic, char *payload, size_t len)> &produce);
+};
+
+struct KafkaServiceStats {
+    uint64_t queued = 0;       // accepted by send()
+    uint64_t queue_full = 0;   // refused by send(), the queue was full
+    uint64_t produced = 0;     // handed to the transport
+    uint64_t delivered = 0;
+    uint64_t failed = 0;       // delivery reports with an error
+    uint64_t spooled = 0;
+    uint64_t spool_dropped = 0;
+    uint64_t spool_unreadable = 0; // bytes of damaged spool records dropped on replay
+    uint64_t replayed = 0;
+};
+
+// The one Kafka producer of the process. Any lcore can send(): messages go through a lock-free MPSC ring
+// to the service lcore, which produces them, polls delivery reports and spools failures to disk
+class KafkaService {
+    private:
+        KafkaTransport *transport;
+        KafkaConfig cfg;
+        struct rte_ring *queue;
+        KafkaSpool spool;
+        KafkaServiceStats stats;
+        std::vector<std::string> topic_names;
+        volatile bool stop_flag = false;
+        uint64_t next_poll = 0;
+        uint64_t next_replay = 0;
+
+        struct Message {
+            int topic;
+            size_t len;
+            char *payload;
+        };
+
+        static inline void bump(uint64_t *counter, uint64_t n = 1) {
+            __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+        }
+        void handle(Message *msg);
+        void on_delivery(bool ok, int topic, const char *payload, size_t len);
+
+    public:
+        KafkaService(KafkaTransport *transport, const KafkaConfig &cfg);
+        ~KafkaService();
+
+        // Setup only, before any send()
+        int add_topic(const char *name);
+
+        // Thread safe, never blocks. Takes ownership of the malloc'd payload even when it returns false
+        bool send(int topic, char *payload, size_t len);
+        bool send(int topic, const std::string &payload);
+
+        // One pass of the service loop, returns how many messages it moved
+        unsigned int run_once();
+        // Until run_once() next polls delivery reports or replays the spool, 0 when it is due
+        uint64_t us_until_due() const;
+        // Service loop for rte_eal_remote_launch, runs until stop()
+        static int run(void *service);
+        void stop() { stop_flag = true; }
+        // Hands what is left in the queue to the transport and waits for its delivery reports
+        void drain(int timeout_ms);
+
+        KafkaServiceStats get_stats() const;
+        void print_stats() const;
+};
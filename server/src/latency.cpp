@@ -0,0 +1,144 @@
+#include "latency.h"
+#include "line_protocol.h"
+
+#include <rte_debug.h>
+#include <rte_errno.h>
+#include <rte_malloc.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <new>
+
+static LcoreLatency *lcore_latency[RTE_MAX_LCORE];
+
+int LatencyField::offset = -1;
+uint64_t LatencyField::flag = 0;
+
+void LatencyField::register_field(){
+    if (offset >= 0)
+        return;
+
+    static const struct rte_mbuf_dynfield field_desc = {
+        LATENCY_DYNFIELD_NAME,
+        sizeof(HopLatencies),
+        alignof(HopLatencies),
+        0,
+    };
+    static const struct rte_mbuf_dynflag flag_desc = {
+        LATENCY_DYNFLAG_NAME,
+        0,
+    };
+
+    offset = rte_mbuf_dynfield_register(&field_desc);
+    if (offset < 0)
+        rte_exit(EXIT_FAILURE, "Cannot register latency mbuf dynfield: %s\n", rte_strerror(rte_errno));
+    int bit = rte_mbuf_dynflag_register(&flag_desc);
+    if (bit < 0)
+        rte_exit(EXIT_FAILURE, "Cannot register latency mbuf dynflag: %s\n", rte_strerror(rte_errno));
+    flag = RTE_BIT64(bit);
+}
+
+LcoreLatency *LcoreLatency::attach(int ctx_id){
+    unsigned int lcore_id = rte_lcore_id();
+    LcoreLatency *latency = lcore_latency[lcore_id];
+    if (latency == nullptr) {
+        void *mem = rte_zmalloc_socket("lcore_latency", sizeof(LcoreLatency), RTE_CACHE_LINE_SIZE, rte_socket_id());
+        if (mem == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot allocate latency histograms for lcore %u\n", lcore_id);
+        latency = new (mem) LcoreLatency();
+        __atomic_store_n(&lcore_latency[lcore_id], latency, __ATOMIC_RELEASE);
+    } else if (latency->ctx_id != ctx_id) {
+        // The lcore served another context before: start from empty histograms
+        __atomic_store_n(&latency->ctx_id, -1, __ATOMIC_RELEASE);
+        for (LatencyHistogram &hop : latency->hops)
+            hop.reset();
+    }
+    // Published last: merge() skips the slot until it belongs to ctx_id
+    __atomic_store_n(&latency->ctx_id, ctx_id, __ATOMIC_RELEASE);
+    return latency;
+}
+
+void LcoreLatency::merge(int ctx_id, LatencyHistogram (&hops)[NB_HOPS - 1]){
+    for (unsigned int lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+        const LcoreLatency *latency = __atomic_load_n(&lcore_latency[lcore_id], __ATOMIC_ACQUIRE);
+        if (latency == nullptr || __atomic_load_n(&latency->ctx_id, __ATOMIC_ACQUIRE) != ctx_id)
+            continue;
+        for (int i = 0; i < NB_HOPS - 1; i++)
+            hops[i].merge(latency->hops[i]);
+    }
+}
+
+void LatencyHistReporter::report(int ctx_id, LineEncoder *enc){
+    auto it = std::find_if(last.begin(), last.end(), [ctx_id](const Merged &m) { return m.ctx_id == ctx_id; });
+    if (it == last.end()) {
+        last.emplace_back();
+        it = last.end() - 1;
+        it->ctx_id = ctx_id;
+    }
+
+    LatencyHistogram hops[NB_HOPS - 1];
+    LcoreLatency::merge(ctx_id, hops);
+    for (int i = 0; i < NB_HOPS - 1; i++) {
+        LatencyHistogram interval = hops[i];
+        interval.subtract(it->hops[i]);
+        it->hops[i] = hops[i];
+        if (interval.count() == 0)
+            continue;
+
+        printf("CTX(%d) hop %d latency: %" PRIu64 " pkts, p50 %" PRIu64 " p90 %" PRIu64 " p99 %" PRIu64
+               " p99.9 %" PRIu64 " max %" PRIu64 " ns\n",
+               ctx_id, i, interval.count(), interval.percentile(0.5), interval.percentile(0.9),
+               interval.percentile(0.99), interval.percentile(0.999), interval.max());
+        if (enc == nullptr)
+            continue;
+        enc->begin(LATENCY_HIST_TABLE_NAME)
+            .tag("ctx", ctx_id)
+            .tag("hop", i)
+            .field_int("count", interval.count())
+            .field_int("p50", interval.percentile(0.5))
+            .field_int("p90", interval.percentile(0.9))
+            .field_int("p99", interval.percentile(0.99))
+            .field_int("p999", interval.percentile(0.999))
+            .field_int("max", interval.max());
+        enc->end();
+    }
+}
+
+// "hop(0)", "hop(1)"...: the latency field names, built once
+static const std::array<std::string, NB_HOPS - 1> hop_field_names = [] {
+    std::array<std::string, NB_HOPS - 1> names;
+    for (int i = 0; i < NB_HOPS - 1; i++)
+        names[i] = "hop(" + std::to_string(i) + ")";
+    return names;
+}();
+
+unsigned int LatencyRecordConsumer::drain(LineEncoder *enc){
+    LatencyRecord records[LATENCY_DRAIN_BURST];
+    unsigned int nb_total = 0;
+    for (;;) {
+        unsigned int max = LATENCY_DRAIN_BURST;
+        if (enc != nullptr)
+            max = RTE_MIN(max, (unsigned int)(enc->room() / LATENCY_LINE_MAX));
+        if (max == 0)
+            break;
+        unsigned int nb = rte_ring_dequeue_burst_elem(ring, records, sizeof(LatencyRecord), max, NULL);
+        for (unsigned int i = 0; enc != nullptr && i < nb; i++) {
+            enc->begin(LATENCY_TABLE_NAME).tag("ctx", records[i].ctx_id);
+            for (int hop = 0; hop < NB_HOPS - 1; hop++)
+                enc->field(hop_field_names[hop].c_str(), records[i].hop_ns[hop]);
+            enc->end();
+        }
+        nb_total += nb;
+        if (nb < max)
+            break;
+    }
+    total += nb_total;
+    return nb_total;
+}
+
+void LatencyRecordConsumer::report(){
+    if (total == last_total)
+        return;
+    printf("Latency records +%" PRIu64 "\n", total - last_total);
+    last_total = total;
+}
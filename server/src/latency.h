@@ -0,0 +1,197 @@
+#pragma once
+
+#include <array>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
+#include <rte_ether.h>
+#include <rte_byteorder.h>
+#include <rte_ring.h>
+#include <rte_ring_elem.h>
+#include <rte_lcore.h>
+
+#include "burst_parse.h"
+#include "histogram.h"
+
+// Timestamp packet constants: unit = Bytes
+#define TIMESTAMP_OFFSET (6+6+2+2+2) //dst MAC + src MAC + TPID + VLAN + Ethertype 
+#define ETHERTYPE_LEN (2)
+#define NB_SYNC_LEN (8) 
+#define CURR_TICK_LEN (8)
+#define TIMESTAMP_PKT_SIZE (60)
+
+#define NB_HOPS (3)
+#define TIMESTAMPS_LEN (NB_HOPS * (NB_SYNC_LEN + CURR_TICK_LEN))
+
+#define LEN_NB_SYNC_NS (1000) // period of one nb_sync packet
+#define LEN_TIME_TICK_NS (4) // period of one tick at 250Mhz
+
+#define CUSTOM_VLAN_ID (0x0ABC)
+
+#define LATENCY_TABLE_NAME ("Latency_stats")
+#define LATENCY_HIST_TABLE_NAME ("Latency_hist")
+#define LATENCY_DRAIN_BURST (32)    // latency records taken off the stats ring at a time
+#define LATENCY_LINE_MAX (128)      // bytes a LATENCY_TABLE_NAME line can take
+
+#define LATENCY_DYNFIELD_NAME "onic_dynfield_hop_latency"
+#define LATENCY_DYNFLAG_NAME "onic_dynflag_hop_latency"
+
+using HopLatencies = std::array<uint64_t, NB_HOPS - 1>; // ns between hop i and i+1
+
+struct Timestamps {
+    uint64_t timestamp_nb_sync[NB_HOPS];
+    uint64_t timestamp_curr_tick[NB_HOPS];
+
+    // VLAN CUSTOM_VLAN_ID packets long enough to carry NB_HOPS timestamps, packet i of the burst
+    // burst_parse() filled meta for: only the mbuf header is read
+    static inline bool is_timestamp_packet(const BurstMeta &meta, uint16_t i, const rte_mbuf *mbuf){
+        if (!(meta.flags[i] & PKT_VLAN) || (meta.vlan_tci[i] & 0xFFF) != CUSTOM_VLAN_ID)
+            return false;
+        return rte_pktmbuf_data_len(mbuf) >= TIMESTAMP_OFFSET + TIMESTAMPS_LEN;
+    }
+
+    // Reads the timestamps in place, the packet must pass is_timestamp_packet()
+    Timestamps(const rte_mbuf *mbuf){
+        const uint8_t *payload = rte_pktmbuf_mtod_offset(mbuf, const uint8_t *, TIMESTAMP_OFFSET);
+        for(int i=0; i<NB_HOPS; i++){
+            memcpy(&timestamp_nb_sync[i], payload, sizeof(uint64_t));
+            payload += NB_SYNC_LEN;
+            memcpy(&timestamp_curr_tick[i], payload, sizeof(uint64_t));
+            payload += CURR_TICK_LEN;
+        }
+    }
+
+    HopLatencies calc_hop_latencies() const { // return latency between each hop in ns
+        HopLatencies latencies{};
+
+        for(int i=0; i<NB_HOPS-1; i++){
+            latencies[i] = 
+                (timestamp_nb_sync[i]-timestamp_nb_sync[i+1])*LEN_NB_SYNC_NS + 
+                (timestamp_curr_tick[i]-timestamp_curr_tick[i+1])*LEN_TIME_TICK_NS;
+        }
+        return latencies;
+    }
+
+    static std::string get_latency_str(const HopLatencies &latencies) {
+        std::ostringstream oss;
+        for(int i=0; i<NB_HOPS-1; i++){
+            oss << "hop(" << i << ")=" << latencies[i] << ",";
+        }
+    
+        std::string result = oss.str();
+        if (!result.empty()) 
+            result.pop_back();  // Remove trailing comma
+        return result;
+    }
+
+    std::string get_latency_str() const {
+        return get_latency_str(calc_hop_latencies());
+    }
+};
+
+// What the stats ring carries per timestamp packet, instead of the mbuf itself
+struct LatencyRecord {
+    uint32_t ctx_id;
+    uint32_t rx_queue;
+    uint64_t rx_tsc;      // TSC of the rx burst the packet came in
+    HopLatencies hop_ns;
+};
+static_assert(sizeof(LatencyRecord) % 4 == 0, "rte_ring elements must be a multiple of 4 bytes");
+
+// Hop latency histograms of one lcore, only that lcore records into them
+struct alignas(RTE_CACHE_LINE_SIZE) LcoreLatency {
+    int ctx_id = -1;
+    LatencyHistogram hops[NB_HOPS - 1];
+
+    // Claims the calling lcore's histograms for ctx_id, allocated on its socket the first time
+    static LcoreLatency *attach(int ctx_id);
+
+    // Adds the histograms of every lcore that served ctx_id into hops
+    static void merge(int ctx_id, LatencyHistogram (&hops)[NB_HOPS - 1]);
+
+    inline void record(const HopLatencies &hop_ns) {
+        for (int i = 0; i < NB_HOPS - 1; i++)
+            hops[i].record(hop_ns[i]);
+    }
+};
+
+class LineEncoder;
+
+// Off the datapath: merges the hop histograms of every lcore of a context and reports what they
+// recorded since the previous call for that context
+class LatencyHistReporter {
+    private:
+        struct Merged {
+            int ctx_id;
+            LatencyHistogram hops[NB_HOPS - 1];
+        };
+        std::vector<Merged> last;
+
+    public:
+        // Prints count, p50/p90/p99/p99.9 and max of each hop that saw packets, and encodes them as
+        // LATENCY_HIST_TABLE_NAME lines into enc when it is set
+        void report(int ctx_id, LineEncoder *enc = nullptr);
+};
+
+// Off the datapath: takes the raw records off the stats ring, the single consumer of it
+class LatencyRecordConsumer {
+    private:
+        struct rte_ring *ring;
+        uint64_t total = 0;
+        uint64_t last_total = 0;
+
+    public:
+        explicit LatencyRecordConsumer(struct rte_ring *ring) : ring(ring) {}
+
+        // Dequeues what is in the ring, only as much as enc still has room for when it is set, one
+        // LATENCY_TABLE_NAME line per record. Returns how many records were taken
+        unsigned int drain(LineEncoder *enc = nullptr);
+        // Prints the records seen since the last call, if any
+        void report();
+};
+
+// Hop latencies computed on the rx lcore and carried in the mbuf metadata, so whoever consumes them
+// later never touches the packet data. The dynflag marks the mbufs the field was filled for
+class LatencyField {
+    public:
+        static int offset;
+        static uint64_t flag;
+
+        // Registers the dynfield/dynflag once, exits on failure
+        static void register_field();
+
+        static inline bool has(const rte_mbuf *mbuf){
+            return (mbuf->ol_flags & flag) != 0;
+        }
+
+        static inline const HopLatencies *get(const rte_mbuf *mbuf){
+            return RTE_MBUF_DYNFIELD(mbuf, offset, const HopLatencies *);
+        }
+
+        // Parses timestamp packets of the burst burst_parse() filled meta for in place, fills their
+        // dynfield and records them in latency. Other packets are skipped on meta alone.
+        // With records, also writes one LatencyRecord per timestamp packet there (room for meta.nb) and returns their count
+        static inline uint16_t parse_burst(struct rte_mbuf **mbufs, const BurstMeta &meta, LcoreLatency *latency,
+                                           LatencyRecord *records = nullptr,
+                                           uint32_t ctx_id = 0, uint32_t rx_queue = 0, uint64_t rx_tsc = 0){
+            uint16_t nb_records = 0;
+            for (uint16_t i = 0; i < meta.nb; i++) {
+                if (!Timestamps::is_timestamp_packet(meta, i, mbufs[i]))
+                    continue;
+                HopLatencies hop_ns = Timestamps(mbufs[i]).calc_hop_latencies();
+                *RTE_MBUF_DYNFIELD(mbufs[i], offset, HopLatencies *) = hop_ns;
+                mbufs[i]->ol_flags |= flag;
+                latency->record(hop_ns);
+                if (records != nullptr)
+                    records[nb_records++] = {ctx_id, rx_queue, rx_tsc, hop_ns};
+            }
+            return nb_records;
+        }
+};
+
+// Stats ring of LatencyRecord elements: any number of rx lcores enqueue, one stats lcore dequeues
+static inline struct rte_ring *create_latency_ring(const char *name, unsigned int size, int socket_id){
+    return rte_ring_create_elem(name, sizeof(LatencyRecord), size, socket_id, RING_F_SC_DEQ);
+}
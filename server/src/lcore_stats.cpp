@@ -0,0 +1,181 @@
+#include "lcore_stats.h"
+#include "forward_context.h"
+#include "line_protocol.h"
+
+#include <cinttypes>
+#include <cstring>
+#include <rte_string_fns.h>
+#include <rte_cycles.h>
+#include <rte_mempool.h>
+
+// Private slots until MetricsPage::publish() moves them into the shared page
+static LcoreStats private_slots[RTE_MAX_LCORE];
+LcoreStats *lcore_stats = private_slots;
+
+void lcore_stats_relocate(LcoreStats *slots){
+    if (slots == nullptr)
+        slots = private_slots;
+    if (slots != lcore_stats)
+        memcpy((void *)slots, (void *)lcore_stats, sizeof(LcoreStats) * RTE_MAX_LCORE);
+    lcore_stats = slots;
+}
+
+LcoreStats *LcoreStats::attach(int ctx_id, const char *role){
+    LcoreStats *stats = &lcore_stats[rte_lcore_id()];
+    strlcpy(stats->role, role, sizeof(stats->role));
+    __atomic_store_n(&stats->ctx_id, ctx_id, __ATOMIC_RELEASE);
+    return stats;
+}
+
+void lcore_stats_snapshot(const LcoreStats &slot, LcoreStats &snap){
+    snap.ctx_id = __atomic_load_n(&slot.ctx_id, __ATOMIC_ACQUIRE);
+    memcpy(snap.role, slot.role, sizeof(snap.role));
+    snap.role[LCORE_ROLE_LEN - 1] = '\0';
+    snap.rx_pkts = lcore_stats_read(&slot.rx_pkts);
+    snap.tx_pkts = lcore_stats_read(&slot.tx_pkts);
+    snap.rx_bytes = lcore_stats_read(&slot.rx_bytes);
+    snap.tx_bytes = lcore_stats_read(&slot.tx_bytes);
+    snap.rx_bursts = lcore_stats_read(&slot.rx_bursts);
+    snap.empty_polls = lcore_stats_read(&slot.empty_polls);
+    snap.bursts_small = lcore_stats_read(&slot.bursts_small);
+    snap.bursts_large = lcore_stats_read(&slot.bursts_large);
+    snap.bursts_full = lcore_stats_read(&slot.bursts_full);
+    snap.busy_cycles = lcore_stats_read(&slot.busy_cycles);
+    snap.idle_cycles = lcore_stats_read(&slot.idle_cycles);
+    snap.idle_waits = lcore_stats_read(&slot.idle_waits);
+    snap.wait_cycles = lcore_stats_read(&slot.wait_cycles);
+    snap.ring_drops = lcore_stats_read(&slot.ring_drops);
+    snap.ring_full = lcore_stats_read(&slot.ring_full);
+    snap.ring_hwm = lcore_stats_read(&slot.ring_hwm);
+    snap.tx_drops = lcore_stats_read(&slot.tx_drops);
+    snap.tx_retries = lcore_stats_read(&slot.tx_retries);
+    snap.tx_retried = lcore_stats_read(&slot.tx_retried);
+    snap.tx_flushes = lcore_stats_read(&slot.tx_flushes);
+    snap.latency_records = lcore_stats_read(&slot.latency_records);
+    snap.latency_drops = lcore_stats_read(&slot.latency_drops);
+    snap.flows_new = lcore_stats_read(&slot.flows_new);
+    snap.flows_active = lcore_stats_read(&slot.flows_active);
+    snap.flow_untracked = lcore_stats_read(&slot.flow_untracked);
+    snap.flows_expired = lcore_stats_read(&slot.flows_expired);
+    snap.flows_evicted = lcore_stats_read(&slot.flows_evicted);
+    snap.flow_records = lcore_stats_read(&slot.flow_records);
+    snap.flow_record_drops = lcore_stats_read(&slot.flow_record_drops);
+    snap.parse_cycles = lcore_stats_read(&slot.parse_cycles);
+    snap.flow_cycles = lcore_stats_read(&slot.flow_cycles);
+    snap.latency_cycles = lcore_stats_read(&slot.latency_cycles);
+    snap.capture_cycles = lcore_stats_read(&slot.capture_cycles);
+    snap.capture_pkts = lcore_stats_read(&slot.capture_pkts);
+    snap.capture_drops = lcore_stats_read(&slot.capture_drops);
+}
+
+static inline double percent(uint64_t part, uint64_t total) {
+    return (total == 0) ? 0 : 100.0 * part / total;
+}
+
+void LcoreStatsReporter::report(const std::vector<ForwardingContext> &ctxs, LineEncoder *enc){
+    uint64_t now = rte_get_tsc_cycles();
+    double elapsed = (last_tsc == 0) ? 0 : (double)(now - last_tsc) / rte_get_tsc_hz();
+    last_tsc = now;
+
+    unsigned int lcore_id;
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        LcoreStats snap;
+        lcore_stats_snapshot(lcore_stats[lcore_id], snap);
+        if (snap.ctx_id < 0)
+            continue;
+
+        LcoreStats &prev = last[lcore_id];
+        if (elapsed > 0 && (snap.rx_pkts != prev.rx_pkts || snap.tx_pkts != prev.tx_pkts ||
+                            snap.ring_drops != prev.ring_drops || snap.tx_drops != prev.tx_drops)) {
+            printf("CTX(%d) %-4s lcore %3u: rx %10.0f pps %7.3f Gbps tx %10.0f pps %7.3f Gbps ring_drops %" PRIu64 " (+%" PRIu64 ") tx_drops %" PRIu64 " (+%" PRIu64 ")\n",
+                   snap.ctx_id, snap.role, lcore_id,
+                   (snap.rx_pkts - prev.rx_pkts) / elapsed, (snap.rx_bytes - prev.rx_bytes) * 8 / elapsed / 1e9,
+                   (snap.tx_pkts - prev.tx_pkts) / elapsed, (snap.tx_bytes - prev.tx_bytes) * 8 / elapsed / 1e9,
+                   snap.ring_drops, snap.ring_drops - prev.ring_drops,
+                   snap.tx_drops, snap.tx_drops - prev.tx_drops);
+            if (snap.ring_full != prev.ring_full)
+                printf("CTX(%d) %-4s lcore %3u: ring full +%" PRIu64 " times, high-water mark %" PRIu64 "\n",
+                       snap.ctx_id, snap.role, lcore_id, snap.ring_full - prev.ring_full, snap.ring_hwm);
+            if (snap.latency_records != prev.latency_records || snap.latency_drops != prev.latency_drops)
+                printf("CTX(%d) %-4s lcore %3u: latency records +%" PRIu64 ", lost %" PRIu64 " (+%" PRIu64 ")\n",
+                       snap.ctx_id, snap.role, lcore_id, snap.latency_records - prev.latency_records,
+                       snap.latency_drops, snap.latency_drops - prev.latency_drops);
+            if (snap.tx_retries != prev.tx_retries || snap.tx_flushes != prev.tx_flushes)
+                printf("CTX(%d) %-4s lcore %3u: tx_retries +%" PRIu64 " saving %" PRIu64 " pkts, tx_flushes +%" PRIu64 "\n",
+                       snap.ctx_id, snap.role, lcore_id, snap.tx_retries - prev.tx_retries,
+                       snap.tx_retried - prev.tx_retried, snap.tx_flushes - prev.tx_flushes);
+            if (snap.flows_new != prev.flows_new || snap.flow_untracked != prev.flow_untracked)
+                printf("CTX(%d) %-4s lcore %3u: flows %" PRIu64 " active, +%" PRIu64 " new, %" PRIu64 " pkts untracked (+%" PRIu64 ")\n",
+                       snap.ctx_id, snap.role, lcore_id, snap.flows_active, snap.flows_new - prev.flows_new,
+                       snap.flow_untracked, snap.flow_untracked - prev.flow_untracked);
+            if (snap.flows_expired != prev.flows_expired || snap.flows_evicted != prev.flows_evicted ||
+                snap.flow_record_drops != prev.flow_record_drops)
+                printf("CTX(%d) %-4s lcore %3u: flows expired +%" PRIu64 " evicted +%" PRIu64 ", records +%" PRIu64 ", lost %" PRIu64 " (+%" PRIu64 ")\n",
+                       snap.ctx_id, snap.role, lcore_id, snap.flows_expired - prev.flows_expired,
+                       snap.flows_evicted - prev.flows_evicted, snap.flow_records - prev.flow_records,
+                       snap.flow_record_drops, snap.flow_record_drops - prev.flow_record_drops);
+            if (snap.capture_pkts != prev.capture_pkts || snap.capture_drops != prev.capture_drops)
+                printf("CTX(%d) %-4s lcore %3u: captured +%" PRIu64 ", lost %" PRIu64 " (+%" PRIu64 ")\n",
+                       snap.ctx_id, snap.role, lcore_id, snap.capture_pkts - prev.capture_pkts,
+                       snap.capture_drops, snap.capture_drops - prev.capture_drops);
+            uint64_t stage_pkts = snap.rx_pkts - prev.rx_pkts;
+            uint64_t parse = snap.parse_cycles - prev.parse_cycles;
+            uint64_t flow = snap.flow_cycles - prev.flow_cycles;
+            uint64_t latency = snap.latency_cycles - prev.latency_cycles;
+            uint64_t capture = snap.capture_cycles - prev.capture_cycles;
+            if (stage_pkts > 0 && parse + flow + latency + capture > 0)
+                printf("CTX(%d) %-4s lcore %3u: inspection cycles/pkt parse %6.1f flows %6.1f latency %6.1f capture %6.1f\n",
+                       snap.ctx_id, snap.role, lcore_id, (double)parse / stage_pkts, (double)flow / stage_pkts,
+                       (double)latency / stage_pkts, (double)capture / stage_pkts);
+        }
+
+        // How loaded the lcore was: share of the loop time that moved packets, and how full its polls came back
+        uint64_t busy = snap.busy_cycles - prev.busy_cycles;
+        uint64_t cycles = busy + snap.idle_cycles - prev.idle_cycles;
+        uint64_t polls = (snap.empty_polls - prev.empty_polls) + (snap.bursts_small - prev.bursts_small) +
+                         (snap.bursts_large - prev.bursts_large) + (snap.bursts_full - prev.bursts_full);
+        uint64_t waited = snap.wait_cycles - prev.wait_cycles;
+        if (elapsed > 0 && busy > 0)
+            printf("CTX(%d) %-4s lcore %3u: busy %5.1f%% asleep %5.1f%% of %" PRIu64 " polls, bursts empty %5.1f%% 1-%d %5.1f%% partial %5.1f%% full %5.1f%%\n",
+                   snap.ctx_id, snap.role, lcore_id, percent(busy, cycles), percent(waited, cycles), polls,
+                   percent(snap.empty_polls - prev.empty_polls, polls), LCORE_SMALL_BURST - 1,
+                   percent(snap.bursts_small - prev.bursts_small, polls),
+                   percent(snap.bursts_large - prev.bursts_large, polls),
+                   percent(snap.bursts_full - prev.bursts_full, polls));
+
+        if (enc != nullptr && elapsed > 0) {
+            enc->begin(LCORE_TABLE_NAME).tag("ctx", snap.ctx_id).tag("role", snap.role).tag("lcore", lcore_id)
+                .field("rx_pkts", snap.rx_pkts)
+                .field("tx_pkts", snap.tx_pkts)
+                .field("rx_bytes", snap.rx_bytes)
+                .field("tx_bytes", snap.tx_bytes)
+                .field("ring_drops", snap.ring_drops)
+                .field("tx_drops", snap.tx_drops)
+                .field("empty_polls", snap.empty_polls)
+                .field("bursts_small", snap.bursts_small)
+                .field("bursts_large", snap.bursts_large)
+                .field("bursts_full", snap.bursts_full)
+                .field("busy_cycles", snap.busy_cycles)
+                .field("idle_cycles", snap.idle_cycles)
+                .field("idle_waits", snap.idle_waits)
+                .field("wait_cycles", snap.wait_cycles)
+                .field("flows_new", snap.flows_new)
+                .field("flows_active", snap.flows_active)
+                .field("flows_expired", snap.flows_expired)
+                .field("flows_evicted", snap.flows_evicted)
+                .field("busy_ppm", (cycles == 0) ? 0 : busy * 1000000 / cycles);
+            enc->end();
+        }
+        prev = snap;
+    }
+
+    // Pool occupancy is sampled here rather than counted on the datapath
+    for (const ForwardingContext &ctx : ctxs) {
+        if (ctx.rx_onic == nullptr)
+            continue;
+        struct rte_mempool *mp = rte_mempool_lookup(ctx.rx_onic->get_ports()[ctx.rx_port].pinfo.mem_pool);
+        if (mp != NULL && rte_mempool_in_use_count(mp) > 0)
+            printf("CTX(%d) rx mempool %s: %u in use, %u available\n",
+                   ctx.ctx_id, mp->name, rte_mempool_in_use_count(mp), rte_mempool_avail_count(mp));
+    }
+}
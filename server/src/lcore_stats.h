@@ -0,0 +1,167 @@
+#pragma once
+
+#include <vector>
+#include <rte_lcore.h>
+#include <rte_common.h>
+#include <rte_branch_prediction.h>
+#include <rte_mbuf.h>
+#include <rte_cycles.h>
+
+#define LCORE_ROLE_LEN (8)
+#define LCORE_TABLE_NAME ("Lcore_stats")
+#define LCORE_SMALL_BURST (8) // bursts under this many mbufs count as small
+
+struct ForwardingContext;
+class LineEncoder;
+
+// Datapath counters, one cache line aligned slot per lcore so workers never share a line.
+// Each slot has a single writer (its lcore), readers only ever do relaxed loads.
+// Plain data only: the slots can live in the shared metrics page, see metrics.h
+struct alignas(RTE_CACHE_LINE_SIZE) LcoreStats {
+    int32_t ctx_id = -1;        // -1 when the lcore runs no forwarder
+    char role[LCORE_ROLE_LEN] = "";
+    uint64_t rx_pkts = 0;
+    uint64_t tx_pkts = 0;
+    uint64_t rx_bytes = 0;
+    uint64_t tx_bytes = 0;
+    uint64_t rx_bursts = 0;     // polls that returned packets
+    uint64_t empty_polls = 0;   // rx (or ring dequeue) polls that returned nothing
+    uint64_t bursts_small = 0;  // polls that returned 1 to LCORE_SMALL_BURST - 1 mbufs
+    uint64_t bursts_large = 0;  // more than that, but less than a full burst
+    uint64_t bursts_full = 0;   // a full burst: there was likely more waiting
+    uint64_t busy_cycles = 0;   // TSC cycles of poll loop iterations that moved packets
+    uint64_t idle_cycles = 0;   // and of those that found nothing
+    uint64_t idle_waits = 0;    // monitor, sleep or interrupt waits of the idle policy
+    uint64_t wait_cycles = 0;   // TSC cycles spent in them, part of idle_cycles
+    uint64_t ring_drops = 0;    // mbufs freed because the rx->tx ring was full
+    uint64_t ring_full = 0;     // bursts that did not fully fit in the ring
+    uint64_t ring_hwm = 0;      // highest ring occupancy seen right after an enqueue
+    uint64_t tx_drops = 0;      // mbufs freed because the tx Q did not take them
+    uint64_t tx_retries = 0;    // extra rte_eth_tx_burst calls made by the retry policy
+    uint64_t tx_retried = 0;    // mbufs sent by those extra calls instead of being dropped
+    uint64_t latency_records = 0; // LatencyRecords pushed to the stats ring
+    uint64_t latency_drops = 0; // LatencyRecords lost because the stats ring was full
+    uint64_t tx_flushes = 0;    // tx buffers flushed on timeout rather than because they were full
+    uint64_t flows_new = 0;     // flows created in the lcore's flow table
+    uint64_t flows_active = 0;  // flows in it now
+    uint64_t flow_untracked = 0; // rx packets not accounted to a flow: not IP, or no room for a new flow
+    uint64_t flows_expired = 0; // flows dropped after their idle timeout
+    uint64_t flows_evicted = 0; // flows dropped to make room for a new one
+    uint64_t flow_records = 0;  // FlowRecords pushed to the flow ring
+    uint64_t flow_record_drops = 0; // FlowRecords lost because the flow ring was full
+    uint64_t parse_cycles = 0;  // TSC cycles of the inspection stages, only counted with stage_cycles
+    uint64_t flow_cycles = 0;
+    uint64_t latency_cycles = 0;
+    uint64_t capture_cycles = 0;
+    uint64_t capture_pkts = 0;  // packets handed to the capture writer
+    uint64_t capture_drops = 0; // packets the filter took but the capture ring had no room for
+
+    // Claims the calling lcore's slot for a forwarder
+    static LcoreStats *attach(int ctx_id, const char *role);
+};
+
+// RTE_MAX_LCORE slots, in the metrics page once it is published
+extern LcoreStats *lcore_stats;
+
+// Copies the slots to slots (RTE_MAX_LCORE of them, nullptr for the private ones) and points
+// lcore_stats there. Only while no forwarder is running
+void lcore_stats_relocate(LcoreStats *slots);
+
+// Single writer: a relaxed store is enough for readers to never see a torn value, and costs no lock
+static inline void lcore_stats_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+// Takes back part of an earlier add, e.g. bytes counted for mbufs that were then dropped
+static inline void lcore_stats_sub(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter - n, __ATOMIC_RELAXED);
+}
+
+static inline void lcore_stats_set(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void lcore_stats_max(uint64_t *counter, uint64_t value) {
+    if (unlikely(value > *counter))
+        __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t lcore_stats_read(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Burst size histogram of a poll (rx burst or ring dequeue) asking for up to burst_size mbufs
+static inline void lcore_stats_burst(LcoreStats *stats, uint16_t nb, uint16_t burst_size) {
+    if (nb == 0)
+        lcore_stats_add(&stats->empty_polls, 1);
+    else if (nb < LCORE_SMALL_BURST)
+        lcore_stats_add(&stats->bursts_small, 1);
+    else if (nb < burst_size)
+        lcore_stats_add(&stats->bursts_large, 1);
+    else
+        lcore_stats_add(&stats->bursts_full, 1);
+}
+
+// One non-empty rx burst: packets, bytes and the burst itself
+static inline void lcore_stats_rx(LcoreStats *stats, struct rte_mbuf **mbufs, uint16_t nb, uint16_t burst_size) {
+    uint64_t bytes = 0;
+    for (uint16_t i = 0; i < nb; i++)
+        bytes += rte_pktmbuf_pkt_len(mbufs[i]);
+    lcore_stats_add(&stats->rx_pkts, nb);
+    lcore_stats_add(&stats->rx_bytes, bytes);
+    lcore_stats_add(&stats->rx_bursts, 1);
+    lcore_stats_burst(stats, nb, burst_size);
+}
+
+// Splits a poll loop's time into busy and idle cycles. lap() is called once per iteration and
+// charges the time since the previous lap to one or the other: a single rdtsc per iteration
+class PollClock {
+    private:
+        uint64_t last;
+
+    public:
+        PollClock() : last(rte_rdtsc()) {}
+
+        inline void lap(LcoreStats *stats, bool busy) {
+            uint64_t now = rte_rdtsc();
+            lcore_stats_add(busy ? &stats->busy_cycles : &stats->idle_cycles, now - last);
+            last = now;
+        }
+
+        // TSC of the last lap: the time of the iteration without another rdtsc
+        inline uint64_t now() const { return last; }
+};
+
+// Charges the stages of a burst's inspection to their own counters: each lap() adds the time since
+// the previous one. Constructed off it reads no TSC at all
+class StageClock {
+    private:
+        bool on;
+        uint64_t last;
+
+    public:
+        explicit StageClock(bool on) : on(on), last(on ? rte_rdtsc() : 0) {}
+
+        inline void lap(uint64_t *counter) {
+            if (!on)
+                return;
+            uint64_t now = rte_rdtsc();
+            lcore_stats_add(counter, now - last);
+            last = now;
+        }
+};
+
+// Consistent copy of a slot from another lcore, field by field
+void lcore_stats_snapshot(const LcoreStats &slot, LcoreStats &snap);
+
+// Reads every slot from a non-datapath lcore and prints the rates since the last call,
+// along with mempool occupancy of the contexts' rx ports
+class LcoreStatsReporter {
+    private:
+        std::vector<LcoreStats> last = std::vector<LcoreStats>(RTE_MAX_LCORE);
+        uint64_t last_tsc = 0;
+
+    public:
+        // Lines are also encoded into enc when it is set, one per forwarding lcore
+        void report(const std::vector<ForwardingContext> &ctxs, LineEncoder *enc = nullptr);
+};
@@ -0,0 +1,132 @@
+#include "line_protocol.h"
+
+#include <cstdlib>
+#include <rte_debug.h>
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+LineEncoder::LineEncoder(size_t capacity) : capacity(capacity) {
+    buf = (char *)malloc(capacity);
+    if (buf == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate %zu B line protocol buffer\n", capacity);
+}
+
+LineEncoder::~LineEncoder(){
+    free(buf);
+}
+
+// Two digits per step, written backwards into a small stack buffer
+void LineEncoder::put_uint(uint64_t value){
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while (value >= 100) {
+        unsigned int pair = (value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        *--p = digit_pairs[value * 2 + 1];
+        *--p = digit_pairs[value * 2];
+    } else {
+        *--p = '0' + value;
+    }
+    put(p, tmp + sizeof(tmp) - p);
+}
+
+void LineEncoder::put_int(int64_t value){
+    if (value < 0) {
+        put('-');
+        put_uint(-(uint64_t)value);
+    } else {
+        put_uint(value);
+    }
+}
+
+LineEncoder &LineEncoder::begin(const char *measurement, size_t n){
+    line_start = len;
+    line_ok = true;
+    first_field = true;
+    put(measurement, n);
+    return *this;
+}
+
+LineEncoder &LineEncoder::tag(const char *key, const char *value){
+    put(',');
+    put(key);
+    put('=');
+    put(value);
+    return *this;
+}
+
+LineEncoder &LineEncoder::tag(const char *key, uint64_t value){
+    put(',');
+    put(key);
+    put('=');
+    put_uint(value);
+    return *this;
+}
+
+LineEncoder &LineEncoder::field(const char *prefix, const char *key, uint64_t value){
+    put(first_field ? ' ' : ',');
+    first_field = false;
+    put(prefix);
+    put(key);
+    put('=');
+    put_uint(value);
+    return *this;
+}
+
+LineEncoder &LineEncoder::field_int(const char *key, int64_t value){
+    put(first_field ? ' ' : ',');
+    first_field = false;
+    put(key);
+    put('=');
+    put_int(value);
+    put('i');
+    return *this;
+}
+
+bool LineEncoder::end(uint64_t timestamp_ns){
+    if (timestamp_ns != 0) {
+        put(' ');
+        put_uint(timestamp_ns);
+    }
+    put('\n');
+
+    if (!line_ok || first_field) {
+        // Out of room (or no field, which InfluxDB rejects): keep only the whole lines before it
+        len = line_start;
+        nb_dropped++;
+        line_ok = true;
+        return false;
+    }
+    nb_lines++;
+    return true;
+}
+
+void LineEncoder::clear(){
+    len = 0;
+    line_start = 0;
+    nb_lines = 0;
+    line_ok = true;
+}
+
+char *LineEncoder::release(){
+    char *out = buf;
+    buf = (char *)malloc(capacity);
+    if (buf == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate %zu B line protocol buffer\n", capacity);
+    clear();
+    return out;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define LINE_ENCODER_DEFAULT_SIZE (64 * 1024)
+#define LINE_ENCODER_MAX_LINE (2048) // flush before a line could need more than what is left
+
+// Writes InfluxDB line protocol into one preallocated buffer, many lines per buffer:
+//   measurement[,tag=value...] field=value[,field=value...][ timestamp]\n
+// No heap allocation per line. A line that does not fit is rolled back and counted in dropped()
+// so the buffer always holds whole lines. The buffer is malloc'd so it can be handed to
+// rd_kafka_produce with RD_KAFKA_MSG_F_FREE through release()
+class LineEncoder {
+    private:
+        char *buf;
+        size_t capacity;
+        size_t len = 0;
+        size_t line_start = 0;
+        unsigned int nb_lines = 0;
+        unsigned int nb_dropped = 0;
+        bool line_ok = true;
+        bool first_field = true;
+
+        inline void put(const char *s, size_t n) {
+            if (no_room(n)) {
+                line_ok = false;
+                return;
+            }
+            memcpy(buf + len, s, n);
+            len += n;
+        }
+        inline void put(const char *s) { put(s, strlen(s)); }
+        inline void put(char c) { put(&c, 1); }
+        inline bool no_room(size_t n) const { return __builtin_expect(!line_ok || len + n > capacity, 0); }
+
+        void put_uint(uint64_t value);
+        void put_int(int64_t value);
+
+    public:
+        explicit LineEncoder(size_t capacity = LINE_ENCODER_DEFAULT_SIZE);
+        ~LineEncoder();
+        LineEncoder(const LineEncoder &) = delete;
+        LineEncoder &operator=(const LineEncoder &) = delete;
+
+        // Starts a line with a measurement name, or with a preformatted "measurement,tag=value" prefix
+        LineEncoder &begin(const char *measurement, size_t n);
+        LineEncoder &begin(const char *measurement) { return begin(measurement, strlen(measurement)); }
+
+        LineEncoder &tag(const char *key, const char *value);
+        LineEncoder &tag(const char *key, uint64_t value);
+
+        // Fields written as plain numbers (stored as floats by InfluxDB, like the existing tables)
+        LineEncoder &field(const char *prefix, const char *key, uint64_t value);
+        LineEncoder &field(const char *key, uint64_t value) { return field("", key, value); }
+        // Fields written as integers: value followed by 'i'
+        LineEncoder &field_int(const char *key, int64_t value);
+
+        // Ends the line, with a timestamp in ns when non-zero. Returns false if the line was dropped
+        bool end(uint64_t timestamp_ns = 0);
+
+        const char *data() const { return buf; }
+        size_t size() const { return len; }
+        unsigned int lines() const { return nb_lines; }
+        unsigned int dropped() const { return nb_dropped; }
+        bool empty() const { return nb_lines == 0; }
+        // True when the next line might not fit: time to send the batch
+        bool nearly_full() const { return capacity - len < LINE_ENCODER_MAX_LINE; }
+        size_t room() const { return capacity - len; }
+
+        // Forgets the lines, the buffer is kept
+        void clear();
+        // Hands the buffer (free() it) to the caller and starts a new empty one
+        char *release();
+};
@@ -1,20 +1,27 @@
 #include "main.h"
 #include "onic_port.h"
 #include "stats.h"
+#include "cmac_collector.h"
+#include "cmac_bringup.h"
+#include "metrics.h"
+#include "burst_parse.h"
+#include "replay.h"
+#include "capture.h"
 
-#include <librdkafka/rdkafka.h>
 #include <rte_ethdev.h>
 #include <rte_mbuf.h>
 #include <rte_atomic.h>
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <vector>
+#include <getopt.h>
 
 #include <rte_metrics.h>
 
-#define BURST_SIZE 32
 #define MBUF_CACHE_SIZE 250
 
-#define STATS_RING_SIZE 8192
 
 int software_forwarder_thread(void *arg);
 std::atomic<bool> sigkill{false};
@@ -24,13 +31,6 @@ void force_exit_handler(int) {
     sigkill= true;  // Signal threads to stop
 }
 
-unsigned int launch_software_forwarder(unsigned int prev_lcore_id, ForwardingContext &ctx);
-
-void produce_kafka();
-void produce_kafka(const char *topic, const char *payload, size_t payload_len, const char *key, size_t key_len);
-
-#define NB_FORWARDS (4)
-struct ForwardingContext ctx[NB_FORWARDS];
 
 int main(int argc, char* argv[]){
 	std::signal(SIGINT, force_exit_handler);  // Catch Ctrl+C
@@ -52,273 +52,369 @@ int main(int argc, char* argv[]){
 	if (ret < 0)
 		rte_exit(EXIT_FAILURE, "Error with EAL initialization\n");
 	rte_log_set_global_level(RTE_LOG_DEBUG);
-
-	num_ports = rte_eth_dev_count_avail();
-	if (num_ports < 1)
-		rte_exit(EXIT_FAILURE, "No Ethernet devices found."
-			" Try updating the FPGA image.\n");
+	printf("Burst header parser: %s\n", to_string(burst_parse_select()));
 
 	/* Make sure things are defined ... */
 	do_sanity_checks();
 
-	/* Allocate aligned mezone */
-	rte_pmd_qdma_compat_memzone_reserve_aligned();
+	/* Application args come after the EAL ones: onic_app [EAL] -- -c topology.toml [-r trace.pcap] */
+	argc -= ret;
+	argv += ret;
+	const char *topology_file = DEFAULT_TOPOLOGY_FILE;
+	const char *replay_pcap = nullptr;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:r:")) != -1) {
+		if (opt == 'c')
+			topology_file = optarg;
+		else if (opt == 'r')
+			replay_pcap = optarg;
+	}
+
+	Topology topology = Topology::load(topology_file, replay_pcap);
+	topology.print();
+	NumaPlacement::policy = topology.numa_policy;
+
+	// A replay runs without any FPGA: no QDMA port is needed
+	if (!topology.replaying()) {
+		num_ports = rte_eth_dev_count_avail();
+		if (num_ports < 1)
+			rte_exit(EXIT_FAILURE, "No Ethernet devices found."
+				" Try updating the FPGA image.\n");
+
+		/* Allocate aligned mezone */
+		rte_pmd_qdma_compat_memzone_reserve_aligned();
+	}
 	/******************************************************************************************************************
 														Init Onics
 	******************************************************************************************************************/
-
-    unsigned int base_q = 0;
-	PortInfo pinfos[] = {
-		{base_q++, 2, 1024, 2, 4096, 0, 2},
-		{base_q++, 2, 1024, 2, 4096, 0, 2}
-	};
-	int onic0_port_ids[] = {0, 1};
-	int onic1_port_ids[] = {2, 3};
-
-	int nb_ports = sizeof(onic0_port_ids)/sizeof(onic0_port_ids[0]);
-
-	Onic onic0(pinfos, onic0_port_ids, nb_ports);
-	Onic onic1(pinfos, onic1_port_ids, nb_ports);
+	// Empty when replaying
+	std::vector<std::unique_ptr<Onic>> onics;
+	for (OnicConfig &onic_cfg : topology.onics) {
+		std::vector<PortInfo> pinfos(onic_cfg.port_ids.size(), onic_cfg.port_info());
+		onics.emplace_back(new Onic(pinfos.data(), onic_cfg.port_ids.data(), onic_cfg.port_ids.size(),
+									-1, -1, onic_cfg.rs_fec, false));
+	}
+
+	// CMACs of all the cards are reset and aligned at once, every wait has a deadline
+	std::vector<Onic *> onic_ptrs;
+	std::vector<std::string> onic_names;
+	for (size_t i = 0; i < onics.size(); i++) {
+		onic_ptrs.push_back(onics[i].get());
+		onic_names.push_back(topology.onics[i].name);
+	}
+	if (!onics.empty()) {
+		CmacBringup bringup(onic_ptrs);
+		int bringup_ret = bringup.run();
+		bringup.report(onic_names);
+		if (bringup_ret < 0)
+			rte_exit(EXIT_FAILURE, "Onic shell did not come out of reset\n");
+	}
 
     /******************************************************************************************************************
 											Configure contexts and rings
 	******************************************************************************************************************/
 
-    struct rte_ring *stats_ring = rte_ring_create(
-        "mbuf_ring",
-        STATS_RING_SIZE,
-        rte_socket_id(),
-        RING_F_SC_DEQ // Single-consumer if only one thread dequeues
-    );
+    // Raw latency records from every rx lcore, drained by the main lcore. Off by default: the hop
+    // histograms the main lcore reports every second already summarise them
+    struct rte_ring *stats_ring = nullptr;
+    if (topology.latency_records) {
+        stats_ring = create_latency_ring("stats_ring", topology.stats_ring_size, rte_socket_id());
+        if (stats_ring == NULL) {
+            rte_exit(EXIT_FAILURE, "Cannot create ring\n");
+        }
+    }
+
+    // Records of ended flows from every rx lcore that tracks flows, drained by the main lcore
+    struct rte_ring *flow_ring = nullptr;
+    bool track_flows = std::any_of(topology.contexts.begin(), topology.contexts.end(),
+                                   [](const ContextConfig &cfg) { return cfg.flows.capacity > 0; });
+    if (track_flows) {
+        flow_ring = create_flow_ring("flow_ring", topology.flow_ring_size, rte_socket_id());
+        if (flow_ring == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot create flow ring\n");
+    }
 
-    if (stats_ring == NULL) {
-        rte_exit(EXIT_FAILURE, "Cannot create ring\n");
+    // Packets the contexts' capture filters take, towards the capture writer
+    struct rte_ring *capture_ring = nullptr;
+    if (topology.capturing()) {
+        capture_ring = create_capture_ring("capture_ring", topology.capture.ring_size, rte_socket_id());
+        if (capture_ring == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot create capture ring\n");
     }
 
+    // A pcap preloaded into mbufs and fed into a net_ring port at full speed, all contexts run on that port
+    std::unique_ptr<PcapReplay> replay;
+    if (topology.replaying()) {
+        uint16_t nb_replay_queues;
+        std::vector<uint16_t> replay_rx_queues;
+        topology.replay_queues(nb_replay_queues, replay_rx_queues);
+        replay.reset(new PcapReplay(topology.replay, nb_replay_queues, replay_rx_queues, rte_socket_id()));
+    }
 
-    ctx[0] = ForwardingContext{
-        .ctx_id = 0,
-        .rx_onic = &onic0,
-        .tx_onic = &onic0,
-        .rx_port = 0,
-        .tx_port = 1,
-
-        .rx_Qs = {0, -1,-1},
-        .tx_Qs = {0, -1,-1},
-        .nb_rx_Qs = 1,
-        .nb_tx_Qs = 1,
-        
-        .stats_ring = stats_ring,
-
-        .stop_flag = RTE_ATOMIC32_INIT(0),
-    };
-
-    ctx[1] = ForwardingContext{
-        .ctx_id = 1,
-        .rx_onic = &onic0,
-        .tx_onic = &onic0,
-        .rx_port = 1,
-        .tx_port = 0,
-
-        .rx_Qs = {0, -1,-1},
-        .tx_Qs = {0, -1,-1},
-        .nb_rx_Qs = 1,
-        .nb_tx_Qs = 1,
-        
-        .stats_ring = stats_ring,
-
-        .stop_flag = RTE_ATOMIC32_INIT(0),
-    };
-
-    ctx[2] = ForwardingContext{
-        .ctx_id = 2,
-        .rx_onic = &onic1,
-        .tx_onic = &onic1,
-        .rx_port = 0,
-        .tx_port = 1,
-
-        .rx_Qs = {0, -1,-1},
-        .tx_Qs = {0, -1,-1},
-        .nb_rx_Qs = 1,
-        .nb_tx_Qs = 1,
-        
-        .stats_ring = stats_ring,
-
-        .stop_flag = RTE_ATOMIC32_INIT(0),
-    };
-
-    ctx[3] = ForwardingContext{
-        .ctx_id = 3,
-        .rx_onic = &onic1,
-        .tx_onic = &onic1,
-        .rx_port = 1,
-        .tx_port = 0,
-
-        .rx_Qs = {0, -1,-1},
-        .tx_Qs = {0, -1,-1},
-        .nb_rx_Qs = 1,
-        .nb_tx_Qs = 1,
-        
-        .stats_ring = stats_ring,
-
-        .stop_flag = RTE_ATOMIC32_INIT(0),
-    };
+    // Sized once: workers keep pointers into this vector
+    std::vector<ForwardingContext> ctx(topology.contexts.size());
+    for (size_t i = 0; i < ctx.size(); i++) {
+        const ContextConfig &cfg = topology.contexts[i];
+        ctx[i].ctx_id = cfg.ctx_id;
+        if (replay) {
+            // No onics: resolve_ports() leaves these alone
+            ctx[i].rx_onic = nullptr;
+            ctx[i].tx_onic = nullptr;
+            ctx[i].rx_port_id = replay->get_port_id();
+            ctx[i].tx_port_id = replay->get_port_id();
+        } else {
+            ctx[i].rx_onic = onics[topology.find_onic(cfg.rx_onic)].get();
+            ctx[i].tx_onic = onics[topology.find_onic(cfg.tx_onic)].get();
+        }
+        ctx[i].rx_port = cfg.rx_port;
+        ctx[i].tx_port = cfg.tx_port;
+        ctx[i].rx_Qs.fill(-1);
+        ctx[i].tx_Qs.fill(-1);
+        std::copy(cfg.rx_Qs.begin(), cfg.rx_Qs.end(), ctx[i].rx_Qs.begin());
+        std::copy(cfg.tx_Qs.begin(), cfg.tx_Qs.end(), ctx[i].tx_Qs.begin());
+        ctx[i].nb_rx_Qs = cfg.rx_Qs.size();
+        ctx[i].nb_tx_Qs = cfg.tx_Qs.size();
+        ctx[i].stats_ring = stats_ring;
+        ctx[i].flow_ring = flow_ring;
+        if (cfg.capture) {
+            ctx[i].capture_ring = capture_ring;
+            ctx[i].capture = cfg.capture_filter;
+            ctx[i].capture_if = i;
+        }
+        rte_atomic32_init(&ctx[i].stop_flag);
+        ctx[i].mode = cfg.mode;
+        ctx[i].ring_size = cfg.ring_size;
+        ctx[i].ring_policy = cfg.ring_policy;
+        ctx[i].parse_latency = cfg.parse_latency;
+        ctx[i].tx_policy = cfg.tx_policy;
+        ctx[i].tx_retry_us = cfg.tx_retry_us;
+        ctx[i].tx_flush_us = cfg.tx_flush_us;
+        ctx[i].idle = cfg.idle;
+        ctx[i].burst_size = cfg.burst_size;
+        ctx[i].prefetch_ahead = cfg.prefetch_ahead;
+        ctx[i].flows = cfg.flows;
+        // What a replay is for: the cost of each inspection stage
+        ctx[i].stage_cycles = cfg.stage_cycles || replay;
+        std::copy(cfg.lcores.begin(), cfg.lcores.end(), ctx[i].lcores.begin());
+    }
     
 	/******************************************************************************************************************
 											Begin software forwarders
 	******************************************************************************************************************/
-    unsigned lcore_id = rte_get_next_lcore(-1, 1, 0);
-    // for(auto & i : ctx){
-    //     lcore_id = launch_software_forwarder(lcore_id, i);
-    //     break; // todo: here
-    // }
-    // rte_eal_remote_launch(software_forwarder_thread, &ctx, lcore_id);
+    // The counters page has to be in place before any forwarder claims its slot
+    MetricsPage metrics;
+    if (!topology.metrics_path.empty()) {
+        int ret = metrics.publish(topology.metrics_path);
+        if (ret < 0)
+            printf("Cannot publish metrics page %s: %s\n", topology.metrics_path.c_str(), strerror(-ret));
+        else
+            printf("Per lcore counters published in %s\n", topology.metrics_path.c_str());
+    }
 
-    lcore_id = launch_software_forwarder(lcore_id, ctx[3]);    
+    // The writer takes its time base now, before any packet can be captured. It is launched once the
+    // forwarders have their lcores. One pcapng interface per context, whether it captures or not: interface i is context i
+    std::unique_ptr<CaptureWriter> capture;
+    bool capture_on_main = false;
+    if (capture_ring != nullptr) {
+        std::vector<std::string> interfaces;
+        for (const ForwardingContext &c : ctx)
+            interfaces.push_back("ctx" + std::to_string(c.ctx_id));
+        capture.reset(new CaptureWriter(topology.capture, capture_ring, interfaces));
+    }
+
+    // Each context owns its own SPSC ring so all directions can run at once
+    for(auto & i : ctx){
+        launch_software_forwarder(i);
+    }
+    NumaPlacement::report(ctx);
+    // The feeder starts once every context polls the replay port
+    if (replay)
+        replay->launch();
+
+    /******************************************************************************************************************
+											Capture writer
+	******************************************************************************************************************/
+    if (capture) {
+        unsigned int capture_lcore = NumaPlacement::free_worker_lcore(rte_socket_id());
+        if (capture_lcore < RTE_MAX_LCORE) {
+            rte_eal_remote_launch(CaptureWriter::run, capture.get(), capture_lcore);
+        } else {
+            printf("No free lcore for the capture writer, polling it from the main lcore\n");
+            capture_on_main = true;
+        }
+    }
+
+    /******************************************************************************************************************
+											Kafka producer service
+	******************************************************************************************************************/
+    std::unique_ptr<RdKafkaTransport> kafka_transport;
+    std::unique_ptr<KafkaService> kafka;
+    int kafka_topic = -1;
+    bool kafka_on_main = false;
+    if (topology.kafka_enabled) {
+        kafka_transport.reset(new RdKafkaTransport(topology.kafka));
+        kafka.reset(new KafkaService(kafka_transport.get(), topology.kafka));
+        kafka_topic = kafka->add_topic(topology.kafka_topic.c_str());
+
+        unsigned int kafka_lcore = NumaPlacement::free_worker_lcore(rte_socket_id());
+        if (kafka_lcore < RTE_MAX_LCORE) {
+            rte_eal_remote_launch(KafkaService::run, kafka.get(), kafka_lcore);
+        } else {
+            printf("No free lcore for the Kafka service, polling it from the main lcore\n");
+            kafka_on_main = true;
+        }
+    }
     /******************************************************************************************************************
 											Begin stats producers
 	******************************************************************************************************************/
     // std::vector<StatsLog> stats;
-    // stats.reserve(NB_FORWARDS);
-    // for (int i = 0; i < NB_FORWARDS; i++) {
-    //     // std::string topic_str = "Ports" + std::to_string(i);
-    //     stats.emplace_back(&ctx[i], "Ports");
+    // stats.reserve(ctx.size());
+    // for (size_t i = 0; i < ctx.size(); i++) {
+    //     stats.emplace_back(&ctx[i], kafka.get(), kafka_topic);
     //     lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
     //     rte_eal_remote_launch(StatsLog_run_producer, &stats[i], lcore_id);
     // }
 
-	CmacStats oldStats_0;
-    CmacStats oldStats_1;
-    // CmacStats accumStats;
-
-    while (!sigkill) {
-        CmacStats stats0 = onic0.get_cmac_stats(0);
-		CmacStats stats1 = onic1.get_cmac_stats(1);
-        
-		if(stats0.rx_total_pkts != oldStats_0.rx_total_pkts || stats1.rx_total_pkts != oldStats_1.rx_total_pkts){
-            if(stats0.rx_total_pkts != 0 || stats1.rx_total_pkts != 0){
-                oldStats_0 = stats0;
-                oldStats_1 = stats1;
-                // uint16_t rx_port_id = (ctx[0].rx_onic->get_ports()[ctx[0].rx_port]).get_port_id();
-                uint16_t rx_port_id = 1;
-                // rte_pmd_qdma_qstats(0, 0);
-                // rte_pmd_qdma_qstats(rx_port_id, 0);
-            
-                // rte_pmd_qdma_dbg_regdump(0);
-
-                onic0.print_packet_adaptor_stats(0);
-                stats0.print();
-                onic1.print_packet_adaptor_stats(1);
-                stats1.print();
-                printf("********************************************************** ");
-                // rte_pmd_qdma_dbg_regdump(1);
+    // CMAC counters of every onic as 64-bit totals and rates, ticked on their own schedule.
+    // Rates are printed whenever a CMAC saw traffic in the last interval
+    std::vector<CmacCollector> cmacs;
+    for (auto &onic : onics)
+        cmacs.push_back(CmacCollector::for_onic(*onic, topology.cmac_interval_ms,
+                                                topology.cmac_mode, topology.cmac_width));
+    LineEncoder stats_batch;
+    LcoreStatsReporter lcore_reporter;
+    LatencyHistReporter latency_reporter;
+    std::unique_ptr<FlowRecordConsumer> flow_records;
+    if (flow_ring != nullptr)
+        flow_records.reset(new FlowRecordConsumer(flow_ring));
+    std::unique_ptr<LatencyRecordConsumer> latency_records;
+    if (stats_ring != nullptr)
+        latency_records.reset(new LatencyRecordConsumer(stats_ring));
+    uint64_t next_report_us = cmac_now_us();
+
+    // A replay with a loop count ends on its own once the last loop went through the pipeline
+    while (!sigkill && !(replay && replay->done())) {
+        uint64_t now_us = cmac_now_us();
+        for (size_t i = 0; i < onics.size(); i++) {
+            if (!cmacs[i].poll(now_us))
+                continue;
+            const char *name = topology.onics[i].name.c_str();
+            for (int cmac_id = 0; cmac_id < NB_CMAC; cmac_id++) {
+                const CmacRates &rates = cmacs[i].rates(cmac_id);
+                if (!rates.valid || (rates.rx_pps == 0 && rates.tx_pps == 0))
+                    continue;
+                onics[i]->print_packet_adaptor_stats(cmac_id);
+                cmacs[i].print(name, cmac_id);
+                if (kafka)
+                    cmacs[i].encode(stats_batch, name, cmac_id);
             }
-		}
-
-        sleep(1);
-    }
-
-    // while (!sigkill);
-
-    // Cleanup
-    for(auto & i : ctx)
-        rte_atomic32_set(&i.stop_flag, 1);
-
-    unsigned nb_lcores = rte_lcore_count();  // Get the total number of cores
-    for (lcore_id = 1; lcore_id < nb_lcores; lcore_id++) {  // Skip lcore 0 (main core)
-        if (rte_lcore_is_enabled(lcore_id)) {  // Check if the lcore is enabled
-            printf("Waiting for Lcore %u to finish...\n", lcore_id);
-            rte_eal_wait_lcore(lcore_id);  // Wait for the lcore to finish
         }
-    }
-	/******************************************************************************************************************
-											Kafka test
-	******************************************************************************************************************/
-	// const char *topic = "telegraf";
-    // const char *payload = "TestTable,tag1=test ti=50,t2=\"1\"\n";
-    // produce_kafka(topic, payload, strlen(payload), NULL, 0);
-	rte_delay_ms(1000);
-
-    return 0;
-}
 
-unsigned int launch_software_forwarder(unsigned int prev_lcore_id, ForwardingContext &ctx){
-    ctx.print_schema();
-    prev_lcore_id = rte_get_next_lcore(prev_lcore_id, 1, 0);
-    rte_eal_remote_launch(fpga_rx_thread, &ctx, prev_lcore_id);
-
-    prev_lcore_id = rte_get_next_lcore(prev_lcore_id, 1, 0);
-    rte_eal_remote_launch(fpga_tx_thread, &ctx, prev_lcore_id);
+        // Flow records as fast as they come: a batch goes out each time it fills up
+        if (flow_records) {
+            while (flow_records->drain(kafka ? &stats_batch : nullptr) > 0 && kafka && stats_batch.nearly_full()) {
+                size_t len = stats_batch.size();
+                kafka->send(kafka_topic, stats_batch.release(), len);
+            }
+        }
+        // Same for the raw latency records: the ring only has to hold what arrives in one sleep of this loop
+        if (latency_records) {
+            while (latency_records->drain(kafka ? &stats_batch : nullptr) > 0 && kafka && stats_batch.nearly_full()) {
+                size_t len = stats_batch.size();
+                kafka->send(kafka_topic, stats_batch.release(), len);
+            }
+        }
 
-    return prev_lcore_id;
-}
+        if (now_us >= next_report_us) {
+            next_report_us = now_us + US_PER_S;
+            metrics.heartbeat();
+            if (replay)
+                replay->report();
+            if (capture)
+                capture->report();
+            lcore_reporter.report(ctx, kafka ? &stats_batch : nullptr);
+            // Hop latency percentiles of the last second, only contexts that saw timestamp packets print
+            for (const ForwardingContext &c : ctx)
+                latency_reporter.report(c.ctx_id, kafka ? &stats_batch : nullptr);
+            if (flow_records)
+                flow_records->report();
+            if (latency_records)
+                latency_records->report();
+            if (kafka)
+                kafka->print_stats();
+        }
 
-void produce_kafka(const char *topic, const char *payload, size_t payload_len, const char *key, size_t key_len) {
-    char hostname[128];
-    char errstr[512];
+        // Between reports the ring only has to hold what arrives in one sleep of this loop
+        if (capture_on_main)
+            capture->drain();
 
-    // 1. Create Kafka configuration
-    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+        // CMAC and lcore lines of this round go out as one message
+        if (kafka && !stats_batch.empty()) {
+            size_t len = stats_batch.size();
+            kafka->send(kafka_topic, stats_batch.release(), len);
+        }
 
-    // 2. Set client ID (hostname)
-    if (gethostname(hostname, sizeof(hostname))) {
-        std::cerr << "Failed to get hostname: " << strerror(errno) << std::endl;
-        exit(1);
-    }
+        // Without an lcore of its own the Kafka service runs here, until its queue is empty
+        if (kafka_on_main) {
+            while (kafka->run_once() == KAFKA_BURST)
+                ;
+        }
 
-    if (rd_kafka_conf_set(conf, "client.id", hostname, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
-        std::cerr << "Kafka config error (client.id): " << errstr << std::endl;
-        exit(1);
+        // Wake up for whichever comes first: the next CMAC tick, the next report or the next Kafka poll
+        uint64_t sleep_us = next_report_us - now_us;
+        for (const CmacCollector &collector : cmacs)
+            sleep_us = std::min(sleep_us, collector.us_until_due(now_us));
+        if (kafka_on_main)
+            sleep_us = std::min(sleep_us, kafka->us_until_due());
+        rte_delay_us_sleep(std::max<uint64_t>(sleep_us, 1000));
     }
 
-    // 3. Set brokers (comma-separated list)
-    if (rd_kafka_conf_set(conf, "bootstrap.servers", "localhost:9092", errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
-        std::cerr << "Kafka config error (bootstrap.servers): " << errstr << std::endl;
-        exit(1);
+    // Cleanup
+    for(auto & i : ctx)
+        rte_atomic32_set(&i.stop_flag, 1);
+    if (replay)
+        replay->stop();
+    if (capture)
+        capture->stop();
+
+    if (kafka) {
+        kafka->stop();
+        if (kafka_on_main)
+            kafka->drain(5000);
     }
 
-    // 4. Topic configuration (acks=all for reliability)
-    rd_kafka_topic_conf_t *topic_conf = rd_kafka_topic_conf_new();
-    if (rd_kafka_topic_conf_set(topic_conf, "acks", "all", errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
-        std::cerr << "Kafka topic config error (acks): " << errstr << std::endl;
-        exit(1);
+    printf("Waiting for lcores to finish...\n");
+    rte_eal_mp_wait_lcore();
+    if (replay) {
+        // Last per-stage lines, then the rate of the whole run
+        lcore_reporter.report(ctx);
+        for (const ForwardingContext &c : ctx)
+            latency_reporter.report(c.ctx_id);
+        replay->summary();
     }
-
-    // 5. Create Kafka producer
-    rd_kafka_t *rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
-    if (!rk) {
-        std::cerr << "Failed to create Kafka producer: " << errstr << std::endl;
-        exit(1);
+    // What the forwarders captured last, then the mbufs go back before their pools do
+    if (capture) {
+        capture->drain();
+        capture->report();
+        capture.reset();
     }
-
-    // 6. Create topic object
-    rd_kafka_topic_t *rkt = rd_kafka_topic_new(rk, topic, topic_conf);
-    if (!rkt) {
-        std::cerr << "Failed to create topic object: " << rd_kafka_err2str(rd_kafka_last_error()) << std::endl;
-        exit(1);
+    // What the rx lcores still had in their tables when they stopped
+    if (flow_records) {
+        flow_records->drain();
+        flow_records->report();
     }
-
-    // 7. Produce message
-    if (rd_kafka_produce(
-            rkt,
-            RD_KAFKA_PARTITION_UA,  // Let Kafka choose partition
-            RD_KAFKA_MSG_F_COPY,    // Copy payload (so you can reuse the buffer)
-            (void *)payload,        // Message payload
-            payload_len,            // Payload length
-            key,                    // Optional key (NULL if unused)
-            key_len,               // Key length (0 if unused)
-            NULL                    // Opaque message data (optional)
-        ) == -1) {
-        std::cerr << "Failed to produce to topic " << topic << ": "
-                  << rd_kafka_err2str(rd_kafka_last_error()) << std::endl;
-    } else {
-        std::cout << "Successfully produced message to topic: " << topic << std::endl;
+    if (latency_records) {
+        latency_records->drain();
+        latency_records->report();
     }
+    metrics.unpublish();
+    for(auto & i : ctx)
+        i.free_ring();
+    rte_ring_free(stats_ring);
+    rte_ring_free(flow_ring);
+    rte_ring_free(capture_ring);
+    replay.reset();
+	rte_delay_ms(1000);
 
-    // 8. Wait for messages to be delivered (optional but recommended)
-    rd_kafka_flush(rk, 10 * 1000);  // Wait up to 10 seconds
-
-    // 9. Cleanup
-    rd_kafka_topic_destroy(rkt);
-    rd_kafka_destroy(rk);
+    return 0;
 }
@@ -25,6 +25,9 @@
 #include "onic.h"
 
 #include "stats.h"
+#include "topology.h"
+#include "numa.h"
+#include "lcore_stats.h"
 
 #include "../tools/dpdk-stable/drivers/net/qdma/rte_pmd_qdma.h"
 
@@ -32,5 +35,3 @@
 #include <atomic>
 #include <csignal>
 
-// Parsing toml files
-#include "toml.hpp"
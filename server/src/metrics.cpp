@@ -0,0 +1,215 @@
+#include "metrics.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+
+#define METRICS_FIELD(name, kind) {#name, (uint32_t)offsetof(LcoreStats, name), sizeof(LcoreStats::name), kind}
+
+static const MetricsField FIELDS[] = {
+    METRICS_FIELD(ctx_id, METRICS_I32),
+    METRICS_FIELD(role, METRICS_STR),
+    METRICS_FIELD(rx_pkts, METRICS_U64),
+    METRICS_FIELD(tx_pkts, METRICS_U64),
+    METRICS_FIELD(rx_bytes, METRICS_U64),
+    METRICS_FIELD(tx_bytes, METRICS_U64),
+    METRICS_FIELD(rx_bursts, METRICS_U64),
+    METRICS_FIELD(empty_polls, METRICS_U64),
+    METRICS_FIELD(bursts_small, METRICS_U64),
+    METRICS_FIELD(bursts_large, METRICS_U64),
+    METRICS_FIELD(bursts_full, METRICS_U64),
+    METRICS_FIELD(busy_cycles, METRICS_U64),
+    METRICS_FIELD(idle_cycles, METRICS_U64),
+    METRICS_FIELD(idle_waits, METRICS_U64),
+    METRICS_FIELD(wait_cycles, METRICS_U64),
+    METRICS_FIELD(ring_drops, METRICS_U64),
+    METRICS_FIELD(ring_full, METRICS_U64),
+    METRICS_FIELD(ring_hwm, METRICS_U64),
+    METRICS_FIELD(tx_drops, METRICS_U64),
+    METRICS_FIELD(tx_retries, METRICS_U64),
+    METRICS_FIELD(tx_retried, METRICS_U64),
+    METRICS_FIELD(latency_records, METRICS_U64),
+    METRICS_FIELD(latency_drops, METRICS_U64),
+    METRICS_FIELD(tx_flushes, METRICS_U64),
+    METRICS_FIELD(flows_new, METRICS_U64),
+    METRICS_FIELD(flows_active, METRICS_U64),
+    METRICS_FIELD(flow_untracked, METRICS_U64),
+    METRICS_FIELD(flows_expired, METRICS_U64),
+    METRICS_FIELD(flows_evicted, METRICS_U64),
+    METRICS_FIELD(flow_records, METRICS_U64),
+    METRICS_FIELD(flow_record_drops, METRICS_U64),
+    METRICS_FIELD(parse_cycles, METRICS_U64),
+    METRICS_FIELD(flow_cycles, METRICS_U64),
+    METRICS_FIELD(latency_cycles, METRICS_U64),
+    METRICS_FIELD(capture_cycles, METRICS_U64),
+    METRICS_FIELD(capture_pkts, METRICS_U64),
+    METRICS_FIELD(capture_drops, METRICS_U64),
+};
+#define NB_FIELDS (sizeof(FIELDS) / sizeof(FIELDS[0]))
+
+static_assert(sizeof(MetricsHeader) % 8 == 0, "MetricsHeader must keep the field table aligned");
+static_assert(sizeof(LcoreStats) % RTE_CACHE_LINE_SIZE == 0, "LcoreStats slots must not share cache lines");
+
+static inline size_t field_table_offset() {
+    return sizeof(MetricsHeader);
+}
+
+static inline size_t slot_offset() {
+    return RTE_ALIGN_CEIL(field_table_offset() + sizeof(FIELDS), RTE_CACHE_LINE_SIZE);
+}
+
+size_t MetricsPage::page_size() {
+    return slot_offset() + sizeof(LcoreStats) * RTE_MAX_LCORE;
+}
+
+int MetricsPage::publish(const std::string &path) {
+    if (header != nullptr)
+        return -EBUSY;
+
+    // A fresh inode: readers still holding the previous run's page keep seeing it stop, not change under them
+    unlink(path.c_str());
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return -errno;
+
+    size_t len = page_size();
+    if (ftruncate(fd, len) < 0) {
+        int err = errno;
+        ::close(fd);
+        unlink(path.c_str());
+        return -err;
+    }
+    void *mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        int err = errno;
+        unlink(path.c_str());
+        return -err;
+    }
+
+    auto *hdr = (MetricsHeader *)mem;
+    hdr->version = METRICS_VERSION;
+    hdr->header_size = sizeof(MetricsHeader);
+    hdr->field_offset = field_table_offset();
+    hdr->nb_fields = NB_FIELDS;
+    hdr->field_size = sizeof(MetricsField);
+    hdr->slot_offset = slot_offset();
+    hdr->nb_slots = RTE_MAX_LCORE;
+    hdr->slot_size = sizeof(LcoreStats);
+    hdr->tsc_hz = rte_get_tsc_hz();
+    hdr->start_tsc = rte_get_tsc_cycles();
+    hdr->heartbeat_tsc = hdr->start_tsc;
+    hdr->pid = getpid();
+    memcpy((uint8_t *)mem + field_table_offset(), FIELDS, sizeof(FIELDS));
+    lcore_stats_relocate((LcoreStats *)((uint8_t *)mem + slot_offset()));
+    __atomic_store_n(&hdr->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+
+    this->path = path;
+    base = mem;
+    size = len;
+    header = hdr;
+    return 0;
+}
+
+void MetricsPage::unpublish() {
+    if (header == nullptr)
+        return;
+    lcore_stats_relocate(nullptr);
+    __atomic_store_n(&header->magic, 0, __ATOMIC_RELEASE);
+    munmap(base, size);
+    unlink(path.c_str());
+    base = nullptr;
+    header = nullptr;
+    size = 0;
+}
+
+void MetricsPage::heartbeat() {
+    if (header != nullptr)
+        __atomic_store_n(&header->heartbeat_tsc, rte_get_tsc_cycles(), __ATOMIC_RELAXED);
+}
+
+int MetricsReader::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(MetricsHeader)) {
+        ::close(fd);
+        return -EPROTO;
+    }
+    void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED)
+        return -errno;
+
+    base = (const uint8_t *)mem;
+    size = st.st_size;
+    header = (const MetricsHeader *)mem;
+
+    // Everything the header points at must be inside the file, whatever version wrote it
+    const MetricsHeader &h = *header;
+    bool ok = __atomic_load_n(&h.magic, __ATOMIC_ACQUIRE) == METRICS_MAGIC &&
+              h.version == METRICS_VERSION &&
+              h.field_size >= sizeof(MetricsField) &&
+              (uint64_t)h.field_offset + (uint64_t)h.nb_fields * h.field_size <= size &&
+              (uint64_t)h.slot_offset + (uint64_t)h.nb_slots * h.slot_size <= size;
+    for (uint32_t i = 0; ok && i < h.nb_fields; i++) {
+        const MetricsField &f = field(i);
+        ok = f.offset + f.size <= h.slot_size && (f.kind != METRICS_U64 || (f.size == 8 && f.offset % 8 == 0));
+    }
+    if (!ok) {
+        close();
+        return -EPROTO;
+    }
+    return 0;
+}
+
+void MetricsReader::close() {
+    if (base != nullptr)
+        munmap((void *)base, size);
+    base = nullptr;
+    header = nullptr;
+    size = 0;
+}
+
+const MetricsField &MetricsReader::field(int field_id) const {
+    return *(const MetricsField *)(base + header->field_offset + (size_t)field_id * header->field_size);
+}
+
+int MetricsReader::find_field(const char *name) const {
+    for (uint32_t i = 0; i < header->nb_fields; i++) {
+        if (strncmp(field(i).name, name, METRICS_FIELD_NAME_LEN) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const uint8_t *MetricsReader::slot(unsigned int slot_id) const {
+    return base + header->slot_offset + (size_t)slot_id * header->slot_size;
+}
+
+uint64_t MetricsReader::read_u64(unsigned int slot_id, int field_id) const {
+    return __atomic_load_n((const uint64_t *)(slot(slot_id) + field(field_id).offset), __ATOMIC_RELAXED);
+}
+
+int32_t MetricsReader::read_i32(unsigned int slot_id, int field_id) const {
+    return __atomic_load_n((const int32_t *)(slot(slot_id) + field(field_id).offset), __ATOMIC_ACQUIRE);
+}
+
+void MetricsReader::read_str(unsigned int slot_id, int field_id, char *buf, size_t len) const {
+    const MetricsField &f = field(field_id);
+    size_t n = RTE_MIN(len - 1, (size_t)f.size);
+    memcpy(buf, slot(slot_id) + f.offset, n);
+    buf[n] = '\0';
+}
+
+uint64_t MetricsReader::heartbeat_tsc() const {
+    return __atomic_load_n(&header->heartbeat_tsc, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "lcore_stats.h"
+
+#define METRICS_DEFAULT_PATH "/dev/shm/onic_app.metrics"
+#define METRICS_MAGIC (0x31525443494e4fULL) // "ONICTR1" little endian
+#define METRICS_VERSION (1)
+#define METRICS_FIELD_NAME_LEN (24)
+
+enum MetricsFieldKind : uint16_t {
+    METRICS_U64 = 0, // counter, read with an 8 byte load
+    METRICS_I32 = 1,
+    METRICS_STR = 2, // NUL terminated within size
+};
+
+// Layout of the page, all offsets from its start. Readers locate everything through the header and
+// the field table, so fields can be added without breaking them; version only changes when an
+// existing field changes meaning
+struct MetricsHeader {
+    uint64_t magic;          // written last, the page is not ready until it matches
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t field_offset;
+    uint32_t nb_fields;
+    uint32_t field_size;
+    uint32_t slot_offset;    // cache line aligned
+    uint32_t nb_slots;       // one per lcore id
+    uint32_t slot_size;
+    uint64_t tsc_hz;
+    uint64_t start_tsc;
+    uint64_t heartbeat_tsc;  // bumped by the main lcore, stops moving when the app is gone
+    int32_t pid;
+    uint32_t reserved;
+};
+
+struct MetricsField {
+    char name[METRICS_FIELD_NAME_LEN];
+    uint32_t offset;         // within a slot
+    uint16_t size;
+    uint16_t kind;
+};
+
+// Publishes the LcoreStats slots in a file mapped MAP_SHARED (tmpfs under /dev/shm), so external
+// tools read the datapath counters with plain loads, no EAL and no request to the app.
+// The workers keep writing their slot through lcore_stats, which is redirected into the page
+class MetricsPage {
+    private:
+        std::string path;
+        void *base = nullptr;
+        size_t size = 0;
+        MetricsHeader *header = nullptr;
+
+    public:
+        MetricsPage() = default;
+        MetricsPage(const MetricsPage &) = delete;
+        MetricsPage &operator=(const MetricsPage &) = delete;
+        ~MetricsPage() { unpublish(); }
+
+        // Must run before the forwarders are launched. Replaces any page left by a previous run,
+        // returns 0 or -errno
+        int publish(const std::string &path);
+        // Moves lcore_stats back to private memory and removes the file, workers must be stopped
+        void unpublish();
+        void heartbeat();
+
+        bool published() const { return header != nullptr; }
+        static size_t page_size();
+};
+
+// Read-only view of a published page, for tools outside the app
+class MetricsReader {
+    private:
+        const uint8_t *base = nullptr;
+        size_t size = 0;
+        const MetricsHeader *header = nullptr;
+
+        const uint8_t *slot(unsigned int slot_id) const;
+
+    public:
+        MetricsReader() = default;
+        MetricsReader(const MetricsReader &) = delete;
+        MetricsReader &operator=(const MetricsReader &) = delete;
+        ~MetricsReader() { close(); }
+
+        // Returns 0, -errno, or -EPROTO when the page is not ready or its layout is not understood
+        int open(const char *path);
+        void close();
+
+        const MetricsHeader &info() const { return *header; }
+        const MetricsField &field(int field_id) const;
+        // -1 if this page does not have it
+        int find_field(const char *name) const;
+
+        uint64_t read_u64(unsigned int slot_id, int field_id) const;
+        int32_t read_i32(unsigned int slot_id, int field_id) const;
+        // Copies a string field into buf of len bytes, always NUL terminated
+        void read_str(unsigned int slot_id, int field_id, char *buf, size_t len) const;
+        uint64_t heartbeat_tsc() const;
+};
@@ -0,0 +1,69 @@
+#include "numa.h"
+#include "forward_context.h"
+
+#include <rte_mempool.h>
+#include <rte_memzone.h>
+
+NumaPolicy NumaPlacement::policy = NumaPolicy::WARN;
+
+unsigned int NumaPlacement::free_worker_lcore(int socket_id){
+    unsigned int lcore_id;
+    unsigned int fallback = RTE_MAX_LCORE;
+
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (rte_eal_get_lcore_state(lcore_id) == RUNNING)
+            continue;
+        if ((int)rte_lcore_to_socket_id(lcore_id) == socket_id)
+            return lcore_id;
+        if (fallback == RTE_MAX_LCORE)
+            fallback = lcore_id;
+    }
+    return fallback;
+}
+
+void NumaPlacement::check(const char *what, int want_socket, int got_socket){
+    if (want_socket < 0 || got_socket < 0 || want_socket == got_socket)
+        return;
+
+    if (policy == NumaPolicy::STRICT)
+        rte_exit(EXIT_FAILURE, "%s is on socket %d but its port is on socket %d (numa_policy=strict)\n",
+                 what, got_socket, want_socket);
+    RTE_LOG(WARNING, USER1, "%s is on socket %d but its port is on socket %d, expect cross-socket traffic\n",
+            what, got_socket, want_socket);
+}
+
+static int mempool_socket(const Onic *onic, int port){
+    if (onic == nullptr)
+        return -1;
+    struct rte_mempool *mp = rte_mempool_lookup(onic->get_ports()[port].pinfo.mem_pool);
+    return (mp == NULL) ? -1 : mp->socket_id;
+}
+
+// The rx/tx Q descriptor rings are set up on the mempool's socket
+static int queue_socket(const Onic *onic, int port){
+    return (onic == nullptr) ? -1 : onic->get_ports()[port].pinfo.socket_id;
+}
+
+void NumaPlacement::report(const std::vector<ForwardingContext> &ctxs){
+    printf("NUMA placement (policy=%s)\n", (policy == NumaPolicy::STRICT) ? "strict" : "warn");
+    printf("%-6s %-14s %-14s %-12s %-12s %-12s %-12s %-10s %-14s %-14s\n",
+           "CTX", "rx_port:sock", "tx_port:sock", "rx_mp_sock", "tx_mp_sock", "rx_q_sock", "tx_q_sock", "ring_sock",
+           "lcore0:sock", "lcore1:sock");
+
+    for (const ForwardingContext &ctx : ctxs) {
+        char rx_port[16], tx_port[16], lcore0[16] = "-", lcore1[16] = "-";
+        snprintf(rx_port, sizeof(rx_port), "%u:%d", ctx.rx_port_id, rte_eth_dev_socket_id(ctx.rx_port_id));
+        snprintf(tx_port, sizeof(tx_port), "%u:%d", ctx.tx_port_id, rte_eth_dev_socket_id(ctx.tx_port_id));
+        if (ctx.lcores[0] >= 0)
+            snprintf(lcore0, sizeof(lcore0), "%d:%u", ctx.lcores[0], rte_lcore_to_socket_id(ctx.lcores[0]));
+        if (ctx.lcores[1] >= 0 && ctx.mode == ForwardMode::PIPELINED)
+            snprintf(lcore1, sizeof(lcore1), "%d:%u", ctx.lcores[1], rte_lcore_to_socket_id(ctx.lcores[1]));
+        int ring_socket = (ctx.mbuf_ring == nullptr) ? -1 : ctx.mbuf_ring->memzone->socket_id;
+
+        printf("%-6d %-14s %-14s %-12d %-12d %-12d %-12d %-10d %-14s %-14s\n",
+               ctx.ctx_id, rx_port, tx_port,
+               mempool_socket(ctx.rx_onic, ctx.rx_port), mempool_socket(ctx.tx_onic, ctx.tx_port),
+               queue_socket(ctx.rx_onic, ctx.rx_port), queue_socket(ctx.tx_onic, ctx.tx_port),
+               ring_socket, lcore0, lcore1);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+
+// What to do when an object ends up on another socket than the port it serves
+enum class NumaPolicy {
+    WARN,   // log and carry on
+    STRICT, // refuse to start
+};
+
+struct ForwardingContext;
+
+class NumaPlacement {
+    public:
+        static NumaPolicy policy;
+
+        // Socket a port's memory/lcores should live on, the caller's socket when unknown (vdevs)
+        static int port_socket(uint16_t port_id) {
+            int socket_id = rte_eth_dev_socket_id(port_id);
+            return (socket_id < 0) ? (int)rte_socket_id() : socket_id;
+        }
+
+        // Free worker lcore on socket_id, any free worker when none is left there; RTE_MAX_LCORE when all are busy
+        static unsigned int free_worker_lcore(int socket_id);
+
+        // Reports an object placed on got_socket while it serves want_socket, exits under NumaPolicy::STRICT
+        static void check(const char *what, int want_socket, int got_socket);
+
+        // Where every port, mempool, ring and lcore of the launched contexts ended up
+        static void report(const std::vector<ForwardingContext> &ctxs);
+};
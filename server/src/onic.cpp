@@ -16,47 +16,50 @@
  */
 
 #include "onic.h"
+#include "cmac_bringup.h"
+
+#include <cerrno>
 
 int Onic::ONIC_LOG_TYPE = rte_log_register("Onic");
 
 int Onic::init_hardware(){
     // Init Queue config regs
-    write_reg(0x1000, 0x1);
-    write_reg(0x2000, 0x00010001);
-
-    /* get the number of CMAC instances */
-    while ((read_reg(SYSCFG_OFFSET_SHELL_STATUS) & 0x10) != 0x10);
-    int i;
-    for (i = 0; i < NB_CMAC; ++i) {
-        int shell_idx = (0x10 << (4*i));
-
-        write_reg(SYSCFG_OFFSET_SHELL_RESET, shell_idx);
-		while ((read_reg(SYSCFG_OFFSET_SHELL_STATUS) & shell_idx) != shell_idx) {
-            rte_delay_ms(CMAC_RESET_WAIT_MS);
-        }
-
-        uint32_t val = read_reg(CMAC_OFFSET_CORE_VERSION(i));
-        if (val != ONIC_CMAC_CORE_VERSION)
-            break;
-        enable_cmac(i);
-    }
-    onic_log(RTE_LOG_INFO, "Number of CMAC instances enabled = %d\n", i);
+    for (int func_id = 0; func_id < nb_ports; func_id++)
+        config_qdma_func(func_id);
+
+    CmacBringup bringup({this});
+    int ret = bringup.run([this](unsigned int ms) { regs->delay_ms(ms); });
+    if (ret < 0)
+        onic_log(RTE_LOG_ERR, "Shell not out of reset after %d ms\n", SHELL_RESET_TIMEOUT_MS);
+    onic_log(RTE_LOG_INFO, "Number of CMAC instances enabled = %d\n", nb_cmacs);
     // rte_pmd_qdma_dbg_regdump()
-    return 0;
+    return ret;
 
 }
 
-int Onic::enable_cmac(int cmac_id){
-
-    if (cmac_id == 0) {
-        write_reg(SYSCFG_OFFSET_SHELL_RESET, 0x10);
-        while ((read_reg(SYSCFG_OFFSET_SHELL_STATUS) & 0x10) != 0x10)
-            rte_delay_ms(CMAC_RESET_WAIT_MS);
-    } else {
-        write_reg(SYSCFG_OFFSET_SHELL_RESET, 0x100);
-        while ((read_reg(SYSCFG_OFFSET_SHELL_STATUS) & 0x100) != 0x100)
-            rte_delay_ms(CMAC_RESET_WAIT_MS);
+void Onic::init(bool init_cmacs) {
+    if (init_cmacs) {
+        init_status = init_hardware();
+        return;
     }
+    for (int func_id = 0; func_id < nb_ports; func_id++)
+        config_qdma_func(func_id);
+}
+
+// Spread rx flows of a function over all its Qs: the shell hashes each packet into the
+// indirection table, whose entries hold a Q index relative to the function's Q base
+void Onic::config_qdma_func(int func_id){
+    const PortInfo &pinfo = ports[func_id].pinfo;
+    uint32_t num_queues = pinfo.num_queues;
+
+    for (int k = 0; k < QDMA_INDIR_TABLE_SIZE; k++)
+        write_reg(QDMA_FUNC_OFFSET_INDIR_TABLE(func_id, k), k % num_queues);
+
+    write_reg(QDMA_FUNC_OFFSET_QCONF(func_id), (pinfo.queue_base << 16) | (num_queues & 0xFFFF));
+    onic_log(RTE_LOG_INFO, "QDMA func %d: queue_base=%u num_queues=%u\n", func_id, pinfo.queue_base, num_queues);
+}
+
+void Onic::configure_cmac(int cmac_id){
     if (RS_FEC) {
         /* Enable RS-FEC for CMACs with RS-FEC implemented */
         write_reg(CMAC_OFFSET_RSFEC_CONF_ENABLE(cmac_id), 0x3);
@@ -65,7 +68,9 @@ int Onic::enable_cmac(int cmac_id){
 
     write_reg(CMAC_OFFSET_CONF_RX_1(cmac_id), 0x1);
     write_reg(CMAC_OFFSET_CONF_TX_1(cmac_id), 0x10);
+}
 
+void Onic::start_cmac_tx(int cmac_id){
     write_reg(CMAC_OFFSET_CONF_TX_1(cmac_id), 0x1);
 
     /* RX flow control */
@@ -84,9 +89,6 @@ int Onic::enable_cmac(int cmac_id){
     write_reg(CMAC_OFFSET_CONF_TX_FC_RFRH_4(cmac_id), 0xFFFFFFFF);
     write_reg(CMAC_OFFSET_CONF_TX_FC_RFRH_5(cmac_id), 0x0000FFFF);
     write_reg(CMAC_OFFSET_CONF_TX_FC_CTRL_1(cmac_id), 0x000001FF);
-
-    printf("Successfully setup cmac id: %d\n", cmac_id);
-    return 0;
 }
 
 CmacStats Onic::get_cmac_stats(int cmac_id, bool debug) const{
@@ -154,7 +156,7 @@ void Onic::get_cmac_debug_stats(int cmac_id, CmacStats &stats) const{
     stats.rx_total_good_pkts= read_reg(CMAC_OFFSET_STAT_RX_TOTAL_GOOD_PKTS(cmac_id));
     stats.rx_total_bytes = read_reg(CMAC_OFFSET_STAT_RX_TOTAL_BYTES(cmac_id));
     stats.rx_total_good_bytes = read_reg(CMAC_OFFSET_STAT_RX_TOTAL_GOOD_BYTES(cmac_id));
-    stats.rx_pkt_65_127 = CMAC_OFFSET_STAT_RX_PKT_65_127_BYTES(cmac_id);
+    stats.rx_pkt_65_127 = read_reg(CMAC_OFFSET_STAT_RX_PKT_65_127_BYTES(cmac_id));
     stats.rx_pkt_large =  read_reg(CMAC_OFFSET_STAT_RX_PKT_LARGE(cmac_id));
     stats.rx_pkt_small =  read_reg(CMAC_OFFSET_STAT_RX_PKT_SMALL(cmac_id));
     stats.rx_undersize =  read_reg(CMAC_OFFSET_STAT_RX_UNDERSIZE(cmac_id));
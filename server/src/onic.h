@@ -2,10 +2,13 @@
 
 #include "onic_port.h"
 #include "onic_regs.h"
+#include "line_protocol.h"
+#include "reg_backend.h"
 #include <rte_cycles.h>
 
 #include <string>
 #include <array>
+#include <memory>
 #include <new>
 
 #define NB_CMAC (2)
@@ -16,11 +19,13 @@
 #define ONIC_CMAC_CORE_VERSION		(0x00000301)
 #define RX_ALIGN_TIMEOUT_MS			(1000)
 #define CMAC_RESET_WAIT_MS			(1)
+#define SHELL_RESET_TIMEOUT_MS		(1000)
+
+#define QDMA_INDIR_TABLE_SIZE		(128) // RSS hash -> Q entries per function
 
 #define FIELD_NAME(field) #field
 
-// Mempool constants
-#define RING_SIZE 8192
+class CmacBringup;
 
 struct CmacStats{
     uint32_t tx_total_pkts = 0;
@@ -119,6 +124,27 @@ struct CmacStats{
         return string_out;
     }
 
+    // Same fields as to_string(), straight into a line protocol batch
+    void encode(LineEncoder &enc, const char *tag) const {
+        char prefix[16];
+        size_t n = strlen(tag);
+        if (n > sizeof(prefix) - 3)
+            n = sizeof(prefix) - 3;
+        prefix[0] = '(';
+        memcpy(prefix + 1, tag, n);
+        prefix[n + 1] = ')';
+        prefix[n + 2] = '\0';
+
+        enc.field(prefix, "tx_total_pkts", tx_total_pkts)
+           .field(prefix, "tx_total_good_pkts", tx_total_good_pkts)
+           .field(prefix, "tx_total_bytes", tx_total_bytes)
+           .field(prefix, "tx_total_good_bytes", tx_total_good_bytes)
+           .field(prefix, "rx_total_pkts", rx_total_pkts)
+           .field(prefix, "rx_total_good_pkts", rx_total_good_pkts)
+           .field(prefix, "rx_total_bytes", rx_total_bytes)
+           .field(prefix, "rx_total_good_bytes", rx_total_good_bytes);
+    }
+
     void add(const CmacStats& other) {
         tx_total_pkts += other.tx_total_pkts;
         tx_total_good_pkts += other.tx_total_good_pkts;
@@ -136,55 +162,70 @@ class Onic {
     private:
         // Attributes
         std::array<OnicPort, NB_PORTS> ports;
+        int nb_ports;
         int config_port_id; // also refers to master_pf
         int axil_bar_id;
 
         int RS_FEC;
+        int nb_cmacs = 0;       // CMACs found and enabled by the bring-up
+        int init_status = 0;    // bring-up result, < 0 if the shell did not come up
+
+        // Every register access goes through regs: the QDMA user BAR, or a model/recording
+        std::unique_ptr<RegisterBackend> own_regs;
+        RegisterBackend *regs;
 
         // DPDK logs
         static int ONIC_LOG_TYPE;
 
-        inline static int ring_ids = 0;
-
     void onic_log(uint32_t level, const char *format, ...);
 
-    public:
-        // mempools
-        struct rte_ring *mbuf_ring; // NUMA local to onic
+    void init(bool init_cmacs);
+
+    // Sets nb_cmacs/init_status once every CMAC is through
+    friend class CmacBringup;
 
+    public:
         // High level functions
+        // QDMA functions then CMAC bring-up of this onic alone, see CmacBringup to bring up several at once
         int init_hardware();
-        int enable_cmac(int cmac_id);
+        // CMAC bring-up steps: rx on and tx sending RFI until rx is aligned, then tx on
+        void configure_cmac(int cmac_id);
+        void start_cmac_tx(int cmac_id);
+        void config_qdma_func(int func_id);
         CmacStats get_cmac_stats(int cmac_id, bool debug=false) const;
         void print_packet_adaptor_stats(int cmac_id);
         void get_cmac_debug_stats(int cmac_id, CmacStats &stats) const;
 
-        std::string ring_name;
-
-
-        // Constructors/etc
+        // Constructors/etc. With init_cmacs=false only the QDMA functions are set up: the CMACs are
+        // left to a CmacBringup shared with the other onics
         Onic(PortInfo portInfos[], int port_ids[], int nb_ports, int config_port_id=-1, int axil_bar_id=-1,
-            int RS_FEC=0) 
+            int RS_FEC=0, bool init_cmacs=true) 
         {
             assert(nb_ports <= NB_PORTS);
 
-            // setup ring
-            ring_name = std::to_string(ring_ids++);
-            mbuf_ring = rte_ring_create(ring_name.c_str(),
-                                    RING_SIZE,
-                                rte_eth_dev_socket_id(port_ids[0]),
-                                    RING_F_SP_ENQ | RING_F_SC_DEQ);
-            
             // setup Qs
             for(int i=0; i<nb_ports; i++) {
                 new (&ports[i]) OnicPort(portInfos[i], port_ids[i]);
             }
 
             // setup hardware
+            this->nb_ports = nb_ports;
             this->config_port_id = (config_port_id == -1) ? port_ids[0] : config_port_id;
             this->axil_bar_id = (axil_bar_id == -1) ? ports[0].get_pinfo().user_bar_idx : axil_bar_id;
             this->RS_FEC = RS_FEC;
-            init_hardware();
+            own_regs.reset(new QdmaRegisterBackend(this->config_port_id, this->axil_bar_id));
+            regs = own_regs.get();
+            init(init_cmacs);
+        };
+        // Control path only, no DPDK port behind it: the shell is reached through regs (not owned),
+        // portInfos only give the Q layout written to the QDMA function registers
+        Onic(RegisterBackend *regs, const PortInfo portInfos[], int nb_ports, int RS_FEC=0, bool init_cmacs=true)
+            : nb_ports(nb_ports), config_port_id(-1), axil_bar_id(-1), RS_FEC(RS_FEC), regs(regs)
+        {
+            assert(nb_ports <= NB_PORTS);
+            for(int i=0; i<nb_ports; i++)
+                ports[i].pinfo = portInfos[i];
+            init(init_cmacs);
         };
         ~Onic(){
             onic_log(RTE_LOG_INFO, "Reset Onic\n");
@@ -193,13 +234,16 @@ class Onic {
 
         // Base functions
         uint32_t read_reg(uint32_t offset) const{
-            return OnicPort::PciRead(axil_bar_id, offset, config_port_id);
+            return regs->read(offset);
         };
         void write_reg(uint32_t offset, uint32_t val) const{
-            OnicPort::PciWrite(axil_bar_id, offset, val,config_port_id);
+            regs->write(offset, val);
         };
 
         // getters/setters
         const std::array<OnicPort, NB_PORTS>& get_ports() const;
         std::array<int, NB_PORTS> get_port_ids() const;
-    };
+        int get_nb_cmacs() const { return nb_cmacs; }
+        RegisterBackend *get_regs() const { return regs; }
+        int get_init_status() const { return init_status; }
+    };
\ No newline at end of file
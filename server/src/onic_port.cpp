@@ -39,6 +39,19 @@ int OnicPort::port_init()
     */
     nb_buff = RTE_MAX(nb_buff, MP_CACHE_SZ * 2);
 
+    if (pinfo.nb_mbufs)
+        nb_buff = RTE_MAX(pinfo.nb_mbufs, MP_CACHE_SZ * 2);
+
+    /* Keep the pool and the Q rings next to the port unless a socket is forced */
+    int port_socket = NumaPlacement::port_socket(port_id);
+    if (pinfo.socket_id == SOCKET_ID_ANY) {
+        pinfo.socket_id = port_socket;
+    } else {
+        char what[64];
+        snprintf(what, sizeof(what), "Port %d mempool and Qs", port_id);
+        NumaPlacement::check(what, port_socket, pinfo.socket_id);
+    }
+
     mbuf_pool = rte_pktmbuf_pool_create(pinfo.mem_pool, nb_buff,
     MP_CACHE_SZ, 0, pinfo.buff_size +
     RTE_PKTMBUF_HEADROOM,
@@ -61,6 +74,7 @@ int OnicPort::port_init()
     memset(&port_conf, 0x0, sizeof(struct rte_eth_conf));
     memset(&tx_conf, 0x0, sizeof(struct rte_eth_txconf));
     memset(&rx_conf, 0x0, sizeof(struct rte_eth_rxconf));
+    port_conf.intr_conf.rxq = pinfo.rx_intr;
     diag = rte_pmd_qdma_get_bar_details(port_id,
         &(pinfo.config_bar_idx),
         &(pinfo.user_bar_idx),
@@ -103,14 +117,14 @@ int OnicPort::port_init()
                     "failed\n");
         }
 
-        diag = rte_eth_tx_queue_setup(port_id, x, pinfo.nb_descs, 0,
+        diag = rte_eth_tx_queue_setup(port_id, x, pinfo.nb_descs, pinfo.socket_id,
             &tx_conf);
         if (diag < 0)
         rte_exit(EXIT_FAILURE, "Cannot setup port %d "
                 "TX Queue id:%d "
                 "(err=%d)\n", port_id, x, diag);
         rx_conf.rx_thresh.wthresh = DEFAULT_RX_WRITEBACK_THRESH;
-        diag = rte_eth_rx_queue_setup(port_id, x, pinfo.nb_descs, 0,
+        diag = rte_eth_rx_queue_setup(port_id, x, pinfo.nb_descs, pinfo.socket_id,
             &rx_conf, mbuf_pool);
         if (diag < 0)
         rte_exit(EXIT_FAILURE, "Cannot setup port %d "
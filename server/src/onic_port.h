@@ -14,6 +14,7 @@
 #include <rte_spinlock.h>
 
 #include "onic_helper.h"
+#include "numa.h"
 
 #define QDMA_MAX_PORTS	256
 
@@ -68,12 +69,14 @@ struct PortInfo {
     unsigned int nb_descs;
     unsigned int st_queues;
     unsigned int buff_size;
-    unsigned int socket_id;
+    int socket_id; // SOCKET_ID_ANY places the mempool and the Q rings on the port's socket
     int config_bar_idx; // IP default is 0
     int user_bar_idx; // IP default is 2
     int bypass_bar_idx; // IP default is 4
     rte_spinlock_t port_update_lock;
     char mem_pool[RTE_MEMPOOL_NAMESIZE];
+    unsigned int nb_mbufs = 0; // 0 derives the mempool size from the Q/descriptor counts
+    bool rx_intr = false; // rx Q interrupts, for lcores that wait for traffic in epoll
 
     PortInfo(
         unsigned int queue_base = -1,
@@ -84,7 +87,7 @@ struct PortInfo {
         int config_bar_idx = -1,
         int user_bar_idx = -1,
         int bypass_bar_idx = -1,
-        unsigned int socket_id = rte_socket_id())
+        int socket_id = SOCKET_ID_ANY)
         :
             queue_base(queue_base),
             num_queues(num_queues),
@@ -107,7 +110,7 @@ class OnicPort { // this is really a qdma port...
 
     // public:
         // Constructors/etc
-        OnicPort(){};
+        OnicPort() : port_id(-1) {}; // no DPDK port: unused slot, or an Onic on a register model
         OnicPort(PortInfo pinfo, int port_id)
             : pinfo(pinfo), port_id(port_id)
             {
@@ -122,6 +125,8 @@ class OnicPort { // this is really a qdma port...
                 //     struct rte_pmd_qdma_dev_attributes *dev_attr) //check that setup worked
             }
         ~OnicPort(){
+            if (port_id < 0)
+                return;
             unregister_callbacks();
             if (pinfo.num_queues)
                 port_close();
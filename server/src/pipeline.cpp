@@ -1,18 +1,202 @@
 #include "pipeline.h"
+#include "burst_parse.h"
+#include "numa.h"
+#include "lcore_stats.h"
+#include "latency.h"
+#include "flow.h"
+
+#include <memory>
+
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+#include <rte_memcpy.h>
+
+// Idle config of one of the context's lcores: a sleeping lcore that owns tx buffers still has to flush them
+static IdleConfig lcore_idle_config(const ForwardingContext *ctx, bool sends){
+    IdleConfig cfg = ctx->idle;
+    if (sends && ctx->tx_policy == TxPolicy::BUFFER)
+        cfg.max_sleep_us = RTE_MIN(cfg.max_sleep_us, ctx->tx_flush_us);
+    return cfg;
+}
+
+static inline uint64_t burst_bytes(struct rte_mbuf *const *mbufs, uint16_t nb){
+    uint64_t bytes = 0;
+    for (uint16_t i = 0; i < nb; i++)
+        bytes += rte_pktmbuf_pkt_len(mbufs[i]);
+    return bytes;
+}
+
+// Flow table of an rx lcore, null when the context does not track flows
+static std::unique_ptr<FlowTable> lcore_flow_table(const ForwardingContext *ctx, LcoreStats *stats){
+    if (ctx->flows.capacity == 0)
+        return nullptr;
+    return std::unique_ptr<FlowTable>(new FlowTable(ctx->flows, rte_socket_id(), stats, ctx->flow_ring));
+}
+
+// Inspection stage shared by both forwarding modes, runs on the rx lcore before the burst is forwarded
+// flows and latency are null when the context does not track flows or parse latency.
+// The headers are parsed once into meta, the lcore's own, every later step reads them from there
+static inline void inspect_burst(struct ForwardingContext *ctx, LcoreStats *stats, FlowTable *flows, LcoreLatency *latency,
+                                 BurstMeta *meta, int rx_Q, struct rte_mbuf **mbufs, uint16_t nb_rx){
+    if (flows == nullptr && latency == nullptr && ctx->capture_ring == nullptr)
+        return;
+    StageClock stage(ctx->stage_cycles);
+    burst_parse(mbufs, nb_rx, meta, ctx->prefetch_ahead);
+    stage.lap(&stats->parse_cycles);
+    // Captured packets are only referenced once more: they go on to tx as they are
+    if (ctx->capture_ring != nullptr) {
+        capture_burst(ctx->capture, ctx->capture_ring, ctx->capture_if, stats, mbufs, *meta, rte_rdtsc());
+        stage.lap(&stats->capture_cycles);
+    }
+    if (flows != nullptr) {
+        flows->update_burst(mbufs, *meta, rte_rdtsc());
+        stage.lap(&stats->flow_cycles);
+    }
+    if (latency == nullptr)
+        return;
+
+    // Hop latencies go into this lcore's histograms. Raw records are only copied into the stats ring when
+    // one is set, the mbufs move on untouched
+    if (ctx->stats_ring == nullptr) {
+        LatencyField::parse_burst(mbufs, *meta, latency);
+        stage.lap(&stats->latency_cycles);
+        return;
+    }
+    LatencyRecord records[MAX_BURST_SIZE];
+    uint16_t nb_records = LatencyField::parse_burst(mbufs, *meta, latency, records, ctx->ctx_id, rx_Q, rte_get_tsc_cycles());
+    stage.lap(&stats->latency_cycles);
+    if (nb_records == 0)
+        return;
+
+    unsigned int nb_enq = rte_ring_enqueue_burst_elem(ctx->stats_ring, records, sizeof(LatencyRecord), nb_records, NULL);
+    lcore_stats_add(&stats->latency_records, nb_enq);
+    if (unlikely(nb_enq < nb_records))
+        lcore_stats_add(&stats->latency_drops, nb_records - nb_enq);
+}
 
-#define BURST_SIZE (32)
+// Sends bursts on the context's tx Qs following its TxPolicy, one per worker lcore
+class TxSender {
+    private:
+        ForwardingContext *ctx;
+        LcoreStats *stats;
+        uint16_t tx_port_id;
+        uint64_t retry_cycles;
+        uint64_t flush_cycles;
+        uint64_t last_flush = 0;
+        std::array<struct rte_eth_dev_tx_buffer *, MAX_Q_PER_FORWARDER> buffers = {};
+
+        // Buffered mbufs the NIC still refused when the buffer was sent
+        static void buffer_error_cb(struct rte_mbuf **unsent, uint16_t count, void *userdata){
+            auto *stats = (LcoreStats *)userdata;
+            lcore_stats_sub(&stats->tx_bytes, burst_bytes(unsent, count));
+            rte_pktmbuf_free_bulk(unsent, count);
+            lcore_stats_add(&stats->tx_drops, count);
+        }
+
+    public:
+        TxSender(ForwardingContext *ctx, LcoreStats *stats)
+            : ctx(ctx), stats(stats), tx_port_id(ctx->tx_port_id),
+              retry_cycles(rte_get_tsc_hz() / US_PER_S * ctx->tx_retry_us),
+              flush_cycles(rte_get_tsc_hz() / US_PER_S * ctx->tx_flush_us)
+        {
+            if (ctx->tx_policy != TxPolicy::BUFFER)
+                return;
+            for (int q_idx = 0; q_idx < ctx->nb_tx_Qs; q_idx++) {
+                buffers[q_idx] = (struct rte_eth_dev_tx_buffer *)rte_zmalloc_socket("tx_buffer",
+                    RTE_ETH_TX_BUFFER_SIZE(ctx->burst_size), 0, rte_eth_dev_socket_id(tx_port_id));
+                if (buffers[q_idx] == NULL)
+                    rte_exit(EXIT_FAILURE, "CTX(%d) Cannot allocate tx buffer\n", ctx->ctx_id);
+                rte_eth_tx_buffer_init(buffers[q_idx], ctx->burst_size);
+                rte_eth_tx_buffer_set_err_callback(buffers[q_idx], buffer_error_cb, stats);
+            }
+            last_flush = rte_get_tsc_cycles();
+        }
+
+        ~TxSender(){
+            for (int q_idx = 0; q_idx < ctx->nb_tx_Qs; q_idx++) {
+                if (buffers[q_idx] == NULL)
+                    continue;
+                rte_eth_tx_buffer_flush(tx_port_id, ctx->tx_Qs[q_idx], buffers[q_idx]);
+                rte_free(buffers[q_idx]);
+            }
+        }
+
+        // tx_bytes is counted before the mbufs are handed over, the driver may free them once sent.
+        // The tail the NIC refused is taken back out, so only dropped bytes are ever left out
+        inline void send(int q_idx, struct rte_mbuf **mbufs, uint16_t nb){
+            uint16_t tx_Q = ctx->tx_Qs[q_idx];
+            uint64_t bytes = burst_bytes(mbufs, nb);
+
+            if (ctx->tx_policy == TxPolicy::BUFFER) {
+                lcore_stats_add(&stats->tx_bytes, bytes);
+                uint16_t nb_tx = 0;
+                for (uint16_t i = 0; i < nb; i++)
+                    nb_tx += rte_eth_tx_buffer(tx_port_id, tx_Q, buffers[q_idx], mbufs[i]);
+                lcore_stats_add(&stats->tx_pkts, nb_tx);
+                return;
+            }
+
+            uint16_t nb_tx = rte_eth_tx_burst(tx_port_id, tx_Q, mbufs, nb);
+            if (unlikely(nb_tx < nb) && ctx->tx_policy == TxPolicy::RETRY) {
+                uint16_t first_try = nb_tx;
+                uint64_t deadline = rte_get_tsc_cycles() + retry_cycles;
+                do {
+                    rte_pause();
+                    nb_tx += rte_eth_tx_burst(tx_port_id, tx_Q, mbufs + nb_tx, nb - nb_tx);
+                    lcore_stats_add(&stats->tx_retries, 1);
+                } while (nb_tx < nb && rte_get_tsc_cycles() < deadline);
+                lcore_stats_add(&stats->tx_retried, nb_tx - first_try);
+            }
+            lcore_stats_add(&stats->tx_pkts, nb_tx);
+
+            // Free any untransmitted packets
+            if (unlikely(nb_tx < nb)) {
+                bytes -= burst_bytes(mbufs + nb_tx, nb - nb_tx);
+                rte_pktmbuf_free_bulk(mbufs + nb_tx, nb - nb_tx);
+                lcore_stats_add(&stats->tx_drops, nb - nb_tx);
+            }
+            lcore_stats_add(&stats->tx_bytes, bytes);
+        }
+
+        // Sends partially filled tx buffers once they are tx_flush_us old, a no-op for the other policies
+        inline void flush_if_due(){
+            if (ctx->tx_policy != TxPolicy::BUFFER)
+                return;
+            uint64_t now = rte_get_tsc_cycles();
+            if (now - last_flush < flush_cycles)
+                return;
+            last_flush = now;
+            for (int q_idx = 0; q_idx < ctx->nb_tx_Qs; q_idx++) {
+                uint16_t nb_tx = rte_eth_tx_buffer_flush(tx_port_id, ctx->tx_Qs[q_idx], buffers[q_idx]);
+                if (nb_tx > 0) {
+                    lcore_stats_add(&stats->tx_pkts, nb_tx);
+                    lcore_stats_add(&stats->tx_flushes, 1);
+                }
+            }
+        }
+};
+
+// Enqueues as much of mbufs as fits in the context's ring, returns how many were taken
+static inline unsigned int ring_enqueue(ForwardingContext *ctx, LcoreStats *stats, struct rte_mbuf **mbufs, unsigned int nb){
+    unsigned int free_space;
+    unsigned int nb_enq = rte_ring_enqueue_burst(ctx->mbuf_ring, (void *const *)mbufs, nb, &free_space);
+
+    lcore_stats_max(&stats->ring_hwm, ctx->ring_size - free_space);
+    return nb_enq;
+}
 
 int fpga_rx_thread(void *arg){
 	auto *ctx = (struct ForwardingContext *)arg;
-    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder Rx started on lcore %u\nmbuf addr: %p\n", ctx->ctx_id, rte_lcore_id(), ctx->rx_onic->mbuf_ring);
+    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder Rx started on lcore %u\nmbuf addr: %p\n", ctx->ctx_id, rte_lcore_id(), ctx->mbuf_ring);
 
-    struct rte_mbuf *mbufs[BURST_SIZE];
+    struct rte_mbuf *mbufs[MAX_BURST_SIZE];
+    BurstMeta meta;
+    // Tail of a burst kept for the next iteration by RingPolicy::HOLD
+    struct rte_mbuf *held[MAX_BURST_SIZE];
+    unsigned int nb_held = 0;
 
-    // convert FPGA port to DPDK port id
-    uint16_t rx_port_id = (ctx->rx_onic->get_ports()[ctx->rx_port]).get_port_id();
-    uint16_t tx_port_id = (ctx->tx_onic->get_ports()[ctx->tx_port]).get_port_id();
-    // track current Q
-    uint16_t curr_Q = 0;
+    uint16_t rx_port_id = ctx->rx_port_id;
+    uint16_t burst_size = ctx->burst_size;
 
     RTE_LOG(INFO, USER1, "rx_port_id=%u\n", rx_port_id);
     struct rte_eth_dev_info di;
@@ -20,144 +204,286 @@ int fpga_rx_thread(void *arg){
     RTE_LOG(INFO, USER1, "driver=%s nb_rx_queues=%u\n",
             di.driver_name ? di.driver_name : "?", di.nb_rx_queues);
 
+    LcoreStats *stats = LcoreStats::attach(ctx->ctx_id, "rx");
+    LcoreLatency *latency = ctx->parse_latency ? LcoreLatency::attach(ctx->ctx_id) : nullptr;
+    std::unique_ptr<FlowTable> flows = lcore_flow_table(ctx, stats);
+    PollClock clock;
+    bool busy = false;
+    IdleGovernor idle(lcore_idle_config(ctx, false), stats);
+    idle.watch_rx(rx_port_id, ctx->rx_Qs.data(), ctx->nb_rx_Qs);
+
     while (!rte_atomic32_read(&ctx->stop_flag)) {
+        // Charged at the top so every way through the last iteration is accounted for
+        clock.lap(stats, busy);
+        uint16_t nb_rx_total = 0;
+        // A bounded slice of the flow timeouts each iteration, busy or not
+        if (flows)
+            flows->age(clock.now());
+
+        // Held mbufs go first, and no Q is polled until they are all in: order is kept
+        // and the backlog stays in the NIC descriptors rather than in dropped packets.
+        // Waiting on the ring counts as busy, the lcore is held up by the tx side
+        busy = (nb_held > 0);
+        if (unlikely(nb_held > 0)) {
+            unsigned int nb_enq = ring_enqueue(ctx, stats, held, nb_held);
+            nb_held -= nb_enq;
+            if (nb_held > 0) {
+                memmove(held, held + nb_enq, nb_held * sizeof(held[0]));
+                rte_pause();
+                continue;
+            }
+        }
 
-        // Check ring availability/alloc memory : continue, wait or exit??
-        // ret = rte_mempool_get(ctx->stats_mp, (void **)&port_stats);
-        // if (ret < 0) {
-        //     rte_exit(EXIT_FAILURE, "Failed to allocate memory for forward_stats\n");
-        // }
+        // Poll every Q owned by this context once per iteration
+        for (int q_idx = 0; q_idx < ctx->nb_rx_Qs; q_idx++) {
+            uint16_t nb_rx = rte_eth_rx_burst(rx_port_id, ctx->rx_Qs[q_idx], mbufs, burst_size);
+            if (nb_rx == 0) {
+                lcore_stats_burst(stats, 0, burst_size);
+                continue;
+            }
+            nb_rx_total += nb_rx;
+            lcore_stats_rx(stats, mbufs, nb_rx, burst_size);
 
-        // Receive packets
-        uint16_t next_Q_idx = curr_Q % ctx->nb_rx_Qs; //round-robin Q select
-        int32_t nb_rx = rte_eth_rx_burst(rx_port_id, 0, mbufs, BURST_SIZE);
-        // rte_pmd_qdma_qstats(rx_port_id, next_Q);
-        if (unlikely(nb_rx == 0)) {
-            rte_pause();
-            // printf("rx(%u) Q(%u) tx(%u)\n", rx_port_id, ctx->rx_Qs[next_Q_idx], tx_port_id);
-            continue;
-        }
-        // rte_pmd_qdma_qstats(rx_port_id, ctx->rx_Qs[next_Q_idx]);
-        // RTE_LOG(INFO, USER1, "CTX(%u) %d packets received on Q %d\n", ctx->ctx_id, nb_rx, ctx->rx_Qs[next_Q_idx]);
-        curr_Q++;
+            inspect_burst(ctx, stats, flows.get(), latency, &meta, ctx->rx_Qs[q_idx], mbufs, nb_rx);
 
-        // Enqueue mbufs for tx
-        if (rte_ring_enqueue_bulk(ctx->rx_onic->mbuf_ring, (void *const *)mbufs, nb_rx, NULL) != 0) {
-            // Ring is full — handle overflow
-            for (uint16_t i = 0; i < nb_rx; i++) {
-                rte_pktmbuf_free(mbufs[i]);
+            // Enqueue mbufs for tx, only the part that did not fit is left to the ring policy
+            unsigned int nb_enq = ring_enqueue(ctx, stats, mbufs, nb_rx);
+            if (likely(nb_enq == nb_rx))
+                continue;
+            lcore_stats_add(&stats->ring_full, 1);
+
+            if (ctx->ring_policy == RingPolicy::HOLD) {
+                nb_held = nb_rx - nb_enq;
+                rte_memcpy(held, mbufs + nb_enq, nb_held * sizeof(mbufs[0]));
+                break;
+            }
+            if (ctx->ring_policy == RingPolicy::RETRY) {
+                for (int retry = 0; retry < RING_RETRY_MAX && nb_enq < nb_rx; retry++) {
+                    rte_pause();
+                    nb_enq += ring_enqueue(ctx, stats, mbufs + nb_enq, nb_rx - nb_enq);
+                }
+            }
+            if (nb_enq < nb_rx) {
+                // Ring is still full: drop only the tail
+                rte_pktmbuf_free_bulk(mbufs + nb_enq, nb_rx - nb_enq);
+                lcore_stats_add(&stats->ring_drops, nb_rx - nb_enq);
             }
         }
 
+        busy |= (nb_rx_total > 0);
+        idle.idle(nb_rx_total);
+    }
+    if (nb_held > 0) {
+        rte_pktmbuf_free_bulk(held, nb_held);
+        lcore_stats_add(&stats->ring_drops, nb_held);
     }
+    if (flows)
+        flows->flush();
     RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder Rx stopped on lcore %u\n", ctx->ctx_id, rte_lcore_id());
     return 0;
 }
 
 int fpga_rx_final_thread(void *arg){
     auto *ctx = (struct ForwardingContext *)arg;
-    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder final Tx started on lcore %u\nmbuf addr: %p\n", ctx->ctx_id, rte_lcore_id(), ctx->rx_onic->mbuf_ring);
+    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder final Rx started on lcore %u\n", ctx->ctx_id, rte_lcore_id());
 
-    struct rte_mbuf *mbufs[BURST_SIZE];
+    struct rte_mbuf *mbufs[MAX_BURST_SIZE];
+    BurstMeta meta;
+    LatencyRecord records[MAX_BURST_SIZE];
     uint16_t nb_rx = 0;
     uint16_t curr_Q = 0;
-    // convert FPGA port to DPDK port id
-    uint16_t rx_port_id = (ctx->rx_onic->get_ports()[ctx->rx_port]).get_port_id();
-    uint16_t tx_port_id = (ctx->tx_onic->get_ports()[ctx->tx_port]).get_port_id();
-
+    uint16_t rx_port_id = ctx->rx_port_id;
+    uint16_t burst_size = ctx->burst_size;
+    uint16_t ahead = ctx->prefetch_ahead;
+    LcoreStats *stats = LcoreStats::attach(ctx->ctx_id, "fin");
+    LcoreLatency *latency = LcoreLatency::attach(ctx->ctx_id);
+    PollClock clock;
+    IdleGovernor idle(lcore_idle_config(ctx, false), stats);
+    idle.watch_rx(rx_port_id, ctx->rx_Qs.data(), ctx->nb_rx_Qs);
 
     while (!rte_atomic32_read(&ctx->stop_flag)) {
-
-        // Check ring availability/alloc memory : continue, wait or exit??
-        // ret = rte_mempool_get(ctx->stats_mp, (void **)&port_stats);
-        // if (ret < 0) {
-        //     rte_exit(EXIT_FAILURE, "Failed to allocate memory for forward_stats\n");
-        // }
+        clock.lap(stats, nb_rx > 0);
 
         // Receive packets
-        uint16_t next_Q = curr_Q % ctx->nb_rx_Qs; //round-robin Q select
-        nb_rx = rte_eth_rx_burst(rx_port_id, ctx->rx_Qs[next_Q], mbufs, BURST_SIZE);
+        uint16_t next_Q = curr_Q++ % ctx->nb_rx_Qs; //round-robin Q select, also skips past empty Qs
+        nb_rx = rte_eth_rx_burst(rx_port_id, ctx->rx_Qs[next_Q], mbufs, burst_size);
+        idle.idle(nb_rx);
         if (unlikely(nb_rx == 0)) {
-            rte_pause();
+            lcore_stats_burst(stats, 0, burst_size);
             continue;
         }
-        curr_Q++;
-
-        // Search for timestamp
-        for(int i=0; i<nb_rx; i++){
-            // Enqueue mbuf containing timestamps
-            if (!is_vlan_packet(mbufs[i])){
-                rte_pktmbuf_free(mbufs[i]); // Free useless packet
+        lcore_stats_rx(stats, mbufs, nb_rx, burst_size);
+
+        // Last hop: only the latency records travel on, every mbuf goes back to the pool right away
+        uint64_t rx_tsc = rte_get_tsc_cycles();
+        uint16_t nb_records = 0;
+        StageClock stage(ctx->stage_cycles);
+        burst_parse(mbufs, nb_rx, &meta, ahead);
+        stage.lap(&stats->parse_cycles);
+        // The writer keeps its own reference, the free below leaves captured packets to it
+        if (ctx->capture_ring != nullptr) {
+            capture_burst(ctx->capture, ctx->capture_ring, ctx->capture_if, stats, mbufs, meta, rx_tsc);
+            stage.lap(&stats->capture_cycles);
+        }
+        for (uint16_t i = 0; i < nb_rx; i++) {
+            if (!Timestamps::is_timestamp_packet(meta, i, mbufs[i]))
                 continue;
-            }
-
-            // Pass stats packet to stats corex
-            if (rte_ring_enqueue(ctx->stats_ring, mbufs[i]) != 0) {
-                printf("Stats ring is full, unable to enqueue packet");
-            }
-            rte_pktmbuf_free(mbufs[i]); // stats_ring is full, must manually free
+            HopLatencies hop_ns = Timestamps(mbufs[i]).calc_hop_latencies();
+            latency->record(hop_ns);
+            records[nb_records++] = {(uint32_t)ctx->ctx_id, (uint32_t)ctx->rx_Qs[next_Q], rx_tsc, hop_ns};
         }
-    }
-    return 0;
-}
-
-bool is_vlan_packet(struct rte_mbuf *mbuf) {
-    struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
-
-    if (rte_be_to_cpu_16(eth_hdr->ether_type) == RTE_ETHER_TYPE_VLAN) {
-        struct rte_vlan_hdr *vlan_hdr = (struct rte_vlan_hdr *)(eth_hdr + 1);
-        uint16_t inner_type = rte_be_to_cpu_16(vlan_hdr->eth_proto);
-
-        printf("VLAN Tag: 0x%04x, Inner Ethertype: 0x%04x\n",
-               rte_be_to_cpu_16(vlan_hdr->vlan_tci), inner_type);
+        stage.lap(&stats->latency_cycles);
+        rte_pktmbuf_free_bulk(mbufs, nb_rx);
+        if (ctx->stats_ring == nullptr)
+            continue;
 
-        return true;
+        unsigned int nb_enq = rte_ring_enqueue_burst_elem(ctx->stats_ring, records, sizeof(LatencyRecord), nb_records, NULL);
+        lcore_stats_add(&stats->latency_records, nb_enq);
+        if (unlikely(nb_enq < nb_records))
+            lcore_stats_add(&stats->latency_drops, nb_records - nb_enq);
     }
-
-    return false;
+    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder final Rx stopped on lcore %u\n", ctx->ctx_id, rte_lcore_id());
+    return 0;
 }
 
 
 int fpga_tx_thread(void *arg){
 	auto *ctx = (struct ForwardingContext *)arg;
-    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder Tx thread started on lcore %u\nmbuf addr: %p\n", ctx->ctx_id, rte_lcore_id(), ctx->rx_onic->mbuf_ring);
+    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder Tx thread started on lcore %u\nmbuf addr: %p\n", ctx->ctx_id, rte_lcore_id(), ctx->mbuf_ring);
 
-    struct rte_mbuf *mbufs[BURST_SIZE];
+    struct rte_mbuf *mbufs[MAX_BURST_SIZE];
     unsigned int nb_rx = 0;
     uint16_t curr_Q = 0;
+    uint16_t burst_size = ctx->burst_size;
 
-    // convert FPGA port to DPDK port id
-    uint16_t tx_port_id = (ctx->tx_onic->get_ports()[ctx->tx_port]).get_port_id();
+    // Counters only: mempool occupancy and drop rates are printed by the LcoreStatsReporter, off this lcore
+    LcoreStats *stats = LcoreStats::attach(ctx->ctx_id, "tx");
+    TxSender tx(ctx, stats);
+    PollClock clock;
+    IdleGovernor idle(lcore_idle_config(ctx, true), stats);
+    idle.watch_ring(ctx->mbuf_ring);
 
     while (!rte_atomic32_read(&ctx->stop_flag)) {
+        clock.lap(stats, nb_rx > 0);
+        tx.flush_if_due();
 
         // Check ring for new packets
-        nb_rx = rte_ring_dequeue_burst(ctx->rx_onic->mbuf_ring, (void **)mbufs, BURST_SIZE, NULL);
-        if (unlikely(nb_rx == 0)) {
-            rte_pause();
+        nb_rx = rte_ring_dequeue_burst(ctx->mbuf_ring, (void **)mbufs, burst_size, NULL);
+        lcore_stats_burst(stats, nb_rx, burst_size);
+        idle.idle(nb_rx);
+        if (unlikely(nb_rx == 0))
             continue;
-        }
-        // printf("Sending 
+        prefetch_mbuf_headers(mbufs, nb_rx, ctx->prefetch_ahead);
+
         // Transmit packets
-        // rte_pktmbuf_dump(stdout, mbufs[0], mbufs[0]->pkt_len);
-        struct rte_mempool *mp = rte_mempool_lookup(ctx->tx_onic->get_ports()[ctx->tx_port].pinfo.mem_pool);
-        printf("dst mempool available: %u\n", rte_mempool_avail_count(mp));
         uint16_t next_Q_idx = curr_Q % ctx->nb_tx_Qs; //round-robin Q select
-        int32_t nb_tx = rte_eth_tx_burst(tx_port_id, ctx->tx_Qs[next_Q_idx], mbufs, nb_rx);
+        tx.send(next_Q_idx, mbufs, nb_rx);
         curr_Q++;
+    }
+    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder Tx stopped on lcore %u\n", ctx->ctx_id, rte_lcore_id());
+    return 0;
+}
 
-        // Free any untransmitted packets
-        if (unlikely(nb_tx < nb_rx)) {
-            for (uint16_t i = nb_tx; i < nb_rx; i++) {
-                rte_pktmbuf_free(mbufs[i]);
+int fpga_rtc_thread(void *arg){
+	auto *ctx = (struct ForwardingContext *)arg;
+    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder run-to-completion started on lcore %u\n", ctx->ctx_id, rte_lcore_id());
+
+    struct rte_mbuf *mbufs[MAX_BURST_SIZE];
+    BurstMeta meta;
+
+    uint16_t rx_port_id = ctx->rx_port_id;
+    uint16_t burst_size = ctx->burst_size;
+    LcoreStats *stats = LcoreStats::attach(ctx->ctx_id, "rtc");
+    LcoreLatency *latency = ctx->parse_latency ? LcoreLatency::attach(ctx->ctx_id) : nullptr;
+    std::unique_ptr<FlowTable> flows = lcore_flow_table(ctx, stats);
+    TxSender tx(ctx, stats);
+    PollClock clock;
+    IdleGovernor idle(lcore_idle_config(ctx, true), stats);
+    idle.watch_rx(rx_port_id, ctx->rx_Qs.data(), ctx->nb_rx_Qs);
+    uint16_t nb_rx_total = 0;
+
+    while (!rte_atomic32_read(&ctx->stop_flag)) {
+        clock.lap(stats, nb_rx_total > 0);
+        nb_rx_total = 0;
+        tx.flush_if_due();
+        if (flows)
+            flows->age(clock.now());
+
+        // Poll every Q owned by this context once per iteration, rx Q i is sent on tx Q i % nb_tx_Qs
+        for (int q_idx = 0; q_idx < ctx->nb_rx_Qs; q_idx++) {
+            uint16_t nb_rx = rte_eth_rx_burst(rx_port_id, ctx->rx_Qs[q_idx], mbufs, burst_size);
+            if (nb_rx == 0) {
+                lcore_stats_burst(stats, 0, burst_size);
+                continue;
             }
-            printf("Not sent %u packets on tx_port(%u) on Q(%u)\n", nb_rx, tx_port_id, ctx->tx_Qs[0]);
+            nb_rx_total += nb_rx;
+            lcore_stats_rx(stats, mbufs, nb_rx, burst_size);
+
+            inspect_burst(ctx, stats, flows.get(), latency, &meta, ctx->rx_Qs[q_idx], mbufs, nb_rx);
+
+            // Transmit packets straight from the rx burst: no ring handoff
+            tx.send(q_idx % ctx->nb_tx_Qs, mbufs, nb_rx);
         }
-        
+        idle.idle(nb_rx_total);
     }
+    if (flows)
+        flows->flush();
+    RTE_LOG(INFO, USER1, "CTX(%u) Software forwarder run-to-completion stopped on lcore %u\n", ctx->ctx_id, rte_lcore_id());
     return 0;
 }
 
+// Pinned lcores are used as given, others are the first free worker on socket_id (the port's socket)
+static unsigned int pick_worker_lcore(int pinned_lcore, int socket_id, const char *role, const ForwardingContext &ctx){
+    unsigned int lcore_id = pinned_lcore;
+
+    if (pinned_lcore < 0) {
+        lcore_id = NumaPlacement::free_worker_lcore(socket_id);
+        if (lcore_id >= RTE_MAX_LCORE)
+            rte_exit(EXIT_FAILURE, "CTX(%d) Not enough lcores, add more with -l\n", ctx.ctx_id);
+    } else {
+        if (pinned_lcore >= RTE_MAX_LCORE || !rte_lcore_is_enabled(pinned_lcore) ||
+            (unsigned int)pinned_lcore == rte_get_main_lcore())
+            rte_exit(EXIT_FAILURE, "CTX(%d) lcore %d is not an enabled worker lcore, check -l\n", ctx.ctx_id, pinned_lcore);
+        if (rte_eal_get_lcore_state(pinned_lcore) == RUNNING)
+            rte_exit(EXIT_FAILURE, "CTX(%d) lcore %d is already running another worker\n", ctx.ctx_id, pinned_lcore);
+    }
+
+    char what[64];
+    snprintf(what, sizeof(what), "CTX(%d) %s %u", ctx.ctx_id, role, lcore_id);
+    NumaPlacement::check(what, socket_id, rte_lcore_to_socket_id(lcore_id));
+    return lcore_id;
+}
+
+unsigned int launch_software_forwarder(ForwardingContext &ctx){
+    ctx.resolve_ports();
+    ctx.print_schema();
+    if (ctx.parse_latency)
+        LatencyField::register_field();
+
+    int rx_socket = NumaPlacement::port_socket(ctx.rx_port_id);
+    int tx_socket = NumaPlacement::port_socket(ctx.tx_port_id);
+
+    if (ctx.mode == ForwardMode::RUN_TO_COMPLETION) {
+        ctx.lcores[0] = pick_worker_lcore(ctx.lcores[0], rx_socket, "worker lcore", ctx);
+        rte_eal_remote_launch(fpga_rtc_thread, &ctx, ctx.lcores[0]);
+        return ctx.lcores[0];
+    }
+
+    if (ctx.mbuf_ring == nullptr && ctx.create_ring() < 0)
+        rte_exit(EXIT_FAILURE, "CTX(%d) Cannot create ring: %s\n", ctx.ctx_id, rte_strerror(rte_errno));
+    char what[64];
+    snprintf(what, sizeof(what), "CTX(%d) ring", ctx.ctx_id);
+    NumaPlacement::check(what, rx_socket, ctx.mbuf_ring->memzone->socket_id);
+
+    ctx.lcores[0] = pick_worker_lcore(ctx.lcores[0], rx_socket, "rx lcore", ctx);
+    rte_eal_remote_launch(fpga_rx_thread, &ctx, ctx.lcores[0]);
+
+    ctx.lcores[1] = pick_worker_lcore(ctx.lcores[1], tx_socket, "tx lcore", ctx);
+    rte_eal_remote_launch(fpga_tx_thread, &ctx, ctx.lcores[1]);
+
+    return ctx.lcores[1];
+}
+
 // int software_forwarder_thread(void *arg){
 // 	auto *ctx = (struct ForwardingContext *)arg;
 //     RTE_LOG(INFO, USER1, "Software forwarder started on lcore %u\n", rte_lcore_id());
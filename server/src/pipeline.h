@@ -1,14 +1,20 @@
 #pragma once
 
 #include <rte_ring.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
 #include "forward_context.h"
 
 int fpga_rx_thread(void *arg);
 
 int fpga_rx_final_thread(void *arg);
 
-bool is_vlan_packet(struct rte_mbuf *mbuf);
-
 int fpga_tx_thread(void *arg);
 
+int fpga_rtc_thread(void *arg);
+
+// Launches ctx according to ctx.mode on its pinned lcores, or on free lcores of its ports' sockets.
+// The lcores used are written back to ctx.lcores, the last one is returned
+unsigned int launch_software_forwarder(ForwardingContext &ctx);
+
 int software_forwarder_thread(void *arg);
\ No newline at end of file
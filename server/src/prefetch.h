@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <rte_common.h>
+#include <rte_mbuf.h>
+#include <rte_prefetch.h>
+
+#define DEFAULT_PREFETCH_AHEAD (4)  // packets between the one prefetched and the one worked on
+#define MAX_PREFETCH_AHEAD (16)
+
+// Software prefetch for loops that walk a burst. The rx descriptors leave the mbuf headers in cache
+// but not the packet data: its first cache line (Ethernet/VLAN headers) would be a miss per packet.
+// Loops prime the first `ahead` packets, then prefetch packet i + ahead while working on packet i.
+// ahead = 0 turns both into no-ops
+
+// First data cache line of packets [0, ahead)
+static inline void prefetch_data_prime(struct rte_mbuf *const *mbufs, uint16_t nb, uint16_t ahead){
+    uint16_t n = RTE_MIN(nb, ahead);
+    for (uint16_t i = 0; i < n; i++)
+        rte_prefetch0(rte_pktmbuf_mtod(mbufs[i], void *));
+}
+
+// First data cache line of packet i + ahead, call while working on packet i
+static inline void prefetch_data_ahead(struct rte_mbuf *const *mbufs, uint16_t i, uint16_t nb, uint16_t ahead){
+    if (ahead > 0 && i + ahead < nb)
+        rte_prefetch0(rte_pktmbuf_mtod(mbufs[i + ahead], void *));
+}
+
+// mbuf headers of a burst taken from a ring were last written by another lcore, fetch them all at
+// once before the tx path reads their lengths
+static inline void prefetch_mbuf_headers(struct rte_mbuf *const *mbufs, uint16_t nb, uint16_t ahead){
+    if (ahead == 0)
+        return;
+    for (uint16_t i = 0; i < nb; i++)
+        rte_prefetch0(mbufs[i]);
+}
@@ -0,0 +1,97 @@
+#include "reg_backend.h"
+#include "onic_port.h"
+
+#include <rte_cycles.h>
+#include <rte_log.h>
+
+void RegisterBackend::delay_ms(unsigned int ms) {
+    rte_delay_ms(ms);
+}
+
+uint32_t QdmaRegisterBackend::read(uint32_t offset) {
+    return OnicPort::PciRead(bar, offset, port_id);
+}
+
+void QdmaRegisterBackend::write(uint32_t offset, uint32_t val) {
+    OnicPort::PciWrite(bar, offset, val, port_id);
+}
+
+RecordingRegisterBackend::RecordingRegisterBackend(RegisterBackend *inner, const char *path) : inner(inner) {
+    log = fopen(path, "w");
+    if (log == nullptr)
+        RTE_LOG(ERR, USER1, "Register recording: cannot open %s\n", path);
+}
+
+RecordingRegisterBackend::~RecordingRegisterBackend() {
+    if (log != nullptr)
+        fclose(log);
+}
+
+uint32_t RecordingRegisterBackend::read(uint32_t offset) {
+    uint32_t val = inner->read(offset);
+    if (log != nullptr)
+        fprintf(log, "R 0x%08x 0x%08x\n", offset, val);
+    return val;
+}
+
+void RecordingRegisterBackend::write(uint32_t offset, uint32_t val) {
+    inner->write(offset, val);
+    if (log != nullptr)
+        fprintf(log, "W 0x%08x 0x%08x\n", offset, val);
+}
+
+void RecordingRegisterBackend::delay_ms(unsigned int ms) {
+    inner->delay_ms(ms);
+    if (log != nullptr)
+        fprintf(log, "D %u\n", ms);
+}
+
+ReplayRegisterBackend::ReplayRegisterBackend(const char *path) {
+    FILE *log = fopen(path, "r");
+    if (log == nullptr) {
+        RTE_LOG(ERR, USER1, "Register replay: cannot open %s\n", path);
+        return;
+    }
+
+    char line[64];
+    while (fgets(line, sizeof(line), log) != nullptr) {
+        Access access = {line[0], 0, 0};
+        int n = (access.op == 'D') ? sscanf(line + 1, "%u", &access.value)
+                                   : sscanf(line + 1, "%x %x", &access.offset, &access.value);
+        if ((access.op == 'D' && n == 1) || ((access.op == 'R' || access.op == 'W') && n == 2))
+            accesses.push_back(access);
+    }
+    fclose(log);
+}
+
+const ReplayRegisterBackend::Access *ReplayRegisterBackend::expect(char op, uint32_t offset, uint32_t value) {
+    if (next >= accesses.size()) {
+        if (nb_mismatches++ == 0)
+            RTE_LOG(WARNING, USER1, "Register replay: %c 0x%08x past the end of the recording\n", op, offset);
+        return nullptr;
+    }
+
+    const Access &access = accesses[next++];
+    // Reads only have to match the offset, their value comes from the recording
+    bool match = access.op == op && access.offset == offset && (op == 'R' || access.value == value);
+    if (!match) {
+        if (nb_mismatches++ == 0)
+            RTE_LOG(WARNING, USER1, "Register replay: access %zu is %c 0x%08x 0x%08x, recorded %c 0x%08x 0x%08x\n",
+                    next - 1, op, offset, value, access.op, access.offset, access.value);
+        return nullptr;
+    }
+    return &access;
+}
+
+uint32_t ReplayRegisterBackend::read(uint32_t offset) {
+    const Access *access = expect('R', offset, 0);
+    return (access != nullptr) ? access->value : 0;
+}
+
+void ReplayRegisterBackend::write(uint32_t offset, uint32_t val) {
+    expect('W', offset, val);
+}
+
+void ReplayRegisterBackend::delay_ms(unsigned int ms) {
+    expect('D', 0, ms);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Access to one BAR of the open-nic-shell AXI-Lite register space. Onic does all its control path
+// through this, so bring-up, stats and reset can run against a model or a recording, no FPGA
+class RegisterBackend {
+    public:
+        virtual ~RegisterBackend() = default;
+        virtual uint32_t read(uint32_t offset) = 0;
+        virtual void write(uint32_t offset, uint32_t val) = 0;
+        // Waits between polls of a status register. Models advance their own clock instead of sleeping
+        virtual void delay_ms(unsigned int ms);
+};
+
+// The hardware: rte_pmd_qdma_compat_pci_* on the config port's user BAR
+class QdmaRegisterBackend : public RegisterBackend {
+    private:
+        int port_id;
+        unsigned int bar;
+
+    public:
+        QdmaRegisterBackend(int port_id, unsigned int bar) : port_id(port_id), bar(bar) {}
+        uint32_t read(uint32_t offset) override;
+        void write(uint32_t offset, uint32_t val) override;
+};
+
+// Passes every access to another backend and logs it, one per line:
+//   R <offset> <value> | W <offset> <value> | D <ms>
+class RecordingRegisterBackend : public RegisterBackend {
+    private:
+        RegisterBackend *inner;
+        FILE *log;
+
+    public:
+        RecordingRegisterBackend(RegisterBackend *inner, const char *path);
+        ~RecordingRegisterBackend();
+        RecordingRegisterBackend(const RecordingRegisterBackend &) = delete;
+        RecordingRegisterBackend &operator=(const RecordingRegisterBackend &) = delete;
+
+        bool ok() const { return log != nullptr; }
+        uint32_t read(uint32_t offset) override;
+        void write(uint32_t offset, uint32_t val) override;
+        void delay_ms(unsigned int ms) override;
+};
+
+// Plays a recording back: reads return the recorded values, writes and delays are checked against it.
+// Any access that does not match the next recorded one counts as a mismatch, the replay then goes on
+// with the following entry so one divergence does not hide the rest
+class ReplayRegisterBackend : public RegisterBackend {
+    private:
+        struct Access {
+            char op; // 'R', 'W' or 'D'
+            uint32_t offset;
+            uint32_t value;
+        };
+        std::vector<Access> accesses;
+        size_t next = 0;
+        unsigned int nb_mismatches = 0;
+
+        const Access *expect(char op, uint32_t offset, uint32_t value);
+
+    public:
+        explicit ReplayRegisterBackend(const char *path);
+
+        bool ok() const { return !accesses.empty(); }
+        uint32_t read(uint32_t offset) override;
+        void write(uint32_t offset, uint32_t val) override;
+        void delay_ms(unsigned int ms) override;
+
+        unsigned int mismatches() const { return nb_mismatches; }
+        size_t remaining() const { return accesses.size() - next; }
+};
@@ -0,0 +1,322 @@
+#include "replay.h"
+#include "numa.h"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_eth_ring.h>
+#include <rte_ether.h>
+#include <rte_memcpy.h>
+#include <rte_pause.h>
+
+#define PCAP_MAGIC_US (0xa1b2c3d4)
+#define PCAP_MAGIC_NS (0xa1b23c4d)
+#define PCAPNG_MAGIC (0x0a0d0d0a)   // section header block type
+#define PCAP_LINKTYPE_ETHERNET (1)
+
+#define replay_exit(...) rte_exit(EXIT_FAILURE, "Replay: " __VA_ARGS__)
+
+// Classic pcap file and record headers, in the writer's byte order
+struct PcapFileHeader {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct PcapRecordHeader {
+    uint32_t ts_sec;
+    uint32_t ts_frac;   // µs or ns, unused: the trace is replayed at full speed
+    uint32_t caplen;
+    uint32_t len;
+};
+
+PcapReplay::PcapReplay(const ReplayConfig &cfg, uint16_t nb_queues, const std::vector<uint16_t> &rx_queues, int socket_id)
+    : cfg(cfg), nb_queues(nb_queues)
+{
+    std::vector<uint8_t> data;
+    std::vector<size_t> offsets;
+    std::vector<uint16_t> lens;
+    load(data, offsets, lens);
+
+    // One copy of the trace per polled rx Q, each long enough that the feeder does not catch up
+    // with mbufs of the previous pass still in the pipeline
+    uint16_t max_len = *std::max_element(lens.begin(), lens.end());
+    size_t copy_len = (size_t)nb_pkts * ((REPLAY_COPY_RINGS * cfg.ring_size + nb_pkts - 1) / nb_pkts);
+    pool = rte_pktmbuf_pool_create("replay_pool", copy_len * rx_queues.size(), 0, 0,
+                                   RTE_PKTMBUF_HEADROOM + max_len, socket_id);
+    if (pool == NULL)
+        replay_exit("cannot create a pool of %zu mbufs of %u B: %s\n", copy_len * rx_queues.size(),
+                    RTE_PKTMBUF_HEADROOM + max_len, rte_strerror(rte_errno));
+
+    create_port(socket_id);
+    for (uint16_t q : rx_queues) {
+        feeds.emplace_back();
+        feeds.back().queue = q;
+        feeds.back().mbufs.resize(copy_len);
+    }
+    fill(data, offsets, lens);
+
+    printf("Replay %s: %u packets (%" PRIu64 " B) on port %u, %u rx Qs, %zu mbufs per Q, %u records skipped\n",
+           cfg.pcap.c_str(), nb_pkts, trace_bytes, port_id, (unsigned int)rx_queues.size(), copy_len, skipped);
+}
+
+PcapReplay::~PcapReplay(){
+    rte_eth_dev_stop(port_id);
+    rte_eth_dev_close(port_id);
+    // References still queued when the run was stopped
+    struct rte_mbuf *burst[REPLAY_FEED_BURST];
+    for (size_t q = 0; q < rx_rings.size(); q++) {
+        unsigned int nb;
+        while ((nb = rte_ring_dequeue_burst(rx_rings[q], (void **)burst, REPLAY_FEED_BURST, NULL)) > 0)
+            rte_pktmbuf_free_bulk(burst, nb);
+        while ((nb = rte_ring_dequeue_burst(tx_rings[q], (void **)burst, REPLAY_FEED_BURST, NULL)) > 0)
+            rte_pktmbuf_free_bulk(burst, nb);
+        rte_ring_free(rx_rings[q]);
+        rte_ring_free(tx_rings[q]);
+    }
+    for (Feed &f : feeds)
+        rte_pktmbuf_free_bulk(f.mbufs.data(), f.mbufs.size());
+    rte_mempool_free(pool);
+}
+
+void PcapReplay::load(std::vector<uint8_t> &data, std::vector<size_t> &offsets, std::vector<uint16_t> &lens){
+    FILE *file = fopen(cfg.pcap.c_str(), "rb");
+    if (file == NULL)
+        replay_exit("cannot open %s: %s\n", cfg.pcap.c_str(), strerror(errno));
+
+    PcapFileHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1)
+        replay_exit("%s is too short for a pcap file\n", cfg.pcap.c_str());
+    bool swapped;
+    if (hdr.magic == PCAP_MAGIC_US || hdr.magic == PCAP_MAGIC_NS)
+        swapped = false;
+    else if (hdr.magic == rte_bswap32(PCAP_MAGIC_US) || hdr.magic == rte_bswap32(PCAP_MAGIC_NS))
+        swapped = true;
+    else if (hdr.magic == PCAPNG_MAGIC)
+        replay_exit("%s is pcapng, convert it with: editcap -F pcap %s out.pcap\n", cfg.pcap.c_str(), cfg.pcap.c_str());
+    else
+        replay_exit("%s is not a pcap file (magic 0x%08x)\n", cfg.pcap.c_str(), hdr.magic);
+
+    // The upper bits of the link type can carry FCS information
+    uint32_t linktype = (swapped ? rte_bswap32(hdr.linktype) : hdr.linktype) & 0xffff;
+    if (linktype != PCAP_LINKTYPE_ETHERNET)
+        replay_exit("%s has link type %u, only Ethernet (1) can be replayed\n", cfg.pcap.c_str(), linktype);
+
+    PcapRecordHeader rec;
+    while (offsets.size() < cfg.max_pkts && fread(&rec, sizeof(rec), 1, file) == 1) {
+        uint32_t caplen = swapped ? rte_bswap32(rec.caplen) : rec.caplen;
+        if (caplen == 0 || caplen > REPLAY_MAX_PKT_LEN) {
+            skipped++;
+            if (fseek(file, caplen, SEEK_CUR) != 0)
+                break;
+            continue;
+        }
+        size_t off = data.size();
+        data.resize(off + caplen);
+        if (fread(data.data() + off, 1, caplen, file) != caplen) {
+            // Cut off mid record, e.g. a capture that was still running
+            data.resize(off);
+            break;
+        }
+        offsets.push_back(off);
+        lens.push_back(caplen);
+        trace_bytes += caplen;
+    }
+    fclose(file);
+
+    if (offsets.empty())
+        replay_exit("%s has no packets to replay\n", cfg.pcap.c_str());
+    nb_pkts = offsets.size();
+}
+
+// Rings on either side of a net_ring port: the feeder produces the rx rings and consumes the tx rings,
+// one context lcore sits on the other end of each
+void PcapReplay::create_port(int socket_id){
+    char name[RTE_RING_NAMESIZE];
+    for (uint16_t q = 0; q < nb_queues; q++) {
+        snprintf(name, sizeof(name), "replay_rx_%u", q);
+        rx_rings.push_back(rte_ring_create(name, cfg.ring_size, socket_id, RING_F_SP_ENQ | RING_F_SC_DEQ | RING_F_EXACT_SZ));
+        snprintf(name, sizeof(name), "replay_tx_%u", q);
+        tx_rings.push_back(rte_ring_create(name, cfg.ring_size, socket_id, RING_F_SP_ENQ | RING_F_SC_DEQ | RING_F_EXACT_SZ));
+        if (rx_rings.back() == NULL || tx_rings.back() == NULL)
+            replay_exit("cannot create the rings of Q %u: %s\n", q, rte_strerror(rte_errno));
+    }
+
+    int ret = rte_eth_from_rings(REPLAY_PORT_NAME, rx_rings.data(), nb_queues, tx_rings.data(), nb_queues, socket_id);
+    if (ret < 0)
+        replay_exit("cannot create port %s: %s\n", REPLAY_PORT_NAME, rte_strerror(rte_errno));
+    port_id = ret;
+
+    struct rte_eth_conf conf;
+    memset(&conf, 0, sizeof(conf));
+    ret = rte_eth_dev_configure(port_id, nb_queues, nb_queues, &conf);
+    for (uint16_t q = 0; q < nb_queues && ret == 0; q++) {
+        ret = rte_eth_rx_queue_setup(port_id, q, cfg.ring_size, socket_id, NULL, pool);
+        if (ret == 0)
+            ret = rte_eth_tx_queue_setup(port_id, q, cfg.ring_size, socket_id, NULL);
+    }
+    if (ret == 0)
+        ret = rte_eth_dev_start(port_id);
+    if (ret < 0)
+        replay_exit("cannot set up port %u: %s\n", port_id, rte_strerror(-ret));
+}
+
+void PcapReplay::fill(const std::vector<uint8_t> &data, const std::vector<size_t> &offsets,
+                      const std::vector<uint16_t> &lens){
+    for (Feed &f : feeds) {
+        if (rte_pktmbuf_alloc_bulk(pool, f.mbufs.data(), f.mbufs.size()) != 0)
+            replay_exit("cannot allocate the trace copy of rx Q %u\n", f.queue);
+        for (size_t i = 0; i < f.mbufs.size(); i++) {
+            struct rte_mbuf *m = f.mbufs[i];
+            uint32_t rec = i % nb_pkts;
+            rte_memcpy(rte_pktmbuf_mtod(m, void *), data.data() + offsets[rec], lens[rec]);
+            m->data_len = lens[rec];
+            m->pkt_len = lens[rec];
+            m->port = port_id;
+        }
+    }
+}
+
+uint64_t PcapReplay::feed_limit() const {
+    return (cfg.loops == 0) ? UINT64_MAX : (uint64_t)cfg.loops * nb_pkts;
+}
+
+// Enqueues the next packets of f's copy with one more reference each, the pipeline's free drops it
+// again. A packet still referenced from the previous pass means the pipeline is behind: the feeder
+// waits for it rather than sending the same mbuf twice at once. Returns whether anything was fed
+bool PcapReplay::feed(Feed &f){
+    struct rte_mbuf *burst[REPLAY_FEED_BURST];
+    uint64_t limit = feed_limit();
+    size_t cursor = f.cursor;
+    unsigned int nb = 0;
+
+    while (nb < REPLAY_FEED_BURST && f.fed + nb < limit) {
+        struct rte_mbuf *m = f.mbufs[cursor];
+        if (rte_mbuf_refcnt_read(m) > 1)
+            break;
+        rte_mbuf_refcnt_update(m, 1);
+        burst[nb++] = m;
+        if (++cursor == f.mbufs.size())
+            cursor = 0;
+    }
+    if (nb == 0)
+        return false;
+
+    unsigned int nb_enq = rte_ring_enqueue_burst(rx_rings[f.queue], (void *const *)burst, nb, NULL);
+    uint64_t bytes = 0;
+    for (unsigned int i = 0; i < nb_enq; i++)
+        bytes += burst[i]->pkt_len;
+    for (unsigned int i = nb_enq; i < nb; i++)
+        rte_mbuf_refcnt_update(burst[i], -1);
+
+    f.cursor = (f.cursor + nb_enq) % f.mbufs.size();
+    lcore_stats_add(&f.fed, nb_enq);
+    lcore_stats_add(&fed_pkts, nb_enq);
+    lcore_stats_add(&fed_bytes, bytes);
+    return nb_enq > 0;
+}
+
+// Frees what the pipeline transmitted, returns how many
+unsigned int PcapReplay::drain(){
+    struct rte_mbuf *burst[REPLAY_FEED_BURST];
+    unsigned int total = 0;
+    for (struct rte_ring *ring : tx_rings) {
+        unsigned int nb = rte_ring_dequeue_burst(ring, (void **)burst, REPLAY_FEED_BURST, NULL);
+        rte_pktmbuf_free_bulk(burst, nb);
+        total += nb;
+    }
+    lcore_stats_add(&returned_pkts, total);
+    return total;
+}
+
+// Every mbuf is back to the copy's own reference: sent, dropped or freed by the final hop
+bool PcapReplay::all_returned() const {
+    for (const Feed &f : feeds) {
+        if (f.fed < feed_limit() || !rte_ring_empty(rx_rings[f.queue]))
+            return false;
+        for (struct rte_mbuf *m : f.mbufs) {
+            if (rte_mbuf_refcnt_read(m) > 1)
+                return false;
+        }
+    }
+    return true;
+}
+
+uint64_t PcapReplay::loops_done() const {
+    uint64_t fed = UINT64_MAX;
+    for (const Feed &f : feeds)
+        fed = std::min(fed, lcore_stats_read(&f.fed));
+    return fed / nb_pkts;
+}
+
+void PcapReplay::launch(){
+    lcore_id = NumaPlacement::free_worker_lcore(NumaPlacement::port_socket(port_id));
+    if (lcore_id >= RTE_MAX_LCORE)
+        replay_exit("no free lcore for the feeder, add one with -l\n");
+    rte_eal_remote_launch(run, this, lcore_id);
+}
+
+int PcapReplay::run(void *arg){
+    auto *replay = (PcapReplay *)arg;
+    RTE_LOG(INFO, USER1, "Replay feeder started on lcore %u\n", rte_lcore_id());
+
+    replay->start_tsc = rte_get_tsc_cycles();
+    while (!replay->stop_flag) {
+        bool fed = false;
+        for (Feed &f : replay->feeds)
+            fed |= replay->feed(f);
+        unsigned int nb_returned = replay->drain();
+        if (fed || nb_returned > 0)
+            continue;
+
+        // Nothing moved: the pipeline is behind, or the last loop is through it
+        if (replay->cfg.loops > 0 && !replay->done_flag && replay->all_returned()) {
+            replay->end_tsc = rte_get_tsc_cycles();
+            replay->done_flag = true;
+        }
+        rte_pause();
+    }
+    RTE_LOG(INFO, USER1, "Replay feeder stopped on lcore %u\n", rte_lcore_id());
+    return 0;
+}
+
+void PcapReplay::report(){
+    uint64_t now = rte_get_tsc_cycles();
+    uint64_t fed = lcore_stats_read(&fed_pkts);
+    uint64_t bytes = lcore_stats_read(&fed_bytes);
+    uint64_t returned = lcore_stats_read(&returned_pkts);
+
+    if (last_tsc != 0 && fed != last_fed) {
+        double elapsed = (double)(now - last_tsc) / rte_get_tsc_hz();
+        printf("Replay: fed %10.0f pps %7.3f Gbps, returned %10.0f pps, %" PRIu64 " loops done\n",
+               (fed - last_fed) / elapsed, (bytes - last_fed_bytes) * 8 / elapsed / 1e9,
+               (returned - last_returned) / elapsed, loops_done());
+    }
+    last_tsc = now;
+    last_fed = fed;
+    last_fed_bytes = bytes;
+    last_returned = returned;
+}
+
+// Once the feeder stopped: the rate of the whole run, up to the point done() turned true
+void PcapReplay::summary(){
+    if (start_tsc == 0)
+        return;
+    uint64_t end = done_flag ? end_tsc : rte_get_tsc_cycles();
+    double seconds = (double)(end - start_tsc) / rte_get_tsc_hz();
+    uint64_t fed = lcore_stats_read(&fed_pkts);
+    uint64_t returned = lcore_stats_read(&returned_pkts);
+    printf("Replay %s: %" PRIu64 " loops of %u packets per rx Q, fed %" PRIu64 " packets in %.3f s: %.3f Mpps %.3f Gbps, "
+           "%" PRIu64 " returned on the tx rings\n",
+           cfg.pcap.c_str(), loops_done(), nb_pkts, fed, seconds, fed / seconds / 1e6,
+           lcore_stats_read(&fed_bytes) * 8 / seconds / 1e9, returned);
+}
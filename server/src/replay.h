@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <rte_ring.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#include "lcore_stats.h"
+
+#define REPLAY_PORT_NAME "net_ring_replay"
+#define REPLAY_MAX_QUEUES (16)              // rx/tx Qs of the replay port
+#define REPLAY_MAX_PKT_LEN (9600)           // longer pcap records are skipped
+#define DEFAULT_REPLAY_RING_SIZE (4096)     // per rx/tx Q of the replay port
+#define DEFAULT_REPLAY_MAX_PKTS (262144)    // pcap records loaded, the rest of the file is ignored
+#define REPLAY_FEED_BURST (64)
+#define REPLAY_COPY_RINGS (4)               // a trace copy holds at least this many rx rings of mbufs
+
+// [replay] table, or onic_app -r <pcap>: contexts run on a net_ring port fed from a pcap instead of
+// on the onics, none of which are touched
+struct ReplayConfig {
+    std::string pcap;                   // empty: no replay
+    unsigned int loops = 0;             // passes over the trace per rx Q, 0 replays until stopped
+    unsigned int ring_size = DEFAULT_REPLAY_RING_SIZE;
+    unsigned int max_pkts = DEFAULT_REPLAY_MAX_PKTS;
+};
+
+// Replays a classic pcap (Ethernet, µs or ns timestamps, either byte order) at full speed, pcap
+// timestamps are ignored. The trace is loaded once into hugepage mbufs, one copy per used rx Q,
+// repeated until a copy holds REPLAY_COPY_RINGS rx rings. The feeder lcore then enqueues those same
+// mbufs over and over with an extra reference: no packet is copied or allocated while replaying.
+// Whatever the pipeline transmits comes back on the port's tx rings and is freed by the feeder,
+// which drops the extra reference again
+class PcapReplay {
+    private:
+        ReplayConfig cfg;
+        uint16_t port_id = 0;
+        uint16_t nb_queues = 0;
+        unsigned int lcore_id = RTE_MAX_LCORE;
+        struct rte_mempool *pool = nullptr;
+        std::vector<struct rte_ring *> rx_rings;
+        std::vector<struct rte_ring *> tx_rings;
+
+        // Per used rx Q: its copy of the trace and where the feeder is in it
+        struct Feed {
+            uint16_t queue;
+            std::vector<struct rte_mbuf *> mbufs;
+            size_t cursor = 0;
+            uint64_t fed = 0;
+        };
+        std::vector<Feed> feeds;
+        uint32_t nb_pkts = 0;               // records of the trace
+        uint64_t trace_bytes = 0;
+        uint32_t skipped = 0;               // records over REPLAY_MAX_PKT_LEN or not Ethernet
+
+        // Single writer (the feeder lcore), read with lcore_stats_read() from the main lcore
+        uint64_t fed_pkts = 0;
+        uint64_t fed_bytes = 0;
+        uint64_t returned_pkts = 0;         // came back on the tx rings
+        uint64_t start_tsc = 0;
+        uint64_t end_tsc = 0;               // when done() turned true
+        volatile bool stop_flag = false;
+        volatile bool done_flag = false;
+
+        // Main lcore only
+        uint64_t last_tsc = 0;
+        uint64_t last_fed = 0;
+        uint64_t last_fed_bytes = 0;
+        uint64_t last_returned = 0;
+
+        // Parses the pcap into raw records, exits on a file it cannot replay
+        void load(std::vector<uint8_t> &data, std::vector<size_t> &offsets, std::vector<uint16_t> &lens);
+        void create_port(int socket_id);
+        void fill(const std::vector<uint8_t> &data, const std::vector<size_t> &offsets,
+                  const std::vector<uint16_t> &lens);
+
+        uint64_t feed_limit() const;
+        bool feed(Feed &f);
+        unsigned int drain();
+        bool all_returned() const;
+        uint64_t loops_done() const;
+
+    public:
+        // Loads cfg.pcap and creates the replay port with nb_queues rx/tx Qs, of which rx_queues are polled
+        PcapReplay(const ReplayConfig &cfg, uint16_t nb_queues, const std::vector<uint16_t> &rx_queues, int socket_id);
+        ~PcapReplay();
+
+        uint16_t get_port_id() const { return port_id; }
+        uint32_t get_nb_pkts() const { return nb_pkts; }
+        uint32_t get_skipped() const { return skipped; }
+
+        // Starts the feeder on a free worker lcore, call after the forwarders took theirs
+        void launch();
+        static int run(void *replay);
+        void stop() { stop_flag = true; }
+        // Every loop was fed and the pipeline took all of it: only with cfg.loops > 0
+        bool done() const { return done_flag; }
+
+        // Fed and returned rates since the last call, and the totals once stopped
+        void report();
+        void summary();
+};
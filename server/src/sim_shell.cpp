@@ -0,0 +1,101 @@
+#include "sim_shell.h"
+
+#include <cstring>
+
+#define SHELL_STATUS_SYSTEM (0x1)
+#define SHELL_STATUS_CMAC(i) (0x10 << (4 * (i)))
+#define RX_STATUS_ALIGNED (0x3) // stat_rx_status | stat_rx_aligned
+
+SimOnicShell::SimOnicShell(const SimShellConfig &cfg) : cfg(cfg) {
+    power_on();
+}
+
+void SimOnicShell::power_on() {
+    regs.clear();
+    shell_status = SHELL_STATUS_SYSTEM;
+    for (int i = 0; i < NB_CMAC; i++)
+        shell_status |= SHELL_STATUS_CMAC(i);
+    shell_status &= ~cfg.stuck_reset;
+    reset_pending = 0;
+    for (int i = 0; i < NB_CMAC; i++)
+        rx_enabled_ms[i] = -1;
+    memset(counts, 0, sizeof(counts));
+}
+
+void SimOnicShell::tick(int cmac_id) {
+    for (int c = 0; c < NB_CMAC_COUNTERS; c++) {
+        uint64_t value = counts[cmac_id][c] & ((1ULL << CMAC_COUNTER_WIDTH) - 1);
+        regs[cmac_counter_offset(cmac_id, c)] = (uint32_t)value;
+        regs[cmac_counter_offset(cmac_id, c) + 4] = (uint32_t)(value >> 32);
+        counts[cmac_id][c] = 0;
+    }
+}
+
+uint32_t SimOnicShell::rx_status(int cmac_id) {
+    if (cmac_id >= cfg.nb_cmacs || (cfg.absent & (1u << cmac_id)) || rx_enabled_ms[cmac_id] < 0 ||
+        (cfg.never_align & (1u << cmac_id)))
+        return 0;
+    return (now_ms >= (uint64_t)rx_enabled_ms[cmac_id] + cfg.align_ms) ? RX_STATUS_ALIGNED : 0;
+}
+
+uint32_t SimOnicShell::read(uint32_t offset) {
+    nb_reads++;
+    if (offset == SYSCFG_OFFSET_SHELL_STATUS) {
+        if (reset_pending && now_ms >= reset_done_ms) {
+            shell_status |= reset_pending & ~cfg.stuck_reset;
+            reset_pending = 0;
+        }
+        return shell_status;
+    }
+    for (int i = 0; i < NB_CMAC; i++) {
+        if (offset == CMAC_OFFSET_CORE_VERSION(i))
+            return (i < cfg.nb_cmacs && !(cfg.absent & (1u << i))) ? ONIC_CMAC_CORE_VERSION : 0;
+        if (offset == CMAC_OFFSET_STAT_RX_STATUS(i))
+            return rx_status(i);
+    }
+    return peek(offset);
+}
+
+void SimOnicShell::write(uint32_t offset, uint32_t val) {
+    nb_writes++;
+    if (offset == SYSCFG_OFFSET_SYSTEM_RESET) {
+        nb_system_resets++;
+        power_on();
+        return;
+    }
+    if (offset == SYSCFG_OFFSET_SHELL_RESET) {
+        shell_status &= ~val;
+        reset_pending |= val;
+        reset_done_ms = now_ms + cfg.reset_ms;
+        return;
+    }
+    for (int i = 0; i < NB_CMAC; i++) {
+        if (offset == CMAC_OFFSET_TICK(i) && (val & 0x1)) {
+            tick(i);
+            return;
+        }
+        if (offset == CMAC_OFFSET_CONF_RX_1(i))
+            rx_enabled_ms[i] = (val & 0x1) ? (int64_t)now_ms : -1;
+    }
+    regs[offset] = val;
+}
+
+void SimOnicShell::add_traffic(int cmac_id, uint64_t rx_pkts, uint64_t rx_bytes, uint64_t tx_pkts, uint64_t tx_bytes,
+                               uint64_t rx_bad) {
+    uint64_t *c = counts[cmac_id];
+    uint64_t rx_avg = (rx_pkts == 0) ? 0 : rx_bytes / rx_pkts;
+    c[CMAC_RX_TOTAL_PKTS] += rx_pkts;
+    c[CMAC_RX_GOOD_PKTS] += rx_pkts - rx_bad;
+    c[CMAC_RX_PKT_BAD_FCS] += rx_bad;
+    c[CMAC_RX_TOTAL_BYTES] += rx_bytes;
+    c[CMAC_RX_GOOD_BYTES] += rx_bytes - rx_bad * rx_avg;
+    c[CMAC_TX_TOTAL_PKTS] += tx_pkts;
+    c[CMAC_TX_GOOD_PKTS] += tx_pkts;
+    c[CMAC_TX_TOTAL_BYTES] += tx_bytes;
+    c[CMAC_TX_GOOD_BYTES] += tx_bytes;
+}
+
+uint32_t SimOnicShell::peek(uint32_t offset) const {
+    auto it = regs.find(offset);
+    return (it == regs.end()) ? 0 : it->second;
+}
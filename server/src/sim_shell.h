@@ -0,0 +1,58 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "reg_backend.h"
+#include "onic.h"
+#include "cmac_collector.h"
+
+#define SIM_SHELL_RESET_MS (2)  // shell reset to status done
+#define SIM_RX_ALIGN_MS (5)     // rx enabled to rx aligned
+
+struct SimShellConfig {
+    int nb_cmacs = NB_CMAC;           // CMACs answering with ONIC_CMAC_CORE_VERSION
+    unsigned int reset_ms = SIM_SHELL_RESET_MS;
+    unsigned int align_ms = SIM_RX_ALIGN_MS;
+    uint32_t stuck_reset = 0;         // SHELL_STATUS bits that never come back after a reset
+    uint32_t never_align = 0;         // bit i: CMAC i never reports rx aligned
+    uint32_t absent = 0;              // bit i: CMAC i has no core, like those past nb_cmacs
+};
+
+// Model of the open-nic-shell register space laid out as in onic_regs.h, enough for Onic's control
+// path: shell/system resets with a completion delay, CMAC versions, rx alignment after CONF_RX_1,
+// and the CMAC stat counters, latched and cleared on every tick like the CMAC does.
+// Time only moves in delay_ms(), so waits cost nothing and a stuck register makes timeouts fire at once.
+// Every other register reads back what was last written
+class SimOnicShell : public RegisterBackend {
+    private:
+        SimShellConfig cfg;
+        std::unordered_map<uint32_t, uint32_t> regs;
+        uint64_t now_ms = 0;
+        uint32_t shell_status = 0;
+        uint32_t reset_pending = 0;
+        uint64_t reset_done_ms = 0;
+        int64_t rx_enabled_ms[NB_CMAC];
+        uint64_t counts[NB_CMAC][NB_CMAC_COUNTERS]; // since the last tick
+
+        void power_on();
+        void tick(int cmac_id);
+        uint32_t rx_status(int cmac_id);
+
+    public:
+        uint64_t nb_reads = 0;
+        uint64_t nb_writes = 0;
+        uint64_t nb_system_resets = 0;
+
+        explicit SimOnicShell(const SimShellConfig &cfg = SimShellConfig());
+
+        uint32_t read(uint32_t offset) override;
+        void write(uint32_t offset, uint32_t val) override;
+        void delay_ms(unsigned int ms) override { now_ms += ms; }
+
+        uint64_t elapsed_ms() const { return now_ms; }
+        // Traffic seen by a CMAC since the last tick, bad packets are counted as bad FCS
+        void add_traffic(int cmac_id, uint64_t rx_pkts, uint64_t rx_bytes, uint64_t tx_pkts, uint64_t tx_bytes,
+                         uint64_t rx_bad = 0);
+        // Value last written to a register, whatever the model does on reads
+        uint32_t peek(uint32_t offset) const;
+};
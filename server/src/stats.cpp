@@ -1,6 +1,7 @@
 #include "stats.h"
 #include "onic.h"
 #include <cstdint>
+#include <cstdlib>
 
 int StatsLog_run_producer(void *statslog) {
     return static_cast<StatsLog *>(statslog)->run_stats_producer();
@@ -10,27 +11,21 @@ int StatsLog::run_stats_producer(){
     RTE_LOG(INFO, USER1, "CTX(%d)Stats producer started on lcore %u\n", ctx->ctx_id, rte_lcore_id());
 
     // convert FPGA port to DPDK port id
-    OnicPort rx_port = (ctx->rx_onic->get_ports()[ctx->rx_port]);
-    OnicPort tx_port = (ctx->tx_onic->get_ports()[ctx->tx_port]);
+    const OnicPort &rx_port = (ctx->rx_onic->get_ports()[ctx->rx_port]);
+    const OnicPort &tx_port = (ctx->tx_onic->get_ports()[ctx->tx_port]);
 
     uint16_t rx_port_id = rx_port.get_port_id();
     uint16_t tx_port_id = tx_port.get_port_id();
     int ret;
 
+    // Measurement and tags never change, formatted once
     std::ostringstream oss;
     oss << STATS_TABLE_NAME
         << "(ports-" << rte_lcore_id() << ")"
         << ",rx_port(" << rx_port_id << ")=" << to_string(rx_port.get_bdf()) 
-        << ",tx_port(" << tx_port_id << ")="<< to_string(tx_port.get_bdf())
-        << " ";
+        << ",tx_port(" << tx_port_id << ")="<< to_string(tx_port.get_bdf());
+    const std::string kafka_header = oss.str();
 
-    std::string kafka_header = oss.str();
-    std::string kafka_data;
-    std::string kafka_message;
-
-    kafka_data.reserve(1024);
-    kafka_message.reserve(2048);
-    
     while (!rte_atomic32_read(&ctx->stop_flag)) {
         // Get rx stats
         ret = rte_eth_stats_get(rx_port_id, &rx_stats);
@@ -47,13 +42,20 @@ int StatsLog::run_stats_producer(){
         curr_time = rte_get_tsc_cycles();
         uint64_t delta_ns = StatsLog::get_tsc_delta_ns(old_time, curr_time, hz);
         old_time = curr_time;
-        kafka_message = kafka_header + \
-                        rte_stats_to_string(rx_stats, "(R)") + "," + \
-                        rte_stats_to_string(tx_stats, "(T)") + "," + \
-                        "DELTA_NS=" + std::to_string(delta_ns) + "\n";
-        produce_kafka_message(kafka_message);
-        // produce latency stats
-        extract_then_produce_latency_packets(ctx);
+
+        batch.begin(kafka_header.data(), kafka_header.size());
+        encode_rte_stats(batch, rx_stats, "(R)");
+        encode_rte_stats(batch, tx_stats, "(T)");
+        batch.field("DELTA_NS", delta_ns);
+        batch.end();
+
+        // produce latency stats: one summary per hop, and the raw records when a stats ring is set
+        latency_hist.report(ctx->ctx_id, &batch);
+        if (ctx->stats_ring != nullptr)
+            extract_then_produce_latency_packets(ctx);
+
+        // Everything of this interval goes out as one Kafka message
+        produce_batch();
         rte_delay_ms(1000);
     }
     return 0;
@@ -68,27 +70,18 @@ int StatsLog::run_cmac_producer(){
     RTE_LOG(INFO, USER1, "CMAC stats producer started on lcore %u\n", core_id);
 
     // convert FPGA port to DPDK port id
-    OnicPort rx_port = (ctx->rx_onic->get_ports()[ctx->rx_port]);
-    OnicPort tx_port = (ctx->tx_onic->get_ports()[ctx->tx_port]);
+    const OnicPort &rx_port = (ctx->rx_onic->get_ports()[ctx->rx_port]);
+    const OnicPort &tx_port = (ctx->tx_onic->get_ports()[ctx->tx_port]);
     
     uint16_t rx_port_id = rx_port.get_port_id();
     uint16_t tx_port_id = tx_port.get_port_id();
 
-    int ret;
-
     std::ostringstream oss;
     oss << STATS_TABLE_NAME
         << "(CMAC-" << core_id << ")"
         << ",rx_port=" << to_string(rx_port.get_bdf())
-        << ",tx_port=" << to_string(tx_port.get_bdf())
-        << " ";
-
-    std::string kafka_header = oss.str();
-    std::string kafka_data;
-    std::string kafka_message;
-
-    kafka_data.reserve(1024);
-    kafka_message.reserve(2048);
+        << ",tx_port=" << to_string(tx_port.get_bdf());
+    const std::string kafka_header = oss.str();
 
     while (!rte_atomic32_read(&ctx->stop_flag)) {
         // Get FPGA level stats
@@ -100,115 +93,45 @@ int StatsLog::run_cmac_producer(){
         curr_time = rte_get_tsc_cycles();
         uint64_t delta_ns = StatsLog::get_tsc_delta_ns(old_time, curr_time, hz);
         old_time = curr_time;
-        kafka_message = kafka_header + \
-                        rx_stats.to_string("R") + "," + \
-                        tx_stats.to_string("T") + ","\
-                        "DELTA_NS=" + std::to_string(delta_ns) + "\n";
-        produce_kafka_message(kafka_message);   
+
+        batch.begin(kafka_header.data(), kafka_header.size());
+        rx_stats.encode(batch, "R");
+        tx_stats.encode(batch, "T");
+        batch.field("DELTA_NS", delta_ns);
+        batch.end();
+        produce_batch();
         rte_delay_ms(3000);
     }
     return 0;
 }
 
-std::string StatsLog::rte_stats_to_string(const struct rte_eth_stats &stats, std::string direction) {
-    std::ostringstream oss;
-    oss << direction << "rx_packets=" << stats.ipackets
-        << "," << direction << "rx_Bytes=" << stats.ibytes
-        << "," << direction << "rx_fail_packets=" << stats.ierrors
-        << "," << direction << "tx_packets=" << stats.opackets
-        << "," << direction << "tx_Bytes=" << stats.obytes
-        << "," << direction << "tx_fail_packets=" << stats.oerrors;
-
-    return oss.str();
+void StatsLog::encode_rte_stats(LineEncoder &enc, const struct rte_eth_stats &stats, const char *direction) {
+    enc.field(direction, "rx_packets", stats.ipackets)
+       .field(direction, "rx_Bytes", stats.ibytes)
+       .field(direction, "rx_fail_packets", stats.ierrors)
+       .field(direction, "tx_packets", stats.opackets)
+       .field(direction, "tx_Bytes", stats.obytes)
+       .field(direction, "tx_fail_packets", stats.oerrors);
 }
 
 void StatsLog::extract_then_produce_latency_packets(const ForwardingContext *ctx){
-    struct rte_ring *mbuf_ring = ctx->stats_ring;
-    struct rte_mbuf *mbufs[BURST_SIZE];
-
-    // Check ring for new packets
-    unsigned int nb_rx = rte_ring_dequeue_burst(ctx->rx_onic->mbuf_ring, (void **)mbufs, BURST_SIZE, NULL);
+    if (!latency_records)
+        latency_records.reset(new LatencyRecordConsumer(ctx->stats_ring));
 
-    for(int i = 0; i < nb_rx; i++){
-        Timestamps timestamp(mbufs[i]);
-        std::string latency = timestamp.get_latency_str();
-        produce_latency_message(latency);
-    }
+    // Drain the records in bursts, no mbuf ever reaches this lcore
+    while (latency_records->drain(&batch) > 0 && batch.nearly_full())
+        produce_batch();
 }
 
-void StatsLog::produce_latency_message(std::string latency){
-    static std::string kafka_header = std::string(LATENCY_TABLE_NAME) + ", ";
-    std::string kafka_payload = kafka_header + latency + "\n";
-    produce_kafka_message(kafka_payload, NULL, 0);
+void StatsLog::produce_kafka_message(const std::string &payload) {
+    kafka->send(topic, payload);
 }
 
-void StatsLog::create_kafka_topic(const char *topic){
-    char hostname[128];
-    char errstr[512];
-
-    // 1. Create Kafka configuration
-    rd_kafka_conf_t *conf = rd_kafka_conf_new();
-
-    // 2. Set client ID (hostname)
-    if (gethostname(hostname, sizeof(hostname))) {
-        std::cerr << "Failed to get hostname: " << strerror(errno) << std::endl;
-        exit(1);
-    }
-
-    if (rd_kafka_conf_set(conf, "client.id", hostname, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
-        std::cerr << "Kafka config error (client.id): " << errstr << std::endl;
-        exit(1);
-    }
-
-    // 3. Set brokers (comma-separated list)
-    if (rd_kafka_conf_set(conf, "bootstrap.servers", "localhost:9092", errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
-        std::cerr << "Kafka config error (bootstrap.servers): " << errstr << std::endl;
-        exit(1);
-    }
-
-    // 4. Topic configuration (acks=all for reliability)
-    rd_kafka_topic_conf_t *topic_conf = rd_kafka_topic_conf_new();
-    if (rd_kafka_topic_conf_set(topic_conf, "acks", "all", errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
-        std::cerr << "Kafka topic config error (acks): " << errstr << std::endl;
-        exit(1);
-    }
-
-    // 5. Create Kafka producer
-    rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
-    if (!rk) {
-        std::cerr << "Failed to create Kafka producer: " << errstr << std::endl;
-        exit(1);
-    }
-
-    // 6. Create topic object
-    rkt = rd_kafka_topic_new(rk, topic, topic_conf);
-    if (!rkt) {
-        std::cerr << "Failed to create topic object: " << rd_kafka_err2str(rd_kafka_last_error()) << std::endl;
-        exit(1);
-    }
-}
-
-void StatsLog::produce_kafka_message(std::string payload, const char *key, size_t key_len) {
-    if (rd_kafka_produce(
-            rkt,
-            RD_KAFKA_PARTITION_UA,  // Let Kafka choose partition
-            RD_KAFKA_MSG_F_COPY,    // Copy payload (so you can reuse the buffer)
-            (void *)payload.c_str(),        // Message payload
-            payload.size(),            // Payload length
-            key,                    // Optional key (NULL if unused)
-            key_len,               // Key length (0 if unused)
-            NULL                    // Opaque message data (optional)
-        ) == -1) {
-        // std::cerr << "Failed to produce to topic " << topic << ": "
-                //   << rd_kafka_err2str(rd_kafka_last_error()) << std::endl;
-    } else {
-        // std::cout << "Successfully produced message to topic: " << topic << std::endl;
-    }
-
-}
+void StatsLog::produce_batch() {
+    if (batch.empty())
+        return;
 
-void StatsLog::cleanup_kafka() {
-    rd_kafka_flush(rk, 10 * 1000);  // Wait for messages to be sent
-    rd_kafka_topic_destroy(rkt);
-    rd_kafka_destroy(rk);
+    // The service, then librdkafka, own the buffer until it is delivered: no copy
+    size_t len = batch.size();
+    kafka->send(topic, batch.release(), len);
 }
@@ -0,0 +1,96 @@
+#include "timer_wheel.h"
+
+#include <rte_common.h>
+#include <rte_debug.h>
+#include <rte_malloc.h>
+
+TimerWheel::TimerWheel(uint32_t nb_nodes, uint64_t now, int socket_id)
+    : nb_nodes(nb_nodes), cur(now)
+{
+    size_t nb_links = (size_t)nb_nodes + NB_LISTS;
+    next = (uint32_t *)rte_malloc_socket("timer_next", sizeof(uint32_t) * nb_links, 0, socket_id);
+    prev = (uint32_t *)rte_malloc_socket("timer_prev", sizeof(uint32_t) * nb_links, 0, socket_id);
+    expire = (uint64_t *)rte_malloc_socket("timer_expire", sizeof(uint64_t) * RTE_MAX(nb_nodes, 1u), 0, socket_id);
+    if (next == NULL || prev == NULL || expire == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate a timer wheel of %u nodes on socket %d\n", nb_nodes, socket_id);
+
+    for (uint32_t node = 0; node < nb_nodes; node++)
+        next[node] = prev[node] = TIMER_NONE;
+    for (uint32_t list = 0; list < NB_LISTS; list++)
+        next[sentinel(list)] = prev[sentinel(list)] = sentinel(list);
+}
+
+TimerWheel::~TimerWheel(){
+    rte_free(next);
+    rte_free(prev);
+    rte_free(expire);
+}
+
+// Lowest level whose span still reaches the deadline. A node in an upper level slot is spliced
+// at the start of its deadline's 256 (or 16384) tick block and placed again from there
+void TimerWheel::place(uint32_t node){
+    uint64_t t = expire[node];
+    if (t <= cur) {
+        link(node, due());
+        return;
+    }
+    uint64_t delta = t - cur;
+    uint32_t list;
+    if (delta < L0_SLOTS) {
+        list = t & (L0_SLOTS - 1);
+    } else if (delta < (1ull << L2_SHIFT)) {
+        list = L0_SLOTS + ((t >> L1_SHIFT) & (L1_SLOTS - 1));
+    } else {
+        if (delta >= RANGE)
+            t = cur + RANGE - 1;
+        list = L0_SLOTS + L1_SLOTS + ((t >> L2_SHIFT) & (L2_SLOTS - 1));
+    }
+    link(node, sentinel(list));
+}
+
+void TimerWheel::splice_due(uint32_t list){
+    uint32_t head = sentinel(list);
+    if (next[head] == head)
+        return;
+    uint32_t first = next[head];
+    uint32_t last = prev[head];
+    uint32_t tail = prev[due()];
+    next[tail] = first;
+    prev[first] = tail;
+    next[last] = due();
+    prev[due()] = last;
+    next[head] = prev[head] = head;
+}
+
+void TimerWheel::tick(){
+    cur++;
+    if ((cur & (L0_SLOTS - 1)) == 0) {
+        if ((cur & ((1ull << L2_SHIFT) - 1)) == 0)
+            splice_due(L0_SLOTS + L1_SLOTS + ((cur >> L2_SHIFT) & (L2_SLOTS - 1)));
+        splice_due(L0_SLOTS + ((cur >> L1_SHIFT) & (L1_SLOTS - 1)));
+    }
+    splice_due(cur & (L0_SLOTS - 1));
+}
+
+uint32_t TimerWheel::advance_slow(uint64_t now, uint32_t *fired, uint32_t max){
+    for (uint32_t n = 0; n < TIMER_WHEEL_MAX_TICKS && cur < now; n++)
+        tick();
+
+    // Nodes an upper level spliced ahead of their deadline go back on the wheel, that counts
+    // against max as well: however much came due, one call does a bounded amount of work
+    uint32_t nb = 0;
+    for (uint32_t work = 0; work < max; work++) {
+        uint32_t node = next[due()];
+        if (node == due())
+            break;
+        unlink(node);
+        if (expire[node] > cur) {
+            place(node);
+            continue;
+        }
+        next[node] = TIMER_NONE;
+        nb_armed--;
+        fired[nb++] = node;
+    }
+    return nb;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <rte_branch_prediction.h>
+
+#define TIMER_NONE (UINT32_MAX)         // link of a node that is not armed
+#define TIMER_WHEEL_L0_BITS (8)         // 256 slots of 1 tick
+#define TIMER_WHEEL_L1_BITS (6)         // 64 slots of 256 ticks
+#define TIMER_WHEEL_L2_BITS (6)         // 64 slots of 16384 ticks: deadlines up to 2^20 ticks out
+#define TIMER_WHEEL_MAX_TICKS (64)      // ticks one advance() moves at most, the rest waits for the next call
+
+// Hierarchical timing wheel over nodes 0 to nb_nodes - 1, e.g. a table's entry indices. Each node
+// is on at most one circular doubly linked list, kept in plain index arrays next to the wheel so
+// arming or cancelling never touches the owner's entries and costs O(1).
+// A slot whose tick comes is spliced whole onto the due list, higher levels when the level under
+// them wraps, so a tick costs O(1) however many nodes it holds. advance() then hands out at most
+// its budget of due nodes: a node fires at or after its deadline, never before. Deadlines further
+// out than the wheel covers are clamped, the node goes round again when it comes up
+class TimerWheel {
+    private:
+        static constexpr uint32_t L0_SLOTS = 1u << TIMER_WHEEL_L0_BITS;
+        static constexpr uint32_t L1_SLOTS = 1u << TIMER_WHEEL_L1_BITS;
+        static constexpr uint32_t L2_SLOTS = 1u << TIMER_WHEEL_L2_BITS;
+        static constexpr uint32_t L1_SHIFT = TIMER_WHEEL_L0_BITS;
+        static constexpr uint32_t L2_SHIFT = TIMER_WHEEL_L0_BITS + TIMER_WHEEL_L1_BITS;
+        static constexpr uint64_t RANGE = 1ull << (L2_SHIFT + TIMER_WHEEL_L2_BITS);
+        static constexpr uint32_t NB_LISTS = L0_SLOTS + L1_SLOTS + L2_SLOTS + 1;  // slots, then due
+
+        uint32_t nb_nodes;
+        // Links of nodes 0 to nb_nodes - 1, then of the lists' sentinels
+        uint32_t *next = nullptr;
+        uint32_t *prev = nullptr;
+        uint64_t *expire = nullptr;
+        uint64_t cur;               // every tick up to this one has been spliced
+        uint32_t nb_armed = 0;
+
+        inline uint32_t sentinel(uint32_t list) const { return nb_nodes + list; }
+        inline uint32_t due() const { return sentinel(NB_LISTS - 1); }
+
+        inline void link(uint32_t node, uint32_t head) {
+            uint32_t tail = prev[head];
+            next[tail] = node;
+            prev[node] = tail;
+            next[node] = head;
+            prev[head] = node;
+        }
+
+        inline void unlink(uint32_t node) {
+            next[prev[node]] = next[node];
+            prev[next[node]] = prev[node];
+        }
+
+        void place(uint32_t node);
+        void splice_due(uint32_t list);
+        void tick();
+        uint32_t advance_slow(uint64_t now, uint32_t *fired, uint32_t max);
+
+    public:
+        // Nodes and lists on socket_id, exits when they cannot be allocated. now is the current tick
+        TimerWheel(uint32_t nb_nodes, uint64_t now, int socket_id);
+        ~TimerWheel();
+        TimerWheel(const TimerWheel &) = delete;
+        TimerWheel &operator=(const TimerWheel &) = delete;
+
+        // (Re)arms node to fire once tick expire_tick has come, right away if it already has
+        inline void arm(uint32_t node, uint64_t expire_tick) {
+            if (next[node] != TIMER_NONE)
+                unlink(node);
+            else
+                nb_armed++;
+            expire[node] = expire_tick;
+            place(node);
+        }
+
+        inline void cancel(uint32_t node) {
+            if (next[node] == TIMER_NONE)
+                return;
+            unlink(node);
+            next[node] = TIMER_NONE;
+            nb_armed--;
+        }
+
+        bool armed(uint32_t node) const { return next[node] != TIMER_NONE; }
+        uint32_t size() const { return nb_armed; }
+        uint64_t now() const { return cur; }
+
+        // Moves the wheel towards now (TIMER_WHEEL_MAX_TICKS at most) and writes up to max nodes
+        // that are due into fired, disarmed. Returns how many. Nothing to do costs a compare
+        inline uint32_t advance(uint64_t now, uint32_t *fired, uint32_t max) {
+            if (likely(now <= cur && next[due()] == due()))
+                return 0;
+            return advance_slow(now, fired, max);
+        }
+};
@@ -0,0 +1,378 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <rte_ethdev.h>
+
+// Parsing toml files
+#include "toml.hpp"
+
+#define topology_exit(...) rte_exit(EXIT_FAILURE, "Topology: " __VA_ARGS__)
+
+// Ports can be given as DPDK port ids (0) or PCI addresses ("81:00.0" or "0000:81:00.0")
+static int parse_port_id(const toml::node &node, const std::string &onic_name) {
+    if (auto id = node.value<int64_t>())
+        return *id;
+
+    auto bdf = node.value<std::string>();
+    if (!bdf)
+        topology_exit("onic '%s': ports must be port ids or PCI addresses\n", onic_name.c_str());
+
+    uint16_t port_id;
+    if (rte_eth_dev_get_port_by_name(bdf->c_str(), &port_id) == 0)
+        return port_id;
+    if (rte_eth_dev_get_port_by_name(("0000:" + *bdf).c_str(), &port_id) == 0)
+        return port_id;
+
+    topology_exit("onic '%s': no DPDK port for %s, is it allowed with -a?\n", onic_name.c_str(), bdf->c_str());
+}
+
+static std::vector<int> parse_int_array(toml::node_view<const toml::node> node) {
+    std::vector<int> out;
+    if (const toml::array *arr = node.as_array()) {
+        for (const toml::node &elem : *arr)
+            out.push_back(elem.value_or(-1));
+    }
+    return out;
+}
+
+static ForwardMode parse_forward_mode(const std::string &mode, int ctx_id) {
+    if (mode == to_string(ForwardMode::PIPELINED))
+        return ForwardMode::PIPELINED;
+    if (mode == to_string(ForwardMode::RUN_TO_COMPLETION))
+        return ForwardMode::RUN_TO_COMPLETION;
+    topology_exit("context %d: unknown mode '%s'\n", ctx_id, mode.c_str());
+}
+
+static RingPolicy parse_ring_policy(const std::string &policy, int ctx_id) {
+    for (RingPolicy p : {RingPolicy::DROP, RingPolicy::RETRY, RingPolicy::HOLD}) {
+        if (policy == to_string(p))
+            return p;
+    }
+    topology_exit("context %d: unknown ring policy '%s'\n", ctx_id, policy.c_str());
+}
+
+static IdlePolicy parse_idle_policy(const std::string &policy, int ctx_id) {
+    for (IdlePolicy p : {IdlePolicy::SPIN, IdlePolicy::PAUSE, IdlePolicy::MONITOR, IdlePolicy::SLEEP, IdlePolicy::INTERRUPT}) {
+        if (policy == to_string(p))
+            return p;
+    }
+    topology_exit("context %d: unknown idle policy '%s'\n", ctx_id, policy.c_str());
+}
+
+static TxPolicy parse_tx_policy(const std::string &policy, int ctx_id) {
+    for (TxPolicy p : {TxPolicy::DROP, TxPolicy::RETRY, TxPolicy::BUFFER}) {
+        if (policy == to_string(p))
+            return p;
+    }
+    topology_exit("context %d: unknown tx policy '%s'\n", ctx_id, policy.c_str());
+}
+
+// Replay port Q standing in for Q q of an onic port: the index of that onic/port/Q among the ones seen
+// so far in the same direction, the next free one the first time
+static int replay_queue(std::vector<std::string> &seen, const ContextConfig &ctx, const std::string &onic, int port, int q) {
+    std::string key = onic + "/" + std::to_string(port) + "/" + std::to_string(q);
+    auto it = std::find(seen.begin(), seen.end(), key);
+    if (it != seen.end())
+        return it - seen.begin();
+    if (seen.size() == REPLAY_MAX_QUEUES)
+        topology_exit("context %d: the replay port has %d queues per direction, the contexts use more\n",
+                      ctx.ctx_id, REPLAY_MAX_QUEUES);
+    seen.push_back(key);
+    return seen.size() - 1;
+}
+
+// Claims onic/port/Q q of one direction for ctx. A DPDK queue is polled or sent on from one lcore only:
+// a second context on it is refused
+static void claim_queue(std::vector<std::pair<std::string, int>> &claimed, const ContextConfig &ctx, const char *dir,
+                        const std::string &onic, int port, int q) {
+    std::string key = onic + "/" + std::to_string(port) + "/" + std::to_string(q);
+    for (const auto &owner : claimed) {
+        if (owner.first == key)
+            topology_exit("context %d: %s queue %s is already used by context %d\n", ctx.ctx_id, dir, key.c_str(),
+                          owner.second);
+    }
+    claimed.emplace_back(key, ctx.ctx_id);
+}
+
+static OnicConfig parse_onic(const toml::table &tbl) {
+    OnicConfig onic;
+    onic.name = tbl["name"].value_or(std::string{});
+    if (onic.name.empty())
+        topology_exit("every [[onic]] needs a name\n");
+
+    if (const toml::array *ports = tbl["ports"].as_array()) {
+        for (const toml::node &port : *ports)
+            onic.port_ids.push_back(parse_port_id(port, onic.name));
+    }
+    if (onic.port_ids.empty() || onic.port_ids.size() > NB_PORTS)
+        topology_exit("onic '%s': needs 1 to %d ports\n", onic.name.c_str(), NB_PORTS);
+
+    onic.num_queues = tbl["num_queues"].value_or(onic.num_queues);
+    onic.nb_descs = tbl["nb_descs"].value_or(onic.nb_descs);
+    onic.st_queues = tbl["st_queues"].value_or(onic.st_queues);
+    onic.buff_size = tbl["buff_size"].value_or(onic.buff_size);
+    onic.nb_mbufs = tbl["nb_mbufs"].value_or(onic.nb_mbufs);
+    onic.rs_fec = tbl["rs_fec"].value_or(false) ? 1 : 0;
+    onic.socket_id = tbl["socket_id"].value_or(onic.socket_id);
+    return onic;
+}
+
+// capture = { proto = "udp", src = "10.0.0.0/8", dst_port = 53, ... }, every key optional
+static CaptureFilter parse_capture_filter(const toml::table &tbl, int ctx_id) {
+    CaptureFilter filter;
+    std::string proto = tbl["proto"].value_or(std::string{});
+    std::string src = tbl["src"].value_or(std::string{});
+    std::string dst = tbl["dst"].value_or(std::string{});
+    int64_t src_port = tbl["src_port"].value_or(-1);
+    int64_t dst_port = tbl["dst_port"].value_or(-1);
+    int64_t vlan = tbl["vlan"].value_or(-1);
+    if (!proto.empty() && !filter.set_proto(proto))
+        topology_exit("context %d: unknown capture proto '%s'\n", ctx_id, proto.c_str());
+    if ((!src.empty() && !filter.set_src(src)) || (!dst.empty() && !filter.set_dst(dst)))
+        topology_exit("context %d: capture src/dst must be addresses or prefixes of one family\n", ctx_id);
+    if (src_port > UINT16_MAX || dst_port > UINT16_MAX)
+        topology_exit("context %d: capture ports go up to %d\n", ctx_id, UINT16_MAX);
+    if (src_port >= 0)
+        filter.set_src_port(src_port);
+    if (dst_port >= 0)
+        filter.set_dst_port(dst_port);
+    if (tbl.contains("vlan") && !filter.set_vlan(vlan))
+        topology_exit("context %d: capture vlan must be 0 to 4095\n", ctx_id);
+    filter.set_both_ways(tbl["both_ways"].value_or(true));
+    return filter;
+}
+
+static ContextConfig parse_context(const toml::table &tbl, int default_id) {
+    ContextConfig ctx;
+    ctx.ctx_id = tbl["id"].value_or(default_id);
+    ctx.mode = parse_forward_mode(tbl["mode"].value_or(std::string(to_string(ForwardMode::PIPELINED))), ctx.ctx_id);
+    ctx.ring_size = tbl["ring_size"].value_or(ctx.ring_size);
+    ctx.ring_policy = parse_ring_policy(tbl["ring_policy"].value_or(std::string(to_string(ctx.ring_policy))), ctx.ctx_id);
+    ctx.parse_latency = tbl["parse_latency"].value_or(false);
+    ctx.tx_policy = parse_tx_policy(tbl["tx"]["policy"].value_or(std::string(to_string(ctx.tx_policy))), ctx.ctx_id);
+    ctx.tx_retry_us = tbl["tx"]["retry_us"].value_or(ctx.tx_retry_us);
+    ctx.tx_flush_us = tbl["tx"]["flush_us"].value_or(ctx.tx_flush_us);
+    ctx.idle.policy = parse_idle_policy(tbl["idle"]["policy"].value_or(std::string(to_string(ctx.idle.policy))), ctx.ctx_id);
+    ctx.idle.pause_after = tbl["idle"]["pause_after"].value_or(ctx.idle.pause_after);
+    ctx.idle.sleep_after = tbl["idle"]["sleep_after"].value_or(ctx.idle.sleep_after);
+    ctx.idle.max_sleep_us = tbl["idle"]["max_sleep_us"].value_or(ctx.idle.max_sleep_us);
+    ctx.burst_size = tbl["burst_size"].value_or(ctx.burst_size);
+    ctx.prefetch_ahead = tbl["prefetch"].value_or(ctx.prefetch_ahead);
+    ctx.flows.capacity = tbl["flows"]["capacity"].value_or(ctx.flows.capacity);
+    ctx.flows.idle_timeout_ms = tbl["flows"]["idle_timeout_ms"].value_or(ctx.flows.idle_timeout_ms);
+    ctx.flows.active_timeout_ms = tbl["flows"]["active_timeout_ms"].value_or(ctx.flows.active_timeout_ms);
+    ctx.stage_cycles = tbl["stage_cycles"].value_or(ctx.stage_cycles);
+    if (const toml::table *capture = tbl["capture"].as_table()) {
+        ctx.capture = true;
+        ctx.capture_filter = parse_capture_filter(*capture, ctx.ctx_id);
+    }
+
+    ctx.rx_onic = tbl["rx"]["onic"].value_or(std::string{});
+    ctx.rx_port = tbl["rx"]["port"].value_or(-1);
+    ctx.rx_Qs = parse_int_array(tbl["rx"]["queues"]);
+    ctx.tx_onic = tbl["tx"]["onic"].value_or(std::string{});
+    ctx.tx_port = tbl["tx"]["port"].value_or(-1);
+    ctx.tx_Qs = parse_int_array(tbl["tx"]["queues"]);
+    ctx.lcores = parse_int_array(tbl["lcores"]);
+
+    if (ctx.rx_Qs.empty())
+        ctx.rx_Qs.push_back(0);
+    if (ctx.tx_Qs.empty())
+        ctx.tx_Qs.push_back(0);
+    return ctx;
+}
+
+Topology Topology::load(const char *path, const char *replay_pcap) {
+    Topology topo;
+    toml::table tbl;
+    try {
+        tbl = toml::parse_file(path);
+    } catch (const toml::parse_error &err) {
+        topology_exit("cannot parse %s: %s (line %u)\n", path,
+                      std::string(err.description()).c_str(), err.source().begin.line);
+    }
+
+    topo.stats_ring_size = tbl["app"]["stats_ring_size"].value_or(topo.stats_ring_size);
+    topo.flow_ring_size = tbl["app"]["flow_ring_size"].value_or(topo.flow_ring_size);
+    topo.latency_records = tbl["app"]["latency_records"].value_or(topo.latency_records);
+    topo.metrics_path = tbl["app"]["metrics_path"].value_or(topo.metrics_path);
+
+    std::string numa_policy = tbl["app"]["numa_policy"].value_or(std::string("warn"));
+    if (numa_policy == "strict")
+        topo.numa_policy = NumaPolicy::STRICT;
+    else if (numa_policy != "warn")
+        topology_exit("unknown numa_policy '%s', use \"warn\" or \"strict\"\n", numa_policy.c_str());
+
+    if (const toml::table *kafka = tbl["kafka"].as_table()) {
+        KafkaConfig &cfg = topo.kafka;
+        topo.kafka_enabled = (*kafka)["enabled"].value_or(true);
+        topo.kafka_topic = (*kafka)["topic"].value_or(topo.kafka_topic);
+        cfg.brokers = (*kafka)["brokers"].value_or(cfg.brokers);
+        cfg.acks = (*kafka)["acks"].value_or(cfg.acks);
+        cfg.compression = (*kafka)["compression"].value_or(cfg.compression);
+        cfg.linger_ms = (*kafka)["linger_ms"].value_or(cfg.linger_ms);
+        cfg.batch_size = (*kafka)["batch_size"].value_or(cfg.batch_size);
+        cfg.poll_ms = (*kafka)["poll_ms"].value_or(cfg.poll_ms);
+        cfg.spool_path = (*kafka)["spool_path"].value_or(cfg.spool_path);
+        cfg.spool_max_mb = (*kafka)["spool_max_mb"].value_or(cfg.spool_max_mb);
+        cfg.spool_retry_ms = (*kafka)["spool_retry_ms"].value_or(cfg.spool_retry_ms);
+    }
+
+    topo.cmac_interval_ms = tbl["cmac"]["interval_ms"].value_or(topo.cmac_interval_ms);
+    topo.cmac_width = tbl["cmac"]["width"].value_or(topo.cmac_width);
+    std::string cmac_counters = tbl["cmac"]["counters"].value_or(std::string("latched"));
+    if (cmac_counters == "free_running")
+        topo.cmac_mode = CmacCounterMode::FREE_RUNNING;
+    else if (cmac_counters != "latched")
+        topology_exit("unknown cmac counters '%s', use \"latched\" or \"free_running\"\n", cmac_counters.c_str());
+    if (topo.cmac_interval_ms == 0 || topo.cmac_width < 32 || topo.cmac_width > 64)
+        topology_exit("cmac: interval_ms must be > 0 and width 32 to 64 bits\n");
+
+    topo.replay.pcap = tbl["replay"]["pcap"].value_or(topo.replay.pcap);
+    topo.replay.loops = tbl["replay"]["loops"].value_or(topo.replay.loops);
+    topo.replay.ring_size = tbl["replay"]["ring_size"].value_or(topo.replay.ring_size);
+    topo.replay.max_pkts = tbl["replay"]["max_pkts"].value_or(topo.replay.max_pkts);
+    if (replay_pcap != nullptr)
+        topo.replay.pcap = replay_pcap;
+    if (topo.replaying() && (topo.replay.ring_size == 0 || topo.replay.max_pkts == 0))
+        topology_exit("replay: ring_size and max_pkts must be > 0\n");
+
+    topo.capture.dir = tbl["capture"]["dir"].value_or(topo.capture.dir);
+    topo.capture.prefix = tbl["capture"]["prefix"].value_or(topo.capture.prefix);
+    topo.capture.file_mb = tbl["capture"]["file_mb"].value_or(topo.capture.file_mb);
+    topo.capture.files = tbl["capture"]["files"].value_or(topo.capture.files);
+    topo.capture.snaplen = tbl["capture"]["snaplen"].value_or(topo.capture.snaplen);
+    topo.capture.ring_size = tbl["capture"]["ring_size"].value_or(topo.capture.ring_size);
+    if (topo.capture.file_mb == 0 || !rte_is_power_of_2(topo.capture.ring_size))
+        topology_exit("capture: file_mb must be > 0 and ring_size a power of 2\n");
+
+    // A replay touches no onic: their PCI addresses are not even resolved, EAL may run with --no-pci
+    const toml::array *onics = tbl["onic"].as_array();
+    if (onics != nullptr && !topo.replaying()) {
+        for (const toml::node &onic : *onics)
+            topo.onics.push_back(parse_onic(*onic.as_table()));
+    }
+    if (const toml::array *contexts = tbl["context"].as_array()) {
+        for (const toml::node &ctx : *contexts)
+            topo.contexts.push_back(parse_context(*ctx.as_table(), topo.contexts.size()));
+    }
+
+    if (topo.onics.empty() && !topo.replaying())
+        topology_exit("%s describes no [[onic]]\n", path);
+
+    // Ids name the context's rings and key its latency histograms: one context each
+    for (size_t i = 0; i < topo.contexts.size(); i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (topo.contexts[i].ctx_id == topo.contexts[j].ctx_id)
+                topology_exit("context id %d is used twice\n", topo.contexts[i].ctx_id);
+        }
+    }
+
+    // Validate references so main never has to
+    std::vector<std::string> replay_rx, replay_tx;
+    std::vector<std::pair<std::string, int>> claimed_rx, claimed_tx;
+    for (ContextConfig &ctx : topo.contexts) {
+        if (ctx.idle.pause_after > ctx.idle.sleep_after || ctx.idle.max_sleep_us == 0)
+            topology_exit("context %d: idle needs pause_after <= sleep_after and max_sleep_us > 0\n", ctx.ctx_id);
+        if (ctx.burst_size == 0 || ctx.burst_size > MAX_BURST_SIZE || ctx.prefetch_ahead > MAX_PREFETCH_AHEAD)
+            topology_exit("context %d: burst_size must be 1 to %d and prefetch 0 to %d\n", ctx.ctx_id,
+                          MAX_BURST_SIZE, MAX_PREFETCH_AHEAD);
+        if (ctx.flows.capacity > MAX_FLOW_CAPACITY || ctx.flows.idle_timeout_ms == 0 || ctx.flows.active_timeout_ms == 0)
+            topology_exit("context %d: at most %u flows per rx lcore, and timeouts > 0\n", ctx.ctx_id, MAX_FLOW_CAPACITY);
+        size_t nb_lcores = (ctx.mode == ForwardMode::PIPELINED) ? 2 : 1;
+        if (!ctx.lcores.empty() && ctx.lcores.size() != nb_lcores)
+            topology_exit("context %d: %s mode needs %zu lcores\n", ctx.ctx_id, to_string(ctx.mode), nb_lcores);
+        if (ctx.rx_Qs.size() > MAX_Q_PER_FORWARDER || ctx.tx_Qs.size() > MAX_Q_PER_FORWARDER)
+            topology_exit("context %d: at most %d queues per direction\n", ctx.ctx_id, MAX_Q_PER_FORWARDER);
+        for (int q : ctx.rx_Qs)
+            claim_queue(claimed_rx, ctx, "rx", ctx.rx_onic, ctx.rx_port, q);
+        for (int q : ctx.tx_Qs)
+            claim_queue(claimed_tx, ctx, "tx", ctx.tx_onic, ctx.tx_port, q);
+
+        // Replayed contexts all run on the replay port: each onic, port and queue they use becomes a Q
+        // of its own there, claimed by one context like a live one
+        if (topo.replaying()) {
+            for (int &q : ctx.rx_Qs)
+                q = replay_queue(replay_rx, ctx, ctx.rx_onic, ctx.rx_port, q);
+            for (int &q : ctx.tx_Qs)
+                q = replay_queue(replay_tx, ctx, ctx.tx_onic, ctx.tx_port, q);
+            continue;
+        }
+
+        int rx_onic = topo.find_onic(ctx.rx_onic);
+        int tx_onic = topo.find_onic(ctx.tx_onic);
+        if (rx_onic < 0 || tx_onic < 0)
+            topology_exit("context %d: unknown onic '%s' or '%s'\n", ctx.ctx_id, ctx.rx_onic.c_str(), ctx.tx_onic.c_str());
+        if (ctx.rx_port < 0 || ctx.rx_port >= (int)topo.onics[rx_onic].port_ids.size() ||
+            ctx.tx_port < 0 || ctx.tx_port >= (int)topo.onics[tx_onic].port_ids.size())
+            topology_exit("context %d: rx/tx port out of range\n", ctx.ctx_id);
+        for (int q : ctx.rx_Qs) {
+            if (q < 0 || q >= (int)topo.onics[rx_onic].num_queues)
+                topology_exit("context %d: rx queue %d does not exist\n", ctx.ctx_id, q);
+        }
+        for (int q : ctx.tx_Qs) {
+            if (q < 0 || q >= (int)topo.onics[tx_onic].num_queues)
+                topology_exit("context %d: tx queue %d does not exist\n", ctx.ctx_id, q);
+        }
+        // Rx interrupts are set up when the port is configured, for all of the onic's ports
+        if (ctx.idle.policy == IdlePolicy::INTERRUPT)
+            topo.onics[rx_onic].rx_intr = true;
+    }
+    return topo;
+}
+
+void Topology::replay_queues(uint16_t &nb_queues, std::vector<uint16_t> &rx_queues) const {
+    nb_queues = 0;
+    rx_queues.clear();
+    for (const ContextConfig &ctx : contexts) {
+        for (int q : ctx.rx_Qs) {
+            nb_queues = std::max<uint16_t>(nb_queues, q + 1);
+            if (std::find(rx_queues.begin(), rx_queues.end(), q) == rx_queues.end())
+                rx_queues.push_back(q);
+        }
+        for (int q : ctx.tx_Qs)
+            nb_queues = std::max<uint16_t>(nb_queues, q + 1);
+    }
+}
+
+bool Topology::capturing() const {
+    return std::any_of(contexts.begin(), contexts.end(), [](const ContextConfig &ctx) { return ctx.capture; });
+}
+
+int Topology::find_onic(const std::string &name) const {
+    for (size_t i = 0; i < onics.size(); i++) {
+        if (onics[i].name == name)
+            return i;
+    }
+    return -1;
+}
+
+void Topology::print() const {
+    if (replaying())
+        std::cout << "Replay " << replay.pcap << ": loops " << replay.loops << " (0 until stopped), ring_size "
+                  << replay.ring_size << ", max_pkts " << replay.max_pkts << ", onics are not used" << std::endl;
+    if (capturing())
+        std::cout << "Capture to " << capture.dir << "/" << capture.prefix << "_*.pcapng: " << capture.files
+                  << " files (0 keeps all) of " << capture.file_mb << " MB, snaplen " << capture.snaplen
+                  << " (0 whole packets), ring_size " << capture.ring_size << std::endl;
+    for (const OnicConfig &onic : onics) {
+        std::cout << "Onic " << onic.name << ": ports";
+        for (int port_id : onic.port_ids)
+            std::cout << " " << port_id;
+        std::cout << " num_queues=" << onic.num_queues << " nb_descs=" << onic.nb_descs
+                  << " buff_size=" << onic.buff_size << " nb_mbufs=" << onic.nb_mbufs << std::endl;
+    }
+    for (const ContextConfig &ctx : contexts) {
+        std::cout << "CTX(" << ctx.ctx_id << ") " << to_string(ctx.mode) << ": "
+                  << ctx.rx_onic << "[" << ctx.rx_port << "] --------> "
+                  << ctx.tx_onic << "[" << ctx.tx_port << "] tx policy " << to_string(ctx.tx_policy)
+                  << " idle " << to_string(ctx.idle.policy) << " burst " << ctx.burst_size
+                  << " prefetch " << ctx.prefetch_ahead << " flows " << ctx.flows.capacity << " (idle " << ctx.flows.idle_timeout_ms
+                  << " ms, active " << ctx.flows.active_timeout_ms << " ms)"
+                  << (ctx.stage_cycles ? " stage cycles" : "")
+                  << (ctx.capture ? " capture " + ctx.capture_filter.to_string() : "") << " lcores";
+        for (int lcore : ctx.lcores)
+            std::cout << " " << lcore;
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "forward_context.h"
+#include "numa.h"
+#include "kafka_service.h"
+#include "cmac_collector.h"
+#include "metrics.h"
+#include "replay.h"
+
+#define DEFAULT_TOPOLOGY_FILE "onic_app.toml"
+#define DEFAULT_STATS_RING_SIZE (8192)
+
+// One open-nic-shell card: a DPDK port per QDMA function, all configured alike
+struct OnicConfig {
+    std::string name;
+    std::vector<int> port_ids; // DPDK port ids, resolved from PCI addresses if given as strings
+    unsigned int num_queues = 2;
+    unsigned int nb_descs = 1024;
+    unsigned int st_queues = 2;
+    unsigned int buff_size = 4096;
+    unsigned int nb_mbufs = 0; // mempool size per port, 0 derives it from the Q/descriptor counts
+    int rs_fec = 0;
+    int socket_id = SOCKET_ID_ANY; // forces the mempools on a socket, default follows the ports
+    bool rx_intr = false; // set when a context polls it with the interrupt idle policy
+
+    PortInfo port_info() const {
+        PortInfo pinfo(0, num_queues, nb_descs, st_queues, buff_size, 0, 2, -1, socket_id);
+        pinfo.nb_mbufs = nb_mbufs;
+        pinfo.rx_intr = rx_intr;
+        return pinfo;
+    }
+};
+
+// One forwarding direction, the rx/tx onics are referred to by name
+struct ContextConfig {
+    int ctx_id;
+    ForwardMode mode = ForwardMode::PIPELINED;
+    std::string rx_onic;
+    std::string tx_onic;
+    int rx_port;
+    int tx_port;
+    std::vector<int> rx_Qs;
+    std::vector<int> tx_Qs;
+    unsigned int ring_size = RING_SIZE;
+    RingPolicy ring_policy = RingPolicy::DROP;
+    bool parse_latency = false;
+    TxPolicy tx_policy = TxPolicy::DROP;
+    unsigned int tx_retry_us = DEFAULT_TX_RETRY_US;
+    unsigned int tx_flush_us = DEFAULT_TX_FLUSH_US;
+    IdleConfig idle;
+    unsigned int burst_size = DEFAULT_BURST_SIZE;
+    unsigned int prefetch_ahead = DEFAULT_PREFETCH_AHEAD;
+    FlowConfig flows;
+    bool stage_cycles = false;
+    bool capture = false;       // a capture table hands the packets matching capture_filter to the writer
+    CaptureFilter capture_filter;
+    std::vector<int> lcores; // [rx, tx] when pipelined, [worker] when run-to-completion, empty picks free lcores on the ports' sockets
+};
+
+struct Topology {
+    unsigned int stats_ring_size = DEFAULT_STATS_RING_SIZE;
+    unsigned int flow_ring_size = DEFAULT_FLOW_RING_SIZE; // FlowRecords of every rx lcore towards the main lcore
+    bool latency_records = false; // export every latency record on top of the hop histograms
+    NumaPolicy numa_policy = NumaPolicy::WARN;
+    std::string metrics_path = METRICS_DEFAULT_PATH; // shared counters page, empty disables it
+    bool kafka_enabled = false; // a [kafka] table starts the producer service
+    KafkaConfig kafka;
+    std::string kafka_topic = "telegraf";
+    unsigned int cmac_interval_ms = CMAC_DEFAULT_INTERVAL_MS;
+    CmacCounterMode cmac_mode = CmacCounterMode::LATCHED;
+    unsigned int cmac_width = CMAC_COUNTER_WIDTH;
+    ReplayConfig replay;
+    CaptureConfig capture;      // files of the contexts that capture
+    std::vector<OnicConfig> onics;
+    std::vector<ContextConfig> contexts;
+
+    // Parses and validates the TOML file, exits on any error. replay_pcap (onic_app -r) overrides
+    // [replay] pcap
+    static Topology load(const char *path, const char *replay_pcap = nullptr);
+
+    // Contexts run on the replay port rather than on the onics, which need not exist
+    bool replaying() const { return !replay.pcap.empty(); }
+    // Qs the replay port needs for the contexts, and the rx Qs they poll. Once loaded, the contexts'
+    // Qs are the replay port's
+    void replay_queues(uint16_t &nb_queues, std::vector<uint16_t> &rx_queues) const;
+    bool capturing() const;
+
+    int find_onic(const std::string &name) const;
+    void print() const;
+};
@@ -0,0 +1,2127 @@
+#include <rte_eal.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_cycles.h>
+#include <rte_ring.h>
+#include <rte_lcore.h>
+#include <rte_random.h>
+#include <rte_bus_vdev.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include <getopt.h>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring> // for strcmp
+#include <unistd.h>
+#include <vector>
+
+#include "../src/forward_context.h"
+#include "../src/pipeline.h"
+#include "../src/lcore_stats.h"
+#include "../src/histogram.h"
+#include "../src/line_protocol.h"
+#include "../src/kafka_service.h"
+#include "../src/cmac_collector.h"
+#include "../src/sim_shell.h"
+#include "../src/cmac_bringup.h"
+#include "../src/metrics.h"
+#include "../src/idle.h"
+#include "../src/flow.h"
+#include "../src/burst_parse.h"
+#include "../src/latency.h"
+#include "../src/replay.h"
+#include "../src/capture.h"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <sstream>
+#include <string>
+
+#define NUM_MBUFS 16384
+#define MBUF_CACHE_SIZE 250
+#define NB_DESCS 1024
+#define DEFAULT_BENCH_SECONDS 5
+#define PRIME_PKT_SIZE 64
+#define MICRO_BURST_SIZE 32
+
+static void usage(const char *prog) {
+    printf("Usage: %s [EAL options] -- [-m pipelined|rtc|both] [-t seconds] [-q nb_queues] [-s] [-P nb_pkts] [-R drop|retry|hold] [-T drop|retry|buffer] [-L] [-f flows] [-b burst_size] [-F prefetch] [-B] [-M tx|hist|encode|kafka|cmac|regs|bringup|metrics|idle|flows|aging|parse|replay|capture|latency]\n"
+           "\t -q \t number of rx/tx Qs per port, one context (and lcore(s)) per Q\n"
+           "\t -R \t ring policy of the pipelined rx lcores, reports ring full events and the high-water mark\n"
+           "\t -T \t tx policy of the forwarders, reports the drops and retries it leads to\n"
+           "\t -L \t parse latency timestamps on the rx lcores, to measure the cost of inspection\n"
+           "\t -f \t track up to this many 5-tuple flows on each rx lcore, to measure the cost of the flow table\n"
+           "\t -b \t packets per rx burst and ring dequeue (default %d, at most %d)\n"
+           "\t -F \t packets the inspection loops prefetch ahead, 0 disables it (default %d)\n"
+           "\t -B \t sweep the burst size at 64, 512 and 1500 B packets, on a net_null pair hotplugged per size\n"
+           "\t -M \t run a microbenchmark on the main lcore instead of the forwarders\n"
+           "\t    \t tx: tx loop with the old per-burst mempool lookup and printf vs per-lcore counters\n"
+           "\t    \t hist: cost of recording one latency in a hop histogram\n"
+           "\t    \t encode: stats message built with ostringstream/std::string vs the line protocol encoder\n"
+           "\t    \t kafka: Kafka service against a mock broker that goes down for the middle third of the run,\n"
+           "\t    \t        checks every message is delivered exactly once through the spool\n"
+           "\t    \t cmac: CMAC collector against mock registers, checks 64-bit totals across wraps and the rates\n"
+           "\t    \t regs: Onic bring-up, reset timeouts, CMAC stats and record/replay on the simulated shell\n"
+           "\t    \t bringup: CMAC bring-up of several simulated cards, one CMAC at a time vs all at once\n"
+           "\t    \t flows: flow table cycles per packet on synthetic flows looped through a net_ring vdev\n"
+           "\t    \t aging: flow idle/active timeouts and eviction on simulated time, checks every packet is exported\n"
+           "\t    \t parse: burst header parser cycles per packet, scalar vs SSE4.1 vs AVX2, checks they agree\n"
+           "\t    \t replay: a pcap replayed through one context in each mode, checks every packet of every loop\n"
+           "\t    \t         comes back once and prints the per stage inspection cycles\n"
+           "\t    \t capture: capture filter, drops on a full capture ring and rotating pcapng files read back,\n"
+           "\t    \t          with the cycles per packet on the rx lcore and of the writer\n"
+           "\t    \t latency: hop histograms of the lcores merged and reported as Latency_hist lines once per interval,\n"
+           "\t    \t          raw records drained off the stats ring into batches of Latency_stats lines\n"
+           "\t -s \t sweep 1..nb_queues to show scaling with the number of Qs\n"
+           "\t -P \t prime every tx Q with nb_pkts packets, for loopback vdevs such as a single net_ring\n"
+           "E.g. %s -l 0-4 --no-pci --vdev=net_null0 --vdev=net_null1 -- -m rtc -q 4 -s\n"
+           "E.g. %s -l 0-4 --no-pci --vdev=net_ring0 -- -m rtc -q 4 -s -P 512\n",
+           prog, DEFAULT_BURST_SIZE, MAX_BURST_SIZE, DEFAULT_PREFETCH_AHEAD, prog, prog);
+}
+
+static void bench_port_init(uint16_t port_id, uint16_t nb_queues, struct rte_mempool *mbuf_pool) {
+    struct rte_eth_conf conf;
+    memset(&conf, 0, sizeof(conf));
+
+    int ret = rte_eth_dev_configure(port_id, nb_queues, nb_queues, &conf);
+    if (ret < 0) rte_exit(EXIT_FAILURE, "Config failed on port %u\n", port_id);
+
+    for (uint16_t q = 0; q < nb_queues; q++) {
+        ret = rte_eth_rx_queue_setup(port_id, q, NB_DESCS, rte_eth_dev_socket_id(port_id), NULL, mbuf_pool);
+        if (ret < 0) rte_exit(EXIT_FAILURE, "RX queue %u setup failed on port %u\n", q, port_id);
+
+        ret = rte_eth_tx_queue_setup(port_id, q, NB_DESCS, rte_eth_dev_socket_id(port_id), NULL);
+        if (ret < 0) rte_exit(EXIT_FAILURE, "TX queue %u setup failed on port %u\n", q, port_id);
+    }
+
+    ret = rte_eth_dev_start(port_id);
+    if (ret < 0) rte_exit(EXIT_FAILURE, "Port start failed on port %u\n", port_id);
+}
+
+// Loopback vdevs (net_ring) have no traffic source: seed each tx Q with packets that then circulate
+static void prime_tx_queues(uint16_t port_id, uint16_t nb_queues, unsigned int nb_pkts, struct rte_mempool *mbuf_pool) {
+    for (uint16_t q = 0; q < nb_queues; q++) {
+        for (unsigned int i = 0; i < nb_pkts; i++) {
+            struct rte_mbuf *m = rte_pktmbuf_alloc(mbuf_pool);
+            if (m == NULL) rte_exit(EXIT_FAILURE, "Cannot allocate priming packet\n");
+            memset(rte_pktmbuf_append(m, PRIME_PKT_SIZE), 0, PRIME_PKT_SIZE);
+            if (rte_eth_tx_burst(port_id, q, &m, 1) == 0) {
+                rte_pktmbuf_free(m);
+                break;
+            }
+        }
+    }
+}
+
+// Runs the first nb_ctx contexts (one per Q) for the given time, prints and returns the aggregate rx Mpps
+static double run_bench(std::vector<ForwardingContext> &ctxs, unsigned int nb_ctx, ForwardMode mode, unsigned int seconds) {
+    struct rte_eth_stats rx_stats, tx_stats;
+    unsigned int lcores_per_ctx = (mode == ForwardMode::PIPELINED) ? 2 : 1;
+
+    if (rte_lcore_count() - 1 < nb_ctx * lcores_per_ctx) {
+        printf("BENCH mode=%-18s queues=%u skipped: needs %u worker lcores\n",
+               to_string(mode), nb_ctx, nb_ctx * lcores_per_ctx);
+        return 0;
+    }
+
+    uint16_t rx_port_id = ctxs[0].rx_port_id;
+    uint16_t tx_port_id = ctxs[0].tx_port_id;
+    rte_eth_stats_reset(rx_port_id);
+    rte_eth_stats_reset(tx_port_id);
+
+    for (unsigned int lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++)
+        lcore_stats[lcore_id] = LcoreStats();
+
+    uint64_t start = rte_get_tsc_cycles();
+    for (unsigned int i = 0; i < nb_ctx; i++) {
+        ctxs[i].mode = mode;
+        ctxs[i].lcores = {-1, -1};
+        rte_atomic32_set(&ctxs[i].stop_flag, 0);
+        launch_software_forwarder(ctxs[i]);
+    }
+    sleep(seconds);
+    for (unsigned int i = 0; i < nb_ctx; i++)
+        rte_atomic32_set(&ctxs[i].stop_flag, 1);
+    rte_eal_mp_wait_lcore();
+    double elapsed = (double)(rte_get_tsc_cycles() - start) / rte_get_tsc_hz();
+
+    // Flush anything left in the handoff rings so loopback vdevs keep their packets circulating
+    struct rte_mbuf *m;
+    for (unsigned int i = 0; i < nb_ctx; i++) {
+        if (ctxs[i].mbuf_ring == nullptr)
+            continue;
+        while (rte_ring_dequeue(ctxs[i].mbuf_ring, (void **)&m) == 0) {
+            if (rte_eth_tx_burst(tx_port_id, ctxs[i].tx_Qs[0], &m, 1) == 0)
+                rte_pktmbuf_free(m);
+        }
+    }
+
+    uint64_t tx_drops = 0, tx_retried = 0, ring_drops = 0, ring_full = 0, ring_hwm = 0;
+    uint64_t busy_cycles = 0, loop_cycles = 0, polls = 0, full_bursts = 0;
+    for (unsigned int lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+        const LcoreStats &slot = lcore_stats[lcore_id];
+        tx_drops += slot.tx_drops;
+        tx_retried += slot.tx_retried;
+        ring_drops += slot.ring_drops;
+        ring_full += slot.ring_full;
+        ring_hwm = RTE_MAX(ring_hwm, slot.ring_hwm);
+        busy_cycles += slot.busy_cycles;
+        loop_cycles += slot.busy_cycles + slot.idle_cycles;
+        polls += slot.empty_polls + slot.bursts_small + slot.bursts_large + slot.bursts_full;
+        full_bursts += slot.bursts_full;
+    }
+
+    rte_eth_stats_get(rx_port_id, &rx_stats);
+    rte_eth_stats_get(tx_port_id, &tx_stats);
+    double rx_mpps = rx_stats.ipackets / elapsed / 1e6;
+    printf("BENCH mode=%-18s tx_policy=%-6s queues=%u lcores=%u burst=%u prefetch=%u rx=%8.3f Mpps tx=%8.3f Mpps tx_fail=%" PRIu64
+           " tx_drops=%" PRIu64 " tx_retried=%" PRIu64 " ring_full=%" PRIu64 " ring_drops=%" PRIu64 " ring_hwm=%" PRIu64
+           " busy=%5.1f%% full_bursts=%5.1f%%\n",
+           to_string(mode), to_string(ctxs[0].tx_policy), nb_ctx, nb_ctx * lcores_per_ctx,
+           ctxs[0].burst_size, ctxs[0].prefetch_ahead, rx_mpps, tx_stats.opackets / elapsed / 1e6, tx_stats.oerrors,
+           tx_drops, tx_retried, ring_full, ring_drops, ring_hwm,
+           (loop_cycles == 0) ? 0 : 100.0 * busy_cycles / loop_cycles, (polls == 0) ? 0 : 100.0 * full_bursts / polls);
+    return rx_mpps;
+}
+
+// Tx hot loop as it used to be: mempool looked up by name and stdio on every burst
+static inline void tx_burst_with_lookup(uint16_t port_id, struct rte_mbuf **mbufs, uint16_t nb, FILE *out) {
+    struct rte_mempool *mp = rte_mempool_lookup("BENCH_POOL");
+    fprintf(out, "dst mempool available: %u\n", rte_mempool_avail_count(mp));
+    uint16_t nb_tx = rte_eth_tx_burst(port_id, 0, mbufs, nb);
+    if (unlikely(nb_tx < nb)) {
+        for (uint16_t i = nb_tx; i < nb; i++)
+            rte_pktmbuf_free(mbufs[i]);
+        fprintf(out, "Not sent %u packets on tx_port(%u) on Q(0)\n", nb, port_id);
+    }
+}
+
+// Tx hot loop as it is now: counters only
+static inline void tx_burst_with_counters(uint16_t port_id, struct rte_mbuf **mbufs, uint16_t nb, LcoreStats *stats) {
+    uint16_t nb_tx = rte_eth_tx_burst(port_id, 0, mbufs, nb);
+    lcore_stats_add(&stats->tx_pkts, nb_tx);
+    if (unlikely(nb_tx < nb)) {
+        for (uint16_t i = nb_tx; i < nb; i++)
+            rte_pktmbuf_free(mbufs[i]);
+        lcore_stats_add(&stats->tx_drops, nb - nb_tx);
+    }
+}
+
+// Sends bursts from the main lcore on Q 0 of port_id for the given time, with each tx path.
+// The old path prints to /dev/null, a console is slower still, so its rate is an upper bound
+static void run_tx_microbench(uint16_t port_id, struct rte_mempool *mbuf_pool, unsigned int seconds) {
+    struct rte_mbuf *mbufs[MICRO_BURST_SIZE];
+    FILE *out = fopen("/dev/null", "w");
+    if (out == NULL) rte_exit(EXIT_FAILURE, "Cannot open /dev/null\n");
+    LcoreStats *stats = LcoreStats::attach(-1, "bench");
+    uint64_t duration = seconds * rte_get_tsc_hz();
+
+    for (int with_counters = 0; with_counters <= 1; with_counters++) {
+        uint64_t nb_pkts = 0;
+        uint64_t start = rte_get_tsc_cycles();
+        while (rte_get_tsc_cycles() - start < duration) {
+            if (rte_pktmbuf_alloc_bulk(mbuf_pool, mbufs, MICRO_BURST_SIZE) != 0)
+                continue;
+            for (int i = 0; i < MICRO_BURST_SIZE; i++)
+                rte_pktmbuf_append(mbufs[i], PRIME_PKT_SIZE);
+
+            if (with_counters)
+                tx_burst_with_counters(port_id, mbufs, MICRO_BURST_SIZE, stats);
+            else
+                tx_burst_with_lookup(port_id, mbufs, MICRO_BURST_SIZE, out);
+            nb_pkts += MICRO_BURST_SIZE;
+        }
+        double elapsed = (double)(rte_get_tsc_cycles() - start) / rte_get_tsc_hz();
+        printf("BENCH micro=tx path=%-8s burst=%u tx=%8.3f Mpps\n",
+               with_counters ? "counters" : "lookup", MICRO_BURST_SIZE, nb_pkts / elapsed / 1e6);
+    }
+    printf("BENCH micro=tx counters: tx_pkts=%" PRIu64 " tx_drops=%" PRIu64 "\n",
+           lcore_stats_read(&stats->tx_pkts), lcore_stats_read(&stats->tx_drops));
+    fclose(out);
+}
+
+// Records pseudo random latencies (log-uniform from 1 ns to ~1 ms) for the given time, prints the cost per value
+static void run_hist_microbench(unsigned int seconds) {
+    static LatencyHistogram hist;
+    std::vector<uint64_t> values(4096);
+    uint64_t seed = 88172645463325252ULL;
+    for (uint64_t &v : values) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        v = (seed >> 44) >> (seed & 15);
+    }
+
+    uint64_t duration = seconds * rte_get_tsc_hz();
+    uint64_t nb_values = 0;
+    uint64_t start = rte_get_tsc_cycles();
+    while (rte_get_tsc_cycles() - start < duration) {
+        for (uint64_t v : values)
+            hist.record(v);
+        nb_values += values.size();
+    }
+    double elapsed = (double)(rte_get_tsc_cycles() - start) / rte_get_tsc_hz();
+    printf("BENCH micro=hist records=%" PRIu64 " cost=%6.2f ns/record p50=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64 "\n",
+           nb_values, elapsed * 1e9 / nb_values, hist.percentile(0.5), hist.percentile(0.99), hist.max());
+}
+
+// Same fields as StatsLog::encode_rte_stats, which lives with the Kafka code
+static void encode_port_stats(LineEncoder &enc, const struct rte_eth_stats &stats) {
+    for (const char *direction : {"(R)", "(T)"}) {
+        enc.field(direction, "rx_packets", stats.ipackets)
+           .field(direction, "rx_Bytes", stats.ibytes)
+           .field(direction, "rx_fail_packets", stats.ierrors)
+           .field(direction, "tx_packets", stats.opackets)
+           .field(direction, "tx_Bytes", stats.obytes)
+           .field(direction, "tx_fail_packets", stats.oerrors);
+    }
+}
+
+// Stats message as StatsLog used to build it: ostringstream per direction, string concatenation, payload by value
+static std::string legacy_rte_stats_to_string(const struct rte_eth_stats &stats, std::string direction) {
+    std::ostringstream oss;
+    oss << direction << "rx_packets=" << stats.ipackets
+        << "," << direction << "rx_Bytes=" << stats.ibytes
+        << "," << direction << "rx_fail_packets=" << stats.ierrors
+        << "," << direction << "tx_packets=" << stats.opackets
+        << "," << direction << "tx_Bytes=" << stats.obytes
+        << "," << direction << "tx_fail_packets=" << stats.oerrors;
+    return oss.str();
+}
+
+static size_t legacy_produce(std::string payload) {
+    return payload.size();
+}
+
+// Encodes one port stats line and one CMAC stats line per message, for the given time with each path
+static void run_encode_microbench(unsigned int seconds) {
+    const std::string header = "Forwarder_stats(ports-1),rx_port(0)=81.0.0,tx_port(1)=81.0.1";
+    struct rte_eth_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    CmacStats cmac;
+    uint64_t duration = seconds * rte_get_tsc_hz();
+
+    for (int with_encoder = 0; with_encoder <= 1; with_encoder++) {
+        LineEncoder batch;
+        uint64_t nb_msgs = 0, nb_bytes = 0, nb_batches = 0;
+        uint64_t start = rte_get_tsc_cycles();
+        while (rte_get_tsc_cycles() - start < duration) {
+            // Values change every message like real counters do
+            stats.ipackets = stats.opackets = nb_msgs * 32;
+            stats.ibytes = stats.obytes = nb_msgs * 2048;
+            cmac.rx_total_pkts = cmac.tx_total_pkts = nb_msgs;
+            uint64_t delta_ns = 1000000000ULL + (nb_msgs & 0xFFF);
+
+            if (with_encoder) {
+                batch.begin(header.data(), header.size());
+                encode_port_stats(batch, stats);
+                batch.field("DELTA_NS", delta_ns);
+                batch.end();
+                batch.begin(header.data(), header.size());
+                cmac.encode(batch, "R");
+                batch.end();
+                if (batch.nearly_full()) {
+                    nb_bytes += batch.size();
+                    nb_batches++;
+                    batch.clear();
+                }
+            } else {
+                std::string msg = header + " " +
+                                  legacy_rte_stats_to_string(stats, "(R)") + "," +
+                                  legacy_rte_stats_to_string(stats, "(T)") + "," +
+                                  "DELTA_NS=" + std::to_string(delta_ns) + "\n";
+                nb_bytes += legacy_produce(msg);
+                nb_bytes += legacy_produce(header + " " + cmac.to_string("R") + "\n");
+                nb_batches += 2;
+            }
+            nb_msgs++;
+        }
+        double elapsed = (double)(rte_get_tsc_cycles() - start) / rte_get_tsc_hz();
+        printf("BENCH micro=encode path=%-8s msgs=%" PRIu64 " cost=%7.1f ns/msg kafka_msgs=%" PRIu64 " bytes=%" PRIu64 "\n",
+               with_encoder ? "encoder" : "legacy", nb_msgs, elapsed * 1e9 / nb_msgs, nb_batches, nb_bytes);
+    }
+}
+
+// Stand-in broker: accepts up to MOCK_KAFKA_INFLIGHT messages, delivers or fails them all on poll()
+#define MOCK_KAFKA_INFLIGHT (1024)
+#define KAFKA_TEST_MSGS (20000) // per producer lcore
+
+class MockKafkaTransport : public KafkaTransport {
+    private:
+        struct Msg { int topic; char *payload; size_t len; };
+        std::vector<Msg> inflight;
+
+    public:
+        volatile bool down = false;
+        std::vector<unsigned int> delivered; // delivery count per message id
+
+        int add_topic(const char *) override { return 0; }
+        bool produce(int topic, char *payload, size_t len) override {
+            if (inflight.size() >= MOCK_KAFKA_INFLIGHT)
+                return false; // queue full, like RD_KAFKA_RESP_ERR__QUEUE_FULL
+            inflight.push_back({topic, payload, len});
+            return true;
+        }
+        void poll(int) override {
+            for (Msg &msg : inflight) {
+                bool ok = !down;
+                if (ok) {
+                    unsigned int id = strtoul(msg.payload + 3, NULL, 10); // "id=<n>"
+                    if (id < delivered.size())
+                        delivered[id]++;
+                }
+                on_delivery(ok, msg.topic, msg.payload, msg.len);
+                free(msg.payload);
+            }
+            inflight.clear();
+        }
+        void flush(int) override { poll(0); }
+};
+
+struct KafkaTestProducer {
+    KafkaService *service;
+    unsigned int first_id;
+    unsigned int delay_us; // spreads the messages over the whole run, outage included
+};
+
+static int kafka_test_producer(void *arg) {
+    auto *producer = static_cast<KafkaTestProducer *>(arg);
+    for (unsigned int i = 0; i < KAFKA_TEST_MSGS; i++) {
+        char payload[32];
+        int len = snprintf(payload, sizeof(payload), "id=%u", producer->first_id + i);
+        // The queue is bounded: back off and resend rather than count the test message lost
+        while (!producer->service->send(0, std::string(payload, len)))
+            rte_delay_us_block(50);
+        rte_delay_us_block(producer->delay_us);
+    }
+    return 0;
+}
+
+static void run_kafka_test(unsigned int seconds) {
+    const char *spool_path = "/tmp/onic_bench_kafka.spool";
+    remove(spool_path);
+
+    KafkaConfig cfg;
+    cfg.poll_ms = 1;
+    cfg.spool_path = spool_path;
+    cfg.spool_retry_ms = 50;
+    MockKafkaTransport transport;
+    KafkaService service(&transport, cfg);
+    service.add_topic("bench");
+
+    // Producers on every worker lcore, the service on the main lcore
+    std::vector<KafkaTestProducer> producers;
+    unsigned int lcore_id;
+    unsigned int delay_us = (uint64_t)seconds * US_PER_S * 9 / 10 / KAFKA_TEST_MSGS;
+    RTE_LCORE_FOREACH_WORKER(lcore_id)
+        producers.push_back({&service, (unsigned int)producers.size() * KAFKA_TEST_MSGS, delay_us});
+    if (producers.empty()) {
+        printf("BENCH micro=kafka skipped: needs at least one worker lcore\n");
+        return;
+    }
+    unsigned int nb_msgs = producers.size() * KAFKA_TEST_MSGS;
+    transport.delivered.assign(nb_msgs, 0);
+
+    unsigned int i = 0;
+    RTE_LCORE_FOREACH_WORKER(lcore_id)
+        rte_eal_remote_launch(kafka_test_producer, &producers[i++], lcore_id);
+
+    uint64_t hz = rte_get_tsc_hz();
+    uint64_t start = rte_get_tsc_cycles();
+    uint64_t end = start + seconds * hz;
+    while (rte_get_tsc_cycles() < end) {
+        uint64_t elapsed = rte_get_tsc_cycles() - start;
+        transport.down = (elapsed > seconds * hz / 3 && elapsed < 2 * seconds * hz / 3);
+        service.run_once();
+    }
+    transport.down = false;
+    rte_eal_mp_wait_lcore();
+
+    // Everything left, spool included, must get through now that the broker is back
+    uint64_t deadline = rte_get_tsc_cycles() + 10 * hz;
+    KafkaServiceStats stats;
+    do {
+        service.run_once();
+        service.drain(0);
+        stats = service.get_stats();
+    } while (stats.delivered < stats.queued && rte_get_tsc_cycles() < deadline);
+
+    unsigned int missing = 0, duplicated = 0;
+    for (unsigned int count : transport.delivered) {
+        missing += (count == 0);
+        duplicated += (count > 1);
+    }
+    service.print_stats();
+    printf("BENCH micro=kafka msgs=%u producers=%zu missing=%u duplicated=%u spooled=%" PRIu64 " %s\n",
+           nb_msgs, producers.size(), missing, duplicated, stats.spooled,
+           (missing == 0 && duplicated == 0 && stats.spooled > 0) ? "PASS" : "FAIL");
+    remove(spool_path);
+}
+
+// CMAC register file: the true counts advance with add(), a write to a tick register copies them
+// into the stat registers the way the hardware would in the given mode
+class MockCmacRegisters {
+    private:
+        std::unordered_map<uint32_t, uint32_t> regs;
+        uint64_t latched[NB_CMAC][NB_CMAC_COUNTERS] = {};
+
+        void latch(int cmac_id) {
+            for (int c = 0; c < NB_CMAC_COUNTERS; c++) {
+                uint64_t value = (mode == CmacCounterMode::LATCHED) ? hw[cmac_id][c] - latched[cmac_id][c] : hw[cmac_id][c];
+                latched[cmac_id][c] = hw[cmac_id][c];
+                value &= (width == 64) ? UINT64_MAX : ((1ULL << width) - 1);
+                regs[cmac_counter_offset(cmac_id, c)] = (uint32_t)value;
+                regs[cmac_counter_offset(cmac_id, c) + 4] = (uint32_t)(value >> 32);
+            }
+        }
+
+    public:
+        CmacCounterMode mode;
+        unsigned int width;
+        uint64_t hw[NB_CMAC][NB_CMAC_COUNTERS] = {}; // counts since reset, never wrap
+
+        MockCmacRegisters(CmacCounterMode mode, unsigned int width) : mode(mode), width(width) {}
+
+        uint32_t read(uint32_t offset) {
+            auto it = regs.find(offset);
+            return (it == regs.end()) ? 0 : it->second;
+        }
+        void write(uint32_t offset, uint32_t val) {
+            regs[offset] = val;
+            for (int i = 0; i < NB_CMAC; i++) {
+                if (offset == CMAC_OFFSET_TICK(i))
+                    latch(i);
+            }
+        }
+        void add(int cmac_id, int counter, uint64_t n) { hw[cmac_id][counter] += n; }
+
+        CmacCollector collector(unsigned int interval_ms) {
+            return CmacCollector([this](uint32_t offset) { return read(offset); },
+                                 [this](uint32_t offset, uint32_t val) { write(offset, val); },
+                                 NB_CMAC, interval_ms, mode, width);
+        }
+};
+
+static bool near(uint64_t value, uint64_t expected) {
+    return value + 1 >= expected && value <= expected + 1;
+}
+
+// Traffic per interval on CMAC 1 (CMAC 0 stays idle): rx bytes per interval are close to a full
+// 32-bit turn so free running 32-bit registers wrap on almost every tick
+struct CmacTestTraffic {
+    uint64_t rx_pkts, rx_bad, rx_bytes, tx_pkts, tx_bytes;
+};
+
+static bool run_cmac_case(const char *name, CmacCounterMode mode, unsigned int width, unsigned int interval_ms,
+                          uint64_t start_count, const CmacTestTraffic &t, unsigned int nb_ticks) {
+    MockCmacRegisters regs(mode, width);
+    // Free running counters start close to their wrap, as after a long uptime
+    if (mode == CmacCounterMode::FREE_RUNNING) {
+        for (int c = 0; c < NB_CMAC_COUNTERS; c++)
+            regs.add(1, c, start_count);
+    }
+    CmacCollector collector = regs.collector(interval_ms);
+    uint64_t interval_us = interval_ms * 1000ULL;
+
+    uint64_t base[NB_CMAC_COUNTERS];
+    uint64_t now_us = 5 * US_PER_S;
+    collector.poll(now_us); // primes the counters
+    for (int c = 0; c < NB_CMAC_COUNTERS; c++)
+        base[c] = (mode == CmacCounterMode::FREE_RUNNING) ? regs.hw[1][c] : 0;
+
+    for (unsigned int i = 0; i < nb_ticks; i++) {
+        regs.add(1, CMAC_RX_TOTAL_PKTS, t.rx_pkts);
+        regs.add(1, CMAC_RX_GOOD_PKTS, t.rx_pkts - t.rx_bad);
+        regs.add(1, CMAC_RX_PKT_BAD_FCS, t.rx_bad);
+        regs.add(1, CMAC_RX_TOTAL_BYTES, t.rx_bytes);
+        regs.add(1, CMAC_RX_GOOD_BYTES, t.rx_bytes);
+        regs.add(1, CMAC_TX_TOTAL_PKTS, t.tx_pkts);
+        regs.add(1, CMAC_TX_GOOD_PKTS, t.tx_pkts);
+        regs.add(1, CMAC_TX_TOTAL_BYTES, t.tx_bytes);
+        regs.add(1, CMAC_TX_GOOD_BYTES, t.tx_bytes);
+        now_us += interval_us;
+        collector.poll(now_us);
+    }
+
+    bool ok = true;
+    const CmacTotals &totals = collector.totals(1);
+    for (int c = 0; c < NB_CMAC_COUNTERS; c++) {
+        if (totals[c] != regs.hw[1][c] - base[c]) {
+            printf("BENCH micro=cmac case=%s %s total=%" PRIu64 " expected=%" PRIu64 "\n",
+                   name, cmac_counter_name(c), totals[c], regs.hw[1][c] - base[c]);
+            ok = false;
+        }
+    }
+
+    const CmacRates &r = collector.rates(1);
+    uint64_t rx_bps = (uint64_t)((double)t.rx_bytes * 8 * US_PER_S / interval_us);
+    uint64_t rx_pps = (uint64_t)((double)t.rx_pkts * US_PER_S / interval_us);
+    uint64_t tx_bps = (uint64_t)((double)t.tx_bytes * 8 * US_PER_S / interval_us);
+    uint64_t err_ppm = t.rx_bad * 1000000 / t.rx_pkts;
+    ok = ok && r.valid && r.interval_us == interval_us && near(r.rx_bps, rx_bps) && near(r.rx_pps, rx_pps) &&
+         near(r.tx_bps, tx_bps) && near(r.rx_err_ppm, err_ppm) && near(r.rx_fcs_ppm, err_ppm) && r.tx_err_ppm == 0;
+    // The idle CMAC must stay at zero
+    ok = ok && collector.totals(0)[CMAC_RX_TOTAL_BYTES] == 0 && collector.rates(0).rx_bps == 0;
+
+    printf("BENCH micro=cmac case=%-7s ticks=%u rx_total_bytes=%" PRIu64 " rx=%.3f Gbps (expected %.3f) err=%" PRIu64 " ppm %s\n",
+           name, nb_ticks, totals[CMAC_RX_TOTAL_BYTES], r.rx_bps / 1e9, rx_bps / 1e9, r.rx_err_ppm, ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Polls at a period that does not divide the interval, then stalls: ticks must keep to the
+// schedule without drifting, and restart it after the stall
+static bool run_cmac_schedule_case() {
+    MockCmacRegisters regs(CmacCounterMode::LATCHED, CMAC_COUNTER_WIDTH);
+    CmacCollector collector = regs.collector(1000);
+    uint64_t start_us = 1000;
+    unsigned int ticks = 0;
+    for (uint64_t now_us = start_us; now_us < start_us + 20 * US_PER_S; now_us += 70000)
+        ticks += collector.poll(now_us);
+    bool on_time = (ticks == 20); // 0, 1s, ... 19s
+
+    uint64_t stall_us = start_us + 23500000;
+    bool late = collector.poll(stall_us) && collector.totals(0).late_ticks == 1 &&
+                collector.us_until_due(stall_us) == 1000000;
+
+    bool ok = on_time && late;
+    printf("BENCH micro=cmac case=schedule ticks=%u late_ticks=%" PRIu64 " %s\n",
+           ticks, collector.totals(0).late_ticks, ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static void run_cmac_test() {
+    // 10M pkts and 5 GB per second: a 32-bit byte register would wrap at every tick
+    CmacTestTraffic line_rate = {10000000, 25, 5000000000ULL, 8000000, 4000000000ULL};
+    // 1.2M pkts and 3.7 GB per 300 ms, just under a 32-bit turn
+    CmacTestTraffic near_wrap = {1200000, 12, 3700000000ULL, 1000000, 3000000000ULL};
+
+    bool ok = true;
+    ok &= run_cmac_case("latched", CmacCounterMode::LATCHED, 48, 1000, 0, line_rate, 20);
+    ok &= run_cmac_case("free32", CmacCounterMode::FREE_RUNNING, 32, 300, (1ULL << 32) - 1000, near_wrap, 50);
+    ok &= run_cmac_case("free48", CmacCounterMode::FREE_RUNNING, 48, 1000, (1ULL << 48) - 1000, line_rate, 20);
+    ok &= run_cmac_schedule_case();
+    printf("BENCH micro=cmac %s\n", ok ? "PASS" : "FAIL");
+}
+
+#define REGS_BRINGUP_LOOPS (1000)
+#define REGS_SIM_QUEUES (4)
+
+static void sim_port_infos(PortInfo pinfos[NB_PORTS]) {
+    for (int i = 0; i < NB_PORTS; i++)
+        pinfos[i] = PortInfo(i * REGS_SIM_QUEUES, REGS_SIM_QUEUES, NB_DESCS, REGS_SIM_QUEUES, RTE_MBUF_DEFAULT_BUF_SIZE, 0, 2);
+}
+
+static bool regs_case(const char *name, bool ok, const char *detail) {
+    printf("BENCH micro=regs case=%-9s %s %s\n", name, detail, ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Onic::init_hardware() as on the card: QDMA function layout, both CMACs out of reset and enabled,
+// then the global reset of ~Onic. Also times the whole bring-up against the model
+static bool run_regs_bringup_case(const PortInfo pinfos[]) {
+    SimOnicShell sim;
+    bool ok;
+    {
+        Onic onic(&sim, pinfos, NB_PORTS);
+        ok = onic.get_init_status() == 0 && onic.get_nb_cmacs() == NB_CMAC;
+        for (int f = 0; f < NB_PORTS; f++) {
+            ok = ok && sim.peek(QDMA_FUNC_OFFSET_QCONF(f)) == ((pinfos[f].queue_base << 16) | REGS_SIM_QUEUES);
+            for (int k = 0; k < QDMA_INDIR_TABLE_SIZE; k++)
+                ok = ok && sim.peek(QDMA_FUNC_OFFSET_INDIR_TABLE(f, k)) == (uint32_t)(k % REGS_SIM_QUEUES);
+        }
+        for (int i = 0; i < NB_CMAC; i++)
+            ok = ok && sim.peek(CMAC_OFFSET_CONF_RX_1(i)) == 0x1 && sim.peek(CMAC_OFFSET_CONF_TX_1(i)) == 0x1;
+    }
+    ok = ok && sim.nb_system_resets == 1;
+
+    char detail[160];
+    snprintf(detail, sizeof(detail), "cmacs=%d sim_time=%" PRIu64 " ms reads=%" PRIu64 " writes=%" PRIu64,
+             NB_CMAC, sim.elapsed_ms(), sim.nb_reads, sim.nb_writes);
+    ok = regs_case("bringup", ok, detail);
+
+    rte_log_set_level_pattern("Onic", RTE_LOG_WARNING); // one INFO line per bring-up otherwise
+    uint64_t start = rte_get_tsc_cycles();
+    for (int i = 0; i < REGS_BRINGUP_LOOPS; i++) {
+        SimOnicShell loop_sim;
+        Onic onic(&loop_sim, pinfos, NB_PORTS);
+    }
+    double us = (double)(rte_get_tsc_cycles() - start) * US_PER_S / rte_get_tsc_hz() / REGS_BRINGUP_LOOPS;
+    rte_log_set_level_pattern("Onic", RTE_LOG_INFO);
+    printf("BENCH micro=regs bringup cost=%8.2f us/onic (model, register accesses only)\n", us);
+    return ok;
+}
+
+// Shell resets that never complete must time out instead of hanging init_hardware()
+static bool run_regs_timeout_case(const PortInfo pinfos[]) {
+    SimShellConfig cfg;
+    cfg.stuck_reset = 0x100; // CMAC 1 stays in reset
+    SimOnicShell cmac1_stuck(cfg);
+    Onic onic1(&cmac1_stuck, pinfos, NB_PORTS);
+    bool ok = onic1.get_init_status() == 0 && onic1.get_nb_cmacs() == 1 &&
+              cmac1_stuck.elapsed_ms() >= SHELL_RESET_TIMEOUT_MS && cmac1_stuck.elapsed_ms() < 2 * SHELL_RESET_TIMEOUT_MS;
+
+    cfg.stuck_reset = 0x10; // the whole shell is stuck
+    SimOnicShell shell_stuck(cfg);
+    Onic onic0(&shell_stuck, pinfos, NB_PORTS);
+    ok = ok && onic0.get_init_status() == -ETIMEDOUT && onic0.get_nb_cmacs() == 0;
+
+    SimShellConfig one;
+    one.nb_cmacs = 1; // single CMAC shell: the second core version does not match
+    SimOnicShell single(one);
+    Onic onic_single(&single, pinfos, NB_PORTS);
+    ok = ok && onic_single.get_init_status() == 0 && onic_single.get_nb_cmacs() == 1;
+
+    char detail[96];
+    snprintf(detail, sizeof(detail), "cmac1_stuck=%" PRIu64 " ms shell_stuck=%" PRIu64 " ms",
+             cmac1_stuck.elapsed_ms(), shell_stuck.elapsed_ms());
+    return regs_case("timeout", ok, detail);
+}
+
+// Runs a bring-up and two collector ticks with traffic in between, returns the collector's rx bytes
+static uint64_t regs_stats_session(RegisterBackend *regs, SimOnicShell *sim, const PortInfo pinfos[], int rs_fec,
+                                   CmacStats *legacy) {
+    Onic onic(regs, pinfos, NB_PORTS, rs_fec);
+    CmacCollector collector = CmacCollector::for_onic(onic);
+    collector.poll(US_PER_S);
+    if (sim != nullptr)
+        sim->add_traffic(1, 1000000, 1500000000ULL, 500000, 32000000, 100);
+    collector.poll(2 * US_PER_S);
+    if (sim != nullptr)
+        sim->add_traffic(1, 1000, 64000, 0, 0);
+    *legacy = onic.get_cmac_stats(1);
+    return collector.totals(1)[CMAC_RX_TOTAL_BYTES];
+}
+
+static bool run_regs_stats_case(const PortInfo pinfos[]) {
+    SimOnicShell sim;
+    CmacStats legacy;
+    Onic onic(&sim, pinfos, NB_PORTS);
+    CmacCollector collector = CmacCollector::for_onic(onic);
+    collector.poll(US_PER_S);
+    sim.add_traffic(1, 1000000, 1500000000ULL, 500000, 32000000, 100);
+    collector.poll(2 * US_PER_S);
+    const CmacRates &r = collector.rates(1);
+    bool ok = collector.totals(1)[CMAC_RX_TOTAL_BYTES] == 1500000000ULL && r.rx_bps == 12000000000ULL &&
+              r.rx_pps == 1000000 && r.rx_err_ppm == 100 && r.tx_pps == 500000 && collector.rates(0).rx_pps == 0;
+
+    // get_cmac_stats() reads the low 32 bits the same registers hold after its own tick
+    sim.add_traffic(1, 1000, 64000, 0, 0);
+    legacy = onic.get_cmac_stats(1);
+    ok = ok && legacy.rx_total_pkts == 1000 && legacy.rx_total_bytes == 64000;
+
+    char detail[96];
+    snprintf(detail, sizeof(detail), "rx=%.3f Gbps %.3f Mpps err=%" PRIu64 " ppm",
+             r.rx_bps / 1e9, r.rx_pps / 1e6, r.rx_err_ppm);
+    return regs_case("stats", ok, detail);
+}
+
+// A session recorded on the model replays access for access; a different control path
+// (RS-FEC enabled) is caught as mismatches
+static bool run_regs_replay_case(const PortInfo pinfos[]) {
+    const char *path = "/tmp/onic_bench_regs.log";
+    CmacStats legacy, replayed_legacy;
+    uint64_t recorded, replayed;
+    {
+        SimOnicShell sim;
+        RecordingRegisterBackend rec(&sim, path);
+        recorded = regs_stats_session(&rec, &sim, pinfos, 0, &legacy);
+    }
+
+    ReplayRegisterBackend replay(path);
+    replayed = regs_stats_session(&replay, nullptr, pinfos, 0, &replayed_legacy);
+    bool ok = replay.ok() && replay.mismatches() == 0 && replay.remaining() == 0 && recorded == replayed &&
+              recorded == 1500000000ULL && replayed_legacy.rx_total_pkts == legacy.rx_total_pkts;
+
+    rte_log_set_level_pattern("user1", RTE_LOG_ERR); // the divergence below is expected
+    ReplayRegisterBackend diverged(path);
+    regs_stats_session(&diverged, nullptr, pinfos, 1, &replayed_legacy);
+    rte_log_set_level_pattern("user1", RTE_LOG_INFO);
+    ok = ok && diverged.mismatches() > 0;
+
+    char detail[96];
+    snprintf(detail, sizeof(detail), "rx_total_bytes=%" PRIu64 "/%" PRIu64 " rs_fec_mismatches=%u",
+             recorded, replayed, diverged.mismatches());
+    remove(path);
+    return regs_case("replay", ok, detail);
+}
+
+static void run_regs_test() {
+    PortInfo pinfos[NB_PORTS];
+    sim_port_infos(pinfos);
+
+    bool ok = true;
+    ok &= run_regs_bringup_case(pinfos);
+    ok &= run_regs_timeout_case(pinfos);
+    ok &= run_regs_stats_case(pinfos);
+    ok &= run_regs_replay_case(pinfos);
+    printf("BENCH micro=regs %s\n", ok ? "PASS" : "FAIL");
+}
+
+#define BRINGUP_TEST_ONICS (4)
+
+// Simulated cards whose links take longer and longer to align, each with an Onic left for the bring-up
+struct BringupTestHost {
+    std::vector<std::unique_ptr<SimOnicShell>> sims;
+    std::vector<std::unique_ptr<Onic>> onics;
+
+    BringupTestHost(const PortInfo pinfos[], SimShellConfig cfg, int faulty, const SimShellConfig &faulty_cfg) {
+        for (int i = 0; i < BRINGUP_TEST_ONICS; i++) {
+            cfg.align_ms = SIM_RX_ALIGN_MS * (i + 1) * 4;
+            sims.emplace_back(new SimOnicShell((i == faulty) ? faulty_cfg : cfg));
+            onics.emplace_back(new Onic(sims.back().get(), pinfos, NB_PORTS, 0, false));
+        }
+    }
+    std::vector<Onic *> onic_ptrs() const {
+        std::vector<Onic *> ptrs;
+        for (auto &onic : onics)
+            ptrs.push_back(onic.get());
+        return ptrs;
+    }
+    // One round of the bring-up: time passes on every card
+    CmacBringup::WaitFn wait() {
+        return [this](unsigned int ms) {
+            for (auto &sim : sims)
+                sim->delay_ms(ms);
+        };
+    }
+};
+
+// The bring-up before CmacBringup: one CMAC after the other, card after card
+static unsigned int run_serial_bringup(BringupTestHost &host) {
+    unsigned int total_ms = 0;
+    for (Onic *onic : host.onic_ptrs()) {
+        for (int cmac_id = 0; cmac_id < NB_CMAC; cmac_id++) {
+            CmacBringup one({onic}, 1u << cmac_id);
+            one.run(host.wait());
+            total_ms += one.elapsed_ms();
+        }
+    }
+    return total_ms;
+}
+
+static bool bringup_case(const char *name, bool ok, unsigned int ms, const char *detail) {
+    printf("BENCH micro=bringup case=%-9s onics=%d cmacs=%d time=%5u ms %s %s\n",
+           name, BRINGUP_TEST_ONICS, BRINGUP_TEST_ONICS * NB_CMAC, ms, detail, ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static void run_bringup_test() {
+    PortInfo pinfos[NB_PORTS];
+    sim_port_infos(pinfos);
+    SimShellConfig healthy;
+    bool ok = true;
+    rte_log_set_level_pattern("Onic", RTE_LOG_WARNING);
+
+    // Every link aligns: all at once costs the slowest card, not the sum
+    {
+        BringupTestHost serial_host(pinfos, healthy, -1, healthy);
+        unsigned int serial_ms = run_serial_bringup(serial_host);
+
+        BringupTestHost host(pinfos, healthy, -1, healthy);
+        CmacBringup bringup(host.onic_ptrs());
+        bool case_ok = bringup.run(host.wait()) == 0;
+        for (int i = 0; i < BRINGUP_TEST_ONICS; i++) {
+            case_ok = case_ok && host.onics[i]->get_nb_cmacs() == NB_CMAC;
+            for (int c = 0; c < NB_CMAC; c++)
+                case_ok = case_ok && bringup.stage(i, c) == CmacStage::UP &&
+                          host.sims[i]->peek(CMAC_OFFSET_CONF_TX_1(c)) == 0x1;
+        }
+        unsigned int slowest = SIM_SHELL_RESET_MS + SIM_RX_ALIGN_MS * BRINGUP_TEST_ONICS * 4;
+        case_ok = case_ok && bringup.elapsed_ms() <= slowest + CMAC_RESET_WAIT_MS && bringup.elapsed_ms() < serial_ms;
+        bringup.report();
+
+        char detail[64];
+        snprintf(detail, sizeof(detail), "serial=%u ms", serial_ms);
+        ok &= bringup_case("parallel", case_ok, bringup.elapsed_ms(), detail);
+    }
+
+    // No link on one CMAC: it is enabled anyway once RX_ALIGN_TIMEOUT_MS is over
+    {
+        SimShellConfig no_link;
+        no_link.never_align = 0x2;
+        BringupTestHost host(pinfos, healthy, 1, no_link);
+        CmacBringup bringup(host.onic_ptrs());
+        bool case_ok = bringup.run(host.wait()) == 0 && bringup.stage(1, 1) == CmacStage::LINK_DOWN &&
+                       bringup.stage(1, 0) == CmacStage::UP && host.onics[1]->get_nb_cmacs() == NB_CMAC &&
+                       bringup.elapsed_ms() >= RX_ALIGN_TIMEOUT_MS &&
+                       bringup.elapsed_ms() <= SIM_SHELL_RESET_MS + RX_ALIGN_TIMEOUT_MS + CMAC_RESET_WAIT_MS;
+        ok &= bringup_case("link_down", case_ok, bringup.elapsed_ms(), "");
+    }
+
+    // A CMAC stuck in reset fails after SHELL_RESET_TIMEOUT_MS, the other cards are not held up
+    {
+        SimShellConfig stuck;
+        stuck.stuck_reset = 0x100;
+        BringupTestHost host(pinfos, healthy, 2, stuck);
+        CmacBringup bringup(host.onic_ptrs());
+        bool case_ok = bringup.run(host.wait()) == 0 && bringup.stage(2, 1) == CmacStage::FAILED &&
+                       host.onics[2]->get_nb_cmacs() == 1 && host.onics[0]->get_nb_cmacs() == NB_CMAC &&
+                       bringup.elapsed_ms() <= SHELL_RESET_TIMEOUT_MS + CMAC_RESET_WAIT_MS;
+        ok &= bringup_case("stuck", case_ok, bringup.elapsed_ms(), "");
+    }
+
+    // No core behind the first CMAC: like the serial bring-up, the second one is left alone
+    {
+        SimShellConfig first_absent;
+        first_absent.absent = 0x1;
+        BringupTestHost host(pinfos, healthy, 1, first_absent);
+        CmacBringup bringup(host.onic_ptrs());
+        bool case_ok = bringup.run(host.wait()) == 0 && bringup.stage(1, 0) == CmacStage::ABSENT &&
+                       bringup.stage(1, 1) == CmacStage::SKIPPED && host.onics[1]->get_nb_cmacs() == 0 &&
+                       host.sims[1]->peek(CMAC_OFFSET_CONF_RX_1(1)) == 0 &&
+                       host.sims[1]->peek(CMAC_OFFSET_CONF_TX_1(1)) == 0 && host.onics[0]->get_nb_cmacs() == NB_CMAC;
+        ok &= bringup_case("absent", case_ok, bringup.elapsed_ms(), "");
+    }
+
+    // A shell that never comes up: the whole bring-up gives up in SHELL_RESET_TIMEOUT_MS
+    {
+        SimShellConfig dead;
+        dead.stuck_reset = 0x10;
+        BringupTestHost host(pinfos, healthy, 3, dead);
+        CmacBringup bringup(host.onic_ptrs());
+        bool case_ok = bringup.run(host.wait()) == -ETIMEDOUT && host.onics[3]->get_init_status() == -ETIMEDOUT &&
+                       host.onics[3]->get_nb_cmacs() == 0 && host.onics[0]->get_nb_cmacs() == NB_CMAC &&
+                       bringup.elapsed_ms() <= SHELL_RESET_TIMEOUT_MS + CMAC_RESET_WAIT_MS;
+        ok &= bringup_case("dead", case_ok, bringup.elapsed_ms(), "");
+    }
+
+    rte_log_set_level_pattern("Onic", RTE_LOG_INFO);
+    printf("BENCH micro=bringup %s\n", ok ? "PASS" : "FAIL");
+}
+
+#define METRICS_TEST_PATH "/tmp/onic_bench.metrics"
+#define METRICS_TEST_BURSTS (2000000)
+#define METRICS_TEST_PKT_LEN (64)
+
+// Datapath side of the metrics test: the counter updates of an rx burst, straight into the page
+static int metrics_test_writer(void *arg) {
+    auto *cycles = static_cast<uint64_t *>(arg);
+    LcoreStats *stats = LcoreStats::attach(rte_lcore_id(), "rx");
+    uint64_t start = rte_get_tsc_cycles();
+    for (unsigned int i = 0; i < METRICS_TEST_BURSTS; i++) {
+        if (i % 4 == 0) {
+            lcore_stats_add(&stats->empty_polls, 1);
+            continue;
+        }
+        lcore_stats_add(&stats->rx_pkts, MICRO_BURST_SIZE);
+        lcore_stats_add(&stats->rx_bytes, MICRO_BURST_SIZE * METRICS_TEST_PKT_LEN);
+        lcore_stats_add(&stats->rx_bursts, 1);
+    }
+    *cycles = rte_get_tsc_cycles() - start;
+    return 0;
+}
+
+// Workers count into the published page while the main lcore watches it through a separate
+// read-only mapping, as an external tool would: counters must never go backwards and must end exact
+static void run_metrics_test() {
+    unsigned int nb_workers = rte_lcore_count() - 1;
+    if (nb_workers == 0) {
+        printf("BENCH micro=metrics skipped: needs at least one worker lcore\n");
+        return;
+    }
+    for (unsigned int lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++)
+        lcore_stats[lcore_id] = LcoreStats();
+
+    MetricsPage page;
+    int ret = page.publish(METRICS_TEST_PATH);
+    if (ret < 0) {
+        printf("BENCH micro=metrics cannot publish %s: %s FAIL\n", METRICS_TEST_PATH, strerror(-ret));
+        return;
+    }
+    MetricsReader reader;
+    ret = reader.open(METRICS_TEST_PATH);
+    if (ret < 0) {
+        printf("BENCH micro=metrics cannot map %s: %s FAIL\n", METRICS_TEST_PATH, strerror(-ret));
+        return;
+    }
+    int f_ctx = reader.find_field("ctx_id");
+    int f_role = reader.find_field("role");
+    int f_pkts = reader.find_field("rx_pkts");
+    int f_bytes = reader.find_field("rx_bytes");
+    int f_bursts = reader.find_field("rx_bursts");
+    int f_empty = reader.find_field("empty_polls");
+    bool ok = f_ctx >= 0 && f_role >= 0 && f_pkts >= 0 && f_bytes >= 0 && f_bursts >= 0 && f_empty >= 0 &&
+              reader.find_field("no_such_counter") < 0 && reader.info().nb_slots == RTE_MAX_LCORE &&
+              reader.info().slot_offset % RTE_CACHE_LINE_SIZE == 0;
+    if (!ok) {
+        printf("BENCH micro=metrics bad layout FAIL\n");
+        return;
+    }
+
+    std::vector<uint64_t> cycles(RTE_MAX_LCORE);
+    unsigned int lcore_id;
+    RTE_LCORE_FOREACH_WORKER(lcore_id)
+        rte_eal_remote_launch(metrics_test_writer, &cycles[lcore_id], lcore_id);
+
+    // Snapshot every slot until the workers are done
+    std::vector<uint64_t> last(RTE_MAX_LCORE, 0);
+    uint64_t nb_snapshots = 0, backwards = 0, snapshot_cycles = 0;
+    bool running = true;
+    while (running) {
+        running = false;
+        RTE_LCORE_FOREACH_WORKER(lcore_id)
+            running |= (rte_eal_get_lcore_state(lcore_id) == RUNNING);
+        uint64_t start = rte_get_tsc_cycles();
+        for (unsigned int slot = 0; slot < RTE_MAX_LCORE; slot++) {
+            if (reader.read_i32(slot, f_ctx) < 0)
+                continue;
+            uint64_t pkts = reader.read_u64(slot, f_pkts);
+            backwards += (pkts < last[slot]);
+            last[slot] = pkts;
+        }
+        snapshot_cycles += rte_get_tsc_cycles() - start;
+        nb_snapshots++;
+        page.heartbeat();
+    }
+    rte_eal_mp_wait_lcore();
+
+    uint64_t bursts = METRICS_TEST_BURSTS - METRICS_TEST_BURSTS / 4;
+    uint64_t update_cycles = 0;
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        char role[LCORE_ROLE_LEN];
+        reader.read_str(lcore_id, f_role, role, sizeof(role));
+        ok &= reader.read_i32(lcore_id, f_ctx) == (int32_t)lcore_id && strcmp(role, "rx") == 0 &&
+              reader.read_u64(lcore_id, f_pkts) == bursts * MICRO_BURST_SIZE &&
+              reader.read_u64(lcore_id, f_bytes) == bursts * MICRO_BURST_SIZE * METRICS_TEST_PKT_LEN &&
+              reader.read_u64(lcore_id, f_bursts) == bursts &&
+              reader.read_u64(lcore_id, f_empty) == METRICS_TEST_BURSTS / 4;
+        update_cycles += cycles[lcore_id];
+    }
+    ok &= backwards == 0 && reader.read_i32(rte_get_main_lcore(), f_ctx) < 0 &&
+          reader.heartbeat_tsc() > reader.info().start_tsc && reader.info().pid == getpid();
+
+    // Counters survive the page going away, and so does the reader's mapping
+    unsigned int first_worker = rte_get_next_lcore(-1, 1, 0);
+    page.unpublish();
+    ok &= access(METRICS_TEST_PATH, F_OK) != 0 && lcore_stats[first_worker].rx_bursts == bursts &&
+          reader.read_u64(first_worker, f_bursts) == bursts;
+    reader.close();
+
+    double ns_per_cycle = 1e9 / rte_get_tsc_hz();
+    printf("BENCH micro=metrics workers=%u page=%zu bytes update=%5.2f ns/poll snapshot=%7.1f ns (%u slots) snapshots=%" PRIu64 " backwards=%" PRIu64 " %s\n",
+           nb_workers, MetricsPage::page_size(), update_cycles * ns_per_cycle / ((uint64_t)METRICS_TEST_BURSTS * nb_workers),
+           snapshot_cycles * ns_per_cycle / nb_snapshots, RTE_MAX_LCORE, nb_snapshots, backwards, ok ? "PASS" : "FAIL");
+}
+
+#define IDLE_TEST_MSGS (10000)
+#define IDLE_TEST_MIN_GAP_US (20)
+#define IDLE_TEST_MAX_GAP_US (200)
+#define IDLE_TEST_SLEEP_AFTER (64)
+
+struct IdleTestConsumer {
+    struct rte_ring *ring;
+    IdleConfig cfg;
+    IdlePolicy effective;
+    LatencyHistogram wake_ns;
+    unsigned int received;
+};
+
+// The tx lcore's loop reduced to its idle handling: every element carries the TSC of its enqueue,
+// so what it waited in the ring is the wake-up latency of the policy
+static int idle_test_consumer(void *arg) {
+    auto *c = static_cast<IdleTestConsumer *>(arg);
+    LcoreStats *stats = LcoreStats::attach(0, "idle");
+    IdleGovernor idle(c->cfg, stats);
+    idle.watch_ring(c->ring);
+    c->effective = idle.effective_policy();
+    PollClock clock;
+    uint64_t hz = rte_get_tsc_hz();
+    void *objs[MICRO_BURST_SIZE];
+    unsigned int nb = 0;
+
+    while (c->received < IDLE_TEST_MSGS) {
+        clock.lap(stats, nb > 0);
+        nb = rte_ring_dequeue_burst(c->ring, objs, MICRO_BURST_SIZE, NULL);
+        uint64_t now = rte_rdtsc();
+        for (unsigned int i = 0; i < nb; i++)
+            c->wake_ns.record((now - (uint64_t)(uintptr_t)objs[i]) * NS_PER_S / hz);
+        c->received += nb;
+        idle.idle(nb);
+    }
+    return 0;
+}
+
+// Sparse traffic, so the consumer is deep in its idle state whenever an element arrives
+static bool run_idle_case(struct rte_ring *ring, unsigned int lcore_id, IdlePolicy policy) {
+    for (unsigned int i = 0; i < RTE_MAX_LCORE; i++)
+        lcore_stats[i] = LcoreStats();
+    auto *c = new IdleTestConsumer();
+    c->ring = ring;
+    c->cfg.policy = policy;
+    c->cfg.sleep_after = IDLE_TEST_SLEEP_AFTER;
+    rte_eal_remote_launch(idle_test_consumer, c, lcore_id);
+
+    for (unsigned int i = 0; i < IDLE_TEST_MSGS; i++) {
+        rte_delay_us_block(IDLE_TEST_MIN_GAP_US + rte_rand() % (IDLE_TEST_MAX_GAP_US - IDLE_TEST_MIN_GAP_US));
+        void *stamp = (void *)(uintptr_t)rte_rdtsc();
+        while (rte_ring_enqueue(ring, stamp) != 0)
+            rte_pause();
+    }
+    rte_eal_wait_lcore(lcore_id);
+
+    const LcoreStats &stats = lcore_stats[lcore_id];
+    uint64_t cycles = stats.busy_cycles + stats.idle_cycles;
+    double asleep = (cycles == 0) ? 0 : 100.0 * stats.wait_cycles / cycles;
+    bool ok = c->received == IDLE_TEST_MSGS && c->wake_ns.count() == IDLE_TEST_MSGS;
+    // Spinning policies never wait, the others spend most of a sparse run waiting
+    if (policy == IdlePolicy::SPIN || policy == IdlePolicy::PAUSE)
+        ok &= stats.idle_waits == 0;
+    else
+        ok &= asleep > 50;
+    printf("BENCH micro=idle policy=%-9s effective=%-7s wake p50=%7" PRIu64 " ns p99=%7" PRIu64 " ns max=%8" PRIu64 " ns asleep=%5.1f%% waits=%" PRIu64 " %s\n",
+           to_string(policy), to_string(c->effective), c->wake_ns.percentile(0.5), c->wake_ns.percentile(0.99),
+           c->wake_ns.max(), asleep, stats.idle_waits, ok ? "PASS" : "FAIL");
+    delete c;
+    return ok;
+}
+
+static void run_idle_test() {
+    unsigned int lcore_id = rte_get_next_lcore(-1, 1, 0);
+    if (lcore_id >= RTE_MAX_LCORE) {
+        printf("BENCH micro=idle skipped: needs at least one worker lcore\n");
+        return;
+    }
+    struct rte_ring *ring = rte_ring_create("idle_test", 1024, rte_lcore_to_socket_id(lcore_id),
+                                            RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (ring == nullptr)
+        rte_exit(EXIT_FAILURE, "Cannot create idle test ring\n");
+
+    bool ok = true;
+    for (IdlePolicy policy : {IdlePolicy::SPIN, IdlePolicy::PAUSE, IdlePolicy::MONITOR, IdlePolicy::SLEEP})
+        ok &= run_idle_case(ring, lcore_id, policy);
+    rte_ring_free(ring);
+    printf("BENCH micro=idle %s\n", ok ? "PASS" : "FAIL");
+}
+
+#define FLOWS_TEST_PKTS (512)          // packets circulating through the net_ring loopback
+#define FLOWS_TEST_CAPACITY (1 << 17)
+#define FLOWS_TEST_TARGET_CYCLES (20)
+
+// Packet of synthetic flow `flow`, the flow number is in the source address: most flows are
+// IPv4/UDP, every 4th IPv4/TCP and every 8th IPv6/TCP
+static void flows_test_fill(struct rte_mbuf *m, uint32_t flow) {
+    bool ipv6 = (flow % 8) == 7;
+    uint8_t proto = (ipv6 || flow % 4 == 0) ? IPPROTO_TCP : IPPROTO_UDP;
+    uint16_t l3_len = ipv6 ? sizeof(struct rte_ipv6_hdr) : sizeof(struct rte_ipv4_hdr);
+    uint16_t l4_len = (proto == IPPROTO_TCP) ? sizeof(struct rte_tcp_hdr) : sizeof(struct rte_udp_hdr);
+    uint16_t len = RTE_MAX(sizeof(struct rte_ether_hdr) + l3_len + l4_len, (size_t)PRIME_PKT_SIZE);
+
+    rte_pktmbuf_reset(m);
+    uint8_t *pkt = (uint8_t *)rte_pktmbuf_append(m, len);
+    memset(pkt, 0, len);
+    auto *eth = (struct rte_ether_hdr *)pkt;
+    eth->ether_type = rte_cpu_to_be_16(ipv6 ? RTE_ETHER_TYPE_IPV6 : RTE_ETHER_TYPE_IPV4);
+    uint8_t *l3 = pkt + sizeof(*eth);
+    if (ipv6) {
+        auto *ip = (struct rte_ipv6_hdr *)l3;
+        ip->vtc_flow = rte_cpu_to_be_32(6 << 28);
+        ip->proto = proto;
+        uint32_t src = rte_cpu_to_be_32(flow);
+        memcpy((uint8_t *)&ip->src_addr + 12, &src, sizeof(src));
+        ((uint8_t *)&ip->dst_addr)[0] = 0x20;
+    } else {
+        auto *ip = (struct rte_ipv4_hdr *)l3;
+        ip->version_ihl = RTE_IPV4_VHL_DEF;
+        ip->next_proto_id = proto;
+        ip->src_addr = rte_cpu_to_be_32(RTE_IPV4(10, 0, 0, 0) + flow);
+        ip->dst_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 0, 1));
+    }
+    uint16_t ports[2] = {rte_cpu_to_be_16(1024 + flow % 4096), rte_cpu_to_be_16(proto == IPPROTO_TCP ? 443 : 53)};
+    memcpy(l3 + l3_len, ports, sizeof(ports));
+}
+
+// Only burst_parse() and update_burst() are timed. Rewriting the next flows into the packets leaves their data in
+// cache, as DDIO would for packets fresh off a NIC
+static bool run_flows_case(uint16_t port_id, struct rte_mbuf **seeds, uint32_t nb_flows, unsigned int seconds) {
+    for (unsigned int i = 0; i < RTE_MAX_LCORE; i++)
+        lcore_stats[i] = LcoreStats();
+    LcoreStats *stats = &lcore_stats[rte_lcore_id()];
+    FlowConfig cfg;
+    cfg.capacity = FLOWS_TEST_CAPACITY;
+    FlowTable table(cfg, rte_socket_id(), stats);
+
+    uint32_t next_flow = 0;
+    for (unsigned int i = 0; i < FLOWS_TEST_PKTS; i++)
+        flows_test_fill(seeds[i], next_flow++ % nb_flows);
+    unsigned int nb_seeded = rte_eth_tx_burst(port_id, 0, seeds, FLOWS_TEST_PKTS);
+
+    struct rte_mbuf *mbufs[MICRO_BURST_SIZE];
+    BurstMeta meta;
+    uint64_t nb_pkts = 0, nb_tracked = 0, cycles = 0;
+    uint64_t end = rte_get_tsc_cycles() + seconds * rte_get_tsc_hz();
+    while (rte_get_tsc_cycles() < end) {
+        uint16_t nb = rte_eth_rx_burst(port_id, 0, mbufs, MICRO_BURST_SIZE);
+        uint64_t start = rte_rdtsc();
+        burst_parse(mbufs, nb, &meta, DEFAULT_PREFETCH_AHEAD);
+        nb_tracked += table.update_burst(mbufs, meta, start);
+        cycles += rte_rdtsc() - start;
+        nb_pkts += nb;
+        for (uint16_t i = 0; i < nb; i++)
+            flows_test_fill(mbufs[i], next_flow++ % nb_flows);
+        rte_eth_tx_burst(port_id, 0, mbufs, nb);
+    }
+    // Take the seeds back out of the loopback for the next case
+    unsigned int nb_drained = 0;
+    uint16_t nb;
+    while ((nb = rte_eth_rx_burst(port_id, 0, seeds + nb_drained, MICRO_BURST_SIZE)) > 0)
+        nb_drained += nb;
+
+    uint64_t flow_pkts = 0;
+    table.for_each([&](const FlowEntry &flow) { flow_pkts += flow.pkts; });
+    FlowKey first = {};
+    memcpy(first.src, "\x0a\x00\x00\x00", 4);
+    memcpy(first.dst, "\xc0\xa8\x00\x01", 4);
+    first.src_port = rte_cpu_to_be_16(1024);
+    first.dst_port = rte_cpu_to_be_16(443);
+    first.proto = IPPROTO_TCP;
+    first.ip_version = 4;
+    const FlowEntry *flow0 = table.lookup(first);
+
+    bool ok = nb_seeded == FLOWS_TEST_PKTS && nb_drained == FLOWS_TEST_PKTS && nb_tracked == nb_pkts &&
+              flow_pkts == nb_pkts && table.size() == RTE_MIN((uint64_t)nb_flows, nb_pkts) &&
+              stats->flows_new == table.size() && stats->flow_untracked == 0 &&
+              flow0 != nullptr && flow0->first_tsc <= flow0->last_tsc && flow0->pkts > 0;
+    double per_pkt = (nb_pkts == 0) ? 0 : (double)cycles / nb_pkts;
+    printf("BENCH micro=flows flows=%6u burst=%u %6.1f cycles/pkt (target %d: %s) %7.2f Mpps of table time pkts=%" PRIu64 " %s\n",
+           nb_flows, MICRO_BURST_SIZE, per_pkt, FLOWS_TEST_TARGET_CYCLES, per_pkt <= FLOWS_TEST_TARGET_CYCLES ? "met" : "missed",
+           (cycles == 0) ? 0 : nb_pkts * (double)rte_get_tsc_hz() / cycles / 1e6, nb_pkts, ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static void run_flows_test(struct rte_mempool *mbuf_pool, unsigned int seconds) {
+    const char *name = "net_ring_flows";
+    uint16_t port_id;
+    if (rte_vdev_init(name, NULL) < 0 || rte_eth_dev_get_port_by_name(name, &port_id) != 0)
+        rte_exit(EXIT_FAILURE, "Cannot create %s\n", name);
+    bench_port_init(port_id, 1, mbuf_pool);
+
+    struct rte_mbuf *seeds[FLOWS_TEST_PKTS];
+    if (rte_pktmbuf_alloc_bulk(mbuf_pool, seeds, FLOWS_TEST_PKTS) != 0)
+        rte_exit(EXIT_FAILURE, "Cannot allocate flow test packets\n");
+
+    // From flows that stay in L1 to a table well past the L2
+    bool ok = true;
+    for (uint32_t nb_flows : {64u, 4096u, 65536u})
+        ok &= run_flows_case(port_id, seeds, nb_flows, RTE_MAX(seconds / 3, 1u));
+
+    rte_pktmbuf_free_bulk(seeds, FLOWS_TEST_PKTS);
+    rte_eth_dev_stop(port_id);
+    rte_eth_dev_close(port_id);
+    rte_vdev_uninit(name);
+    printf("BENCH micro=flows %s\n", ok ? "PASS" : "FAIL");
+}
+
+#define AGING_TEST_IDLE_MS (100)
+#define AGING_TEST_ACTIVE_MS (250)
+#define AGING_TEST_FLOWS (4096)
+#define AGING_TEST_STEP_DIV (20)    // age() calls per ms of simulated time
+
+struct AgingCheck {
+    uint64_t reasons[FLOW_END_REASONS] = {};
+    uint64_t pkts = 0;
+    uint64_t early = 0;             // idle records exported before their flow's idle timeout
+};
+
+// One packet of each of flows first to first + nb - 1, all at tsc. Returns how many were tracked
+static uint64_t aging_feed(FlowTable &table, struct rte_mbuf **mbufs, uint32_t first, uint32_t nb, uint64_t tsc) {
+    uint64_t nb_tracked = 0;
+    BurstMeta meta;
+    for (uint32_t f = 0; f < nb; f += MICRO_BURST_SIZE) {
+        uint16_t n = RTE_MIN((uint32_t)MICRO_BURST_SIZE, nb - f);
+        for (uint16_t i = 0; i < n; i++)
+            flows_test_fill(mbufs[i], first + f + i);
+        burst_parse(mbufs, n, &meta, DEFAULT_PREFETCH_AHEAD);
+        nb_tracked += table.update_burst(mbufs, meta, tsc);
+    }
+    return nb_tracked;
+}
+
+static void aging_drain(struct rte_ring *ring, uint64_t tsc, uint64_t idle_cycles, AgingCheck &check) {
+    FlowRecord records[FLOW_EXPORT_BATCH];
+    unsigned int nb;
+    while ((nb = rte_ring_dequeue_burst_elem(ring, records, sizeof(FlowRecord), FLOW_EXPORT_BATCH, NULL)) > 0) {
+        for (unsigned int i = 0; i < nb; i++) {
+            check.reasons[(int)records[i].reason]++;
+            check.pkts += records[i].pkts;
+            if (records[i].reason == FlowEnd::IDLE && tsc < records[i].last_tsc + idle_cycles)
+                check.early++;
+        }
+    }
+}
+
+// Runs the table's timeouts from `from` to `to` in steps of 1/AGING_TEST_STEP_DIV ms, draining the
+// records after each step. Keeps the most flows and cycles a single age() call took
+static void aging_run(FlowTable &table, struct rte_ring *ring, uint64_t from, uint64_t to, AgingCheck &check,
+                      uint32_t *max_flows = nullptr, uint64_t *max_cycles = nullptr) {
+    uint64_t ms = rte_get_tsc_hz() / MS_PER_S;
+    for (uint64_t tsc = from; tsc < to; tsc += ms / AGING_TEST_STEP_DIV) {
+        uint64_t start = rte_rdtsc();
+        uint32_t nb = table.age(tsc);
+        uint64_t cycles = rte_rdtsc() - start;
+        if (max_flows != nullptr)
+            *max_flows = RTE_MAX(*max_flows, nb);
+        if (max_cycles != nullptr)
+            *max_cycles = RTE_MAX(*max_cycles, cycles);
+        aging_drain(ring, tsc, AGING_TEST_IDLE_MS * ms, check);
+    }
+}
+
+// Simulated time: the table only ever sees the TSC values it is given, so seconds of flow life
+// take milliseconds to run. Checks that nothing expires early, that no age() call looks at more
+// than FLOW_AGE_BUDGET flows however many come due at once, and that every packet is exported once
+static void run_aging_test(struct rte_mempool *mbuf_pool) {
+    for (unsigned int i = 0; i < RTE_MAX_LCORE; i++)
+        lcore_stats[i] = LcoreStats();
+    LcoreStats *stats = &lcore_stats[rte_lcore_id()];
+    stats->ctx_id = 0;
+    struct rte_ring *ring = create_flow_ring("aging_ring", 65536, rte_socket_id());
+    struct rte_mbuf *mbufs[MICRO_BURST_SIZE];
+    if (ring == nullptr || rte_pktmbuf_alloc_bulk(mbuf_pool, mbufs, MICRO_BURST_SIZE) != 0)
+        rte_exit(EXIT_FAILURE, "Cannot create the aging test ring or packets\n");
+    uint64_t ms = rte_get_tsc_hz() / MS_PER_S;
+    FlowConfig cfg;
+    cfg.capacity = 2 * AGING_TEST_FLOWS;
+    cfg.idle_timeout_ms = AGING_TEST_IDLE_MS;
+    cfg.active_timeout_ms = AGING_TEST_ACTIVE_MS;
+    bool ok = true;
+
+    // Idle: every flow comes due in the same ms, they are spread over the next polls
+    {
+        FlowTable table(cfg, rte_socket_id(), stats, ring);
+        uint64_t t0 = rte_rdtsc();
+        AgingCheck check;
+        uint32_t max_flows = 0;
+        uint64_t max_cycles = 0;
+        uint64_t fed = aging_feed(table, mbufs, 0, AGING_TEST_FLOWS, t0);
+        aging_run(table, ring, t0, t0 + (AGING_TEST_IDLE_MS - 1) * ms, check);
+        uint64_t before = check.reasons[(int)FlowEnd::IDLE];
+        aging_run(table, ring, t0 + (AGING_TEST_IDLE_MS - 1) * ms, t0 + 2 * AGING_TEST_IDLE_MS * ms, check,
+                  &max_flows, &max_cycles);
+
+        uint64_t start = rte_rdtsc();
+        for (int i = 0; i < 1000000; i++)
+            table.age(t0 + 2 * AGING_TEST_IDLE_MS * ms);
+        double empty_cycles = (rte_rdtsc() - start) / 1e6;
+
+        bool pass = fed == AGING_TEST_FLOWS && before == 0 && check.early == 0 &&
+                    check.reasons[(int)FlowEnd::IDLE] == AGING_TEST_FLOWS && check.pkts == fed &&
+                    table.size() == 0 && stats->flows_expired == AGING_TEST_FLOWS && max_flows <= FLOW_AGE_BUDGET;
+        printf("BENCH micro=aging case=idle flows=%u expired=%" PRIu64 " early=%" PRIu64 " most per age()=%u in %" PRIu64 " cycles, %.1f cycles with nothing due %s\n",
+               AGING_TEST_FLOWS, check.reasons[(int)FlowEnd::IDLE], check.early + before, max_flows, max_cycles,
+               empty_cycles, pass ? "PASS" : "FAIL");
+        ok &= pass;
+    }
+
+    // Active: flows that keep sending are exported every active timeout, then go idle once they stop
+    {
+        FlowTable table(cfg, rte_socket_id(), stats, ring);
+        uint64_t t0 = rte_rdtsc();
+        AgingCheck check;
+        uint64_t fed = 0;
+        uint32_t nb_flows = AGING_TEST_FLOWS / 16;
+        uint64_t end = t0 + (2 * AGING_TEST_ACTIVE_MS + AGING_TEST_IDLE_MS) * ms;
+        for (uint64_t t = t0; t < end; t += 20 * ms) {
+            fed += aging_feed(table, mbufs, 0, nb_flows, t);
+            aging_run(table, ring, t, t + 20 * ms, check);
+        }
+        aging_run(table, ring, end, end + 2 * AGING_TEST_IDLE_MS * ms, check);
+
+        bool pass = check.reasons[(int)FlowEnd::ACTIVE] >= 2 * nb_flows && check.reasons[(int)FlowEnd::IDLE] == nb_flows &&
+                    check.early == 0 && check.pkts == fed && table.size() == 0;
+        printf("BENCH micro=aging case=active flows=%u active records=%" PRIu64 " idle records=%" PRIu64 " pkts=%" PRIu64 "/%" PRIu64 " %s\n",
+               nb_flows, check.reasons[(int)FlowEnd::ACTIVE], check.reasons[(int)FlowEnd::IDLE], check.pkts, fed,
+               pass ? "PASS" : "FAIL");
+        ok &= pass;
+    }
+
+    // Pressure: twice the capacity in new flows, the oldest make room and are exported
+    {
+        FlowConfig small = cfg;
+        small.capacity = AGING_TEST_FLOWS / 4;
+        lcore_stats[rte_lcore_id()] = LcoreStats();
+        stats->ctx_id = 0;
+        FlowTable table(small, rte_socket_id(), stats, ring);
+        uint64_t t0 = rte_rdtsc();
+        AgingCheck check;
+        uint64_t fed = 0;
+        uint64_t start = rte_rdtsc();
+        for (uint32_t f = 0; f < AGING_TEST_FLOWS; f += MICRO_BURST_SIZE) {
+            fed += aging_feed(table, mbufs, f, MICRO_BURST_SIZE, t0 + f);
+            aging_drain(ring, t0, AGING_TEST_IDLE_MS * ms, check);
+        }
+        double per_flow = (double)(rte_rdtsc() - start) / AGING_TEST_FLOWS;
+        // How close the sampled LRU comes to keeping exactly the newest flows
+        uint32_t newest = 0;
+        table.for_each([&](const FlowEntry &flow) { newest += (flow.last_tsc >= t0 + AGING_TEST_FLOWS - small.capacity); });
+        table.flush();
+        aging_drain(ring, t0, AGING_TEST_IDLE_MS * ms, check);
+
+        bool pass = fed == AGING_TEST_FLOWS && table.size() <= small.capacity &&
+                    stats->flows_evicted == AGING_TEST_FLOWS - table.size() &&
+                    check.reasons[(int)FlowEnd::EVICTED] == stats->flows_evicted &&
+                    check.reasons[(int)FlowEnd::STOP] == table.size() && check.pkts == fed &&
+                    newest >= small.capacity / 2;
+        printf("BENCH micro=aging case=evict capacity=%u new=%u evicted=%" PRIu64 " newest kept=%u/%u %.1f cycles per new flow %s\n",
+               small.capacity, AGING_TEST_FLOWS, stats->flows_evicted, newest, table.size(), per_flow, pass ? "PASS" : "FAIL");
+        ok &= pass;
+    }
+
+    rte_pktmbuf_free_bulk(mbufs, MICRO_BURST_SIZE);
+    rte_ring_free(ring);
+    printf("BENCH micro=aging %s\n", ok ? "PASS" : "FAIL");
+}
+
+#define PARSE_TEST_PKTS (1024)
+#define PARSE_TEST_KINDS (12)
+
+// What burst_parse() must find in a packet of each kind of parse_test_fill()
+struct ParseExpect {
+    uint16_t ether_type;
+    uint8_t l3_off;
+    uint8_t ip_proto;
+    uint16_t l4_off;
+    uint8_t flags;
+};
+
+static const ParseExpect parse_expect[PARSE_TEST_KINDS] = {
+    {RTE_ETHER_TYPE_IPV4, 14, IPPROTO_UDP, 34, PKT_IPV4 | PKT_L4},                 // IPv4/UDP
+    {RTE_ETHER_TYPE_IPV4, 18, IPPROTO_TCP, 42, PKT_VLAN | PKT_IPV4 | PKT_L4},      // VLAN, IPv4 options/TCP
+    {RTE_ETHER_TYPE_IPV6, 14, IPPROTO_TCP, 54, PKT_IPV6 | PKT_L4},                 // IPv6/TCP
+    {RTE_ETHER_TYPE_IPV6, 18, IPPROTO_UDP, 58, PKT_VLAN | PKT_IPV6 | PKT_L4},      // VLAN, IPv6/UDP
+    {RTE_ETHER_TYPE_IPV4, 14, IPPROTO_UDP, 0, PKT_IPV4 | PKT_FRAG},                // later IPv4 fragment
+    {RTE_ETHER_TYPE_ARP, 14, 0, 0, 0},                                             // not IP
+    {0, 0, 0, 0, 0},                                                               // runt, not read
+    {0x88b5, 18, 0, 0, PKT_VLAN},                                                  // VLAN timestamp packet
+    {RTE_ETHER_TYPE_IPV4, 14, IPPROTO_TCP, 0, PKT_IPV4},                           // IHL under 5
+    {RTE_ETHER_TYPE_IPV4, 14, IPPROTO_UDP, 0, PKT_IPV4},                           // IPv4 header, no L4
+    {RTE_ETHER_TYPE_IPV4, 18, IPPROTO_TCP, 0, PKT_VLAN | PKT_IPV4},                // VLAN, L4 header cut short
+    {RTE_ETHER_TYPE_IPV6, 14, 0, 0, 0},                                            // IPv6 header cut short
+};
+
+// Packet of the given kind, see parse_expect. Lengths and the VLAN id vary with seq
+static void parse_test_fill(struct rte_mbuf *m, int kind, uint32_t seq) {
+    static const uint16_t lens[PARSE_TEST_KINDS] = {64, 64, 74, 78, 60, 60, 20, 70, 60, 34, 40, 50};
+    bool vlan = kind == 1 || kind == 3 || kind == 7 || kind == 10;
+    uint16_t len = lens[kind] + ((kind == 6 || kind >= 9) ? 0 : seq % 64);
+
+    rte_pktmbuf_reset(m);
+    uint8_t *pkt = (uint8_t *)rte_pktmbuf_append(m, len);
+    for (uint16_t b = 0; b < len; b++)
+        pkt[b] = (uint8_t)(seq * 31 + b);
+    if (kind == 6)
+        return;
+    uint16_t type = parse_expect[kind].ether_type;
+    uint8_t *l3 = pkt + sizeof(struct rte_ether_hdr);
+    if (vlan) {
+        ((struct rte_ether_hdr *)pkt)->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_VLAN);
+        auto *tag = (struct rte_vlan_hdr *)l3;
+        tag->vlan_tci = rte_cpu_to_be_16(kind == 7 ? (0x6000 | CUSTOM_VLAN_ID) : (seq & 0xfff));
+        tag->eth_proto = rte_cpu_to_be_16(type);
+        l3 += sizeof(struct rte_vlan_hdr);
+    } else {
+        ((struct rte_ether_hdr *)pkt)->ether_type = rte_cpu_to_be_16(type);
+    }
+
+    if (type == RTE_ETHER_TYPE_IPV4) {
+        auto *ip = (struct rte_ipv4_hdr *)l3;
+        ip->version_ihl = (kind == 1) ? 0x46 : (kind == 8) ? 0x44 : RTE_IPV4_VHL_DEF;
+        ip->next_proto_id = parse_expect[kind].ip_proto;
+        // More fragments set on the others: only the offset makes a later fragment
+        ip->fragment_offset = rte_cpu_to_be_16(kind == 4 ? 185 : RTE_IPV4_HDR_MF_FLAG);
+    } else if (type == RTE_ETHER_TYPE_IPV6) {
+        ((struct rte_ipv6_hdr *)l3)->proto = parse_expect[kind].ip_proto;
+    }
+}
+
+static bool parse_meta_equal(const BurstMeta &a, const BurstMeta &b) {
+    if (a.nb != b.nb)
+        return false;
+    for (uint16_t i = 0; i < a.nb; i++) {
+        if (a.ether_type[i] != b.ether_type[i] || a.vlan_tci[i] != b.vlan_tci[i] || a.l4_off[i] != b.l4_off[i] ||
+            a.l3_off[i] != b.l3_off[i] || a.ip_proto[i] != b.ip_proto[i] || a.flags[i] != b.flags[i])
+            return false;
+    }
+    return true;
+}
+
+// Every implementation the CPU has is checked against the expected fields and against the scalar
+// parser on shuffled kinds, in bursts of every size up to MICRO_BURST_SIZE so each tail length is
+// covered. The timing parses bursts of packets already in cache, the header loads are then hits
+// and what is left is the parser's own work
+static void run_parse_test(struct rte_mempool *mbuf_pool, unsigned int seconds) {
+    struct rte_mbuf *mbufs[PARSE_TEST_PKTS];
+    int kinds[PARSE_TEST_PKTS];
+    if (rte_pktmbuf_alloc_bulk(mbuf_pool, mbufs, PARSE_TEST_PKTS) != 0)
+        rte_exit(EXIT_FAILURE, "Cannot allocate parse test packets\n");
+    for (uint32_t i = 0; i < PARSE_TEST_PKTS; i++) {
+        kinds[i] = rte_rand() % PARSE_TEST_KINDS;
+        parse_test_fill(mbufs[i], kinds[i], i);
+    }
+
+    BurstMeta expect, meta;
+    bool ok = true;
+    double scalar_cycles = 0;
+    for (ParseImpl impl : {ParseImpl::SCALAR, ParseImpl::SSE, ParseImpl::AVX2}) {
+        if (burst_parse_force(impl) != impl) {
+            printf("BENCH micro=parse impl=%-7s skipped: not supported here\n", to_string(impl));
+            continue;
+        }
+
+        uint64_t mismatches = 0;
+        uint32_t first = 0;
+        for (uint16_t nb = 1; first + nb <= PARSE_TEST_PKTS; first += nb, nb = nb % MICRO_BURST_SIZE + 1) {
+            burst_parse_force(ParseImpl::SCALAR);
+            burst_parse(mbufs + first, nb, &expect, DEFAULT_PREFETCH_AHEAD);
+            burst_parse_force(impl);
+            burst_parse(mbufs + first, nb, &meta, DEFAULT_PREFETCH_AHEAD);
+            mismatches += !parse_meta_equal(expect, meta);
+            for (uint16_t i = 0; i < nb; i++) {
+                const ParseExpect &e = parse_expect[kinds[first + i]];
+                mismatches += meta.ether_type[i] != e.ether_type || meta.l3_off[i] != e.l3_off ||
+                              meta.ip_proto[i] != e.ip_proto || meta.l4_off[i] != e.l4_off || meta.flags[i] != e.flags;
+            }
+        }
+
+        uint64_t nb_pkts = 0, cycles = 0;
+        uint64_t end = rte_get_tsc_cycles() + RTE_MAX(seconds / 3, 1u) * rte_get_tsc_hz();
+        while (rte_get_tsc_cycles() < end) {
+            uint64_t start = rte_rdtsc();
+            for (uint32_t b = 0; b < PARSE_TEST_PKTS; b += MICRO_BURST_SIZE)
+                burst_parse(mbufs + b, MICRO_BURST_SIZE, &meta, DEFAULT_PREFETCH_AHEAD);
+            cycles += rte_rdtsc() - start;
+            nb_pkts += PARSE_TEST_PKTS;
+        }
+        double per_pkt = (double)cycles / nb_pkts;
+        if (impl == ParseImpl::SCALAR)
+            scalar_cycles = per_pkt;
+        printf("BENCH micro=parse impl=%-7s burst=%u %5.2f cycles/pkt (%.1fx scalar) mismatches=%" PRIu64 " %s\n",
+               to_string(impl), MICRO_BURST_SIZE, per_pkt, scalar_cycles / per_pkt, mismatches, mismatches == 0 ? "PASS" : "FAIL");
+        ok &= mismatches == 0;
+    }
+
+    printf("BENCH micro=parse selected=%s %s\n", to_string(burst_parse_select()), ok ? "PASS" : "FAIL");
+    rte_pktmbuf_free_bulk(mbufs, PARSE_TEST_PKTS);
+}
+
+#define REPLAY_TEST_PKTS (1000)         // records of the test trace, not a multiple of any burst size
+#define REPLAY_TEST_LOOPS (500)
+#define REPLAY_TEST_RING_SIZE (1024)
+#define REPLAY_TEST_TIMEOUT_S (60)
+#define REPLAY_TEST_PATH "/tmp/onic_bench_replay.pcap"
+
+// REPLAY_TEST_PKTS packets of synthetic flows as a pcap, in this CPU's byte order with µs timestamps or
+// swapped with ns ones. An oversized record in the middle and one cut off at the end must not be loaded
+static void replay_test_write(bool swapped, struct rte_mbuf *m) {
+    FILE *file = fopen(REPLAY_TEST_PATH, "wb");
+    if (file == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot write %s: %s\n", REPLAY_TEST_PATH, strerror(errno));
+    auto put32 = [&](uint32_t v) { v = swapped ? rte_bswap32(v) : v; fwrite(&v, sizeof(v), 1, file); };
+    auto put16 = [&](uint16_t v) { v = swapped ? rte_bswap16(v) : v; fwrite(&v, sizeof(v), 1, file); };
+
+    put32(swapped ? 0xa1b23c4d : 0xa1b2c3d4);   // ns or µs magic
+    put16(2);
+    put16(4);
+    put32(0);
+    put32(0);
+    put32(65535);
+    put32(1);                                   // Ethernet
+    std::vector<uint8_t> oversized(REPLAY_MAX_PKT_LEN + 1);
+    for (uint32_t i = 0; i < REPLAY_TEST_PKTS; i++) {
+        if (i == REPLAY_TEST_PKTS / 2) {
+            put32(i); put32(0); put32(oversized.size()); put32(oversized.size());
+            fwrite(oversized.data(), 1, oversized.size(), file);
+        }
+        flows_test_fill(m, i);
+        put32(i); put32(0); put32(m->pkt_len); put32(m->pkt_len);
+        fwrite(rte_pktmbuf_mtod(m, void *), 1, m->pkt_len, file);
+    }
+    put32(REPLAY_TEST_PKTS); put32(0); put32(PRIME_PKT_SIZE); put32(PRIME_PKT_SIZE);
+    fwrite(oversized.data(), 1, PRIME_PKT_SIZE / 2, file);
+    fclose(file);
+}
+
+// The whole trace REPLAY_TEST_LOOPS times through one context, every packet must come out of the
+// pipeline exactly once per loop: forwarded back to the feeder or counted as dropped
+static bool run_replay_case(ForwardingContext &ctx, ForwardMode mode, bool swapped, struct rte_mbuf *m) {
+    replay_test_write(swapped, m);
+    ReplayConfig cfg;
+    cfg.pcap = REPLAY_TEST_PATH;
+    cfg.loops = REPLAY_TEST_LOOPS;
+    cfg.ring_size = REPLAY_TEST_RING_SIZE;
+    PcapReplay replay(cfg, 1, {0}, rte_socket_id());
+
+    for (unsigned int lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++)
+        lcore_stats[lcore_id] = LcoreStats();
+    ForwardingContext saved = ctx;
+    ctx.rx_port_id = replay.get_port_id();
+    ctx.tx_port_id = replay.get_port_id();
+    ctx.mode = mode;
+    ctx.lcores = {-1, -1};
+    ctx.stage_cycles = true;
+    ctx.flows.capacity = RTE_MAX(ctx.flows.capacity, (unsigned int)REPLAY_TEST_PKTS);
+    rte_atomic32_set(&ctx.stop_flag, 0);
+
+    uint64_t start = rte_get_tsc_cycles();
+    launch_software_forwarder(ctx);
+    replay.launch();
+    uint64_t deadline = start + REPLAY_TEST_TIMEOUT_S * rte_get_tsc_hz();
+    while (!replay.done() && rte_get_tsc_cycles() < deadline)
+        rte_delay_ms(10);
+    double elapsed = (double)(rte_get_tsc_cycles() - start) / rte_get_tsc_hz();
+    bool done = replay.done();
+    rte_atomic32_set(&ctx.stop_flag, 1);
+    replay.stop();
+    rte_eal_mp_wait_lcore();
+    replay.summary();
+
+    uint64_t rx_pkts = 0, tx_pkts = 0, dropped = 0, parse_cycles = 0, flow_cycles = 0;
+    for (unsigned int lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+        const LcoreStats &slot = lcore_stats[lcore_id];
+        rx_pkts += slot.rx_pkts;
+        tx_pkts += slot.tx_pkts;
+        dropped += slot.tx_drops + slot.ring_drops;
+        parse_cycles += slot.parse_cycles;
+        flow_cycles += slot.flow_cycles;
+    }
+    ctx.free_ring();
+    ctx.rx_port_id = saved.rx_port_id;
+    ctx.tx_port_id = saved.tx_port_id;
+    ctx.mode = saved.mode;
+    ctx.stage_cycles = saved.stage_cycles;
+    ctx.flows = saved.flows;
+
+    uint64_t expected = (uint64_t)REPLAY_TEST_LOOPS * REPLAY_TEST_PKTS;
+    bool ok = done && replay.get_nb_pkts() == REPLAY_TEST_PKTS && replay.get_skipped() == 1 &&
+              rx_pkts == expected && tx_pkts + dropped == expected && parse_cycles > 0 && flow_cycles > 0;
+    printf("BENCH micro=replay mode=%-18s pcap=%s pkts=%u loops=%u rx=%8.3f Mpps dropped=%" PRIu64
+           " cycles/pkt parse %5.1f flows %5.1f %s\n",
+           to_string(mode), swapped ? "ns,swapped" : "us", replay.get_nb_pkts(), REPLAY_TEST_LOOPS,
+           rx_pkts / elapsed / 1e6, dropped, (double)parse_cycles / RTE_MAX(rx_pkts, (uint64_t)1),
+           (double)flow_cycles / RTE_MAX(rx_pkts, (uint64_t)1), ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static void run_replay_test(ForwardingContext &ctx, struct rte_mempool *mbuf_pool) {
+    if (rte_lcore_count() < 4) {
+        printf("BENCH micro=replay skipped: needs 3 worker lcores (pipelined context and the feeder)\n");
+        return;
+    }
+    struct rte_mbuf *m = rte_pktmbuf_alloc(mbuf_pool);
+    if (m == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate replay test packet\n");
+
+    bool ok = true;
+    ok &= run_replay_case(ctx, ForwardMode::RUN_TO_COMPLETION, false, m);
+    ok &= run_replay_case(ctx, ForwardMode::PIPELINED, true, m);
+    rte_pktmbuf_free(m);
+    remove(REPLAY_TEST_PATH);
+    printf("BENCH micro=replay %s\n", ok ? "PASS" : "FAIL");
+}
+
+#define CAPTURE_TEST_PKTS (1024)
+#define CAPTURE_TEST_RING_SIZE (1024)
+#define CAPTURE_TEST_ROUNDS (512)       // passes over the packets while timing, several MB of pcapng
+#define CAPTURE_TEST_SNAPLEN (54)       // under the 64 B test packets, and not a multiple of 4: padded
+#define CAPTURE_TEST_FILES (3)
+#define CAPTURE_TEST_DIR "/tmp"
+#define CAPTURE_TEST_PREFIX "onic_bench_capture"
+
+// What the test filter (udp, src 10.0.0.0/24) takes from flows_test_fill(): the IPv4 UDP flows under 256
+static bool capture_test_expect(uint32_t flow) {
+    return flow < 256 && flow % 8 != 7 && flow % 4 != 0;
+}
+
+static std::string capture_test_path(uint32_t seq) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s_%05u.pcapng", CAPTURE_TEST_DIR, CAPTURE_TEST_PREFIX, seq);
+    return path;
+}
+
+// Walks a pcapng file the writer closed: one SHB, one IDB per interface, then EPBs of packets cut to
+// CAPTURE_TEST_SNAPLEN whose data is the flow's packet. Returns the EPBs, or -1 on anything else
+static int64_t capture_test_read(const std::string &path, unsigned int nb_interfaces, struct rte_mbuf *m) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return -1;
+    std::vector<uint8_t> data;
+    uint8_t chunk[65536];
+    size_t nb;
+    while ((nb = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.insert(data.end(), chunk, chunk + nb);
+    fclose(file);
+
+    auto get32 = [&](size_t off) { uint32_t v; memcpy(&v, &data[off], sizeof(v)); return v; };
+    size_t off = 0;
+    int64_t nb_epb = 0;
+    unsigned int nb_idb = 0;
+    uint64_t last_ts = 0;
+    while (off + 12 <= data.size()) {
+        uint32_t type = get32(off);
+        uint32_t total = get32(off + 4);
+        if (total < 12 || total % 4 != 0 || off + total > data.size() || get32(off + total - 4) != total)
+            return -1;
+        if (off == 0 && (type != 0x0A0D0D0A || get32(off + 8) != 0x1A2B3C4D))
+            return -1;
+        if (type == 0x00000001) {
+            // if_tsresol must say ns: option 9, length 1, value 9
+            bool ns = false;
+            for (size_t opt = off + 16; opt + 4 <= off + total - 4;) {
+                uint16_t code, len;
+                memcpy(&code, &data[opt], 2);
+                memcpy(&len, &data[opt + 2], 2);
+                ns |= code == 9 && len == 1 && data[opt + 4] == 9;
+                opt += 4 + ((len + 3) & ~3u);
+                if (code == 0)
+                    break;
+            }
+            if (!ns || nb_epb > 0)
+                return -1;
+            nb_idb++;
+        } else if (type == 0x00000006) {
+            uint32_t interface = get32(off + 8);
+            uint64_t ts = (uint64_t)get32(off + 12) << 32 | get32(off + 16);
+            uint32_t caplen = get32(off + 20);
+            uint32_t len = get32(off + 24);
+            const uint8_t *pkt = &data[off + 28];
+            if (interface >= nb_idb || ts < last_ts || caplen != RTE_MIN(len, (uint32_t)CAPTURE_TEST_SNAPLEN) ||
+                total != 28 + ((caplen + 3) & ~3u) + 4)
+                return -1;
+            // The source address says which flow it is: its packet is rebuilt and compared
+            uint32_t src;
+            memcpy(&src, pkt + sizeof(struct rte_ether_hdr) + offsetof(struct rte_ipv4_hdr, src_addr), sizeof(src));
+            uint32_t flow = rte_be_to_cpu_32(src) - RTE_IPV4(10, 0, 0, 0);
+            flows_test_fill(m, flow);
+            if (!capture_test_expect(flow) || len != m->pkt_len || memcmp(pkt, rte_pktmbuf_mtod(m, void *), caplen) != 0)
+                return -1;
+            last_ts = ts;
+            nb_epb++;
+        }
+        off += total;
+    }
+    return (off == data.size() && nb_idb == nb_interfaces) ? nb_epb : -1;
+}
+
+// The filter on its own, one packet at a time
+static bool run_capture_filter_case(struct rte_mbuf **mbufs) {
+    BurstMeta meta;
+    CaptureFilter filter;
+    bool ok = filter.set_proto("udp") && filter.set_src("10.0.0.0/24");
+    uint64_t wrong = 0;
+    for (uint32_t b = 0; b < CAPTURE_TEST_PKTS; b += MICRO_BURST_SIZE) {
+        burst_parse(mbufs + b, MICRO_BURST_SIZE, &meta, DEFAULT_PREFETCH_AHEAD);
+        for (uint16_t i = 0; i < MICRO_BURST_SIZE; i++)
+            wrong += filter.match(mbufs[b + i], meta, i) != capture_test_expect(b + i);
+    }
+
+    // Flow 5 is 10.0.0.5 -> 192.168.0.1: a filter on the replies' destination takes it both ways only
+    burst_parse(mbufs, MICRO_BURST_SIZE, &meta, DEFAULT_PREFETCH_AHEAD);
+    CaptureFilter reply, one_way, vlan, bad;
+    ok &= reply.set_dst("10.0.0.5") && one_way.set_dst("10.0.0.5") && vlan.set_vlan(10);
+    one_way.set_both_ways(false);
+    ok &= reply.match(mbufs[5], meta, 5) && !reply.match(mbufs[6], meta, 6) && !one_way.match(mbufs[5], meta, 5) &&
+          !vlan.match(mbufs[5], meta, 5) && CaptureFilter().match(mbufs[7], meta, 7);
+    ok &= !bad.set_src("10.0.0.0/33") && !bad.set_proto("tcpp") && bad.set_src("2001:db8::/32") &&
+          !bad.set_dst("10.0.0.1") && !bad.set_vlan(4096);
+    ok &= wrong == 0;
+    printf("BENCH micro=capture filter=\"%s\" mismatches=%" PRIu64 " %s\n", filter.to_string().c_str(), wrong,
+           ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static void run_capture_test(struct rte_mempool *mbuf_pool) {
+    struct rte_mbuf *mbufs[CAPTURE_TEST_PKTS];
+    if (rte_pktmbuf_alloc_bulk(mbuf_pool, mbufs, CAPTURE_TEST_PKTS) != 0)
+        rte_exit(EXIT_FAILURE, "Cannot allocate capture test packets\n");
+    for (uint32_t i = 0; i < CAPTURE_TEST_PKTS; i++)
+        flows_test_fill(mbufs[i], i);
+    struct rte_mbuf *m = rte_pktmbuf_alloc(mbuf_pool);
+    if (m == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate capture test packet\n");
+    uint32_t nb_expect = 0;
+    for (uint32_t i = 0; i < CAPTURE_TEST_PKTS; i++)
+        nb_expect += capture_test_expect(i);
+
+    bool ok = run_capture_filter_case(mbufs);
+
+    for (unsigned int i = 0; i < RTE_MAX_LCORE; i++)
+        lcore_stats[i] = LcoreStats();
+    LcoreStats *stats = &lcore_stats[rte_lcore_id()];
+    struct rte_ring *ring = create_capture_ring("capture_test", CAPTURE_TEST_RING_SIZE, rte_socket_id());
+    if (ring == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot create capture test ring\n");
+    CaptureConfig cfg;
+    cfg.dir = CAPTURE_TEST_DIR;
+    cfg.prefix = CAPTURE_TEST_PREFIX;
+    cfg.file_mb = 1;
+    cfg.files = CAPTURE_TEST_FILES;
+    cfg.snaplen = CAPTURE_TEST_SNAPLEN;
+    std::unique_ptr<CaptureWriter> writer(new CaptureWriter(cfg, ring, {"ctx0"}));
+    CaptureFilter filter;
+    filter.set_proto("udp");
+    filter.set_src("10.0.0.0/24");
+
+    // Metas of every burst up front: only capture_burst() is timed
+    std::vector<BurstMeta> metas(CAPTURE_TEST_PKTS / MICRO_BURST_SIZE);
+    for (uint32_t b = 0; b < metas.size(); b++)
+        burst_parse(mbufs + b * MICRO_BURST_SIZE, MICRO_BURST_SIZE, &metas[b], DEFAULT_PREFETCH_AHEAD);
+
+    // A writer that does not keep up: the ring fills, what does not fit is counted and not referenced
+    const unsigned int full_rounds = CAPTURE_TEST_RING_SIZE / nb_expect + 2;
+    for (unsigned int r = 0; r < full_rounds; r++) {
+        for (uint32_t b = 0; b < metas.size(); b++)
+            capture_burst(filter, ring, 0, stats, mbufs + b * MICRO_BURST_SIZE, metas[b], rte_rdtsc());
+    }
+    uint64_t refs = 0;
+    for (uint32_t i = 0; i < CAPTURE_TEST_PKTS; i++)
+        refs += rte_mbuf_refcnt_read(mbufs[i]) - 1;
+    bool full_ok = stats->capture_pkts == rte_ring_count(ring) && stats->capture_drops > 0 &&
+                   stats->capture_pkts + stats->capture_drops == (uint64_t)full_rounds * nb_expect &&
+                   refs == stats->capture_pkts;
+    printf("BENCH micro=capture ring full: captured=%" PRIu64 " dropped=%" PRIu64 " refs=%" PRIu64 " %s\n",
+           stats->capture_pkts, stats->capture_drops, refs, full_ok ? "PASS" : "FAIL");
+    ok &= full_ok;
+    writer->drain();
+
+    // Then a writer that keeps up, rotating files on the way
+    uint64_t capture_cycles = 0, write_cycles = 0, nb_pkts = 0;
+    for (unsigned int r = 0; r < CAPTURE_TEST_ROUNDS; r++) {
+        for (uint32_t b = 0; b < metas.size(); b++) {
+            uint64_t start = rte_rdtsc();
+            capture_burst(filter, ring, 0, stats, mbufs + b * MICRO_BURST_SIZE, metas[b], start);
+            capture_cycles += rte_rdtsc() - start;
+            nb_pkts += MICRO_BURST_SIZE;
+            if (rte_ring_count(ring) >= CAPTURE_BATCH) {
+                start = rte_rdtsc();
+                writer->run_once();
+                write_cycles += rte_rdtsc() - start;
+            }
+        }
+    }
+    uint64_t start = rte_rdtsc();
+    writer->drain();
+    write_cycles += rte_rdtsc() - start;
+    CaptureStats written = writer->get_stats();
+    writer.reset();
+
+    refs = 0;
+    for (uint32_t i = 0; i < CAPTURE_TEST_PKTS; i++)
+        refs += rte_mbuf_refcnt_read(mbufs[i]) - 1;
+    // Only the newest files are left, each a valid capture
+    int64_t nb_epb = 0;
+    uint32_t nb_files = 0;
+    bool files_ok = written.files > CAPTURE_TEST_FILES;
+    for (uint32_t seq = 0; seq < written.files; seq++) {
+        std::string path = capture_test_path(seq);
+        bool kept = seq + CAPTURE_TEST_FILES >= written.files;
+        if (access(path.c_str(), F_OK) == 0) {
+            int64_t nb = capture_test_read(path, 1, m);
+            files_ok &= kept && nb > 0;
+            nb_epb += nb;
+            nb_files++;
+            remove(path.c_str());
+        } else {
+            files_ok &= !kept;
+        }
+    }
+    uint64_t captured = stats->capture_pkts;
+    bool write_ok = refs == 0 && written.pkts == captured && written.truncated == captured &&
+                    written.bytes == captured * CAPTURE_TEST_SNAPLEN && written.write_errors == 0 &&
+                    files_ok && nb_files == CAPTURE_TEST_FILES && nb_epb > 0 && (uint64_t)nb_epb < captured;
+    printf("BENCH micro=capture burst=%u %5.1f cycles/pkt on the rx lcore (1 in %.1f taken) writer %6.1f cycles/pkt"
+           " %6.2f Mpps written=%" PRIu64 " files=%" PRIu64 " kept=%u %s\n",
+           MICRO_BURST_SIZE, (double)capture_cycles / nb_pkts, (double)CAPTURE_TEST_PKTS / nb_expect,
+           (double)write_cycles / RTE_MAX(written.pkts, (uint64_t)1),
+           (write_cycles == 0) ? 0 : written.pkts * (double)rte_get_tsc_hz() / write_cycles / 1e6,
+           written.pkts, written.files, nb_files, write_ok ? "PASS" : "FAIL");
+    ok &= write_ok;
+
+    rte_ring_free(ring);
+    rte_pktmbuf_free(m);
+    rte_pktmbuf_free_bulk(mbufs, CAPTURE_TEST_PKTS);
+    printf("BENCH micro=capture %s\n", ok ? "PASS" : "FAIL");
+}
+
+#define LATENCY_TEST_CTX (7)             // no bench context uses it
+#define LATENCY_TEST_PKTS (1000)
+#define LATENCY_TEST_RING_SIZE (2048)
+
+static bool latency_test_has(const LineEncoder &enc, const char *line) {
+    return std::string(enc.data(), enc.size()).find(line) != std::string::npos;
+}
+
+// What the main lcore reporter emits: per hop percentiles of the interval as Latency_hist lines, hops and
+// intervals without packets left out
+static void run_latency_test() {
+    bool ok = true;
+    LcoreLatency *latency = LcoreLatency::attach(LATENCY_TEST_CTX);
+    LatencyHistReporter reporter;
+    LineEncoder enc;
+
+    // First interval: both hops, 1..1000 ns on hop 0 and ten times that on hop 1
+    for (uint64_t v = 1; v <= LATENCY_TEST_PKTS; v++)
+        latency->record(HopLatencies{v, v * 10});
+    reporter.report(LATENCY_TEST_CTX, &enc);
+    bool first_ok = enc.lines() == NB_HOPS - 1 && enc.dropped() == 0 &&
+                    latency_test_has(enc, "Latency_hist,ctx=7,hop=0 count=1000i,") &&
+                    latency_test_has(enc, "Latency_hist,ctx=7,hop=1 count=1000i,");
+    printf("BENCH micro=latency case=interval lines=%u bytes=%zu %s\n", enc.lines(), enc.size(), first_ok ? "PASS" : "FAIL");
+    if (!first_ok)
+        printf("%.*s", (int)enc.size(), enc.data());
+    ok &= first_ok;
+
+    // Nothing recorded since: no lines
+    enc.clear();
+    reporter.report(LATENCY_TEST_CTX, &enc);
+    bool idle_ok = enc.empty();
+    printf("BENCH micro=latency case=idle lines=%u %s\n", enc.lines(), idle_ok ? "PASS" : "FAIL");
+    ok &= idle_ok;
+
+    // Only the packets recorded since the last report are counted
+    enc.clear();
+    for (uint64_t v = 1; v <= LATENCY_TEST_PKTS / 2; v++)
+        latency->record(HopLatencies{v, v});
+    reporter.report(LATENCY_TEST_CTX, &enc);
+    bool delta_ok = enc.lines() == NB_HOPS - 1 && latency_test_has(enc, "Latency_hist,ctx=7,hop=0 count=500i,");
+    printf("BENCH micro=latency case=delta lines=%u %s\n", enc.lines(), delta_ok ? "PASS" : "FAIL");
+    ok &= delta_ok;
+
+    // Raw records: every one comes out as a line, a batch never takes more than it has room for
+    struct rte_ring *ring = create_latency_ring("latency_test_ring", LATENCY_TEST_RING_SIZE, rte_socket_id());
+    if (ring == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot create the latency test ring\n");
+    for (uint32_t i = 0; i < LATENCY_TEST_PKTS; i++) {
+        LatencyRecord record = {LATENCY_TEST_CTX, 0, i, HopLatencies{i, i * 10}};
+        rte_ring_enqueue_elem(ring, &record, sizeof(record));
+    }
+    LatencyRecordConsumer records(ring);
+    unsigned int nb_lines = 0, nb_batches = 0;
+    enc.clear();
+    while (records.drain(&enc) > 0) {
+        nb_lines += enc.lines();
+        nb_batches++;
+        enc.clear();
+    }
+    bool records_ok = nb_lines == LATENCY_TEST_PKTS && enc.dropped() == 0 && rte_ring_count(ring) == 0;
+    printf("BENCH micro=latency case=records lines=%u batches=%u dropped=%u %s\n", nb_lines, nb_batches, enc.dropped(),
+           records_ok ? "PASS" : "FAIL");
+    ok &= records_ok;
+    rte_ring_free(ring);
+
+    // The test slot must not show up under a real context once the bench moves on
+    LcoreLatency::attach(-1);
+    printf("BENCH micro=latency %s\n", ok ? "PASS" : "FAIL");
+}
+
+static void run_sweep(std::vector<ForwardingContext> &ctxs, ForwardMode mode, unsigned int seconds, bool sweep) {
+    unsigned int nb_queues = ctxs.size();
+    for (unsigned int n = sweep ? 1 : nb_queues; n <= nb_queues; n++)
+        run_bench(ctxs, n, mode, seconds);
+}
+
+static const unsigned int SWEEP_PKT_SIZES[] = {64, 512, 1500};
+static const uint16_t SWEEP_BURST_SIZES[] = {4, 8, 16, 32, 64, 128, 256};
+#define NB_SWEEP_PKT_SIZES (sizeof(SWEEP_PKT_SIZES) / sizeof(SWEEP_PKT_SIZES[0]))
+#define NB_SWEEP_BURST_SIZES (sizeof(SWEEP_BURST_SIZES) / sizeof(SWEEP_BURST_SIZES[0]))
+
+// net_null generates packets of one size per device: a fresh rx/tx pair is hotplugged for each size
+static void sweep_vdev_init(const char *name, unsigned int pkt_size, uint16_t nb_queues,
+                            struct rte_mempool *mbuf_pool, uint16_t *port_id) {
+    char args[32];
+    snprintf(args, sizeof(args), "size=%u", pkt_size);
+    if (rte_vdev_init(name, args) < 0 || rte_eth_dev_get_port_by_name(name, port_id) != 0)
+        rte_exit(EXIT_FAILURE, "Cannot create %s with %s\n", name, args);
+    bench_port_init(*port_id, nb_queues, mbuf_pool);
+}
+
+static void sweep_vdev_uninit(const char *name, uint16_t port_id) {
+    rte_eth_dev_stop(port_id);
+    rte_eth_dev_close(port_id);
+    rte_vdev_uninit(name);
+}
+
+// Rx Mpps of every context at each burst size and packet size, then the whole table at once
+static void run_burst_sweep(std::vector<ForwardingContext> &ctxs, ForwardMode mode, unsigned int seconds,
+                            struct rte_mempool *mbuf_pool) {
+    double mpps[NB_SWEEP_BURST_SIZES][NB_SWEEP_PKT_SIZES];
+    uint16_t nb_queues = ctxs.size();
+    uint16_t saved_ports[2] = {ctxs[0].rx_port_id, ctxs[0].tx_port_id};
+    uint16_t saved_burst = ctxs[0].burst_size;
+
+    for (size_t s = 0; s < NB_SWEEP_PKT_SIZES; s++) {
+        char rx_name[RTE_DEV_NAME_MAX_LEN], tx_name[RTE_DEV_NAME_MAX_LEN];
+        snprintf(rx_name, sizeof(rx_name), "net_null_sweep_rx%u", SWEEP_PKT_SIZES[s]);
+        snprintf(tx_name, sizeof(tx_name), "net_null_sweep_tx%u", SWEEP_PKT_SIZES[s]);
+        uint16_t rx_port_id, tx_port_id;
+        sweep_vdev_init(rx_name, SWEEP_PKT_SIZES[s], nb_queues, mbuf_pool, &rx_port_id);
+        sweep_vdev_init(tx_name, SWEEP_PKT_SIZES[s], nb_queues, mbuf_pool, &tx_port_id);
+
+        printf("BENCH burst sweep: %u B packets\n", SWEEP_PKT_SIZES[s]);
+        for (size_t b = 0; b < NB_SWEEP_BURST_SIZES; b++) {
+            for (ForwardingContext &ctx : ctxs) {
+                ctx.rx_port_id = rx_port_id;
+                ctx.tx_port_id = tx_port_id;
+                ctx.burst_size = SWEEP_BURST_SIZES[b];
+            }
+            mpps[b][s] = run_bench(ctxs, nb_queues, mode, seconds);
+        }
+        sweep_vdev_uninit(rx_name, rx_port_id);
+        sweep_vdev_uninit(tx_name, tx_port_id);
+    }
+    for (ForwardingContext &ctx : ctxs) {
+        ctx.rx_port_id = saved_ports[0];
+        ctx.tx_port_id = saved_ports[1];
+        ctx.burst_size = saved_burst;
+    }
+
+    printf("BENCH burst sweep mode=%s queues=%u prefetch=%u, rx Mpps:\n", to_string(mode), nb_queues, ctxs[0].prefetch_ahead);
+    printf("%8s", "burst");
+    for (size_t s = 0; s < NB_SWEEP_PKT_SIZES; s++)
+        printf(" %8u B", SWEEP_PKT_SIZES[s]);
+    printf("\n");
+    for (size_t b = 0; b < NB_SWEEP_BURST_SIZES; b++) {
+        printf("%8u", SWEEP_BURST_SIZES[b]);
+        for (size_t s = 0; s < NB_SWEEP_PKT_SIZES; s++)
+            printf(" %10.3f", mpps[b][s]);
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    int ret = rte_eal_init(argc, argv);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "Error with EAL initialization\n");
+    burst_parse_select();
+
+    argc -= ret;
+    argv += ret;
+
+    const char *mode_str = "both";
+    unsigned int seconds = DEFAULT_BENCH_SECONDS;
+    uint16_t nb_queues = 1;
+    bool sweep = false;
+    unsigned int nb_prime = 0;
+    const char *micro = nullptr;
+    TxPolicy tx_policy = TxPolicy::DROP;
+    RingPolicy ring_policy = RingPolicy::DROP;
+    bool parse_latency = false;
+    unsigned int burst_size = DEFAULT_BURST_SIZE;
+    unsigned int prefetch_ahead = DEFAULT_PREFETCH_AHEAD;
+    bool burst_sweep = false;
+    unsigned int flow_capacity = DEFAULT_FLOW_CAPACITY;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:t:q:sP:R:T:Lf:b:F:BM:h")) != -1) {
+        switch (opt) {
+            case 'm': mode_str = optarg; break;
+            case 't': seconds = atoi(optarg); break;
+            case 'q': nb_queues = atoi(optarg); break;
+            case 's': sweep = true; break;
+            case 'P': nb_prime = atoi(optarg); break;
+            case 'M': micro = optarg; break;
+            case 'L': parse_latency = true; break;
+            case 'f': flow_capacity = RTE_MIN((unsigned int)atoi(optarg), MAX_FLOW_CAPACITY); break;
+            case 'b': burst_size = RTE_MIN(RTE_MAX(atoi(optarg), 1), MAX_BURST_SIZE); break;
+            case 'F': prefetch_ahead = RTE_MIN(RTE_MAX(atoi(optarg), 0), MAX_PREFETCH_AHEAD); break;
+            case 'B': burst_sweep = true; break;
+            case 'R':
+                if (strcmp(optarg, "retry") == 0) ring_policy = RingPolicy::RETRY;
+                else if (strcmp(optarg, "hold") == 0) ring_policy = RingPolicy::HOLD;
+                break;
+            case 'T':
+                if (strcmp(optarg, "retry") == 0) tx_policy = TxPolicy::RETRY;
+                else if (strcmp(optarg, "buffer") == 0) tx_policy = TxPolicy::BUFFER;
+                break;
+            default: usage(argv[0]); return 0;
+        }
+    }
+
+    int num_ports = rte_eth_dev_count_avail();
+    if (num_ports < 1)
+        rte_exit(EXIT_FAILURE, "No Ethernet devices found. Pass --vdev=net_null0 --vdev=net_null1\n");
+
+    struct rte_mempool *mbuf_pool = rte_pktmbuf_pool_create("BENCH_POOL",
+        NUM_MBUFS * num_ports * nb_queues, MBUF_CACHE_SIZE, 0,
+        RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    if (!mbuf_pool) rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+
+    for (uint16_t port_id = 0; port_id < num_ports; port_id++)
+        bench_port_init(port_id, nb_queues, mbuf_pool);
+
+    if (nb_prime > 0)
+        prime_tx_queues((num_ports > 1) ? 1 : 0, nb_queues, nb_prime, mbuf_pool);
+
+    // One context per Q: Q i of the rx port is forwarded to Q i of the tx port
+    std::vector<ForwardingContext> ctxs(nb_queues);
+    for (uint16_t q = 0; q < nb_queues; q++) {
+        ForwardingContext &ctx = ctxs[q];
+        ctx.ctx_id = q;
+        ctx.rx_Qs = {q, -1, -1};
+        ctx.tx_Qs = {q, -1, -1};
+        ctx.nb_rx_Qs = 1;
+        ctx.nb_tx_Qs = 1;
+        ctx.rx_port_id = 0;
+        ctx.tx_port_id = (num_ports > 1) ? 1 : 0;
+        ctx.tx_policy = tx_policy;
+        ctx.ring_policy = ring_policy;
+        ctx.parse_latency = parse_latency;
+        ctx.burst_size = burst_size;
+        ctx.prefetch_ahead = prefetch_ahead;
+        ctx.flows.capacity = flow_capacity;
+    }
+
+    if (micro != nullptr) {
+        if (strcmp(micro, "tx") == 0)
+            run_tx_microbench(ctxs[0].tx_port_id, mbuf_pool, seconds);
+        else if (strcmp(micro, "hist") == 0)
+            run_hist_microbench(seconds);
+        else if (strcmp(micro, "encode") == 0)
+            run_encode_microbench(seconds);
+        else if (strcmp(micro, "kafka") == 0)
+            run_kafka_test(seconds);
+        else if (strcmp(micro, "cmac") == 0)
+            run_cmac_test();
+        else if (strcmp(micro, "regs") == 0)
+            run_regs_test();
+        else if (strcmp(micro, "bringup") == 0)
+            run_bringup_test();
+        else if (strcmp(micro, "metrics") == 0)
+            run_metrics_test();
+        else if (strcmp(micro, "idle") == 0)
+            run_idle_test();
+        else if (strcmp(micro, "flows") == 0)
+            run_flows_test(mbuf_pool, seconds);
+        else if (strcmp(micro, "aging") == 0)
+            run_aging_test(mbuf_pool);
+        else if (strcmp(micro, "parse") == 0)
+            run_parse_test(mbuf_pool, seconds);
+        else if (strcmp(micro, "replay") == 0)
+            run_replay_test(ctxs[0], mbuf_pool);
+        else if (strcmp(micro, "capture") == 0)
+            run_capture_test(mbuf_pool);
+        else if (strcmp(micro, "latency") == 0)
+            run_latency_test();
+        else
+            usage(argv[0]);
+    } else if (burst_sweep) {
+        if (strcmp(mode_str, "pipelined") == 0 || strcmp(mode_str, "both") == 0)
+            run_burst_sweep(ctxs, ForwardMode::PIPELINED, seconds, mbuf_pool);
+        if (strcmp(mode_str, "rtc") == 0 || strcmp(mode_str, "both") == 0)
+            run_burst_sweep(ctxs, ForwardMode::RUN_TO_COMPLETION, seconds, mbuf_pool);
+    } else {
+        if (strcmp(mode_str, "pipelined") == 0 || strcmp(mode_str, "both") == 0)
+            run_sweep(ctxs, ForwardMode::PIPELINED, seconds, sweep);
+        if (strcmp(mode_str, "rtc") == 0 || strcmp(mode_str, "both") == 0)
+            run_sweep(ctxs, ForwardMode::RUN_TO_COMPLETION, seconds, sweep);
+    }
+
+    for (uint16_t port_id = 0; port_id < num_ports; port_id++) {
+        rte_eth_dev_stop(port_id);
+        rte_eth_dev_close(port_id);
+    }
+    for (auto &ctx : ctxs)
+        ctx.free_ring();
+    rte_mempool_free(mbuf_pool);
+    rte_eal_cleanup();
+    return 0;
+}